@@ -0,0 +1,629 @@
+/**
+ * cruxpass-bench: builds a synthetic vault and times every phase a user
+ * goes through, from unlock to export. Results are printed as JSON.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ARGS_HIDE_DEFAULTS
+#define ARGS_LINE_LENGTH 120
+#define ARGS_MIN_DESC_LENGTH 80
+
+#include "args.h"
+#include "bench.h"
+#include "crypt.h"
+#include "database.h"
+#include "import.h"
+#include "kdf.h"
+#include "lookup.h"
+#include "render.h"
+#include "secmem.h"
+#include "tui.h"
+
+extern char *cruxpass_db_path;
+extern char *meta_db_path;
+extern int current_page;
+extern int records_per_page;
+
+typedef struct {
+    long records;
+    long ops;
+    long iterations;
+    long unlocks;
+    long import_records;
+    long stress;
+    long kdf_lanes;
+    uint64_t seed;
+    const char *script;
+    const char *dir;
+    storage_profile_t profile;
+    bool own_dir;
+} bench_opts_t;
+
+#define TIMED(phase, ops, ...)                                               \
+    do {                                                                     \
+        uint64_t _start = bench_now_ns();                                    \
+        __VA_ARGS__;                                                         \
+        phase_add(phase_get(phase), (bench_now_ns() - _start) / 1e6, (ops)); \
+    } while (0)
+
+static char *work_path(const char *dir, const char *name) {
+    char *path = NULL;
+    if ((path = calloc(MAX_PATH_LEN, sizeof(char))) == NULL) CRXP__OUT_OF_MEMORY();
+    snprintf(path, MAX_PATH_LEN, "%s/%s", dir, name);
+    return path;
+}
+
+static bool populate(vault_ctx_t *ctx, gen_t *gen, long records) {
+    bool ok = true;
+    secret_t rec = {0};
+    import_sink_t sink = {0};
+    import_opts_t opts = {.mode = DEDUP_KEEP};
+
+    if (!import_begin(&sink, ctx->secret_db, &opts)) return false;
+    TIMED("generate", records, {
+        for (long i = 0; i < records && ok; i++) {
+            gen_record(gen, &rec);
+            ok = import_record(&sink, &rec);
+        }
+    });
+
+    return import_end(&sink, ok);
+}
+
+static bool create_bench_vault(vault_ctx_t *ctx, gen_t *gen, long records, const storage_profile_t *profile) {
+    if ((ctx->secret_db = open_db(cruxpass_db_path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) == NULL
+        || (ctx->meta_db = open_db(meta_db_path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) == NULL) {
+        return false;
+    }
+
+    /* Saved before the vault is keyed, the page size is fixed from the first page on */
+    bool ok = update_profile(ctx->meta_db, profile, false) && create_vault(ctx, BENCH_PASSWORD) && prepare_stmt(ctx)
+              && populate(ctx, gen, records);
+    cleanup_stmts();
+    sqlite3_close(ctx->meta_db);
+    sqlite3_close(ctx->secret_db);
+    ctx->meta_db = ctx->secret_db = NULL;
+    return ok;
+}
+
+/* The steps of authenticate() without the prompt */
+static unsigned char *bench_unlock(vault_ctx_t *ctx, long unlocks) {
+    unsigned char *key = NULL;
+    if ((key = secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+
+    for (long i = 0; i < unlocks; i++) {
+        bool ok = true;
+        meta_t *meta = NULL;
+        uint64_t start = bench_now_ns();
+
+        close_db(ctx->secret_db);
+        if ((ctx->secret_db = open_db(cruxpass_db_path, SQLITE_OPEN_READWRITE)) == NULL) break;
+
+        TIMED("fetch_meta", 1, meta = fetch_meta());
+        if (meta == NULL) break;
+        TIMED("key_gen", 1, ok = key_gen(key, BENCH_PASSWORD, meta->salt, meta->lanes));
+        free(meta);
+        if (ok) TIMED("decrypt", 1, ok = decrypt(ctx->secret_db, key));
+        if (!ok) break;
+
+        phase_add(phase_get("unlock"), (bench_now_ns() - start) / 1e6, 1);
+        if (i + 1 == unlocks) return key;
+    }
+
+    secmem_free(key);
+    return NULL;
+}
+
+static bool bench_prepare(vault_ctx_t *ctx, long iterations) {
+    bool ok = true;
+    for (long i = 0; i < iterations && ok; i++) {
+        cleanup_stmts();
+        TIMED("prepare_stmt", 1, ok = prepare_stmt(ctx));
+    }
+
+    return ok;
+}
+
+/* first_page is what `cruxpass -l` reads before the list shows, load_records all of it */
+static bool bench_load(sqlite3 *db, record_array_t *records, long iterations) {
+    bool ok = true;
+    bool done = false;
+    for (long i = 0; i < iterations && ok; i++) {
+        free_records(records);
+        TIMED("first_page", 1, ok = stream_records(db, records, BENCH_TERM_HEIGHT, &done));
+        if (!done) stream_records_end(db);
+    }
+
+    for (long i = 0; i < iterations && ok; i++) {
+        free_records(records);
+        TIMED("load_records", (size_t) records->size, ok = load_records(db, records));
+    }
+
+    return ok;
+}
+
+/* What `cruxpass exec` does for a service: BENCH_LOOKUP_KEYS keys in one query, against one query each */
+static bool bench_lookup(sqlite3 *db, long records, long iterations) {
+    bool ok = true;
+    char **secrets = NULL;
+    lookup_key_t keys[BENCH_LOOKUP_KEYS] = {0};
+
+    if (records == 0) return true;
+    for (int i = 0; i < BENCH_LOOKUP_KEYS; i++) keys[i].id = 1 + i * (records / BENCH_LOOKUP_KEYS);
+    for (long i = 0; i < iterations && ok; i++) {
+        TIMED("lookup_batch", BENCH_LOOKUP_KEYS, ok = (secrets = lookup_secrets(db, keys, BENCH_LOOKUP_KEYS)) != NULL);
+        lookup_secrets_free(secrets);
+    }
+
+    for (long i = 0; i < iterations && ok; i++) {
+        uint64_t start = bench_now_ns();
+        for (int j = 0; j < BENCH_LOOKUP_KEYS && ok; j++) {
+            ok = (secrets = lookup_secrets(db, &keys[j], 1)) != NULL;
+            lookup_secrets_free(secrets);
+        }
+        phase_add(phase_get("lookup_each"), (bench_now_ns() - start) / 1e6, BENCH_LOOKUP_KEYS);
+    }
+
+    return ok;
+}
+
+/**
+ * Renders the first page into a pty the way tui_main() does. Every
+ * frame is invalidated first, so each sample is a full first paint.
+ */
+static bool bench_frames(record_array_t *records, gen_t *gen, long iterations) {
+    term_t term = {0};
+    queue_t search_queue = {0};
+
+    if (!term_open(&term, BENCH_TERM_WIDTH, BENCH_TERM_HEIGHT)) return false;
+    if (tb_init_rwfd(term.slave, term.out_write) != TB_OK) {
+        fprintf(stderr, "Error: Failed to initialize TUI on pty\n");
+        term_close(&term);
+        return false;
+    }
+
+    setlocale(LC_ALL, "");
+    int start_x = (tb_width() - TABLE_WIDTH) / 2;
+    if (start_x < 0) start_x = 0;
+    int table_h = tb_height() - 4;
+    records_per_page = tb_height() - 8;
+    if (records_per_page < 1) records_per_page = 1;
+    current_page = 0;
+
+    for (long i = 0; i < iterations; i++) {
+        tb_invalidate();
+        TIMED("first_frame", 1, {
+            draw_table_border(start_x, 1, table_h);
+            draw_table(records, &search_queue, NULL, .start_x = start_x, .height = table_h, .cursor = 0);
+        });
+        term_drain(&term);
+    }
+
+    /* Searching happens inside _draw_table(), it scans every record */
+    for (long i = 0; i < iterations; i++) {
+        char *pattern = (char *) gen_word(gen);
+        free_queue(&search_queue);
+        TIMED("search", (size_t) records->size,
+              draw_table(records, &search_queue, pattern, .start_x = start_x, .height = table_h, .cursor = 0));
+        term_drain(&term);
+    }
+
+    tb_shutdown();
+    term_drain(&term);
+    free_queue(&search_queue);
+    term_close(&term);
+    return true;
+}
+
+/* Every key sorted from cold, as the first press of `s` on it does; the TUI caches the result */
+static bool bench_sort(record_array_t *records, long iterations) {
+    bool ok = true;
+    record_view_t view = {0};
+
+    for (long i = 0; i < iterations && ok; i++) {
+        for (int key = SORT_USERNAME; key < SORT_KEY_COUNT && ok; key++)
+            TIMED("sort_records", (size_t) records->size, ok = sort_records(&view, records, (SORT_KEY) key));
+        sort_invalidate(&view);
+    }
+
+    return ok;
+}
+
+/**
+ * Tags the vault, then times reading the tags and filtering by two and
+ * three of them: the intersection plus the rows in username order,
+ * which is what pressing `t` costs once the tags are in.
+ */
+static bool bench_tags(sqlite3 *db, record_array_t *records, long iterations) {
+    static const char *const filters[] = {"tag0 tag1", "tag0 tag1 tag2"};
+    char sql[512];
+    bool ok = true;
+    tag_index_t tags = {0};
+    record_view_t view = {0};
+
+    /* Deterministic: a multiplicative hash of the id picks the tags of a record */
+    snprintf(sql, sizeof(sql),
+             "WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM n WHERE i < %d) "
+             "INSERT INTO tags (name) SELECT 'tag' || i FROM n;"
+             "INSERT INTO secret_tags (tag_id, secret_id) SELECT tags.id, secrets.id FROM tags, secrets "
+             "WHERE ((secrets.id * 2654435761) >> (tags.id * 3)) & 3 = 0;",
+             BENCH_TAGS - 1);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to tag the vault: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    for (long i = 0; i < iterations && ok; i++) TIMED("load_tags", 1, ok = load_tags(db, &tags));
+    ok = ok && sort_records(&view, records, SORT_USERNAME);
+    for (long i = 0; i < iterations && ok; i++) {
+        for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]) && ok; f++) {
+            TIMED("tag_filter", (size_t) records->size, {
+                int64_t *ids = NULL;
+                int count = 0;
+                ok = tag_filter(&tags, filters[f], &ids, &count);
+                filter_set(&view, ids, count);
+                ok = ok && filter_rows(&view, records, SORT_USERNAME);
+            });
+        }
+    }
+
+    filter_set(&view, NULL, 0);
+    sort_invalidate(&view);
+    free_tags(&tags);
+    return ok;
+}
+
+static bool bench_mutations(sqlite3 *db, gen_t *gen, long records, long ops) {
+    secret_t rec = {0};
+    int64_t first_id = 0;
+    bool ok = true;
+
+    for (long i = 0; i < ops && ok; i++) {
+        gen_record(gen, &rec);
+        TIMED("insert_record", 1, ok = insert_record(db, &rec));
+        if (i == 0) first_id = sqlite3_last_insert_rowid(db);
+    }
+
+    for (long i = 0; i < ops && ok; i++) {
+        int id = 1 + (int) (gen_next(gen) % (uint64_t) (records > 0 ? records : 1));
+        gen_record(gen, &rec);
+        TIMED("update_record", 1,
+              ok = update_record(db, &rec, id, UPDATE_USERNAME | UPDATE_SECRET | UPDATE_DESCRIPTION));
+    }
+
+    for (long i = 0; i < ops && ok; i++) TIMED("delete_record", 1, ok = delete_record(db, (int) (first_id + i)));
+
+    sodium_memzero(&rec, sizeof(secret_t));
+    return ok;
+}
+
+/* Each sample merges a batch of updated rows, load_records is the full reload it replaces */
+static bool bench_refresh(sqlite3 *db, record_array_t *records, gen_t *gen, long iterations) {
+    secret_t rec = {0};
+    bool ok = refresh_records(db, records); /* catches up with bench_mutations() */
+
+    for (long i = 0; i < iterations && ok; i++) {
+        for (int j = 0; j < BENCH_REFRESH_BATCH && ok; j++) {
+            int64_t id = records->data[gen_next(gen) % (uint64_t) records->size].id;
+            gen_record(gen, &rec);
+            ok = update_record(db, &rec, (int) id, UPDATE_ALL);
+        }
+
+        if (ok) TIMED("refresh_records", BENCH_REFRESH_BATCH, ok = refresh_records(db, records));
+    }
+
+    sodium_memzero(&rec, sizeof(secret_t));
+    return ok;
+}
+
+static bool bench_transfer(sqlite3 *db, gen_t *gen, const bench_opts_t *opts) {
+    bool ok = true;
+    char *csv_path = work_path(opts->dir, "import.csv");
+    char *export_path = work_path(opts->dir, "export.csv");
+    import_opts_t import_opts = {.format = IMPORT_CSV, .mode = DEDUP_SKIP};
+    export_opts_t export_opts = {.format = EXPORT_CSV};
+
+    ok = gen_csv(gen, csv_path, (size_t) opts->import_records);
+    if (ok) TIMED("import", (size_t) opts->import_records, ok = import_secrets(db, csv_path, &import_opts));
+    size_t exported = (size_t) (opts->records + opts->import_records);
+    for (long i = 0; i < opts->iterations && ok; i++)
+        TIMED("export", exported, ok = export_secrets(db, export_path, &export_opts));
+
+    unlink(csv_path);
+    unlink(export_path);
+    free(csv_path);
+    free(export_path);
+    return ok;
+}
+
+/* Rendered to /dev/null, so the phase is the scan, the lookup and the copy */
+static bool bench_render(sqlite3 *db, gen_t *gen, const bench_opts_t *opts) {
+    int null_fd = -1;
+    char *path = NULL;
+
+    if (opts->records == 0) return true;
+    path = work_path(opts->dir, "render.tpl");
+    bool ok = gen_template(gen, path, BENCH_RENDER_LINES, opts->records)
+              && (null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC)) >= 0;
+    for (long i = 0; i < opts->iterations && ok; i++)
+        TIMED("render", BENCH_RENDER_LINES, ok = render_template(db, path, null_fd));
+
+    if (null_fd >= 0) close(null_fd);
+    unlink(path);
+    free(path);
+    return ok;
+}
+
+static bool bench_rekey(sqlite3 *db) {
+    int rc = SQLITE_OK;
+    unsigned char salt[SALT_LEN] = {0};
+    unsigned char *key = NULL;
+
+    if ((key = secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+    randombytes_buf(salt, SALT_LEN);
+    bool ok = key_gen(key, BENCH_PASSWORD "-rekeyed", salt, KDF_LANES_DEFAULT);
+    if (ok) TIMED("rekey", 1, rc = sqlite3_rekey(db, key, KEY_LEN));
+
+    secmem_free(key);
+    return ok && rc == SQLITE_OK;
+}
+
+/* A prompt or key buffer per pair, sodium_malloc is what every one of them cost before the slab */
+static void bench_secmem(long iterations, long ops) {
+    for (long i = 0; i < iterations && ops > 0; i++) {
+        TIMED("sodium_malloc", ops, {
+            for (long j = 0; j < ops; j++) sodium_free(sodium_malloc(KEY_LEN));
+        });
+        TIMED("secmem_alloc", ops, {
+            for (long j = 0; j < ops; j++) secmem_free(secmem_alloc(KEY_LEN));
+        });
+    }
+}
+
+/* Unlock time against lanes at the vault's memory and passes, one lane is libsodium */
+static bool bench_kdf(long unlocks, long max_lanes) {
+    static const char *const phases[] = {"kdf_lanes_1", "kdf_lanes_2",  "kdf_lanes_4",
+                                         "kdf_lanes_8", "kdf_lanes_16", "kdf_lanes_32"};
+    unsigned char salt[SALT_LEN] = {0};
+    unsigned char *key = NULL;
+    bool ok = true;
+
+    if ((key = secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+    for (size_t i = 0; i < LEN(phases) && (1L << i) <= max_lanes && ok; i++) {
+        for (long j = 0; j < unlocks && ok; j++)
+            TIMED(phases[i], 1, ok = key_gen(key, BENCH_PASSWORD, salt, (uint32_t) 1 << i));
+    }
+
+    secmem_free(key);
+    return ok;
+}
+
+static void remove_work_dir(const char *dir, bool own_dir) {
+    const char *files[] = {CRUXPASS_DB,         META_DB,           CRUXPASS_DB "-journal",
+                           META_DB "-journal", CRUXPASS_DB "-wal", CRUXPASS_DB "-shm"};
+    for (size_t i = 0; i < LEN(files); i++) {
+        char *path = work_path(dir, files[i]);
+        unlink(path);
+        free(path);
+    }
+
+    if (own_dir) rmdir(dir);
+}
+
+/* Only the unlock is timed in-process, the vault is closed before the children fork */
+static int run_stress(const bench_opts_t *opts, gen_t *gen, FILE *out) {
+    int failures = -1;
+    vault_ctx_t ctx = {0};
+    unsigned char *key = NULL;
+
+    cruxpass_db_path = work_path(opts->dir, CRUXPASS_DB);
+    meta_db_path = work_path(opts->dir, META_DB);
+
+    if (create_bench_vault(&ctx, gen, opts->records, &opts->profile)
+        && (key = bench_unlock(&ctx, opts->unlocks)) != NULL) {
+        cleanup_stmts();
+        close_db(ctx.secret_db);
+        ctx.secret_db = NULL;
+        failures = bench_stress(key, gen, opts->stress, opts->ops);
+    }
+
+    if (failures >= 0) {
+        char profile[STORAGE_SPEC_MAX];
+        storage_format(&opts->profile, profile, sizeof(profile));
+        phase_report(out,
+                     "\"benchmark\": \"cruxpass\", \"mode\": \"stress\", \"timestamp\": %lld, \"records\": %ld, "
+                     "\"seed\": %llu, \"writers\": %ld, \"ops\": %ld, \"failures\": %d, \"profile\": \"%s\"",
+                     (long long) time(NULL), opts->records, (unsigned long long) opts->seed, opts->stress, opts->ops,
+                     failures, profile);
+    }
+
+    if (failures != 0) fprintf(stderr, "Error: Stress run failed\n");
+    cleanup_stmts();
+    if (ctx.secret_db != NULL) sqlite3_close(ctx.secret_db);
+    if (key != NULL) secmem_free(key);
+    secmem_cleanup();
+    free(cruxpass_db_path);
+    free(meta_db_path);
+    cruxpass_db_path = meta_db_path = NULL;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int run(const bench_opts_t *opts, gen_t *gen, FILE *out, const char *dist) {
+    bool ok = false;
+    vault_ctx_t ctx = {0};
+    unsigned char *key = NULL;
+    arena_t arena = {0};
+    record_array_t records = {0, 0, NULL, 0, &arena};
+
+    cruxpass_db_path = work_path(opts->dir, CRUXPASS_DB);
+    meta_db_path = work_path(opts->dir, META_DB);
+
+    if (!create_bench_vault(&ctx, gen, opts->records, &opts->profile)) goto defer;
+    if ((key = bench_unlock(&ctx, opts->unlocks)) == NULL) goto defer;
+    if (!bench_prepare(&ctx, opts->iterations)) goto defer;
+    if (!bench_load(ctx.secret_db, &records, opts->iterations)) goto defer;
+    if (!bench_lookup(ctx.secret_db, opts->records, opts->iterations)) goto defer;
+    if (!bench_frames(&records, gen, opts->iterations)) goto defer;
+    if (!bench_sort(&records, opts->iterations)) goto defer;
+    if (!bench_tags(ctx.secret_db, &records, opts->iterations)) goto defer;
+    if (!bench_replay(&records, opts->script, opts->iterations)) goto defer;
+    if (!bench_mutations(ctx.secret_db, gen, opts->records, opts->ops)) goto defer;
+    if (!bench_refresh(ctx.secret_db, &records, gen, opts->iterations)) goto defer;
+    if (!bench_transfer(ctx.secret_db, gen, opts)) goto defer;
+    if (!bench_render(ctx.secret_db, gen, opts)) goto defer;
+    if (!bench_rekey(ctx.secret_db)) goto defer;
+    if (!bench_kdf(opts->unlocks, opts->kdf_lanes)) goto defer;
+    bench_secmem(opts->iterations, opts->ops);
+    ok = true;
+
+    char profile[STORAGE_SPEC_MAX];
+    stmt_stats_t stmts = stmt_stats();
+    secmem_stats_t secmem = secmem_stats();
+    arena_stats_t arena_stats = arena.stats;
+    storage_format(&opts->profile, profile, sizeof(profile));
+    phase_report(out,
+                 "\"benchmark\": \"cruxpass\", \"timestamp\": %lld, \"records\": %ld, \"seed\": %llu, "
+                 "\"distribution\": \"%s\", \"lengths\": {\"username\": [%d, %d], \"secret\": [%d, %d], "
+                 "\"description\": [%d, %d]}, \"terminal\": [%d, %d], \"script\": \"%s\", "
+                 "\"statements\": {\"hits\": %llu, \"misses\": %llu}, \"secmem\": {\"allocs\": %llu, "
+                 "\"fallbacks\": %llu, \"peak\": %llu, \"locked_bytes\": %zu}, \"arena\": {\"peak\": %zu, "
+                 "\"reserved\": %zu, \"blocks\": %zu, \"fragmentation\": %d}, \"kdf\": {\"max_lanes\": %ld, "
+                 "\"cores\": %ld}, \"profile\": \"%s\"",
+                 (long long) time(NULL), opts->records, (unsigned long long) opts->seed, dist, gen->username.min,
+                 gen->username.max, gen->secret.min, gen->secret.max, gen->description.min, gen->description.max,
+                 BENCH_TERM_WIDTH, BENCH_TERM_HEIGHT, opts->script, (unsigned long long) stmts.hits,
+                 (unsigned long long) stmts.misses, (unsigned long long) secmem.allocs,
+                 (unsigned long long) secmem.fallbacks, (unsigned long long) secmem.peak, secmem.locked_bytes,
+                 arena_stats.peak, arena_stats.reserved, arena_stats.blocks, arena_fragmentation(&arena_stats),
+                 opts->kdf_lanes, sysconf(_SC_NPROCESSORS_ONLN), profile);
+
+defer:
+    if (!ok) fprintf(stderr, "Error: Benchmark aborted\n");
+    free_records(&records);
+    arena_free(&arena);
+    cleanup_stmts();
+    if (ctx.secret_db != NULL) sqlite3_close(ctx.secret_db);
+    if (key != NULL) secmem_free(key);
+    secmem_cleanup();
+    free(cruxpass_db_path);
+    free(meta_db_path);
+    cruxpass_db_path = meta_db_path = NULL;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    Args args = {0};
+    const bool *help = option_flag(&args, "help", "Show this help", .short_name = 'h', .early_exit = true);
+    const long *records = option_long(&args, "records", "Records in the synthetic vault", .default_value = 10000);
+    const long *seed = option_long(&args, "seed", "Generator seed, same seed same vault", .default_value = 1);
+    const long *ops
+        = option_long(&args, "ops", "Operations per insert/update/delete phase", .default_value = 1000);
+    const long *iterations
+        = option_long(&args, "iterations", "Samples for prepare, load, frame, search and export", .default_value = 20);
+    const long *unlocks = option_long(&args, "unlocks", "Samples for unlock (Argon2id is slow)", .default_value = 3);
+    const long *import_records
+        = option_long(&args, "import-records", "Records in the imported CSV", .default_value = 10000);
+    const char **username_len
+        = option_string(&args, "username-len", "Username length range MIN:MAX", .default_value = "6:24");
+    const char **secret_len
+        = option_string(&args, "secret-len", "Secret length range MIN:MAX", .default_value = "12:40");
+    const char **desc_len
+        = option_string(&args, "desc-len", "Description length range MIN:MAX", .default_value = "8:96");
+    const size_t *dist = option_enum(&args, "dist", "Length distribution: uniform or skewed (short heavy)",
+                                     ((const char *[]) {"uniform", "skewed", NULL}), .default_value = DIST_UNIFORM);
+    const char **script
+        = option_string(&args, "script", "TUI key script: j k h l g G n s S, /TEXT, WxH; N repeats with *N",
+                        .default_value = BENCH_SCRIPT);
+    const char **profile = option_string(&args, "profile", "Storage profile of the vault, as for cruxpass --storage",
+                                         .default_value = "default");
+    const long *kdf_lanes = option_long(
+        &args, "kdf-lanes", "Also time key derivation with 1, 2, 4... up to N lanes, --unlocks samples each");
+    const long *stress = option_long(&args, "stress",
+                                     "Fork N writer processes and a polling reader instead of the single process run",
+                                     .default_value = 0);
+    const char **dir = option_path(&args, "dir", "Work directory (default: a fresh one under /tmp)");
+    const char **output = option_path(&args, "output", "Write the JSON report here instead of stdout", .short_name = 'o');
+    const char **generate
+        = option_path(&args, "generate", "Only write --records generated records to a CSV file and exit");
+
+    char **pos_args = NULL;
+    int pos_args_len = parse_args(&args, argc, argv, &pos_args);
+    if (*help || pos_args_len != 0) {
+        fprintf(stdout, "usage: %s [options]\n\n", argv[0]);
+        print_options(&args, stdout);
+        free_args(&args);
+        return EXIT_SUCCESS;
+    }
+
+    gen_t gen = {0};
+    storage_profile_t storage = STORAGE_PROFILE_DEFAULT;
+    gen_init(&gen, (uint64_t) *seed, (DIST_T) *dist);
+    if (*records < 1 || *ops < 0 || *iterations < 1 || *unlocks < 1 || *import_records < 0 || *stress < 0
+        || *kdf_lanes < 0 || *kdf_lanes > KDF_LANES_MAX
+        || !gen_parse_range(*username_len, &gen.username, FIELD_MIN, USERNAME_MAX_LEN)
+        || !gen_parse_range(*secret_len, &gen.secret, SECRET_MIN_LEN, SECRET_MAX_LEN)
+        || !gen_parse_range(*desc_len, &gen.description, FIELD_MIN, DESC_MAX_LEN - 1)
+        || !storage_parse(*profile, &storage)) {
+        fprintf(stderr, "Error: Invalid benchmark options\n");
+        free_args(&args);
+        return EXIT_FAILURE;
+    }
+
+    if (sodium_init() == -1) {
+        fprintf(stderr, "Error: Failed to initialize libsodium\n");
+        free_args(&args);
+        return EXIT_FAILURE;
+    }
+
+    if (*generate != NULL) {
+        bool ok = gen_csv(&gen, *generate, (size_t) *records);
+        free_args(&args);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    char tmp_dir[] = "/tmp/cruxpass-bench.XXXXXX";
+    bench_opts_t opts = {.records = *records,
+                         .ops = *ops,
+                         .iterations = *iterations,
+                         .unlocks = *unlocks,
+                         .import_records = *import_records,
+                         .stress = *stress,
+                         .kdf_lanes = *kdf_lanes,
+                         .seed = (uint64_t) *seed,
+                         .script = *script,
+                         .dir = *dir,
+                         .profile = storage};
+
+    if (opts.dir == NULL) {
+        if ((opts.dir = mkdtemp(tmp_dir)) == NULL) {
+            fprintf(stderr, "Error: Failed to create work directory: %s\n", strerror(errno));
+            free_args(&args);
+            return EXIT_FAILURE;
+        }
+
+        opts.own_dir = true;
+    }
+
+    FILE *out = stdout;
+    if (*output != NULL && (out = fopen(*output, "w")) == NULL) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", *output, strerror(errno));
+        free_args(&args);
+        return EXIT_FAILURE;
+    }
+
+    const char *dist_names[] = {"uniform", "skewed"};
+    int status = opts.stress > 0 ? run_stress(&opts, &gen, out) : run(&opts, &gen, out, dist_names[*dist]);
+
+    if (out != stdout) fclose(out);
+    remove_work_dir(opts.dir, opts.own_dir);
+    phase_free_all();
+    free_args(&args);
+    return status;
+}
@@ -0,0 +1,91 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cruxpass.h"
+#include "tui.h"
+
+#define BENCH_PASSWORD "cruxpass-bench-password"
+#define BENCH_MAX_PHASES 64
+#define BENCH_TERM_WIDTH 120
+#define BENCH_TERM_HEIGHT 40
+#define TERM_PIPE_SIZE (1 << 20)
+#define BENCH_REFRESH_BATCH 10
+#define BENCH_LOOKUP_KEYS 30
+#define BENCH_RENDER_LINES 100000
+#define BENCH_RENDER_EVERY 1000 /* one line in this many holds a reference */
+#define BENCH_TAGS 8             /* tag0..tag7, each on about a quarter of the records */
+#define BENCH_SCRIPT \
+    "j*200 l*20 G k*20 g h /mail n*5 j*40 80x24 j*100 l*10 200x60 l*10 k*40 120x40 g s*4 S s*5 j*40"
+
+typedef enum {
+    DIST_UNIFORM,
+    DIST_SKEWED
+} DIST_T;
+
+typedef struct {
+    int min;
+    int max;
+} range_t;
+
+/**
+ * Deterministic record generator: the same seed and ranges always
+ * produce the same vault, so runs on different releases compare.
+ */
+typedef struct {
+    uint64_t state;
+    DIST_T dist;
+    range_t username;
+    range_t secret;
+    range_t description;
+} gen_t;
+
+/* Samples of one phase, latencies are in milliseconds */
+typedef struct {
+    const char *name;
+    const char *unit;
+    size_t count;
+    size_t capacity;
+    size_t ops;  // operations covered by all samples, for throughput
+    double *samples;
+} phase_t;
+
+/* In-memory terminal: keys go in through a pty, frames come out of a pipe */
+typedef struct {
+    int master;
+    int slave;
+    int out_read;
+    int out_write;
+} term_t;
+
+uint64_t bench_now_ns(void);
+
+void gen_init(gen_t *gen, uint64_t seed, DIST_T dist);
+bool gen_parse_range(const char *str, range_t *range, int min, int max);
+uint64_t gen_next(gen_t *gen);
+void gen_record(gen_t *gen, secret_t *rec);
+const char *gen_word(gen_t *gen);
+bool gen_csv(gen_t *gen, const char *path, size_t count);
+bool gen_template(gen_t *gen, const char *path, size_t count, long records);
+
+phase_t *phase_get(const char *name);
+phase_t *phase_get_unit(const char *name, const char *unit);
+void phase_add(phase_t *phase, double value, size_t ops);
+void phase_report(FILE *out, const char *header_fmt, ...);
+void phase_free_all(void);
+
+bool bench_replay(record_array_t *records, const char *script, long iterations);
+int bench_stress(unsigned char *key, const gen_t *gen, long writers, long ops);
+
+bool term_open(term_t *term, int width, int height);
+bool term_resize(term_t *term, int width, int height);
+bool term_signal_resize(term_t *term, int width, int height);
+bool term_send(term_t *term, const char *keys, size_t len);
+size_t term_drain(term_t *term);
+void term_close(term_t *term);
+
+#endif  // !BENCH_H
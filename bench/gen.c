@@ -0,0 +1,136 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "export.h"
+
+static const char *words[] = {"mail",   "bank",   "work",    "home",  "cloud",  "server", "router", "vpn",
+                              "admin",  "backup", "forum",   "shop",  "git",    "social", "wiki",   "printer",
+                              "office", "travel", "account", "media", "stream", "game",   "school", "health",
+                              "api",    "token",  "staging", "prod",  "dev",    "family", "old",    "personal"};
+
+static const char username_bank[] = "abcdefghijklmnopqrstuvwxyz0123456789._";
+
+uint64_t bench_now_ns(void) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+void gen_init(gen_t *gen, uint64_t seed, DIST_T dist) {
+    gen->state = seed;
+    gen->dist = dist;
+}
+
+/* splitmix64 */
+uint64_t gen_next(gen_t *gen) {
+    uint64_t z = (gen->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static double gen_unit(gen_t *gen) { return (gen_next(gen) >> 11) * (1.0 / 9007199254740992.0); }
+
+/* Skewed lengths favour the short end, like real vaults do */
+static int gen_length(gen_t *gen, range_t range) {
+    double u = gen_unit(gen);
+    if (gen->dist == DIST_SKEWED) u = u * u * u;
+    return range.min + (int) (u * (range.max - range.min + 1));
+}
+
+/**
+ * Parses "MIN:MAX" (or a single length) and clamps it to what the
+ * vault accepts for that field.
+ */
+bool gen_parse_range(const char *str, range_t *range, int min, int max) {
+    char *end = NULL;
+    long low = strtol(str, &end, 10);
+    long high = low;
+
+    if (end == str) return false;
+    if (*end == ':') high = strtol(end + 1, &end, 10);
+    if (*end != '\0' || low > high || low < min || high > max) {
+        fprintf(stderr, "Error: Invalid length range \"%s\" (allowed: %d:%d)\n", str, min, max);
+        return false;
+    }
+
+    range->min = (int) low;
+    range->max = (int) high;
+    return true;
+}
+
+const char *gen_word(gen_t *gen) { return words[gen_next(gen) % (sizeof(words) / sizeof(words[0]))]; }
+
+void gen_record(gen_t *gen, secret_t *rec) {
+    int len = gen_length(gen, gen->username);
+    for (int i = 0; i < len; i++) rec->username[i] = username_bank[gen_next(gen) % (sizeof(username_bank) - 1)];
+    rec->username[len] = '\0';
+
+    len = gen_length(gen, gen->secret);
+    for (int i = 0; i < len; i++) rec->secret[i] = (char) (33 + gen_next(gen) % 94);
+    rec->secret[len] = '\0';
+
+    /* Descriptions are words so that searching them behaves like a real vault */
+    len = gen_length(gen, gen->description);
+    int pos = 0;
+    while (pos < len) {
+        const char *word = gen_word(gen);
+        int word_len = (int) strlen(word);
+        if (pos > 0) rec->description[pos++] = ' ';
+        for (int i = 0; i < word_len && pos < len; i++) rec->description[pos++] = word[i];
+    }
+    while (pos > 0 && rec->description[pos - 1] == ' ') pos--;
+    rec->description[pos] = '\0';
+}
+
+bool gen_csv(gen_t *gen, const char *path, size_t count) {
+    int fd = -1;
+    outbuf_t out = {0};
+    secret_t rec = {0};
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        fprintf(stderr, "Error: Failed to open %s\n", path);
+        return false;
+    }
+
+    outbuf_open(&out, fd);
+    outbuf_puts(&out, "Username,Secret,Description\r\n");
+    for (size_t i = 0; i < count; i++) {
+        gen_record(gen, &rec);
+        write_csv_field(&out, rec.username, (int) strlen(rec.username));
+        outbuf_putc(&out, ',');
+        write_csv_field(&out, rec.secret, (int) strlen(rec.secret));
+        outbuf_putc(&out, ',');
+        write_csv_field(&out, rec.description, (int) strlen(rec.description));
+        outbuf_puts(&out, "\r\n");
+    }
+
+    bool ok = outbuf_close(&out);
+    return close(fd) == 0 && ok;
+}
+
+/* A config file of count lines, one in BENCH_RENDER_EVERY carrying a reference to one of records */
+bool gen_template(gen_t *gen, const char *path, size_t count, long records) {
+    int fd = -1;
+    outbuf_t out = {0};
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        fprintf(stderr, "Error: Failed to open %s\n", path);
+        return false;
+    }
+
+    outbuf_open(&out, fd);
+    for (size_t i = 0; i < count; i++) {
+        if (i % BENCH_RENDER_EVERY == 0)
+            outbuf_printf(&out, "    %s {{ crux:id:%llu }};\n", gen_word(gen),
+                          (unsigned long long) (gen_next(gen) % (uint64_t) records + 1));
+        else outbuf_printf(&out, "    location /%s { proxy_pass http://%s:8080; }\n", gen_word(gen), gen_word(gen));
+    }
+
+    bool ok = outbuf_close(&out);
+    return close(fd) == 0 && ok;
+}
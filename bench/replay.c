@@ -0,0 +1,219 @@
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "tui.h"
+
+/**
+ * Replays a key script against the real list view (tui_handle_event and
+ * tui_render) on an in-memory terminal. A script is whitespace separated
+ * steps, each optionally repeated with *N:
+ *
+ *   j k h l g G n s S keys, as typed in the TUI
+ *   /TEXT            search for TEXT
+ *   WxH              resize the terminal, e.g. 80x24
+ */
+#define SCRIPT_MAX_STEPS 256
+
+typedef struct {
+    const char *phase;
+    char keys[SEARCH_TXT_MAX + 3];
+    size_t len;
+    int width;
+    int height;
+    long repeat;
+} step_t;
+
+typedef struct {
+    uint32_t ch;
+    uintattr_t fg;
+    uintattr_t bg;
+} cell_t;
+
+/* What termbox2 last put on screen, to count the cells a frame changed */
+typedef struct {
+    int width;
+    int height;
+    cell_t *cells;
+} screen_t;
+
+static bool parse_step(const char *token, size_t len, step_t *step) {
+    char *end = NULL;
+
+    memset(step, 0, sizeof(step_t));
+    step->repeat = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (token[i] != '*') continue;
+        step->repeat = strtol(token + i + 1, &end, 10);
+        if (end != token + len || step->repeat < 1) return false;
+        len = i;
+        break;
+    }
+
+    if (len == 0) return false;
+    if (token[0] == '/') {
+        /* The script is echoed into the JSON report as is */
+        if (len < 2 || len - 1 > SEARCH_TXT_MAX || memchr(token, '"', len) || memchr(token, '\\', len)) return false;
+        step->phase = "tui_search";
+        memcpy(step->keys, token, len);
+        step->keys[len] = '\r';
+        step->len = len + 1;
+        return true;
+    }
+
+    if (len == 1) {
+        switch (token[0]) {
+            case 'j':
+            case 'k': step->phase = "tui_scroll"; break;
+            case 'h':
+            case 'l':
+            case 'g':
+            case 'G': step->phase = "tui_page"; break;
+            case 'n': step->phase = "tui_next"; break;
+            case 's':
+            case 'S': step->phase = "tui_sort"; break;
+            default: return false;
+        }
+
+        step->keys[0] = token[0];
+        step->len = 1;
+        return true;
+    }
+
+    step->width = (int) strtol(token, &end, 10);
+    if (*end != 'x') return false;
+    step->height = (int) strtol(end + 1, &end, 10);
+    if (end != token + len || step->width < MIN_WIN_WIDTH || step->height < 10 || step->width > 1000
+        || step->height > 500) {
+        return false;
+    }
+
+    step->phase = "tui_resize";
+    return true;
+}
+
+static int parse_script(const char *script, step_t *steps) {
+    int count = 0;
+    const char *pos = script;
+
+    while (*pos != '\0') {
+        while (*pos == ' ' || *pos == '\t' || *pos == '\n') pos++;
+        if (*pos == '\0') break;
+
+        size_t len = strcspn(pos, " \t\n");
+        if (count == SCRIPT_MAX_STEPS || !parse_step(pos, len, &steps[count])) {
+            fprintf(stderr, "Error: Invalid script step \"%.*s\"\n", (int) len, pos);
+            return -1;
+        }
+
+        count++;
+        pos += len;
+    }
+
+    return count;
+}
+
+/* Takes a copy of the front buffer and returns how many cells differ from the last one */
+static size_t screen_update(screen_t *screen) {
+    int width = tb_width();
+    int height = tb_height();
+    size_t changed = 0;
+    struct tb_cell *cell = NULL;
+
+    if (width != screen->width || height != screen->height) {
+        cell_t *cells = realloc(screen->cells, sizeof(cell_t) * (size_t) width * (size_t) height);
+        if (cells == NULL) CRXP__OUT_OF_MEMORY();
+        memset(cells, 0, sizeof(cell_t) * (size_t) width * (size_t) height);
+        screen->cells = cells;
+        screen->width = width;
+        screen->height = height;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (tb_get_cell(x, y, 0, &cell) != TB_OK) continue;
+            cell_t *old = &screen->cells[(size_t) y * (size_t) width + (size_t) x];
+            if (old->ch != cell->ch || old->fg != cell->fg || old->bg != cell->bg) {
+                *old = (cell_t) {.ch = cell->ch, .fg = cell->fg, .bg = cell->bg};
+                changed++;
+            }
+        }
+    }
+
+    return changed;
+}
+
+static bool replay_step(term_t *term, tui_state_t *tui, screen_t *screen, const step_t *step) {
+    struct tb_event ev = {0};
+    uint64_t start = bench_now_ns();
+
+    bool ok = strcmp(step->phase, "tui_resize") == 0 ? term_signal_resize(term, step->width, step->height)
+                                                     : term_send(term, step->keys, step->len);
+    if (!ok || tb_poll_event(&ev) != TB_OK) {
+        fprintf(stderr, "Error: Failed to replay a key\n");
+        return false;
+    }
+
+    tui_handle_event(tui, &ev);
+    tui_render(tui);
+    double ms = (bench_now_ns() - start) / 1e6;
+
+    phase_add(phase_get(step->phase), ms, 1);
+    phase_add(phase_get("tui_frame"), ms, 1);
+    phase_add(phase_get_unit("tui_frame_cells", "cells"), (double) screen_update(screen), 1);
+    phase_add(phase_get_unit("tui_frame_bytes", "bytes"), (double) term_drain(term), 1);
+    return true;
+}
+
+/**
+ * Every iteration starts from the top of an unfiltered list at the
+ * default terminal size, so the samples of all iterations compare.
+ */
+bool bench_replay(record_array_t *records, const char *script, long iterations) {
+    bool ok = true;
+    term_t term = {0};
+    screen_t screen = {0};
+    step_t steps[SCRIPT_MAX_STEPS];
+    int step_count = 0;
+
+    if ((step_count = parse_script(script, steps)) <= 0) return false;
+    if (!term_open(&term, BENCH_TERM_WIDTH, BENCH_TERM_HEIGHT)) return false;
+    if (tb_init_rwfd(term.slave, term.out_write) != TB_OK) {
+        fprintf(stderr, "Error: Failed to initialize TUI on pty\n");
+        term_close(&term);
+        return false;
+    }
+
+    tb_set_input_mode(TB_INPUT_ESC);
+    setlocale(LC_ALL, "");
+    for (long i = 0; i < iterations && ok; i++) {
+        tui_state_t tui = {.records = *records};
+        tui.search_queue.arena = &tui.scratch;
+        struct tb_event ev = {0};
+
+        /* Back to the default size, the resize event is not part of the samples */
+        if (tb_width() != BENCH_TERM_WIDTH || tb_height() != BENCH_TERM_HEIGHT) {
+            ok = term_signal_resize(&term, BENCH_TERM_WIDTH, BENCH_TERM_HEIGHT) && tb_poll_event(&ev) == TB_OK;
+        }
+
+        tui_layout(&tui, tb_width(), tb_height());
+        draw_table_border(tui.start_x, tui.start_y, tui.table_h);
+        tui_render(&tui);
+        screen_update(&screen);
+        term_drain(&term);
+
+        for (int j = 0; j < step_count && ok; j++) {
+            for (long k = 0; k < steps[j].repeat && ok; k++) ok = replay_step(&term, &tui, &screen, &steps[j]);
+        }
+
+        sort_invalidate(&tui.view);
+        arena_free(&tui.scratch);
+    }
+
+    tb_shutdown();
+    term_drain(&term);
+    term_close(&term);
+    free(screen.cells);
+    return ok;
+}
@@ -0,0 +1,89 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+static phase_t phases[BENCH_MAX_PHASES];
+static size_t phase_count;
+
+phase_t *phase_get(const char *name) { return phase_get_unit(name, "ms"); }
+
+/* Phases in other units (bytes, cells) are reported without a throughput */
+phase_t *phase_get_unit(const char *name, const char *unit) {
+    for (size_t i = 0; i < phase_count; i++) {
+        if (strcmp(phases[i].name, name) == 0) return &phases[i];
+    }
+
+    if (phase_count == BENCH_MAX_PHASES) CRXP__FATAL("Too many benchmark phases");
+    phases[phase_count].name = name;
+    phases[phase_count].unit = unit;
+    return &phases[phase_count++];
+}
+
+void phase_add(phase_t *phase, double value, size_t ops) {
+    if (phase->count == phase->capacity) {
+        size_t capacity = phase->capacity == 0 ? 64 : phase->capacity * 2;
+        double *samples = realloc(phase->samples, capacity * sizeof(double));
+        if (samples == NULL) CRXP__OUT_OF_MEMORY();
+        phase->samples = samples;
+        phase->capacity = capacity;
+    }
+
+    phase->samples[phase->count++] = value;
+    phase->ops += ops;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile over sorted samples */
+static double percentile(const phase_t *phase, double p) {
+    size_t rank = (size_t) ceil(p / 100.0 * phase->count);
+    return phase->samples[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * Writes every phase as one JSON document. header_fmt supplies the
+ * top level fields ahead of "phases", without braces.
+ */
+void phase_report(FILE *out, const char *header_fmt, ...) {
+    va_list args;
+
+    fprintf(out, "{\n  ");
+    va_start(args, header_fmt);
+    vfprintf(out, header_fmt, args);
+    va_end(args);
+    fprintf(out, ",\n  \"phases\": [");
+
+    for (size_t i = 0; i < phase_count; i++) {
+        phase_t *phase = &phases[i];
+        double total = 0;
+
+        if (phase->count == 0) continue;
+        qsort(phase->samples, phase->count, sizeof(double), compare_double);
+        for (size_t j = 0; j < phase->count; j++) total += phase->samples[j];
+
+        fprintf(out,
+                "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": %zu, \"ops\": %zu, \"total\": %.3f, "
+                "\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f",
+                i == 0 ? "" : ",", phase->name, phase->unit, phase->count, phase->ops, total, phase->samples[0],
+                total / phase->count, percentile(phase, 50), percentile(phase, 90), percentile(phase, 99),
+                phase->samples[phase->count - 1]);
+        if (strcmp(phase->unit, "ms") == 0)
+            fprintf(out, ", \"ops_per_sec\": %.1f", total > 0 ? phase->ops / (total / 1000.0) : 0.0);
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+}
+
+void phase_free_all(void) {
+    for (size_t i = 0; i < phase_count; i++) free(phases[i].samples);
+    memset(phases, 0, sizeof(phases));
+    phase_count = 0;
+}
@@ -0,0 +1,244 @@
+/**
+ * Multi-process stress: writer processes insert, update and delete their
+ * own records while a reader polls the vault the way an open TUI does.
+ * Every process has its own connection, samples come back over pipes.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "crypt.h"
+#include "database.h"
+
+#define STRESS_POLL_MS 10
+
+extern char *cruxpass_db_path;
+
+typedef enum {
+    STRESS_INSERT,
+    STRESS_UPDATE,
+    STRESS_DELETE,
+    STRESS_POLL,
+    STRESS_REFRESH
+} STRESS_OP_T;
+
+/* Smaller than PIPE_BUF, writes from different children never interleave */
+typedef struct {
+    int op;
+    double ms;
+} stress_sample_t;
+
+static const char *op_names[] = {"stress_insert", "stress_update", "stress_delete", "stress_poll", "stress_refresh"};
+
+static void send_sample(int fd, STRESS_OP_T op, uint64_t start) {
+    stress_sample_t sample = {.op = op, .ms = (bench_now_ns() - start) / 1e6};
+    while (write(fd, &sample, sizeof(sample)) < 0 && errno == EINTR);
+}
+
+static sqlite3 *stress_open(unsigned char *key) {
+    sqlite3 *db = NULL;
+    if ((db = open_db(cruxpass_db_path, SQLITE_OPEN_READWRITE)) == NULL) return NULL;
+    if (!decrypt(db, key)) {
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+static bool stress_writer(unsigned char *key, gen_t gen, long ops, int fd) {
+    bool ok = true;
+    secret_t rec = {0};
+    sqlite3 *db = NULL;
+
+    if ((db = stress_open(key)) == NULL) return false;
+
+    /* Ids of one writer are not contiguous, the others insert in between */
+    int64_t *ids = NULL;
+    if ((ids = calloc((size_t) (ops > 0 ? ops : 1), sizeof(int64_t))) == NULL) CRXP__OUT_OF_MEMORY();
+
+    for (long i = 0; i < ops && ok; i++) {
+        uint64_t start = bench_now_ns();
+        gen_record(&gen, &rec);
+        if ((ok = insert_record(db, &rec))) ids[i] = sqlite3_last_insert_rowid(db);
+        send_sample(fd, STRESS_INSERT, start);
+    }
+
+    for (long i = 0; i < ops && ok; i++) {
+        uint64_t start = bench_now_ns();
+        gen_record(&gen, &rec);
+        ok = update_record(db, &rec, (int) ids[i], UPDATE_ALL);
+        send_sample(fd, STRESS_UPDATE, start);
+    }
+
+    for (long i = 0; i < ops && ok; i++) {
+        uint64_t start = bench_now_ns();
+        ok = delete_record(db, (int) ids[i]);
+        send_sample(fd, STRESS_DELETE, start);
+    }
+
+    sodium_memzero(&rec, sizeof(secret_t));
+    free(ids);
+    close_db(db);
+    return ok;
+}
+
+/* Polls until stop_fd is closed, refreshing the list whenever a writer committed */
+static bool stress_reader(unsigned char *key, int fd, int stop_fd) {
+    bool ok = true;
+    int64_t version = 0;
+    sqlite3 *db = NULL;
+    record_array_t records = {0, 0, NULL, 0, NULL};
+    struct pollfd stop = {.fd = stop_fd, .events = POLLIN};
+
+    if ((db = stress_open(key)) == NULL) return false;
+    vault_changed(db, &version);
+    ok = load_records(db, &records);
+
+    while (ok && poll(&stop, 1, STRESS_POLL_MS) == 0) {
+        uint64_t start = bench_now_ns();
+        bool changed = vault_changed(db, &version);
+        send_sample(fd, STRESS_POLL, start);
+        if (!changed) continue;
+
+        start = bench_now_ns();
+        ok = refresh_records(db, &records);
+        send_sample(fd, STRESS_REFRESH, start);
+    }
+
+    free_records(&records);
+    close_db(db);
+    return ok;
+}
+
+/* Reads every sample a child sent, returns false on EOF */
+static bool drain_samples(int fd) {
+    stress_sample_t sample = {0};
+    size_t got = 0;
+
+    while (got < sizeof(sample)) {
+        ssize_t n = read(fd, (char *) &sample + got, sizeof(sample) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += (size_t) n;
+    }
+
+    if (sample.op >= 0 && (size_t) sample.op < LEN(op_names)) phase_add(phase_get(op_names[sample.op]), sample.ms, 1);
+    return true;
+}
+
+static pid_t spawn(bool (*child)(void), int *close_fds, size_t close_len) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    for (size_t i = 0; i < close_len; i++) close(close_fds[i]);
+    bool ok = child();
+    cleanup_stmts();
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static struct {
+    unsigned char *key;
+    gen_t gen;
+    long ops;
+    int sample_fd;
+    int stop_fd;
+} job;
+
+static bool run_writer(void) { return stress_writer(job.key, job.gen, job.ops, job.sample_fd); }
+static bool run_reader(void) { return stress_reader(job.key, job.sample_fd, job.stop_fd); }
+
+static int64_t count_records(unsigned char *key) {
+    sqlite3 *db = NULL;
+    record_array_t records = {0, 0, NULL, 0, NULL};
+
+    if ((db = stress_open(key)) == NULL) return -1;
+    int64_t count = load_records(db, &records) ? records.size : -1;
+    free_records(&records);
+    cleanup_stmts();
+    close_db(db);
+    return count;
+}
+
+/**
+ * Runs the writers and the reader against the closed vault at
+ * cruxpass_db_path. Returns the number of processes that failed, plus
+ * one when the writers left a different record count behind.
+ */
+int bench_stress(unsigned char *key, const gen_t *gen, long writers, long ops) {
+    int failures = 0;
+    int writer_pipe[2];
+    int reader_pipe[2];
+    int stop_pipe[2];
+    pid_t reader = -1;
+    pid_t *pids = NULL;
+
+    int64_t before = count_records(key);
+    if (before < 0) return 1;
+    if ((pids = calloc((size_t) writers, sizeof(pid_t))) == NULL) CRXP__OUT_OF_MEMORY();
+
+    if (pipe(writer_pipe) != 0 || pipe(reader_pipe) != 0 || pipe(stop_pipe) != 0) {
+        fprintf(stderr, "Error: Failed to create pipes: %s\n", strerror(errno));
+        free(pids);
+        return 1;
+    }
+
+    job.key = key;
+    job.ops = ops;
+    job.sample_fd = reader_pipe[1];
+    job.stop_fd = stop_pipe[0];
+    reader = spawn(run_reader, (int[]) {writer_pipe[0], writer_pipe[1], reader_pipe[0], stop_pipe[1]}, 4);
+
+    job.sample_fd = writer_pipe[1];
+    for (long i = 0; i < writers; i++) {
+        /* Same lengths as the vault, a different stream of records per writer */
+        job.gen = *gen;
+        gen_init(&job.gen, gen->state + (uint64_t) i + 1, gen->dist);
+        pids[i] = spawn(run_writer, (int[]) {writer_pipe[0], reader_pipe[0], reader_pipe[1], stop_pipe[0], stop_pipe[1]},
+                        5);
+    }
+
+    close(writer_pipe[1]);
+    close(reader_pipe[1]);
+    close(stop_pipe[0]);
+
+    /* Both pipes are drained together, a full one would stall its writers */
+    struct pollfd fds[] = {{.fd = writer_pipe[0], .events = POLLIN}, {.fd = reader_pipe[0], .events = POLLIN}};
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, LEN(fds), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (size_t i = 0; i < LEN(fds); i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0 || drain_samples(fds[i].fd)) continue;
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            if (i == 0) close(stop_pipe[1]);
+        }
+    }
+
+    for (long i = 0; i < writers; i++) {
+        int status = 0;
+        if (pids[i] < 0 || waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+
+    int status = 0;
+    if (reader < 0 || waitpid(reader, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failures++;
+
+    int64_t after = count_records(key);
+    if (after != before) {
+        fprintf(stderr, "Error: Vault has %lld records after the stress run, expected %lld\n", (long long) after,
+                (long long) before);
+        failures++;
+    }
+
+    free(pids);
+    return failures;
+}
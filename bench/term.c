@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/**
+ * termbox2 reads keys and the window size from the pty slave but writes
+ * its output into a pipe, so every frame's bytes can be counted exactly.
+ */
+bool term_open(term_t *term, int width, int height) {
+    int pipe_fds[2] = {-1, -1};
+
+    memset(term, 0, sizeof(term_t));
+    term->slave = term->out_read = term->out_write = -1;
+    if ((term->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0 || grantpt(term->master) != 0
+        || unlockpt(term->master) != 0) {
+        fprintf(stderr, "Error: Failed to allocate a pty: %s\n", strerror(errno));
+        if (term->master >= 0) close(term->master);
+        return false;
+    }
+
+    if ((term->slave = open(ptsname(term->master), O_RDWR | O_NOCTTY | O_CLOEXEC)) < 0
+        || !term_resize(term, width, height) || pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        fprintf(stderr, "Error: Failed to open pty: %s\n", strerror(errno));
+        term_close(term);
+        return false;
+    }
+
+    term->out_read = pipe_fds[0];
+    term->out_write = pipe_fds[1];
+    fcntl(term->out_read, F_SETFL, O_NONBLOCK);
+    /* A full repaint must fit, termbox2 would block in tb_present() otherwise */
+    if (fcntl(term->out_write, F_SETPIPE_SZ, TERM_PIPE_SIZE) < 0) {
+        fprintf(stderr, "Warning: Failed to grow the output pipe, large terminals may stall\n");
+    }
+
+    /* termbox2 picks its escape sequences from TERM */
+    setenv("TERM", "xterm-256color", 0);
+    return true;
+}
+
+bool term_resize(term_t *term, int width, int height) {
+    struct winsize size = {.ws_row = (unsigned short) height, .ws_col = (unsigned short) width};
+    return ioctl(term->slave, TIOCSWINSZ, &size) == 0;
+}
+
+/* The pty is not our controlling terminal, so the kernel will not signal a resize */
+bool term_signal_resize(term_t *term, int width, int height) {
+    return term_resize(term, width, height) && raise(SIGWINCH) == 0;
+}
+
+bool term_send(term_t *term, const char *keys, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(term->master, keys, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        keys += written;
+        len -= (size_t) written;
+    }
+
+    return true;
+}
+
+/* Empties the output pipe and returns how many bytes were in it */
+size_t term_drain(term_t *term) {
+    char buf[16 * 1024];
+    size_t total = 0;
+
+    for (;;) {
+        ssize_t got = read(term->out_read, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        total += (size_t) got;
+    }
+
+    return total;
+}
+
+void term_close(term_t *term) {
+    int *fds[] = {&term->out_write, &term->out_read, &term->slave, &term->master};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0) close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
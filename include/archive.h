@@ -0,0 +1,46 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+#include <sqlcipher/sqlite3.h>
+#include <stdint.h>
+
+#include "crypt.h"
+#include "cruxpass.h"
+
+/**
+ * Archive layout (all integers little endian):
+ *
+ *   header  | magic[8] version[1] kdf[1] reserved[2] salt[16] stream_header[24]
+ *   chunk*  | length[4] ciphertext[length]
+ *
+ * Each chunk is one crypto_secretstream_xchacha20poly1305 message holding
+ * whole records: ulen[2] slen[2] dlen[2] username secret description.
+ * The header is authenticated as additional data of the first chunk and
+ * the last chunk carries TAG_FINAL, so tampering, reordering and truncation
+ * all fail to decrypt.
+ */
+#define ARCHIVE_MAGIC "CRXPARC"
+#define ARCHIVE_VERSION 0x01
+#define ARCHIVE_KDF_ARGON2ID 0x01
+#define ARCHIVE_CHUNK_SIZE (64 * 1024)
+#define ARCHIVE_RECORD_HEADER 6
+#define ARCHIVE_CIPHER_MAX (ARCHIVE_CHUNK_SIZE + crypto_secretstream_xchacha20poly1305_ABYTES)
+
+typedef struct {
+    char magic[8];
+    uint8_t version;
+    uint8_t kdf;
+    uint8_t reserved[2];
+    uint8_t salt[SALT_LEN];
+    uint8_t stream_header[crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+} archive_header_t;
+
+int export_archive(sqlite3 *db, const char *archive_file);
+int import_archive(sqlite3 *db, const char *archive_file, const import_opts_t *opts);
+
+#endif  // !ARCHIVE_H
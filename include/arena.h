@@ -0,0 +1,54 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Bump allocator for data that lives as long as a TUI session, or a
+ * scope inside it. Allocations come from blocks of ARENA_BLOCK_SIZE,
+ * larger ones get a block of their own. Nothing is freed on its own:
+ * arena_end() gives back everything allocated since arena_begin(), and
+ * arena_free() releases the whole arena.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block arena_block_t;
+
+typedef struct {
+    size_t used;     /* bytes handed out since the arena was created, minus given back */
+    size_t wasted;   /* part of used left behind by arena_grow() moves */
+    size_t reserved; /* bytes in blocks, spare ones included */
+    size_t peak;     /* largest used */
+    size_t blocks;
+    size_t scopes;
+} arena_stats_t;
+
+typedef struct {
+    arena_block_t *head;  /* newest block, the one allocations come from */
+    arena_block_t *spare; /* standard blocks given back by scopes */
+    size_t depth;         /* blocks in the head list */
+    size_t floor_depth;   /* start of the innermost scope */
+    size_t floor_offset;
+    arena_stats_t stats;
+} arena_t;
+
+typedef struct {
+    arena_t *arena;
+    size_t depth;
+    size_t offset;
+    size_t floor_depth;
+    size_t floor_offset;
+    size_t used;
+    size_t wasted;
+} arena_scope_t;
+
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+void arena_release(arena_t *arena, void *ptr, size_t size);
+arena_scope_t arena_begin(arena_t *arena);
+void arena_end(arena_scope_t *scope);
+void arena_free(arena_t *arena);
+int arena_fragmentation(const arena_stats_t *stats);
+
+#endif  // !ARENA_H
@@ -0,0 +1,26 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+
+#include "cruxpass.h"
+
+/**
+ * The vault is copied BACKUP_STEP_PAGES at a time, every step takes and
+ * drops the read lock so other processes can write between steps.
+ */
+#define BACKUP_STEP_PAGES 128
+#define BACKUP_YIELD_MS 1
+#define BACKUP_BUSY_MS 50
+#define BACKUP_GEN_PREFIX "backup."
+#define BACKUP_TMP_DIR ".backup.tmp"
+#define BACKUP_TRASH_DIR ".backup.old"
+#define BACKUP_MAX_GENERATIONS 64
+
+int backup_vault(vault_ctx_t *ctx, const unsigned char *key, const char *dest_dir, int generations);
+
+#endif  // !BACKUP_H
@@ -0,0 +1,35 @@
+#ifndef BREACH_H
+#define BREACH_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdint.h>
+
+#include "cruxpass.h"
+
+#define SHA1_LEN 20
+#define SHA1_HEX_LEN 40
+
+/**
+ * The fan-out index maps every 5 hex digit (20 bit) hash prefix, the same
+ * prefix HIBP uses for its range API, to the byte offset of the first line
+ * carrying that prefix. A lookup is then a binary search over a few pages.
+ */
+#define FANOUT_BITS 20
+#define FANOUT_SIZE (1 << FANOUT_BITS)
+#define FANOUT_MAGIC "CRXPBIX1"
+#define FANOUT_EXT ".idx"
+
+typedef struct {
+    char magic[8];
+    uint64_t corpus_size;
+    uint64_t offsets[FANOUT_SIZE + 1];
+} fanout_t;
+
+int build_breach_index(const char *hash_file);
+int breach_check(sqlite3 *db, const char *hash_file);
+
+#endif  // !BREACH_H
@@ -30,6 +30,10 @@
 #define SECRET_MIN_LEN 8
 #define GEN_SECRET_MIN_LEN 4
 #define USERNAME_MAX_LEN 32
+#define DATE_LEN 10 /* YYYY-MM-DD, as SQLite CURRENT_DATE stores dates */
+#define TAG_MAX_LEN 32
+#define TAGS_MAX_LEN 128 /* a record's tags as text, see tag_next() */
+#define IMPORT_BATCH_SIZE 4096
 
 #ifndef CRUXPASS_DB
 #define CRUXPASS_DB "cruxpass.db"
@@ -83,6 +87,39 @@ typedef enum {
     CRXP_OKK
 } ERROR_T;
 
+typedef enum {
+    DEDUP_SKIP,
+    DEDUP_UPDATE,
+    DEDUP_KEEP
+} DEDUP_T;
+
+typedef enum {
+    IMPORT_CSV,
+    IMPORT_BITWARDEN,
+    IMPORT_KEEPASS,
+    IMPORT_1PASSWORD
+} IMPORT_FORMAT;
+
+typedef struct {
+    IMPORT_FORMAT format;
+    DEDUP_T mode;
+    bool match_secret;
+} import_opts_t;
+
+typedef enum {
+    EXPORT_CSV,
+    EXPORT_JSONL,
+    EXPORT_KEEPASS,
+    EXPORT_BITWARDEN,
+    EXPORT_TSV,
+    EXPORT_FORMAT_COUNT
+} EXPORT_FORMAT;
+
+typedef struct {
+    EXPORT_FORMAT format;
+    const char *filter;
+} export_opts_t;
+
 typedef struct {
     bool upper;
     bool lower;
@@ -92,10 +129,11 @@ typedef struct {
 } bank_options_t;
 
 vault_ctx_t *initcrux(char *run_dir);
+char *existing_meta_path(const char *run_dir);
 char *init_secret_bank(const bank_options_t *options);
 
 char *random_secret(int secret_len, bank_options_t *bank_options);
-int export_secrets(sqlite3 *db, const char *export_file);
-int import_secrets(sqlite3 *db, const char *import_file);
+int export_secrets(sqlite3 *db, const char *export_file, const export_opts_t *opts);
+int import_secrets(sqlite3 *db, const char *import_file, const import_opts_t *opts);
 
 #endif  // !CRUXPASS_H
@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "cruxpass.h"
+#include "tui.h"
 
 #define GEN_KEY 0x01
 #define KEY_LEN 32
@@ -20,8 +21,8 @@
 #define BUFFMAX SECRET_MAX_LEN + USERNAME_MAX_LEN + DESC_MAX_LEN + 1
 
 bool rotate_login_secret(sqlite3 *db);
-unsigned char *authenticate(vault_ctx_t *ctx);
+unsigned char *authenticate(vault_ctx_t *ctx, uint32_t lanes, tui_state_t *tui, int password_fd);
 bool decrypt(sqlite3 *db, unsigned char *key);
-bool key_gen(unsigned char *key, const char *const passd_str, unsigned char *salt);
+bool key_gen(unsigned char *key, const char *const passd_str, unsigned char *salt, uint32_t lanes);
 
 #endif  // !CRTYPT_H
@@ -8,38 +8,129 @@
 #include <stdint.h>
 
 #include "cruxpass.h"
+#include "storage.h"
 #include "tui.h"
 
 #define UPDATE_DESCRIPTION 0x01
 #define UPDATE_SECRET 0x02
 #define UPDATE_USERNAME 0x04
+#define UPDATE_ALL (UPDATE_DESCRIPTION | UPDATE_SECRET | UPDATE_USERNAME)
 
+/* Fields of a lookup key, a _PREFIX bit matches its field by prefix */
+#define LOOKUP_USERNAME 0x01
+#define LOOKUP_DESCRIPTION 0x02
+#define LOOKUP_USERNAME_PREFIX 0x04
+#define LOOKUP_DESCRIPTION_PREFIX 0x08
+#define LOOKUP_ALL (LOOKUP_USERNAME | LOOKUP_DESCRIPTION | LOOKUP_USERNAME_PREFIX | LOOKUP_DESCRIPTION_PREFIX)
+
+/**
+ * Another process holding the lock is waited for with exponential
+ * backoff, DB_BUSY_MIN_MS doubling up to DB_BUSY_MAX_MS per sleep and
+ * at most DB_BUSY_TIMEOUT_MS in total, before SQLITE_BUSY is returned.
+ */
+#define DB_BUSY_MIN_MS 1
+#define DB_BUSY_MAX_MS 100
+#define DB_BUSY_TIMEOUT_MS 10000
+
+/**
+ * Version of the vault schema kept in PRAGMA user_version. Version 1
+ * adds the changes table: triggers give every inserted, updated or
+ * deleted record the next sequence number, so a reader can fetch only
+ * what changed after the last sequence it saw. Version 2 indexes
+ * username and description under NOCASE for `get` lookups, version 3
+ * date_added for `query` date ranges and sorting. Version 4 adds
+ * date_modified, set by every insert and update, and indexes it.
+ * Version 5 adds tags: secret_tags is keyed by (tag_id, secret_id)
+ * without a rowid, so the records of a tag are one ascending run of
+ * the table itself, and an index on (secret_id, tag_id) covers the
+ * tags of a record. Triggers drop the links of a deleted record and
+ * tags nothing links to, and log tag changes as changes of the record.
+ */
+#define SCHEMA_VERSION 5
+
+/**
+ * Every query cruxpass runs. Statements are prepared on first use and
+ * kept until cleanup_stmts(); UPDATE_REC_STMT + mask is the update of
+ * the fields in an UPDATE_* mask, one cached statement per mask.
+ */
 typedef enum {
     INSERT_REC_STMT,
     DELETE_REC_STMT,
     FETCH_SEC_STMT,
-    STMT_COUNT
+    LOAD_RECS_STMT,
+    EXPORT_ALL_STMT,
+    EXPORT_FILTER_STMT,
+    DEDUP_SCAN_STMT,
+    ARCHIVE_SCAN_STMT,
+    BREACH_COUNT_STMT,
+    BREACH_SCAN_STMT,
+    BEGIN_STMT,
+    COMMIT_STMT,
+    ROLLBACK_STMT,
+    META_FETCH_STMT,
+    META_INSERT_STMT,
+    META_UPDATE_STMT,
+    PROFILE_FETCH_STMT,
+    PROFILE_SAVE_STMT,
+    DATA_VERSION_STMT,
+    USER_VERSION_STMT,
+    CHANGES_STMT,
+    TAG_INSERT_STMT,
+    TAG_LINK_STMT,
+    TAG_CLEAR_STMT,
+    TAG_TOUCH_STMT,
+    TAGS_LOAD_STMT,
+    TAG_IDS_STMT,
+    RECORD_TAGS_STMT,
+    UPDATE_REC_STMT,
+    STMT_COUNT = UPDATE_REC_STMT + UPDATE_ALL + 1
 } SQL_STMT;
 
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+} stmt_stats_t;
+
 typedef struct {
     uint8_t version;
+    uint32_t lanes; /* Argon2id lanes the key is derived with */
     uint8_t salt[];
 } meta_t;
 
+bool migrate_schema(sqlite3 *db);
 bool prepare_stmt(vault_ctx_t *ctx);
+sqlite3_stmt *get_stmt(sqlite3 *db, SQL_STMT id);
+size_t lookup_where(uint8_t mask, char *buf, size_t size);
+bool exec_stmt(sqlite3 *db, SQL_STMT id);
+void release_stmt(sqlite3_stmt *stmt);
 void cleanup_stmts(void);
+stmt_stats_t stmt_stats(void);
 
 int init_sqlite(void);
+int create_vault(vault_ctx_t *ctx, const char *login_secret);
 sqlite3 *open_db(char *db_name, int flags);
+void close_db(sqlite3 *db);
 
 meta_t *fetch_meta(void);
 bool update_meta(sqlite3 *db, meta_t *meta);
 bool insert_meta(sqlite3 *db, meta_t *meta);
+bool fetch_profile(storage_profile_t *profile, bool *pending);
+bool update_profile(sqlite3 *db, const storage_profile_t *profile, bool pending);
 
 int delete_record(sqlite3 *db, int id);
 int insert_record(sqlite3 *db, secret_t *secret);
 int load_records(sqlite3 *db, record_array_t *records);
+int stream_records(sqlite3 *db, record_array_t *records, int limit, bool *done);
+void stream_records_end(sqlite3 *db);
+int refresh_records(sqlite3 *db, record_array_t *records);
 int update_record(sqlite3 *db, secret_t *secret, int id, uint8_t flags);
 
+bool tag_next(const char **text, char *name);
+int add_tags(sqlite3 *db, int64_t id, const char *tags);
+int set_tags(sqlite3 *db, int64_t id, const char *tags);
+bool fetch_tags(sqlite3 *db, int64_t id, char *tags, size_t size);
+int load_tags(sqlite3 *db, tag_index_t *tags);
+
 bool fetch_secret(sqlite3 *db, const int64_t id);
+bool vault_changed(sqlite3 *db, int64_t *version);
 #endif  // !SQLITE_H
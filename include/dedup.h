@@ -0,0 +1,42 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sodium/crypto_shorthash.h>
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cruxpass.h"
+
+#define DEDUP_MIN_CAPACITY 1024
+
+typedef struct {
+    uint64_t key;     // keyed hash of the matched fields, 0 marks a free slot
+    uint64_t secret;  // keyed hash of the secret, for update-if-changed
+    int64_t id;
+} dedup_entry_t;
+
+/**
+ * Open addressing set of keyed (SipHash) row hashes. The hash key is
+ * random per run so nothing derived from secrets outlives the import.
+ */
+typedef struct {
+    size_t size;
+    size_t capacity;
+    bool match_secret;
+    dedup_entry_t *data;
+    unsigned char hash_key[crypto_shorthash_KEYBYTES];
+} dedup_set_t;
+
+bool dedup_init(dedup_set_t *set, sqlite3 *db, bool match_secret);
+void dedup_hash(dedup_set_t *set, const secret_t *rec, dedup_entry_t *entry);
+dedup_entry_t *dedup_find(dedup_set_t *set, const dedup_entry_t *entry);
+bool dedup_add(dedup_set_t *set, const dedup_entry_t *entry);
+void dedup_free(dedup_set_t *set);
+
+#endif  // !DEDUP_H
@@ -0,0 +1,36 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cruxpass.h"
+#include "lookup.h"
+
+#define EXEC_NAME_MAX 128
+
+/**
+ * Environment of `cruxpass exec`, given as NAME=key arguments. Every key
+ * is resolved by one lookup, then the child's envp is the inherited
+ * variables followed by NAME=secret strings, all in one guarded block.
+ */
+typedef struct {
+    int count;
+    const char **names; /* point into argv, a name ends at its '=' */
+    lookup_key_t *keys;
+    char **envp;
+    char *block; /* NAME=secret strings, sodium_malloc'd */
+    size_t block_size;
+} exec_env_t;
+
+exec_env_t *exec_parse(char **specs, int count);
+bool exec_resolve(exec_env_t *env, sqlite3 *db);
+void exec_run(exec_env_t *env, char **argv);
+void exec_free(exec_env_t *env);
+
+#endif  // !EXEC_H
@@ -0,0 +1,77 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cruxpass.h"
+
+#define OUTBUF_SIZE (1 << 20)
+#define EXPORT_FORMAT_NAMES "csv", "jsonl", "keepass", "bitwarden", "tsv"
+
+/**
+ * Single output buffer shared by every writer. It lives in secure memory
+ * since rows carry secrets, and is flushed with plain write(2) calls.
+ */
+typedef struct {
+    int fd;
+    bool failed;
+    size_t used;
+    uint64_t written;  // bytes flushed so far
+    char *data;
+} outbuf_t;
+
+typedef enum {
+    EXPORT_USERNAME,
+    EXPORT_SECRET,
+    EXPORT_DESCRIPTION,
+    EXPORT_DATE_ADDED,
+    EXPORT_DATE_MODIFIED,
+    EXPORT_FIELD_COUNT
+} EXPORT_FIELD;
+
+/**
+ * Points straight into the sqlite3_step() row, valid until the next
+ * step. The secret is NULL when it was left out of the query, writers
+ * that can then drop it do.
+ */
+typedef struct {
+    int64_t id;
+    const char *fields[EXPORT_FIELD_COUNT];
+    int lens[EXPORT_FIELD_COUNT];
+} export_row_t;
+
+typedef struct {
+    const char *name;
+    void (*begin)(outbuf_t *out);
+    void (*row)(outbuf_t *out, const export_row_t *row, size_t index);
+    void (*end)(outbuf_t *out);
+} export_writer_t;
+
+bool outbuf_open(outbuf_t *out, int fd);
+bool outbuf_flush(outbuf_t *out);
+bool outbuf_close(outbuf_t *out);
+void outbuf_write(outbuf_t *out, const char *data, size_t len);
+void outbuf_puts(outbuf_t *out, const char *str);
+void outbuf_printf(outbuf_t *out, const char *fmt, ...);
+
+static inline void outbuf_putc(outbuf_t *out, char c) {
+    if (out->used == OUTBUF_SIZE) outbuf_flush(out);
+    out->data[out->used++] = c;
+}
+
+void write_csv_field(outbuf_t *out, const char *str, int len);
+void write_json_string(outbuf_t *out, const char *str, int len);
+void write_xml_text(outbuf_t *out, const char *str, int len);
+void write_tsv_field(outbuf_t *out, const char *str, int len);
+
+const export_writer_t *export_writer(EXPORT_FORMAT format);
+bool export_rows(sqlite3_stmt *stmt, const export_writer_t *writer, outbuf_t *out, size_t *count);
+
+#endif  // !EXPORT_H
@@ -0,0 +1,40 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cruxpass.h"
+#include "dedup.h"
+
+#define IMPORT_FORMAT_NAMES "csv", "bitwarden", "keepass", "1password"
+
+/**
+ * Every importer feeds parsed records into a sink, which applies
+ * the dedup mode and groups the writes into large transactions.
+ */
+typedef struct {
+    sqlite3 *db;
+    const import_opts_t *opts;
+    dedup_set_t set;
+    bool atomic;  // hold a single transaction until import_end()
+    size_t pending;
+    size_t inserted;
+    size_t updated;
+    size_t skipped;
+    size_t truncated;  // username or description cut to fit
+    size_t rejected;   // no usable secret
+    size_t ignored;    // not a login, e.g. a Bitwarden card or note
+    char tags[TAGS_MAX_LEN + 1];  // of the next record, import_record() takes them
+} import_sink_t;
+
+bool import_begin(import_sink_t *sink, sqlite3 *db, const import_opts_t *opts);
+int import_record(import_sink_t *sink, secret_t *rec);
+bool import_end(import_sink_t *sink, bool ok);
+
+#endif  // !IMPORT_H
@@ -0,0 +1,25 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include <sodium/crypto_pwhash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Argon2id (RFC 9106) with p lanes filled by p threads. libsodium only
+ * computes a single lane, so key_gen() keeps it for single lane vaults
+ * and comes here for vaults re-keyed with --kdf-lanes. The memory and
+ * passes are the same whatever the lanes, each lane holds its share.
+ * Lanes meet at the end of each of the four slices of a pass, between
+ * two meetings they only read what the others finished before.
+ */
+#define KDF_OPSLIMIT crypto_pwhash_OPSLIMIT_INTERACTIVE
+#define KDF_MEMLIMIT crypto_pwhash_MEMLIMIT_SENSITIVE
+#define KDF_LANES_DEFAULT 1
+#define KDF_LANES_MAX 32
+
+bool kdf_argon2id(unsigned char *out, size_t out_len, const char *passwd, size_t passwd_len,
+                  const unsigned char *salt, size_t salt_len, uint64_t opslimit, size_t memlimit, uint32_t lanes);
+
+#endif  // !KDF_H
@@ -0,0 +1,42 @@
+#ifndef LOOKUP_H
+#define LOOKUP_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cruxpass.h"
+
+#define LOOKUP_PREFIX_CHAR '*'
+#define LOOKUP_TERM_SEP ','
+#define LOOKUP_FIELD_SEPS "=:"
+#define LOOKUP_BATCH_MAX 200 /* keys per query, SQLite allows 500 terms in a compound SELECT */
+#define LOOKUP_ARM_MAX 256   /* SQL of one key in the query */
+
+/**
+ * One key of `get` or `exec`: a record id, or a username and/or a
+ * description compared without case, where a trailing '*' matches a
+ * prefix. Values point into the arguments and are not copied. A key
+ * resolves only when exactly one record matches it.
+ */
+typedef struct {
+    int64_t id;   /* 0 unless the key is an id */
+    uint8_t mask; /* LOOKUP_* fields of a username/description key */
+    const char *username;
+    size_t username_len;
+    const char *description;
+    size_t description_len;
+} lookup_key_t;
+
+bool lookup_key(lookup_key_t *key, long id, const char *username, const char *description);
+bool lookup_parse(lookup_key_t *key, const char *spec, size_t spec_len);
+char **lookup_secrets(sqlite3 *db, const lookup_key_t *keys, int count);
+void lookup_secrets_free(char **secrets);
+int get_secrets(sqlite3 *db, const lookup_key_t *keys, int count, int fd);
+
+#endif  // !LOOKUP_H
@@ -0,0 +1,48 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Operation counters. Each process counts into lock-free atomics and
+ * merges the deltas into the stats table of meta.db on exit; --metrics
+ * prints the totals in OpenMetrics text format.
+ */
+#define METRICS_PREFIX "cruxpass_"
+#define METRICS_BUSY_TIMEOUT_MS 2000
+
+typedef enum {
+    METRIC_RECORDS_INSERTED,
+    METRIC_RECORDS_UPDATED,
+    METRIC_RECORDS_DELETED,
+    METRIC_IMPORT_ROWS,
+    METRIC_IMPORT_BYTES,
+    METRIC_EXPORT_ROWS,
+    METRIC_EXPORT_BYTES,
+    METRIC_SECRETS_GENERATED,
+    METRIC_UNLOCK_FAILURES,
+    METRIC_BUSY_WAITS,
+    METRIC_SECRETS_READ,
+    METRIC_QUERY_ROWS,
+    METRIC_COUNT
+} METRIC_T;
+
+typedef enum {
+    HIST_UNLOCK_SECONDS,
+    HIST_KDF_SECONDS,
+    HIST_COUNT
+} HIST_T;
+
+/* Upper bounds in seconds, the last bucket is +Inf */
+#define HIST_BOUNDS 0.05, 0.1, 0.25, 0.5, 1, 2, 4, 8
+#define HIST_BUCKETS 9
+
+void metrics_add(METRIC_T metric, uint64_t n);
+void metrics_observe(HIST_T hist, uint64_t ns);
+uint64_t metrics_now(void);
+bool metrics_flush(const char *meta_path);
+bool metrics_print(const char *meta_path, FILE *out);
+
+#endif  // !METRICS_H
@@ -0,0 +1,125 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STREAM_BUF_SIZE (64 * 1024)
+#define TOKEN_MAX 4096
+#define JSON_MAX_DEPTH 64
+#define CSV_MAX_FIELDS 32
+
+/**
+ * Pull parsers over a fixed size read buffer: memory use does not depend
+ * on the size of the document. Buffers and tokens hold secrets in the
+ * clear, so all of them come from sodium_malloc.
+ */
+typedef struct {
+    int fd;
+    bool failed;
+    size_t pos;
+    size_t len;
+    size_t line;
+    uint64_t consumed;  // bytes read so far
+    unsigned char *buf;
+} stream_t;
+
+/* Longer values are cut at TOKEN_MAX and flagged, never reallocated */
+typedef struct {
+    size_t len;
+    bool truncated;
+    char data[TOKEN_MAX + 1];
+} token_t;
+
+typedef enum {
+    JSON_ERROR,
+    JSON_EOF,
+    JSON_OBJECT_BEGIN,
+    JSON_OBJECT_END,
+    JSON_ARRAY_BEGIN,
+    JSON_ARRAY_END,
+    JSON_KEY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} JSON_TOKEN;
+
+typedef struct {
+    stream_t *in;
+    int depth;
+    bool want_key;
+    bool stack[JSON_MAX_DEPTH]; /* true for objects */
+    token_t token;
+} json_parser_t;
+
+typedef enum {
+    XML_ERROR,
+    XML_EOF,
+    XML_START,
+    XML_END,
+    XML_TEXT
+} XML_TOKEN;
+
+typedef struct {
+    stream_t *in;
+    bool close_pending; /* <tag/> reports START then END */
+    token_t name;
+    token_t text;
+} xml_parser_t;
+
+typedef struct {
+    stream_t *in;
+    size_t count;
+    size_t line;
+    token_t fields[CSV_MAX_FIELDS + 1]; /* the last one soaks up extra fields */
+} csv_reader_t;
+
+bool stream_open(stream_t *stream, const char *path);
+void stream_close(stream_t *stream);
+bool stream_fill(stream_t *stream);
+
+static inline int stream_peek(stream_t *stream) {
+    if (stream->pos == stream->len && !stream_fill(stream)) return EOF;
+    return stream->buf[stream->pos];
+}
+
+static inline int stream_getc(stream_t *stream) {
+    if (stream->pos == stream->len && !stream_fill(stream)) return EOF;
+    int c = stream->buf[stream->pos++];
+    if (c == '\n') stream->line++;
+    return c;
+}
+
+static inline void token_reset(token_t *token) {
+    token->len = 0;
+    token->truncated = false;
+    token->data[0] = '\0';
+}
+
+static inline void token_putc(token_t *token, char c) {
+    if (token->len == TOKEN_MAX) {
+        token->truncated = true;
+        return;
+    }
+
+    token->data[token->len++] = c;
+    token->data[token->len] = '\0';
+}
+
+void token_utf8(token_t *token, unsigned long codepoint);
+
+void json_init(json_parser_t *parser, stream_t *in);
+JSON_TOKEN json_next(json_parser_t *parser);
+bool json_skip(json_parser_t *parser, JSON_TOKEN current);
+
+void xml_init(xml_parser_t *parser, stream_t *in);
+XML_TOKEN xml_next(xml_parser_t *parser);
+
+void csv_init(csv_reader_t *reader, stream_t *in);
+int csv_next_row(csv_reader_t *reader);
+
+#endif  // !PARSER_H
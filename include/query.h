@@ -0,0 +1,43 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cruxpass.h"
+
+#define QUERY_SORT_NAMES "id", "username", "description", "date", "modified"
+
+typedef enum {
+    QUERY_SORT_ID,
+    QUERY_SORT_USERNAME,
+    QUERY_SORT_DESCRIPTION,
+    QUERY_SORT_DATE,
+    QUERY_SORT_MODIFIED,
+    QUERY_SORT_COUNT
+} QUERY_SORT;
+
+/* Filters left NULL or 0 do not apply, the ones set must all match */
+typedef struct {
+    EXPORT_FORMAT format;
+    const char *filter; /* substring of the username or description */
+    const char *regex;  /* POSIX extended regex on the username or description */
+    const char *since;  /* date_added range, both ends included */
+    const char *until;
+    int64_t min_id;
+    int64_t max_id;
+    QUERY_SORT sort;
+    bool reverse;
+    long limit;
+    bool secrets;
+} query_opts_t;
+
+bool query_ids(query_opts_t *opts, const char *range);
+int query_records(sqlite3 *db, const query_opts_t *opts, int fd);
+
+#endif  // !QUERY_H
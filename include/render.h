@@ -0,0 +1,44 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stddef.h>
+
+#include "cruxpass.h"
+#include "lookup.h"
+
+/**
+ * A reference is `{{ crux:KEY }}` on one line, KEY as lookup_parse()
+ * reads it: id:42 or user:svc,desc:prod db*. Spaces inside the braces
+ * are optional, and `{{ }}` that do not start with crux: are copied.
+ */
+#define RENDER_OPEN '{'
+#define RENDER_CLOSE '}'
+#define RENDER_SCHEME "crux:"
+
+typedef struct {
+    size_t start; /* offset of the reference's first '{' */
+    size_t end;   /* offset past its last '}' */
+    int key;      /* index of its key, a key used twice is resolved once */
+} render_ref_t;
+
+typedef struct {
+    const char *data; /* the mapped template */
+    size_t size;
+    render_ref_t *refs;
+    size_t refs_len;
+    size_t refs_cap;
+    lookup_key_t *keys;
+    const char **specs; /* text of each key, to find it again */
+    size_t *spec_lens;
+    int keys_len;
+    int keys_cap;
+} template_t;
+
+int render_template(sqlite3 *db, const char *path, int fd);
+
+#endif  // !RENDER_H
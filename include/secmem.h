@@ -0,0 +1,34 @@
+#ifndef SECMEM_H
+#define SECMEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Secure slab for small secrets: keys, passwords and records. One region,
+ * mapped on first use, locked into RAM, left out of core dumps and fenced
+ * by guard pages, is cut into fixed slots that are wiped when freed. A
+ * slot costs no syscall; requests too large for a slot, or made while the
+ * slab is full, fall back to sodium_malloc. Streaming buffers are large
+ * and go to sodium_malloc directly.
+ */
+#define SECMEM_SMALL_SLOT 64
+#define SECMEM_LARGE_SLOT 512
+#define SECMEM_SLOTS 64                 /* per slot size, one bitmap word */
+#define SECMEM_MLOCK_BUDGET (64 * 1024) /* bytes the slab may lock */
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t fallbacks; /* requests served by sodium_malloc */
+    uint64_t in_use;
+    uint64_t peak;
+    size_t locked_bytes;
+} secmem_stats_t;
+
+void *secmem_alloc(size_t size);
+void secmem_free(void *ptr);
+void secmem_cleanup(void);
+secmem_stats_t secmem_stats(void);
+
+#endif  // !SECMEM_H
@@ -0,0 +1,61 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "cruxpass.h"
+
+/**
+ * Per vault storage profile, kept in meta.db and applied by decrypt()
+ * every time the vault is opened. It is written and read as a spec:
+ * comma separated presets and key=value pairs, later ones win, e.g.
+ * "wal,cache=16384".
+ */
+#define STORAGE_PAGE_MIN 512
+#define STORAGE_PAGE_MAX 65536
+#define STORAGE_CACHE_MAX (1024 * 1024) /* KiB */
+#define STORAGE_SPEC_MAX 128
+#define STORAGE_MIGRATE_SUFFIX ".migrate"
+#define STORAGE_LOCK_SUFFIX ".lock"
+
+typedef enum {
+    SYNC_OFF,
+    SYNC_NORMAL,
+    SYNC_FULL,
+    SYNC_EXTRA
+} SYNC_T;
+
+typedef struct {
+    bool wal;
+    SYNC_T synchronous;
+    int page_size; /* cipher_page_size, changing it rewrites the vault */
+    int cache_kib;
+    bool temp_memory;
+    bool memory_security; /* SQLCipher wipes every buffer it frees */
+} storage_profile_t;
+
+/* SQLCipher's own defaults, what vaults without a profile run with */
+#define STORAGE_PROFILE_DEFAULT                                                                                \
+    (storage_profile_t) {                                                                                      \
+        .wal = false, .synchronous = SYNC_FULL, .page_size = 4096, .cache_kib = 2000, .temp_memory = false, \
+        .memory_security = true                                                                                \
+    }
+
+bool storage_parse(const char *spec, storage_profile_t *profile);
+void storage_format(const storage_profile_t *profile, char *buf, size_t size);
+
+bool storage_key_pragmas(sqlite3 *db, const storage_profile_t *profile);
+bool storage_apply(sqlite3 *db, const storage_profile_t *profile);
+
+bool storage_recover(void);
+int storage_set(vault_ctx_t *ctx, unsigned char *key, const char *spec);
+bool storage_show(FILE *out);
+
+#endif  // !STORAGE_H
@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Phase tracing. TRACE_SCOPE("name") records a span from that line to the
+ * end of the enclosing block into a preallocated ring buffer; --trace FILE
+ * dumps it as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+ * While tracing is off a span costs one predictable branch, and building
+ * with -DCRXP_NO_TRACE removes it entirely.
+ */
+#define TRACE_RING_SIZE 16384
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+} trace_scope_t;
+
+extern bool trace_enabled;
+
+bool trace_init(const char *path);
+uint64_t trace_now(void);
+void trace_record(const char *name, uint64_t start, uint64_t end);
+bool trace_dump(void);
+
+static inline void trace_scope_end(trace_scope_t *scope) {
+    if (scope->start != 0) trace_record(scope->name, scope->start, trace_now());
+}
+
+#define TRACE__CONCAT_(a, b) a##b
+#define TRACE__CONCAT(a, b) TRACE__CONCAT_(a, b)
+
+// clang-format off
+#if defined(CRXP_NO_TRACE) || !defined(__has_attribute)
+    #define TRACE_SCOPE(name) ((void) 0)
+#elif __has_attribute(cleanup)
+    #define TRACE_SCOPE(name)                                                                           \
+        trace_scope_t TRACE__CONCAT(trace__scope_, __LINE__) __attribute__((cleanup(trace_scope_end))) \
+            = {(name), __builtin_expect(trace_enabled, 0) ? trace_now() : 0}
+#else
+    #define TRACE_SCOPE(name) ((void) 0)
+#endif
+// clang-format on
+
+#endif  // !TRACE_H
@@ -2,16 +2,19 @@
 #define TUI_H
 
 #include <sodium/utils.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "arena.h"
 #include "cruxpass.h"
 #include "termbox2.h"
 
 #define ID_WIDTH 8
 #define USERNAME_WIDTH USERNAME_MAX_LEN
 #define DESC_WIDTH 48
-#define TABLE_WIDTH (ID_WIDTH + USERNAME_WIDTH + DESC_WIDTH + 3)
+#define DATE_WIDTH DATE_LEN
+#define TABLE_WIDTH (ID_WIDTH + USERNAME_WIDTH + DESC_WIDTH + 2 * DATE_WIDTH + 5)
 #define QUEUE_MAX 10
 #define DELETED (-1)
 
@@ -20,12 +23,23 @@
 #define COLOR_PAGINATION (TB_GREEN | TB_BOLD)
 #define COLOR_STATUS (TB_RED | TB_BOLD)
 #define COLOR_SEARCH (TB_YELLOW | TB_BOLD)
+#define COLOR_HUD (TB_CYAN)
 
 #define SEARCH_TXT_MAX 32
 #define MIN_WIN_WIDTH 32
 #define QUEUE_ERR (-2)
 #define DIGIT_COUNT_MAX 8
 #define HELP_WIN_WIDTH (TABLE_WIDTH / 2)
+#define HUD_FRAMES 256
+#define TUI_COALESCE_MAX 64
+#define TUI_REFRESH_MS 500 /* how often an idle TUI checks the vault for other writers */
+#define TUI_STREAM_ROWS 1024 /* records read between two frames while the list is still loading */
+#define TUI_SPINNER_MS 16 /* how soon the spinner sees the work is done, it turns every 5 */
+#define RECORD_COLUMNS 5  /* id, username, description, date_added, date_modified */
+#define SORT_PARALLEL_MIN 32768 /* records below which one thread sorts */
+#define SORT_THREADS_MAX 8
+#define TAG_FILTER_MAX 8  /* tags one filter intersects */
+#define TAG_FILTER_LEN 64
 
 #define BORDER_H 0x2500             // ─
 #define BORDER_V 0x2502             // │
@@ -33,6 +47,8 @@
 #define BORDER_TOP_RIGHT 0x256E     // ╮
 #define BORDER_BOTTOM_LEFT 0x2570   // ╰
 #define BORDER_BOTTOM_RIGHT 0x256F  // ╯
+#define SORT_ARROW_UP 0x25B2        // ▲
+#define SORT_ARROW_DOWN 0x25BC      // ▼
 
 #define LEN(arr) (sizeof(arr) / sizeof((arr)[0]))
 #define draw_table(records, search_queue, search_parttern, ...) \
@@ -43,20 +59,76 @@ typedef struct {
     int64_t id;
     char username[USERNAME_MAX_LEN + 1];
     char description[DESC_MAX_LEN + 1];
+    char date_added[DATE_LEN + 1];
+    char date_modified[DATE_LEN + 1];
 } record_t;
 
 typedef struct {
     int size;
     int capacity;
     record_t *data;
+    int64_t seq;    /* last change the records include, see refresh_records() */
+    arena_t *arena; /* where data lives, NULL for the heap */
 } record_array_t;
 
+typedef enum {
+    SORT_ID,
+    SORT_USERNAME,
+    SORT_DESCRIPTION,
+    SORT_ADDED,
+    SORT_MODIFIED,
+    SORT_KEY_COUNT
+} SORT_KEY;
+
+typedef struct {
+    int64_t id;
+    char name[TAG_MAX_LEN + 1];
+    int first; /* its records are ids[first, first + count) of the index */
+    int count;
+} tag_t;
+
+/**
+ * Every tag with the ids of its records, as load_tags() reads them:
+ * tags in id order, the record ids of each ascending and back to back
+ * in ids, so a filter intersects sorted runs.
+ */
+typedef struct {
+    int size;
+    int capacity;
+    tag_t *data;
+    int id_count;
+    int id_capacity;
+    int64_t *ids;
+    bool loaded;
+} tag_index_t;
+
+/**
+ * Order the list is shown in. Records stay in id order, other keys read
+ * them through a permutation: orders[key][i] is the record on row i,
+ * sorted ascending, and reverse reads it from the end. A permutation is
+ * computed on first use and kept until the records change, so switching
+ * keys or direction again costs nothing. A tag filter narrows the rows
+ * to the records whose ids it holds, listed in rows in the same order.
+ */
+typedef struct {
+    SORT_KEY key;
+    bool reverse;
+    int size; /* records the cached orders and rows cover */
+    int *orders[SORT_KEY_COUNT];
+    int64_t *filter; /* ids the tag filter keeps, ascending, NULL shows every record */
+    int filter_size;
+    int *rows; /* records the filter keeps, in key order */
+    int row_count;
+} record_view_t;
+
 typedef struct {
     int width;
     int height;
     int start_x;
     int start_y;
     int64_t cursor;
+    const record_view_t *view; /* NULL shows records in id order */
+    const char *tags;          /* tag filter, NULL when there is none */
 } table_t;
 
 typedef struct {
@@ -65,8 +137,56 @@ typedef struct {
     int tail;
     int capacity;
     int64_t *data;
+    arena_t *arena; /* NULL for the heap */
 } queue_t;
 
+/* Performance overlay, toggled with 'P'. Nothing is measured while it is hidden */
+typedef struct {
+    bool visible;
+    size_t frames;
+    uint64_t frame_ns[HUD_FRAMES];
+    uint64_t last_frame_ns;
+    uint64_t search_ns;
+    uint64_t sort_ns;
+    uint64_t filter_ns;
+    uint64_t db_ns;
+    const char *db_op;
+    size_t coalesced;
+    const arena_t *arena;
+} hud_t;
+
+extern hud_t hud;
+
+/**
+ * State of the record list in tui_main(), kept apart so it can be driven
+ * without a user. The records live in arena for the whole session; the
+ * pattern and matches of a search live in scratch, inside search_scope,
+ * and are dropped at once when the next search begins. A session handed
+ * to authenticate() comes back with termbox up and the first page read,
+ * the rest of the records stream in between frames.
+ */
+typedef struct {
+    sqlite3 *db;
+    arena_t arena;
+    arena_t scratch;
+    arena_scope_t search_scope;
+    record_array_t records;
+    record_view_t view;
+    tag_index_t tags;
+    char tag_text[TAG_FILTER_LEN + 1]; /* the active tag filter as typed */
+    queue_t search_queue;
+    char *search_pattern;
+    int64_t position;
+    int term_width;
+    int term_height;
+    int start_x;
+    int start_y;
+    int table_h;
+    int64_t data_version;
+    bool term_ready; /* termbox is up since the unlock prompt */
+    bool streaming;  /* stream_records() has more rows */
+} tui_state_t;
+
 /**
  * NOTE: No readline to handle term input and cruxpass
  * relies fully on termbox2 events for input handling (TUI).
@@ -78,11 +198,20 @@ typedef struct {
 
 bool tui_init(void);
 void tui_cleanup(void);
-int tui_main(sqlite3 *db);
+void tui_hold_stderr(void);
+void tui_session(tui_state_t *tui, sqlite3 *db);
+int tui_main(tui_state_t *tui);
+bool tui_stream(tui_state_t *tui, int limit);
+void tui_layout(tui_state_t *tui, int width, int height);
+void tui_render(tui_state_t *tui);
+bool tui_handle_event(tui_state_t *tui, struct tb_event *ev);
+bool tui_refresh(tui_state_t *tui);
+void tui_free(tui_state_t *tui);
 int tui_pipeline(void *data, int argc, char **argv, char **column_name);
 
 bool get_long(char *prompt, long *out);
-char *get_search_parttern(void);
+char *get_search_parttern(arena_t *arena);
+bool get_tag_filter(char *tags);
 char *get_secret(const char *prompt);
 void get_random_secret(sqlite3 *db, bank_options_t opt);
 char *get_input(const char *prompt, char *input, const int text_len, int cod_y, int cod_x);
@@ -92,14 +221,23 @@ void draw_border(int start_x, int start_y, int width, int height, uintattr_t fg,
 void _draw_table(record_array_t *records, queue_t *search_queue, char *search_parttern, table_t table);
 void draw_update_menu(int option, int start_x, int start_y);
 void draw_table_border(int start_x, int start_y, int table_h);
+void draw_hud(int status_x, int status_w, int start_y, int64_t total_records);
 
-bool do_updates(sqlite3 *db, record_array_t *records, int64_t current_position);
+uint64_t hud_start(void);
+void hud_frame_done(uint64_t start);
+void hud_search_done(uint64_t start);
+void hud_sort_done(uint64_t start);
+void hud_filter_done(uint64_t start);
+void hud_db_done(const char *op, uint64_t start);
+
+bool do_updates(sqlite3 *db, record_array_t *records, int64_t index);
 
 void display_help(void);
 void display_desc(char *description);
 void send_notifctn(char *message);
 void display_ran_secret(sqlite3 *db, const char *secret);
 void display_secret(const char *secret, int len);
+void display_spinner(const char *msg, atomic_bool *done);
 
 bool select_next(queue_t *queue);
 
@@ -111,5 +249,19 @@ void free_queue(queue_t *queue);
 
 bool add_record(record_array_t *arr, record_t rec);
 void free_records(record_array_t *arr);
+int64_t find_record(const record_array_t *arr, int64_t id);
+
+bool sort_records(record_view_t *view, const record_array_t *records, SORT_KEY key);
+void sort_invalidate(record_view_t *view);
+int64_t view_index(const record_view_t *view, int64_t size, int64_t row);
+int64_t view_row(const record_view_t *view, int64_t size, int64_t index);
+int64_t view_size(const record_view_t *view, int64_t size);
+
+bool add_tag(tag_index_t *tags, int64_t id, const char *name);
+bool add_tag_id(tag_index_t *tags, int tag, int64_t id);
+void free_tags(tag_index_t *tags);
+bool tag_filter(const tag_index_t *tags, const char *text, int64_t **ids, int *count);
+void filter_set(record_view_t *view, int64_t *ids, int count);
+bool filter_rows(record_view_t *view, const record_array_t *records, SORT_KEY key);
 
 #endif  // !TUI_H
@@ -0,0 +1,357 @@
+#include "archive.h"
+
+#include <errno.h>
+#include <sodium/crypto_secretstream_xchacha20poly1305.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "database.h"
+#include "import.h"
+#include "kdf.h"
+#include "secmem.h"
+#include "tui.h"
+
+typedef struct {
+    FILE *fp;
+    crypto_secretstream_xchacha20poly1305_state state;
+    const archive_header_t *ad;  // authenticated with the first chunk only
+    unsigned char *plain;        // secure memory, ARCHIVE_CHUNK_SIZE
+    unsigned char *cipher;       // ARCHIVE_CIPHER_MAX
+    size_t used;
+} archive_stream_t;
+
+static void put_u16(unsigned char *buf, uint16_t value) {
+    buf[0] = (unsigned char) value;
+    buf[1] = (unsigned char) (value >> 8);
+}
+
+static void put_u32(unsigned char *buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) buf[i] = (unsigned char) (value >> (i * 8));
+}
+
+static uint16_t get_u16(const unsigned char *buf) { return (uint16_t) (buf[0] | buf[1] << 8); }
+
+static uint32_t get_u32(const unsigned char *buf) {
+    return (uint32_t) buf[0] | (uint32_t) buf[1] << 8 | (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24;
+}
+
+static char *archive_password(bool confirm) {
+    char *secret = NULL;
+    char *again = NULL;
+
+    tui_init();
+    if ((secret = get_secret("Archive Password: ")) == NULL) {
+        tui_cleanup();
+        return NULL;
+    }
+
+    if (confirm) {
+        if ((again = get_secret("Confirm Archive Password: ")) == NULL) {
+            tui_cleanup();
+            sodium_memzero(secret, LOGIN_MAX_LEN);
+            secmem_free(secret);
+            return NULL;
+        }
+
+        if (strncmp(secret, again, LOGIN_MAX_LEN) != 0) {
+            tui_cleanup();
+            fprintf(stderr, "Error: Passwords do not match\n");
+            sodium_memzero(secret, LOGIN_MAX_LEN);
+            sodium_memzero(again, LOGIN_MAX_LEN);
+            secmem_free(secret);
+            secmem_free(again);
+            return NULL;
+        }
+
+        sodium_memzero(again, LOGIN_MAX_LEN);
+        secmem_free(again);
+    }
+
+    tui_cleanup();
+    return secret;
+}
+
+static unsigned char *archive_key(const archive_header_t *header, bool confirm) {
+    char *password = NULL;
+    unsigned char *key = NULL;
+
+    if ((password = archive_password(confirm)) == NULL) return NULL;
+    if ((key = (unsigned char *) secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+
+    /* Archives keep single lane keys, a release without the threaded KDF opens them too */
+    bool ok = key_gen(key, password, (unsigned char *) header->salt, KDF_LANES_DEFAULT);
+    sodium_memzero(password, LOGIN_MAX_LEN);
+    secmem_free(password);
+    if (!ok) {
+        secmem_free(key);
+        return NULL;
+    }
+
+    return key;
+}
+
+static bool stream_open(archive_stream_t *stream, FILE *fp) {
+    memset(stream, 0, sizeof(archive_stream_t));
+    stream->fp = fp;
+    if ((stream->plain = sodium_malloc(ARCHIVE_CHUNK_SIZE)) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((stream->cipher = malloc(ARCHIVE_CIPHER_MAX)) == NULL) CRXP__OUT_OF_MEMORY();
+    return true;
+}
+
+static void stream_close(archive_stream_t *stream) {
+    sodium_memzero(&stream->state, sizeof(stream->state));
+    sodium_free(stream->plain);
+    free(stream->cipher);
+    stream->plain = NULL;
+    stream->cipher = NULL;
+}
+
+static bool flush_chunk(archive_stream_t *stream, unsigned char tag) {
+    unsigned long long cipher_len = 0;
+    unsigned char len_buf[4] = {0};
+    const unsigned char *ad = (const unsigned char *) stream->ad;
+    size_t ad_len = stream->ad != NULL ? sizeof(archive_header_t) : 0;
+
+    crypto_secretstream_xchacha20poly1305_push(&stream->state, stream->cipher, &cipher_len, stream->plain,
+                                               stream->used, ad, ad_len, tag);
+    sodium_memzero(stream->plain, stream->used);
+    stream->used = 0;
+    stream->ad = NULL;
+
+    put_u32(len_buf, (uint32_t) cipher_len);
+    if (fwrite(len_buf, sizeof(len_buf), 1, stream->fp) != 1
+        || fwrite(stream->cipher, cipher_len, 1, stream->fp) != 1) {
+        fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool push_record(archive_stream_t *stream, const unsigned char **fields, const int *lens) {
+    size_t rec_len = ARCHIVE_RECORD_HEADER + lens[0] + lens[1] + lens[2];
+    if (stream->used + rec_len > ARCHIVE_CHUNK_SIZE && !flush_chunk(stream, 0)) return false;
+
+    unsigned char *p = stream->plain + stream->used;
+    for (int i = 0; i < 3; i++) put_u16(p + i * 2, (uint16_t) lens[i]);
+    p += ARCHIVE_RECORD_HEADER;
+
+    for (int i = 0; i < 3; i++) {
+        memcpy(p, fields[i], lens[i]);
+        p += lens[i];
+    }
+
+    stream->used += rec_len;
+    return true;
+}
+
+int export_archive(sqlite3 *db, const char *archive_file) {
+    FILE *fp = NULL;
+    size_t count = 0;
+    unsigned char *key = NULL;
+    sqlite3_stmt *sql_stmt = NULL;
+    int rc = SQLITE_ERROR;
+    archive_stream_t stream = {0};
+    archive_header_t header = {0};
+
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.kdf = ARCHIVE_KDF_ARGON2ID;
+    randombytes_buf(header.salt, sizeof(header.salt));
+
+    if ((key = archive_key(&header, true)) == NULL) return CRXP_ERR;
+
+    if ((fp = fopen(archive_file, "wb")) == NULL) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", archive_file, strerror(errno));
+        secmem_free(key);
+        return CRXP_ERR;
+    }
+
+    stream_open(&stream, fp);
+    crypto_secretstream_xchacha20poly1305_init_push(&stream.state, header.stream_header, key);
+    sodium_memzero(key, KEY_LEN);
+    secmem_free(key);
+    stream.ad = &header;
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+        fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(errno));
+        goto err;
+    }
+
+    if ((sql_stmt = get_stmt(db, ARCHIVE_SCAN_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        goto err;
+    }
+
+    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        const unsigned char *fields[3];
+        int lens[3];
+        for (int i = 0; i < 3; i++) {
+            fields[i] = sqlite3_column_text(sql_stmt, i);
+            lens[i] = sqlite3_column_bytes(sql_stmt, i);
+        }
+
+        if (lens[0] > USERNAME_MAX_LEN || lens[1] > SECRET_MAX_LEN || lens[2] >= DESC_MAX_LEN) {
+            fprintf(stderr, "Warning: Record %zu exceeds field limits, skipped\n", count + 1);
+            continue;
+        }
+
+        if (!push_record(&stream, fields, lens)) goto err;
+        count++;
+    }
+
+    /* A scan cut short must not be sealed as a complete archive */
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to read records: %s\n", sqlite3_errmsg(db));
+        goto err;
+    }
+
+    sqlite3_reset(sql_stmt);
+    sql_stmt = NULL;
+    if (!flush_chunk(&stream, crypto_secretstream_xchacha20poly1305_TAG_FINAL)) goto err;
+
+    stream_close(&stream);
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(errno));
+        unlink(archive_file);
+        return CRXP_ERR;
+    }
+
+    fprintf(stderr, "Info: %zu records written to archive\n", count);
+    return CRXP_OK;
+
+err:
+    if (sql_stmt != NULL) sqlite3_reset(sql_stmt);
+    stream_close(&stream);
+    fclose(fp);
+    unlink(archive_file);
+    return CRXP_ERR;
+}
+
+/**
+ * Splits a decrypted chunk back into records and hands them to the sink.
+ */
+static bool pull_records(import_sink_t *sink, const unsigned char *plain, size_t len, secret_t *rec) {
+    size_t off = 0;
+    while (off < len) {
+        if (len - off < ARCHIVE_RECORD_HEADER) return false;
+
+        uint16_t ulen = get_u16(plain + off);
+        uint16_t slen = get_u16(plain + off + 2);
+        uint16_t dlen = get_u16(plain + off + 4);
+        off += ARCHIVE_RECORD_HEADER;
+
+        if ((size_t) ulen + slen + dlen > len - off) return false;
+        if (ulen > USERNAME_MAX_LEN || slen > SECRET_MAX_LEN || dlen >= DESC_MAX_LEN) return false;
+
+        sodium_memzero(rec, sizeof(secret_t));
+        memcpy(rec->username, plain + off, ulen);
+        memcpy(rec->secret, plain + off + ulen, slen);
+        memcpy(rec->description, plain + off + ulen + slen, dlen);
+        off += ulen + slen + dlen;
+
+        if (!import_record(sink, rec)) fprintf(stderr, "Error: Failed to insert record: %s\n", rec->username);
+    }
+
+    return true;
+}
+
+int import_archive(sqlite3 *db, const char *archive_file, const import_opts_t *opts) {
+    FILE *fp = NULL;
+    bool ok = false;
+    bool final = false;
+    secret_t *rec = NULL;
+    unsigned char *key = NULL;
+    import_sink_t sink = {0};
+    archive_stream_t stream = {0};
+    archive_header_t header = {0};
+
+    if ((fp = fopen(archive_file, "rb")) == NULL) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", archive_file, strerror(errno));
+        return CRXP_ERR;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "Error: [ %s ] is not a cruxpass archive\n", archive_file);
+        fclose(fp);
+        return CRXP_ERR;
+    }
+
+    if (header.version != ARCHIVE_VERSION || header.kdf != ARCHIVE_KDF_ARGON2ID) {
+        fprintf(stderr, "Error: Unsupported archive version: %u\n", header.version);
+        fclose(fp);
+        return CRXP_ERR;
+    }
+
+    if ((key = archive_key(&header, false)) == NULL) {
+        fclose(fp);
+        return CRXP_ERR;
+    }
+
+    stream_open(&stream, fp);
+    int rc = crypto_secretstream_xchacha20poly1305_init_pull(&stream.state, header.stream_header, key);
+    sodium_memzero(key, KEY_LEN);
+    secmem_free(key);
+    stream.ad = &header;
+
+    if (rc != 0 || !import_begin(&sink, db, opts)) {
+        stream_close(&stream);
+        fclose(fp);
+        return CRXP_ERR;
+    }
+
+    /* Nothing from a truncated or tampered archive may reach the vault */
+    sink.atomic = true;
+    if ((rec = secmem_alloc(sizeof(secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
+
+    while (!final) {
+        unsigned char len_buf[4] = {0};
+        unsigned long long plain_len = 0;
+        unsigned char tag = 0;
+
+        if (fread(len_buf, sizeof(len_buf), 1, fp) != 1) {
+            fprintf(stderr, "Error: Archive is truncated\n");
+            break;
+        }
+
+        uint32_t cipher_len = get_u32(len_buf);
+        if (cipher_len < crypto_secretstream_xchacha20poly1305_ABYTES || cipher_len > ARCHIVE_CIPHER_MAX
+            || fread(stream.cipher, cipher_len, 1, fp) != 1) {
+            fprintf(stderr, "Error: Archive is truncated or corrupted\n");
+            break;
+        }
+
+        const unsigned char *ad = (const unsigned char *) stream.ad;
+        size_t ad_len = stream.ad != NULL ? sizeof(archive_header_t) : 0;
+        if (crypto_secretstream_xchacha20poly1305_pull(&stream.state, stream.plain, &plain_len, &tag, stream.cipher,
+                                                       cipher_len, ad, ad_len)
+            != 0) {
+            fprintf(stderr, "Error: Wrong password or the archive was tampered with\n");
+            break;
+        }
+
+        stream.ad = NULL;
+        if (!pull_records(&sink, stream.plain, plain_len, rec)) {
+            fprintf(stderr, "Error: Malformed record in archive\n");
+            break;
+        }
+
+        sodium_memzero(stream.plain, plain_len);
+        final = (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL);
+    }
+
+    if (final && fgetc(fp) != EOF) fprintf(stderr, "Error: Trailing data after the end of the archive\n");
+    else ok = final;
+
+    ok = import_end(&sink, ok);
+    secmem_free(rec);
+    stream_close(&stream);
+    fclose(fp);
+    return ok ? CRXP_OK : CRXP_ERR;
+}
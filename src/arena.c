@@ -0,0 +1,181 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_block {
+    arena_block_t *next;
+    size_t size;
+    size_t offset;
+    alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static size_t align_up(size_t size) { return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1); }
+
+static void account(arena_t *arena, size_t added) {
+    arena->stats.used += added;
+    if (arena->stats.used > arena->stats.peak) arena->stats.peak = arena->stats.used;
+}
+
+static arena_block_t *push_block(arena_t *arena, size_t size) {
+    arena_block_t *block = NULL;
+
+    if (size <= ARENA_BLOCK_SIZE && arena->spare != NULL) {
+        block = arena->spare;
+        arena->spare = block->next;
+    } else {
+        size_t data_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        if ((block = malloc(sizeof(arena_block_t) + data_size)) == NULL) return NULL;
+        block->size = data_size;
+        arena->stats.reserved += data_size;
+        arena->stats.blocks++;
+    }
+
+    block->offset = 0;
+    block->next = arena->head;
+    arena->head = block;
+    arena->depth++;
+    return block;
+}
+
+/* True when ptr, size bytes long, is the newest allocation and belongs to the innermost scope */
+static bool is_top(const arena_t *arena, const void *ptr, size_t size) {
+    const arena_block_t *block = arena->head;
+    const unsigned char *p = ptr;
+
+    if (block == NULL || p < block->data || p + size != block->data + block->offset) return false;
+    return arena->depth > arena->floor_depth || (size_t) (p - block->data) >= arena->floor_offset;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_block_t *block = arena->head;
+
+    size = align_up(size == 0 ? 1 : size);
+    if ((block == NULL || block->size - block->offset < size) && (block = push_block(arena, size)) == NULL) return NULL;
+
+    void *ptr = block->data + block->offset;
+    block->offset += size;
+    account(arena, size);
+    return ptr;
+}
+
+/**
+ * Extends the newest allocation in place when it fits, a block that
+ * holds nothing else moves with realloc() like a heap array would.
+ * Anything else is copied into the current scope, the old bytes stay
+ * until theirs ends.
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) return arena_alloc(arena, new_size);
+
+    old_size = align_up(old_size);
+    new_size = align_up(new_size);
+    if (new_size <= old_size) return ptr;
+
+    arena_block_t *block = arena->head;
+    if (is_top(arena, ptr, old_size)) {
+        size_t start = (size_t) ((unsigned char *) ptr - block->data);
+        if (block->size - start >= new_size) {
+            block->offset = start + new_size;
+            account(arena, new_size - old_size);
+            return ptr;
+        }
+
+        if (start == 0) {
+            arena_block_t *moved = realloc(block, sizeof(arena_block_t) + new_size);
+            if (moved == NULL) return NULL;
+
+            arena->stats.reserved += new_size - moved->size;
+            moved->size = moved->offset = new_size;
+            arena->head = moved;
+            account(arena, new_size - old_size);
+            return moved->data;
+        }
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    if (moved == NULL) return NULL;
+    memcpy(moved, ptr, old_size);
+    arena->stats.wasted += old_size;
+    return moved;
+}
+
+/* Gives the newest allocation back, anything older is dead space until its scope ends */
+void arena_release(arena_t *arena, void *ptr, size_t size) {
+    if (ptr == NULL) return;
+
+    size = align_up(size == 0 ? 1 : size);
+    if (is_top(arena, ptr, size)) {
+        arena->head->offset -= size;
+        arena->stats.used -= size;
+    } else {
+        arena->stats.wasted += size;
+    }
+}
+
+arena_scope_t arena_begin(arena_t *arena) {
+    arena_scope_t scope = {
+        .arena = arena,
+        .depth = arena->depth,
+        .offset = arena->head != NULL ? arena->head->offset : 0,
+        .floor_depth = arena->floor_depth,
+        .floor_offset = arena->floor_offset,
+        .used = arena->stats.used,
+        .wasted = arena->stats.wasted,
+    };
+
+    arena->floor_depth = scope.depth;
+    arena->floor_offset = scope.offset;
+    arena->stats.scopes++;
+    return scope;
+}
+
+/* Blocks the scope filled go to the spare list, oversized ones back to malloc */
+void arena_end(arena_scope_t *scope) {
+    arena_t *arena = scope->arena;
+
+    if (arena == NULL) return;
+    while (arena->depth > scope->depth) {
+        arena_block_t *block = arena->head;
+        arena->head = block->next;
+        arena->depth--;
+
+        if (block->size == ARENA_BLOCK_SIZE) {
+            block->next = arena->spare;
+            arena->spare = block;
+        } else {
+            arena->stats.reserved -= block->size;
+            arena->stats.blocks--;
+            free(block);
+        }
+    }
+
+    if (arena->head != NULL) arena->head->offset = scope->offset;
+    arena->floor_depth = scope->floor_depth;
+    arena->floor_offset = scope->floor_offset;
+    arena->stats.used = scope->used;
+    arena->stats.wasted = scope->wasted;
+    scope->arena = NULL;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *lists[] = {arena->head, arena->spare};
+
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        while (lists[i] != NULL) {
+            arena_block_t *next = lists[i]->next;
+            free(lists[i]);
+            lists[i] = next;
+        }
+    }
+
+    memset(arena, 0, sizeof(arena_t));
+}
+
+/* Percent of the reserved bytes not holding live data */
+int arena_fragmentation(const arena_stats_t *stats) {
+    if (stats->reserved == 0) return 0;
+    return (int) ((stats->reserved - (stats->used - stats->wasted)) * 100 / stats->reserved);
+}
@@ -0,0 +1,217 @@
+#include "backup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crypt.h"
+#include "database.h"
+
+extern char *cruxpass_db_path;
+extern char *meta_db_path;
+
+static bool join_path(char *out, const char *dir, const char *name) {
+    int len = snprintf(out, MAX_PATH_LEN, "%s/%s", dir, name);
+    if (len <= 0 || len >= MAX_PATH_LEN) {
+        fprintf(stderr, "Error: Backup path too long (max: %d characters)\n", MAX_PATH_LEN);
+        return false;
+    }
+
+    return true;
+}
+
+static bool generation_path(char *out, const char *dest_dir, int generation) {
+    char name[32] = {0};
+    snprintf(name, sizeof(name), "%s%d", BACKUP_GEN_PREFIX, generation);
+    return join_path(out, dest_dir, name);
+}
+
+/* A copy opened under a WAL profile can leave its -wal and -shm behind */
+static bool remove_generation(const char *dir) {
+    char path[MAX_PATH_LEN] = {0};
+    const char *files[] = {
+        CRUXPASS_DB, CRUXPASS_DB "-wal", CRUXPASS_DB "-shm", CRUXPASS_DB "-journal",
+        META_DB, META_DB "-wal", META_DB "-shm", META_DB "-journal",
+    };
+
+    for (size_t i = 0; i < LEN(files); i++) {
+        if (!join_path(path, dir, files[i])) return false;
+        if (unlink(path) != 0 && errno != ENOENT) {
+            fprintf(stderr, "Error: Failed to remove %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+
+    if (rmdir(dir) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Error: Failed to remove %s: %s\n", dir, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Copies src into dest through the online backup API. Writes made to src
+ * by other connections restart the copy, writes through src itself are
+ * applied to dest as they happen, so the result is always consistent.
+ */
+static int copy_db(sqlite3 *src, sqlite3 *dest, int step_pages, int *pages) {
+    int rc = SQLITE_OK;
+    sqlite3_backup *backup = NULL;
+
+    if ((backup = sqlite3_backup_init(dest, "main", src, "main")) == NULL) {
+        fprintf(stderr, "Error: Failed to start backup: %s\n", sqlite3_errmsg(dest));
+        return CRXP_ERR;
+    }
+
+    do {
+        rc = sqlite3_backup_step(backup, step_pages);
+        if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) sqlite3_sleep(BACKUP_BUSY_MS);
+        else if (rc == SQLITE_OK) sqlite3_sleep(BACKUP_YIELD_MS);
+    } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+    *pages = sqlite3_backup_pagecount(backup);
+    if (sqlite3_backup_finish(backup) != SQLITE_OK || rc != SQLITE_DONE) {
+        fprintf(stderr, "Error: Backup failed: %s\n", sqlite3_errstr(rc));
+        return CRXP_ERR;
+    }
+
+    return CRXP_OK;
+}
+
+static int backup_secrets(sqlite3 *src, const unsigned char *key, const char *tmp_dir, int *pages) {
+    sqlite3 *dest = NULL;
+    char path[MAX_PATH_LEN] = {0};
+
+    if (!join_path(path, tmp_dir, CRUXPASS_DB)) return CRXP_ERR;
+    if ((dest = open_db(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) == NULL) return CRXP_ERR;
+
+    /* The copy is keyed like the vault, pages never hit the disk in the clear */
+    if (!decrypt(dest, (unsigned char *) key) || !copy_db(src, dest, BACKUP_STEP_PAGES, pages)) {
+        sqlite3_close(dest);
+        return CRXP_ERR;
+    }
+
+    sqlite3_close(dest);
+    return CRXP_OK;
+}
+
+static int backup_meta(const char *tmp_dir) {
+    int pages = 0;
+    sqlite3 *src = NULL;
+    sqlite3 *dest = NULL;
+    char path[MAX_PATH_LEN] = {0};
+
+    if (!join_path(path, tmp_dir, META_DB)) return CRXP_ERR;
+    if ((src = open_db(meta_db_path, SQLITE_OPEN_READONLY)) == NULL) return CRXP_ERR;
+    if ((dest = open_db(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) == NULL) {
+        sqlite3_close(src);
+        return CRXP_ERR;
+    }
+
+    int ok = copy_db(src, dest, -1, &pages);
+    sqlite3_close(dest);
+    sqlite3_close(src);
+    return ok;
+}
+
+static bool rename_generation(const char *from, const char *to) {
+    if (rename(from, to) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Error: Failed to rotate %s: %s\n", from, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Moves the oldest generation aside, shifts backup.N-2 .. backup.0 up by
+ * one and moves the finished copy in as backup.0. The oldest is only
+ * deleted once the new one is in place; a failed install shifts every
+ * generation back. Both files of a generation live in one directory, so
+ * a rename swaps them in together.
+ */
+static int rotate_generations(const char *dest_dir, const char *tmp_dir, int generations) {
+    char from[MAX_PATH_LEN] = {0};
+    char to[MAX_PATH_LEN] = {0};
+    char trash[MAX_PATH_LEN] = {0};
+    int gen = generations - 2;
+
+    if (!join_path(trash, dest_dir, BACKUP_TRASH_DIR) || !remove_generation(trash)) return CRXP_ERR;
+    if (!generation_path(from, dest_dir, generations - 1) || !rename_generation(from, trash)) return CRXP_ERR;
+
+    for (; gen >= 0; gen--) {
+        if (!generation_path(from, dest_dir, gen) || !generation_path(to, dest_dir, gen + 1)) break;
+        if (!rename_generation(from, to)) break;
+    }
+
+    if (gen < 0 && generation_path(to, dest_dir, 0)) {
+        if (rename(tmp_dir, to) == 0) {
+            int dir_fd = open(dest_dir, O_RDONLY | O_DIRECTORY);
+            if (dir_fd >= 0) {
+                fsync(dir_fd);
+                close(dir_fd);
+            }
+
+            remove_generation(trash);
+            return CRXP_OK;
+        }
+
+        fprintf(stderr, "Error: Failed to install backup %s: %s\n", to, strerror(errno));
+    }
+
+    /* Undo the shift, the generations on disk stay as they were */
+    for (gen++; gen <= generations - 2; gen++) {
+        if (generation_path(from, dest_dir, gen + 1) && generation_path(to, dest_dir, gen)) rename_generation(from, to);
+    }
+
+    if (generation_path(to, dest_dir, generations - 1)) rename_generation(trash, to);
+    return CRXP_ERR;
+}
+
+int backup_vault(vault_ctx_t *ctx, const unsigned char *key, const char *dest_dir, int generations) {
+    int pages = 0;
+    struct stat file_stat = {0};
+    struct timespec start = {0};
+    struct timespec end = {0};
+    char tmp_dir[MAX_PATH_LEN] = {0};
+
+    if (generations < 1 || generations > BACKUP_MAX_GENERATIONS) {
+        fprintf(stderr, "Error: Backup generations must be between 1 and %d\n", BACKUP_MAX_GENERATIONS);
+        return CRXP_ERR;
+    }
+
+    if (stat(dest_dir, &file_stat) != 0 || !S_ISDIR(file_stat.st_mode)) {
+        fprintf(stderr, "Error: [ %s ] is either missing or not a valid directory\n", dest_dir);
+        return CRXP_ERR;
+    }
+
+    if (!join_path(tmp_dir, dest_dir, BACKUP_TMP_DIR) || !remove_generation(tmp_dir)) return CRXP_ERR;
+    if (mkdir(tmp_dir, 0700) != 0) {
+        fprintf(stderr, "Error: Failed to create %s: %s\n", tmp_dir, strerror(errno));
+        return CRXP_ERR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!backup_secrets(ctx->secret_db, key, tmp_dir, &pages) || !backup_meta(tmp_dir)) {
+        remove_generation(tmp_dir);
+        return CRXP_ERR;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!rotate_generations(dest_dir, tmp_dir, generations)) {
+        remove_generation(tmp_dir);
+        return CRXP_ERR;
+    }
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Info: Backed up %d pages in %.3fs (%.0f pages/s) to %s/%s0\n", pages, elapsed,
+            elapsed > 0 ? pages / elapsed : (double) pages, dest_dir, BACKUP_GEN_PREFIX);
+    return CRXP_OK;
+}
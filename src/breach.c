@@ -0,0 +1,450 @@
+#include "breach.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sodium/utils.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "database.h"
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+typedef struct {
+    const char *data;
+    size_t size;
+} mapping_t;
+
+typedef struct {
+    int64_t id;
+    uint64_t count;
+    uint8_t digest[SHA1_LEN];
+} hashed_secret_t;
+
+/**
+ * HIBP publishes plain SHA-1 hashes and libsodium ships no SHA-1,
+ * so a small FIPS 180-1 implementation lives here.
+ */
+static void sha1_block(uint32_t state[5], const uint8_t block[64]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16 | (uint32_t) block[i * 4 + 2] << 8
+               | (uint32_t) block[i * 4 + 3];
+    }
+
+    for (int i = 16; i < 80; i++) w[i] = ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f = 0;
+        uint32_t k = 0;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t tmp = ROTL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL32(b, 30);
+        b = a;
+        a = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    sodium_memzero(w, sizeof(w));
+}
+
+static void sha1(uint8_t digest[SHA1_LEN], const uint8_t *msg, size_t len) {
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint8_t block[64];
+    size_t off = 0;
+
+    for (; len - off >= 64; off += 64) sha1_block(state, msg + off);
+
+    size_t rem = len - off;
+    memcpy(block, msg + off, rem);
+    block[rem++] = 0x80;
+    if (rem > 56) {
+        memset(block + rem, 0, 64 - rem);
+        sha1_block(state, block);
+        rem = 0;
+    }
+
+    memset(block + rem, 0, 56 - rem);
+    uint64_t bits = (uint64_t) len * 8;
+    for (int i = 0; i < 8; i++) block[63 - i] = (uint8_t) (bits >> (i * 8));
+    sha1_block(state, block);
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (uint8_t) (state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t) (state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t) (state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t) state[i];
+    }
+
+    sodium_memzero(block, sizeof(block));
+    sodium_memzero(state, sizeof(state));
+}
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool map_file(const char *path, mapping_t *map) {
+    int fd = -1;
+    struct stat file_stat = {0};
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        fprintf(stderr, "Error: [ %s ] is either empty or unreadable\n", path);
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    map->data = data;
+    map->size = file_stat.st_size;
+    return true;
+}
+
+static void unmap_file(mapping_t *map) {
+    if (map->data != NULL) munmap((void *) map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+static const char *line_start(const char *p, const char *lo) {
+    while (p > lo && p[-1] != '\n') p--;
+    return p;
+}
+
+static const char *next_line(const char *p, const char *hi) {
+    const char *nl = memchr(p, '\n', hi - p);
+    return nl == NULL ? hi : nl + 1;
+}
+
+/**
+ * Compares the hash at the head of a corpus line with a binary digest.
+ * Works on nibbles so upper and lower case corpora sort the same way.
+ * Returns false when the line does not start with a hash.
+ */
+static bool compare_line(const char *line, const char *end, const uint8_t digest[SHA1_LEN], int *cmp) {
+    if (end - line < SHA1_HEX_LEN) return false;
+
+    for (int i = 0; i < SHA1_LEN; i++) {
+        int high = hex_nibble(line[i * 2]);
+        int low = hex_nibble(line[i * 2 + 1]);
+        if (high < 0 || low < 0) return false;
+
+        int byte = (high << 4) | low;
+        if (byte != digest[i]) {
+            *cmp = byte < digest[i] ? -1 : 1;
+            return true;
+        }
+    }
+
+    *cmp = 0;
+    return true;
+}
+
+static uint64_t parse_count(const char *p, const char *end) {
+    uint64_t count = 0;
+    if (p < end && *p == ':') p++;
+    while (p < end && *p >= '0' && *p <= '9') count = count * 10 + (*p++ - '0');
+
+    /* A listed hash without a count is still a breached hash */
+    return count == 0 ? 1 : count;
+}
+
+/* Stores the breach count of digest in *count, 0 if not listed; false on a malformed line */
+static bool corpus_lookup(const char *base, const char *lo, const char *hi, const uint8_t digest[SHA1_LEN],
+                          uint64_t *count) {
+    int cmp = 0;
+
+    *count = 0;
+    while (lo < hi) {
+        const char *line = line_start(lo + (hi - lo) / 2, lo);
+        const char *end = next_line(line, hi);
+        if (!compare_line(line, end, digest, &cmp)) {
+            fprintf(stderr, "Error: Malformed hash at offset %zu\n", (size_t) (line - base));
+            return false;
+        }
+
+        if (cmp == 0) {
+            *count = parse_count(line + SHA1_HEX_LEN, end);
+            return true;
+        }
+
+        if (cmp < 0) lo = end;
+        else hi = line;
+    }
+
+    return true;
+}
+
+static bool index_path(char *path, const char *hash_file) {
+    int len = snprintf(path, MAX_PATH_LEN, "%s%s", hash_file, FANOUT_EXT);
+    if (len <= 0 || len >= MAX_PATH_LEN) {
+        fprintf(stderr, "Error: Path to breach corpus too long\n");
+        return false;
+    }
+
+    return true;
+}
+
+int build_breach_index(const char *hash_file) {
+    FILE *fp = NULL;
+    fanout_t *fanout = NULL;
+    mapping_t corpus = {0};
+    char path[MAX_PATH_LEN] = {0};
+    char tmp_path[MAX_PATH_LEN + 4] = {0};
+
+    if (!index_path(path, hash_file)) return CRXP_ERR;
+    if (!map_file(hash_file, &corpus)) return CRXP_ERR;
+    madvise((void *) corpus.data, corpus.size, MADV_SEQUENTIAL);
+
+    if ((fanout = calloc(1, sizeof(fanout_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    memcpy(fanout->magic, FANOUT_MAGIC, sizeof(fanout->magic));
+    fanout->corpus_size = corpus.size;
+
+    uint32_t next = 0;
+    const char *end = corpus.data + corpus.size;
+    for (const char *line = corpus.data; line < end; line = next_line(line, end)) {
+        uint32_t prefix = 0;
+        for (int i = 0; i < FANOUT_BITS / 4; i++) {
+            int nibble = (line + i < end) ? hex_nibble(line[i]) : -1;
+            if (nibble < 0) {
+                fprintf(stderr, "Error: Malformed hash at offset %zu\n", (size_t) (line - corpus.data));
+                goto err;
+            }
+            prefix = (prefix << 4) | nibble;
+        }
+
+        if (prefix + 1 < next) {
+            fprintf(stderr, "Error: [ %s ] is not sorted by hash\n", hash_file);
+            goto err;
+        }
+
+        while (next <= prefix) fanout->offsets[next++] = line - corpus.data;
+    }
+
+    while (next <= FANOUT_SIZE) fanout->offsets[next++] = corpus.size;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ((fp = fopen(tmp_path, "wb")) == NULL) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", tmp_path, strerror(errno));
+        goto err;
+    }
+
+    if (fwrite(fanout, sizeof(fanout_t), 1, fp) != 1 || fclose(fp) != 0) {
+        fprintf(stderr, "Error: Failed to write %s: %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        goto err;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Failed to install %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        goto err;
+    }
+
+    free(fanout);
+    unmap_file(&corpus);
+    fprintf(stderr, "Info: Breach index written to: %s\n", path);
+    return CRXP_OK;
+
+err:
+    free(fanout);
+    unmap_file(&corpus);
+    return CRXP_ERR;
+}
+
+/**
+ * Maps the prebuilt fan-out index if one sits next to the corpus.
+ * A missing or stale index is not an error, lookups fall back to
+ * a binary search over the whole corpus.
+ */
+static const fanout_t *load_breach_index(const char *hash_file, size_t corpus_size, mapping_t *map) {
+    char path[MAX_PATH_LEN] = {0};
+    if (!index_path(path, hash_file) || access(path, R_OK) != 0) return NULL;
+    if (!map_file(path, map)) return NULL;
+
+    const fanout_t *fanout = (const fanout_t *) map->data;
+    if (map->size != sizeof(fanout_t) || memcmp(fanout->magic, FANOUT_MAGIC, sizeof(fanout->magic)) != 0
+        || fanout->corpus_size != corpus_size) {
+        fprintf(stderr, "Warning: Ignoring stale breach index: %s\n", path);
+        unmap_file(map);
+        return NULL;
+    }
+
+    return fanout;
+}
+
+static int cmp_digest(const void *a, const void *b) {
+    return memcmp(((const hashed_secret_t *) a)->digest, ((const hashed_secret_t *) b)->digest, SHA1_LEN);
+}
+
+static int cmp_id(const void *a, const void *b) {
+    int64_t x = ((const hashed_secret_t *) a)->id;
+    int64_t y = ((const hashed_secret_t *) b)->id;
+    return (x > y) - (x < y);
+}
+
+static hashed_secret_t *grow_entries(hashed_secret_t *entries, size_t *capacity) {
+    hashed_secret_t *new_entries = sodium_allocarray(*capacity * 2, sizeof(hashed_secret_t));
+
+    if (new_entries != NULL) memcpy(new_entries, entries, *capacity * sizeof(hashed_secret_t));
+    sodium_memzero(entries, *capacity * sizeof(hashed_secret_t));
+    sodium_free(entries);
+    *capacity *= 2;
+    return new_entries;
+}
+
+static bool hash_secrets(sqlite3 *db, hashed_secret_t **out, size_t *count) {
+    sqlite3_stmt *sql_stmt = NULL;
+    hashed_secret_t *entries = NULL;
+    size_t capacity = 0;
+    int rc = SQLITE_ERROR;
+
+    *out = NULL;
+    *count = 0;
+
+    if ((sql_stmt = get_stmt(db, BREACH_COUNT_STMT)) == NULL || sqlite3_step(sql_stmt) != SQLITE_ROW) {
+        fprintf(stderr, "Error: Failed to count secrets: %s\n", sqlite3_errmsg(db));
+        if (sql_stmt != NULL) sqlite3_reset(sql_stmt);
+        return false;
+    }
+
+    capacity = sqlite3_column_int64(sql_stmt, 0);
+    sqlite3_reset(sql_stmt);
+    if (capacity == 0) capacity = 1;
+
+    if ((entries = sodium_allocarray(capacity, sizeof(hashed_secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((sql_stmt = get_stmt(db, BREACH_SCAN_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        sodium_free(entries);
+        return false;
+    }
+
+    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        /* Records inserted since the count was taken */
+        if (*count == capacity && (entries = grow_entries(entries, &capacity)) == NULL) CRXP__OUT_OF_MEMORY();
+
+        hashed_secret_t *entry = &entries[(*count)++];
+        entry->id = sqlite3_column_int64(sql_stmt, 0);
+        entry->count = 0;
+        sha1(entry->digest, sqlite3_column_text(sql_stmt, 1), sqlite3_column_bytes(sql_stmt, 1));
+    }
+
+    /* A partial scan would read as an all-clear for the records it missed */
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to read secrets: %s\n", sqlite3_errmsg(db));
+        sqlite3_reset(sql_stmt);
+        sodium_memzero(entries, capacity * sizeof(hashed_secret_t));
+        sodium_free(entries);
+        *count = 0;
+        return false;
+    }
+
+    sqlite3_reset(sql_stmt);
+    *out = entries;
+    return true;
+}
+
+int breach_check(sqlite3 *db, const char *hash_file) {
+    size_t count = 0;
+    size_t breached = 0;
+    int ok = CRXP_OK;
+    mapping_t corpus = {0};
+    mapping_t index = {0};
+    hashed_secret_t *entries = NULL;
+
+    if (!map_file(hash_file, &corpus)) return CRXP_ERR;
+
+    const fanout_t *fanout = load_breach_index(hash_file, corpus.size, &index);
+    if (fanout == NULL) madvise((void *) corpus.data, corpus.size, MADV_RANDOM);
+
+    if (!hash_secrets(db, &entries, &count)) {
+        unmap_file(&corpus);
+        unmap_file(&index);
+        return CRXP_ERR;
+    }
+
+    if (count == 0) {
+        fprintf(stderr, "Warning: No records found\n");
+        sodium_free(entries);
+        unmap_file(&corpus);
+        unmap_file(&index);
+        return CRXP_OK;
+    }
+
+    /* Probing in hash order walks the corpus front to back and keeps hot pages hot */
+    qsort(entries, count, sizeof(hashed_secret_t), cmp_digest);
+
+    for (size_t i = 0; i < count; i++) {
+        const char *lo = corpus.data;
+        const char *hi = corpus.data + corpus.size;
+
+        if (fanout != NULL) {
+            uint32_t prefix = (entries[i].digest[0] << 12) | (entries[i].digest[1] << 4) | (entries[i].digest[2] >> 4);
+            lo = corpus.data + fanout->offsets[prefix];
+            hi = corpus.data + fanout->offsets[prefix + 1];
+        }
+
+        if (!corpus_lookup(corpus.data, lo, hi, entries[i].digest, &entries[i].count)) {
+            ok = CRXP_ERR;
+            break;
+        }
+
+        if (entries[i].count != 0) breached++;
+    }
+
+    if (ok) {
+        qsort(entries, count, sizeof(hashed_secret_t), cmp_id);
+        for (size_t i = 0; i < count; i++) {
+            if (entries[i].count != 0) fprintf(stdout, "%" PRId64 "\t%" PRIu64 "\n", entries[i].id, entries[i].count);
+        }
+
+        fprintf(stderr, "Info: %zu of %zu secrets found in breach corpus\n", breached, count);
+    }
+
+    sodium_memzero(entries, count * sizeof(hashed_secret_t));
+    sodium_free(entries);
+    unmap_file(&corpus);
+    unmap_file(&index);
+    return ok;
+}
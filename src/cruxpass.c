@@ -10,6 +10,10 @@
 
 #include "crypt.h"
 #include "database.h"
+#include "metrics.h"
+#include "secmem.h"
+#include "storage.h"
+#include "trace.h"
 
 char *cruxpass_db_path;
 char *meta_db_path;
@@ -28,10 +32,10 @@ char *random_secret(int secret_len, bank_options_t *opt) {
     }
 
     const int bank_len = strlen(bank);
-    if ((secret = malloc(sizeof(char) * secret_len + 1)) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((secret = secmem_alloc(sizeof(char) * secret_len + 1)) == NULL) CRXP__OUT_OF_MEMORY();
     if (sodium_init() == -1) {
         free(bank);
-        free(secret);
+        secmem_free(secret);
         fprintf(stderr, "Error: Failed to initialize libsodium\n");
         return NULL;
     }
@@ -42,114 +46,10 @@ char *random_secret(int secret_len, bank_options_t *opt) {
 
     free(bank);
     secret[secret_len] = '\0';
+    metrics_add(METRIC_SECRETS_GENERATED, 1);
     return secret;
 }
 
-int export_secrets(sqlite3 *db, const char *export_file) {
-    FILE *fp;
-    const unsigned char *username = NULL;
-    const unsigned char *description = NULL;
-    const unsigned char *secret = NULL;
-    sqlite3_stmt *sql_stmt = NULL;
-
-    if ((fp = fopen(export_file, "wb")) == NULL) {
-        fprintf(stderr, "Error: Failed to open %s: %s", export_file, strerror(errno));
-        return CRXP_ERR;
-    }
-
-    char *sql_str = "SELECT username, secret, description FROM secrets;";
-    if (sqlite3_prepare_v2(db, sql_str, -1, &sql_stmt, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
-        fclose(fp);
-        return CRXP_ERR;
-    }
-
-    fputs("Username,Secret,Description\n", fp);
-    while (sqlite3_step(sql_stmt) == SQLITE_ROW) {
-        username = sqlite3_column_text(sql_stmt, 0);
-        secret = sqlite3_column_text(sql_stmt, 1);
-        description = sqlite3_column_text(sql_stmt, 2);
-
-        fprintf(fp, "%s,%s,%s\n", username, secret, description);
-    }
-
-    fclose(fp);
-    sqlite3_finalize(sql_stmt);
-    return CRXP_OK;
-}
-
-/**
- * @field: password_t field
- * @max_length: field MAX, a const
- * @field_name: for error handling
- * @line_number also for error handling
- */
-static int process_field(char *field, const int max_length, char *token, const char *field_name, size_t line_number) {
-    if (token == NULL) {
-        fprintf(stderr, "Error: Missing %s at line %zu\n", field_name, line_number);
-        return CRXP_ERR;
-    }
-
-    if ((const int) strlen(token) > max_length) {
-        fprintf(stderr, "Error: %s at line %zu is more than %d characters\n", field_name, line_number, max_length);
-        return CRXP_ERR;
-    }
-
-    if (strlen(token) < FIELD_MIN && (max_length != SECRET_MAX_LEN)) {
-        fprintf(stderr, "Error: %s at line %zu is less than %d characters\n", field_name, line_number, FIELD_MIN);
-        return CRXP_ERR;
-    } else if (strlen(token) < SECRET_MIN_LEN && (max_length == SECRET_MAX_LEN)) {
-        fprintf(stderr, "Error: %s at line %zu is less than %d characters\n", field_name, line_number, SECRET_MIN_LEN);
-        return CRXP_ERR;
-    }
-
-    strncpy(field, token, max_length);
-    return CRXP_OK;
-}
-
-int import_secrets(sqlite3 *db, const char *import_file) {
-    FILE *fp = NULL;
-    char *saveptr = NULL;
-    secret_t *rec = NULL;
-    size_t line_number = 1;
-    char buf[BUFFMAX + 1] = {0};
-
-    if ((fp = fopen(import_file, "r")) == NULL) {
-        fprintf(stderr, "Error: Failed to open %s: %s", import_file, strerror(errno));
-        return CRXP_ERR;
-    }
-
-    if ((rec = malloc(sizeof(secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
-
-    // TODO: propre csv parsing
-    while (fgets(buf, BUFFMAX, fp) != NULL) {
-        buf[strcspn(buf, "\n")] = '\0';
-
-        if (!process_field(rec->username, USERNAME_MAX_LEN, strtok_r(buf, ",", &saveptr), "Username", line_number)) {
-            line_number++;
-            continue;
-        }
-
-        if (!process_field(rec->secret, SECRET_MAX_LEN, strtok_r(NULL, ",", &saveptr), "Password", line_number)) {
-            line_number++;
-            continue;
-        }
-
-        if (!process_field(rec->description, DESC_MAX_LEN, strtok_r(NULL, ",", &saveptr), "Description", line_number)) {
-            line_number++;
-            continue;
-        }
-
-        if (!insert_record(db, rec)) fprintf(stderr, "Error: Failed to insert record at line: %zu", line_number);
-        line_number++;
-    }
-
-    fclose(fp);
-    free(rec);
-    return CRXP_OK;
-}
-
 static bool create_run_dir(const char *path) {
     int ret = mkdir(path, 0776);
     if (ret == 0) fprintf(stderr, "Info: Run directory created\n");
@@ -221,8 +121,29 @@ static bool validate_run_dir(char *path) {
     return true;
 }
 
+/**
+ * Path of meta.db when a vault already exists in run_dir (or the default
+ * run directory), NULL otherwise. Nothing is created.
+ */
+char *existing_meta_path(const char *run_dir) {
+    char *path = NULL;
+    const char *home = getenv("HOME");
+
+    if ((path = calloc(MAX_PATH_LEN, sizeof(char))) == NULL) CRXP__OUT_OF_MEMORY();
+    int len = run_dir != NULL ? snprintf(path, MAX_PATH_LEN, "%s/%s", run_dir, META_DB)
+              : home != NULL  ? snprintf(path, MAX_PATH_LEN, "%s/%s/%s", home, CRUXPASS_RUNDIR, META_DB)
+                              : -1;
+    if (len <= 0 || len >= MAX_PATH_LEN || access(path, F_OK) != 0) {
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
 vault_ctx_t *initcrux(char *run_dir) {
     vault_ctx_t *ctx = NULL;
+    TRACE_SCOPE("initcrux");
     if (!validate_run_dir(run_dir)) return NULL;
 
     if (sodium_init() == -1) {
@@ -234,6 +155,7 @@ vault_ctx_t *initcrux(char *run_dir) {
     switch (inited) {
         case CRXP_OKK: fprintf(stderr, "Info: New password created\nWarning: Retry your operation\n"); return NULL;
         case CRXP_OK:
+            if (!storage_recover()) return NULL;
             if ((ctx = malloc(sizeof(vault_ctx_t))) == NULL) CRXP__OUT_OF_MEMORY();
             if ((ctx->secret_db = open_db(cruxpass_db_path, SQLITE_OPEN_READWRITE)) == NULL) {
                 free(ctx);
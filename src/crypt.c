@@ -1,52 +1,83 @@
 #include "crypt.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <sodium/crypto_pwhash.h>
 #include <sodium/utils.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "cruxpass.h"
 #include "database.h"
+#include "kdf.h"
+#include "metrics.h"
+#include "secmem.h"
+#include "storage.h"
+#include "trace.h"
 #include "tui.h"
 
-bool key_gen(unsigned char *key, const char *const passd_str, unsigned char *salt) {
+/* libsodium computes a single lane, keys with more come from the threaded backend */
+bool key_gen(unsigned char *key, const char *const passd_str, unsigned char *salt, uint32_t lanes) {
+    TRACE_SCOPE("key_gen");
     if (key == NULL) return false;
     sodium_memzero(key, sizeof(unsigned char) * KEY_LEN);
-    if (crypto_pwhash(key, sizeof(unsigned char) * KEY_LEN, passd_str, strlen(passd_str), salt,
-                      crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_SENSITIVE,
-                      crypto_pwhash_ALG_ARGON2ID13)
-        != 0) {
+    uint64_t start = metrics_now();
+    bool ok = false;
+    if (lanes <= 1)
+        ok = crypto_pwhash(key, sizeof(unsigned char) * KEY_LEN, passd_str, strlen(passd_str), salt, KDF_OPSLIMIT,
+                           KDF_MEMLIMIT, crypto_pwhash_ALG_ARGON2ID13)
+             == 0;
+    else
+        ok = kdf_argon2id(key, KEY_LEN, passd_str, strlen(passd_str), salt, SALT_LEN, KDF_OPSLIMIT, KDF_MEMLIMIT,
+                          lanes);
+
+    if (!ok) {
         fprintf(stderr, "Error: Failed not Generate key\n");
         return false;
     }
 
+    metrics_observe(HIST_KDF_SECONDS, metrics_now() - start);
     return true;
 }
 
 bool decrypt(sqlite3 *db, unsigned char *key) {
-    if (sqlite3_key(db, key, KEY_LEN) != SQLITE_OK) {
-        fprintf(stderr, "Error: Failed to decrypt DB: %s\n", sqlite3_errmsg(db));
+    storage_profile_t profile = STORAGE_PROFILE_DEFAULT;
+
+    TRACE_SCOPE("decrypt");
+    if (!fetch_profile(&profile, NULL)) {
+        fprintf(stderr, "Error: Failed to read the storage profile\n");
         return false;
     }
 
+    {
+        TRACE_SCOPE("sqlite3_key");
+        if (sqlite3_key(db, key, KEY_LEN) != SQLITE_OK) {
+            fprintf(stderr, "Error: Failed to decrypt DB: %s\n", sqlite3_errmsg(db));
+            return false;
+        }
+    }
+
     if (sqlite3_exec(db, "PRAGMA cipher_log_level = NONE;", NULL, NULL, NULL) != SQLITE_OK) {
         fprintf(stderr, "Error: Failed to disable logging to STDERR: %s\n", sqlite3_errmsg(db));
     }
 
-    if (sqlite3_exec(db, "PRAGMA cipher_memory_security = ON;", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Error: Failed to enable memory security: %s\n", sqlite3_errmsg(db));
-        return false;
-    }
+    if (!storage_key_pragmas(db, &profile)) return false;
 
+    /* SQLCipher derives its page key on first read, so this span is its KDF */
+    TRACE_SCOPE("sqlcipher_verify");
     if (sqlite3_exec(db, "SELECT count(*) FROM sqlite_master;", NULL, NULL, NULL) != SQLITE_OK) {
         fprintf(stderr, "Warning: Wrong password. Try again\n");
         return false;
     }
 
+    /* A profile that cannot be applied leaves the defaults, the vault still opens */
+    storage_apply(db, &profile);
     return true;
 }
 
@@ -62,7 +93,7 @@ bool rotate_login_secret(sqlite3 *db) {
         tui_cleanup();
         fprintf(stderr, "Warn: Could not get user input\n");
         sodium_memzero(new_secret, sizeof(char) * LOGIN_MAX_LEN);
-        sodium_free(new_key);
+        secmem_free(new_key);
         return !ok;
     }
 
@@ -72,8 +103,8 @@ bool rotate_login_secret(sqlite3 *db) {
         sodium_memzero(new_secret, sizeof(char) * LOGIN_MAX_LEN);
         sodium_memzero(temp_secret, sizeof(char) * LOGIN_MAX_LEN);
 
-        sodium_free(new_secret);
-        sodium_free(temp_secret);
+        secmem_free(new_secret);
+        secmem_free(temp_secret);
         return !ok;
     }
 
@@ -83,16 +114,20 @@ bool rotate_login_secret(sqlite3 *db) {
         sodium_memzero(new_secret, sizeof(char) * LOGIN_MAX_LEN);
         sodium_memzero(temp_secret, sizeof(char) * LOGIN_MAX_LEN);
 
-        sodium_free(new_secret);
-        sodium_free(temp_secret);
+        secmem_free(new_secret);
+        secmem_free(temp_secret);
         return !ok;
     }
 
-    if ((meta = calloc(1, sizeof(meta_t) + SALT_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
-    if ((new_key = (unsigned char *) sodium_malloc(sizeof(unsigned char) * KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+    /* The new password keeps the lanes of the old one */
+    if ((new_key = (unsigned char *) secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((meta = fetch_meta()) == NULL) {
+        ok = false;
+        goto defer;
+    }
 
     randombytes_buf(meta->salt, SALT_LEN);
-    if (!key_gen(new_key, (const char *const) new_secret, meta->salt)) {
+    if (!key_gen(new_key, (const char *const) new_secret, meta->salt, meta->lanes)) {
         fprintf(stderr, "Error: Failed to Create New Password\n");
         ok = false;
         goto defer;
@@ -115,59 +150,205 @@ defer:
     sodium_memzero(temp_secret, sizeof(char) * LOGIN_MAX_LEN);
     sodium_memzero(new_key, KEY_LEN);
 
-    sodium_free(temp_secret);
-    sodium_free(new_secret);
-    sodium_free(new_key);
+    secmem_free(temp_secret);
+    secmem_free(new_secret);
+    secmem_free(new_key);
     return ok;
 }
 
 /**
- * Decrypts the db and returns an encryption key.
+ * Re-keys an unlocked vault so its key is derived with lanes. The old
+ * key is put back if meta.db cannot be updated, key ends up holding
+ * whichever the vault is keyed with.
  */
-unsigned char *authenticate(vault_ctx_t *ctx) {
+static bool rekey_lanes(sqlite3 *db, const char *login_secret, uint32_t lanes, unsigned char *key) {
+    bool ok = false;
     meta_t *meta = NULL;
-    char *login_secret = NULL;
-    unsigned char *key = NULL;
+    unsigned char *new_key = NULL;
 
-    if ((meta = fetch_meta()) == NULL) {
-        return NULL;
+    TRACE_SCOPE("rekey_lanes");
+    if ((meta = fetch_meta()) == NULL) return false;
+    if ((new_key = (unsigned char *) secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+
+    meta->lanes = lanes;
+    randombytes_buf(meta->salt, SALT_LEN);
+    if (!key_gen(new_key, login_secret, meta->salt, lanes)) goto defer;
+    if (sqlite3_rekey(db, new_key, KEY_LEN) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to re-key the vault: %s\n", sqlite3_errmsg(db));
+        goto defer;
     }
 
-    tui_init();
-    if ((login_secret = get_secret("Login Password: ")) == NULL) {
-        tui_cleanup();
-        free(meta);
-        return NULL;
+    if (!update_meta(NULL, meta)) {
+        if (sqlite3_rekey(db, key, KEY_LEN) != SQLITE_OK)
+            fprintf(stderr, "Error: Failed to restore the vault key: %s\n", sqlite3_errmsg(db));
+        goto defer;
+    }
+
+    memcpy(key, new_key, KEY_LEN);
+    fprintf(stderr, "Note: Vault key now derived with %u lane%s.\n", lanes, lanes == 1 ? "" : "s");
+    ok = true;
+
+defer:
+    free(meta);
+    sodium_memzero(new_key, KEY_LEN);
+    secmem_free(new_key);
+    return ok;
+}
+
+/* The password is the first line of fd, for scripts that cannot answer a prompt */
+static char *read_secret(int fd) {
+    char c = 0;
+    size_t len = 0;
+    ssize_t n = 0;
+    char *secret = NULL;
+
+    if ((secret = (char *) secmem_alloc(LOGIN_MAX_LEN + 1)) == NULL) CRXP__OUT_OF_MEMORY();
+    sodium_memzero(secret, LOGIN_MAX_LEN + 1);
+    while (len <= LOGIN_MAX_LEN) {
+        if ((n = read(fd, &c, 1)) < 0 && errno == EINTR) continue;
+        if (n <= 0 || c == '\n') break;
+        if (len < LOGIN_MAX_LEN) secret[len] = c;
+        len++;
     }
-    tui_cleanup();
 
-    if ((key = (unsigned char *) sodium_malloc(sizeof(unsigned char) * KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
-    if (!key_gen(key, login_secret, meta->salt)) {
+    c = 0;
+    if (len > 0 && len <= LOGIN_MAX_LEN && secret[len - 1] == '\r') secret[--len] = '\0';
+    if (n < 0) fprintf(stderr, "Error: Failed to read the password: %s\n", strerror(errno));
+    else if (len < SECRET_MIN_LEN || len > LOGIN_MAX_LEN) fprintf(stderr, "Error: Invalid secret length\n");
+    if (n >= 0 && len >= SECRET_MIN_LEN && len <= LOGIN_MAX_LEN) return secret;
+
+    sodium_memzero(secret, LOGIN_MAX_LEN + 1);
+    secmem_free(secret);
+    return NULL;
+}
+
+/**
+ * One unlock, shared by authenticate() and its worker. The worker has
+ * ctx->secret_db, meta.db and tui->records to itself until done is set.
+ */
+typedef struct {
+    vault_ctx_t *ctx;
+    tui_state_t *tui;
+    uint32_t lanes;
+    int first_rows;
+    meta_t *meta;
+    char *login_secret;
+    unsigned char *key;
+    bool go;
+    bool cancelled;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_bool done;
+} unlock_t;
+
+/* Everything after the prompt: key, SQLCipher check, statements and the first page */
+static bool unlock(unlock_t *job) {
+    sqlite3 *db = job->ctx->secret_db;
+    uint64_t start = metrics_now();
+
+    if ((job->key = (unsigned char *) secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+    if (!key_gen(job->key, job->login_secret, job->meta->salt, job->meta->lanes)) {
         fprintf(stderr, "Error: Failed to generate description key\n");
-        sodium_memzero(login_secret, sizeof(char) * LOGIN_MAX_LEN);
-        sodium_memzero(key, KEY_LEN);
+        return false;
+    }
 
-        sodium_free(login_secret);
-        sodium_free(key);
-        free(meta);
-        return NULL;
+    if (!decrypt(db, job->key)) {
+        metrics_add(METRIC_UNLOCK_FAILURES, 1);
+        return false;
     }
 
-    free(meta);
-    sodium_memzero(login_secret, sizeof(char) * LOGIN_MAX_LEN);
-    sodium_free(login_secret);
+    if (!prepare_stmt(job->ctx)) return false;
+    metrics_observe(HIST_UNLOCK_SECONDS, metrics_now() - start);
+    if (job->lanes != 0 && job->lanes != job->meta->lanes
+        && !rekey_lanes(db, job->login_secret, job->lanes, job->key))
+        return false;
 
-    if (!decrypt(ctx->secret_db, key)) {
-        sodium_memzero(key, KEY_LEN);
-        sodium_free(key);
-        return NULL;
+    bool done = false;
+    if (job->tui != NULL && !stream_records(db, &job->tui->records, job->first_rows, &done)) return false;
+    if (job->tui != NULL) job->tui->streaming = !done;
+    return true;
+}
+
+static void *unlock_worker(void *arg) {
+    unlock_t *job = arg;
+    bool go = false;
+
+    TRACE_SCOPE("unlock");
+    /* meta.db is read while the password is typed */
+    job->meta = fetch_meta();
+
+    pthread_mutex_lock(&job->lock);
+    while (!job->go && !job->cancelled) pthread_cond_wait(&job->wake, &job->lock);
+    go = job->go;
+    pthread_mutex_unlock(&job->lock);
+
+    if (go && (job->meta == NULL || !unlock(job)) && job->key != NULL) {
+        sodium_memzero(job->key, KEY_LEN);
+        secmem_free(job->key);
+        job->key = NULL;
     }
 
-    if (!prepare_stmt(ctx)) {
-        sodium_memzero(key, KEY_LEN);
-        sodium_free(key);
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+/**
+ * Decrypts the db and returns an encryption key. A lanes other than 0
+ * and the vault's own re-keys the vault with it once it is unlocked.
+ *
+ * termbox comes up once: a worker reads meta.db while the password is
+ * typed, then derives the key and opens the vault behind a spinner.
+ * With a tui the session stays up and its first page is read too, so
+ * tui_main() can go on from there; without one termbox is shut down.
+ * What is printed meanwhile shows once it is, see tui_hold_stderr().
+ * A password_fd other than -1 is read instead, termbox stays down.
+ */
+unsigned char *authenticate(vault_ctx_t *ctx, uint32_t lanes, tui_state_t *tui, int password_fd) {
+    pthread_t worker;
+    bool prompt = password_fd < 0;
+    unlock_t job = {.ctx = ctx, .tui = prompt ? tui : NULL, .lanes = lanes};
+
+    TRACE_SCOPE("authenticate");
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.wake, NULL);
+    atomic_init(&job.done, false);
+    if (pthread_create(&worker, NULL, unlock_worker, &job) != 0) {
+        fprintf(stderr, "Error: Failed to start the unlock\n");
+        pthread_cond_destroy(&job.wake);
+        pthread_mutex_destroy(&job.lock);
         return NULL;
     }
 
-    return key;
+    if (!prompt) {
+        job.login_secret = read_secret(password_fd);
+    } else {
+        tui_hold_stderr();
+        if (tui_init()) {
+            TRACE_SCOPE("prompt");
+            job.login_secret = get_secret("Login Password: ");
+            job.first_rows = tb_height();
+        }
+    }
+
+    pthread_mutex_lock(&job.lock);
+    job.go = job.login_secret != NULL;
+    job.cancelled = !job.go;
+    pthread_cond_signal(&job.wake);
+    pthread_mutex_unlock(&job.lock);
+
+    if (job.go && prompt) display_spinner("Unlocking...", &job.done);
+    pthread_join(worker, NULL);
+    pthread_cond_destroy(&job.wake);
+    pthread_mutex_destroy(&job.lock);
+
+    if (job.tui != NULL && job.key != NULL) tui->term_ready = true;
+    else if (prompt) tui_cleanup();
+
+    free(job.meta);
+    if (job.login_secret != NULL) {
+        sodium_memzero(job.login_secret, sizeof(char) * LOGIN_MAX_LEN);
+        secmem_free(job.login_secret);
+    }
+
+    return job.key;
 }
@@ -11,17 +11,118 @@
 
 #include "cruxpass.h"
 #include "crypt.h"
+#include "kdf.h"
+#include "metrics.h"
+#include "secmem.h"
+#include "trace.h"
 #include "tui.h"
 
 extern char *cruxpass_db_path;
 extern char *meta_db_path;
-sqlite3_stmt *sql_stmts[STMT_COUNT];
+static sqlite3_stmt *sql_stmts[STMT_COUNT];
+static sqlite3 *stmt_owner[STMT_COUNT];
+static stmt_stats_t stats;
+static sqlite3 *meta_conn;
 
 // clang-format off
-char *sql_str[STMT_COUNT] = {
-                 "INSERT INTO secrets (username, secret,description )  VALUES (?, ?, ?);",
-                 "DELETE FROM secrets WHERE id = ?;", 
-                 "SELECT secret FROM secrets WHERE id = ?;"
+static const char *sql_str[STMT_COUNT] = {
+    [INSERT_REC_STMT] = "INSERT INTO secrets (username, secret, description, date_modified) "
+                        "VALUES (?, ?, ?, CURRENT_DATE);",
+    [DELETE_REC_STMT] = "DELETE FROM secrets WHERE id = ?;",
+    [FETCH_SEC_STMT] = "SELECT secret FROM secrets WHERE id = ?;",
+    [LOAD_RECS_STMT] = "SELECT id, username, description, date_added, date_modified, (SELECT max(seq) FROM changes) "
+                       "FROM secrets ORDER BY id;",
+    [EXPORT_ALL_STMT] = "SELECT id, username, secret, description, date_added, date_modified FROM secrets ORDER BY id;",
+    [EXPORT_FILTER_STMT] = "SELECT id, username, secret, description, date_added, date_modified FROM secrets "
+                           "WHERE instr(lower(username), lower(?1)) > 0 OR instr(lower(description), lower(?1)) > 0 "
+                           "ORDER BY id;",
+    [DEDUP_SCAN_STMT] = "SELECT id, username, secret, description FROM secrets;",
+    [ARCHIVE_SCAN_STMT] = "SELECT username, secret, description FROM secrets;",
+    [BREACH_COUNT_STMT] = "SELECT count(*) FROM secrets;",
+    [BREACH_SCAN_STMT] = "SELECT id, secret FROM secrets;",
+    [BEGIN_STMT] = "BEGIN IMMEDIATE;",
+    [COMMIT_STMT] = "COMMIT;",
+    [ROLLBACK_STMT] = "ROLLBACK;",
+    [META_FETCH_STMT] = "SELECT salt, version, lanes FROM meta WHERE id = ?;",
+    [META_INSERT_STMT] = "INSERT INTO meta (salt, version, lanes) VALUES (?, ?, ?);",
+    [META_UPDATE_STMT] = "UPDATE meta SET salt = ?, lanes = ? WHERE id = ?;",
+    [PROFILE_FETCH_STMT] = "SELECT profile, pending FROM storage WHERE id = 1;",
+    [PROFILE_SAVE_STMT] = "INSERT INTO storage (id, profile, pending) VALUES (1, ?, ?) "
+                          "ON CONFLICT (id) DO UPDATE SET profile = excluded.profile, pending = excluded.pending;",
+    [DATA_VERSION_STMT] = "PRAGMA data_version;",
+    [USER_VERSION_STMT] = "PRAGMA user_version;",
+    /* Deleted records come back with a NULL username */
+    [CHANGES_STMT] = "SELECT changes.id, username, description, date_added, date_modified, changes.seq "
+                     "FROM changes LEFT JOIN secrets USING (id) WHERE changes.seq > ? ORDER BY +changes.id;",
+    [TAG_INSERT_STMT] = "INSERT OR IGNORE INTO tags (name) VALUES (?);",
+    /* Not OR IGNORE, which would also turn the OR REPLACE of the change log triggers into an IGNORE */
+    [TAG_LINK_STMT] = "INSERT INTO secret_tags (tag_id, secret_id) SELECT id, ?2 FROM tags WHERE name = ?1 "
+                      "AND NOT EXISTS (SELECT 1 FROM secret_tags WHERE tag_id = tags.id AND secret_id = ?2);",
+    [TAG_CLEAR_STMT] = "DELETE FROM secret_tags WHERE secret_id = ?;",
+    [TAG_TOUCH_STMT] = "UPDATE secrets SET date_modified = CURRENT_DATE WHERE id = ?;",
+    [TAGS_LOAD_STMT] = "SELECT id, name FROM tags ORDER BY id;",
+    /* The primary key, each tag's records come out as one ascending run */
+    [TAG_IDS_STMT] = "SELECT tag_id, secret_id FROM secret_tags ORDER BY tag_id, secret_id;",
+    [RECORD_TAGS_STMT] = "SELECT name FROM secret_tags JOIN tags ON tags.id = tag_id WHERE secret_id = ? "
+                         "ORDER BY name;",
+};
+
+/* schema_steps[v] takes a vault from user_version v to v + 1 */
+static const char *schema_steps[SCHEMA_VERSION] = {
+    "CREATE TABLE changes (id INTEGER PRIMARY KEY, seq INTEGER NOT NULL);"
+    "CREATE UNIQUE INDEX changes_seq ON changes (seq);"
+    "CREATE TRIGGER secrets_inserted AFTER INSERT ON secrets BEGIN "
+        "INSERT OR REPLACE INTO changes (id, seq) VALUES (NEW.id, (SELECT coalesce(max(seq), 0) + 1 FROM changes)); "
+    "END;"
+    "CREATE TRIGGER secrets_updated AFTER UPDATE OF username, secret, description ON secrets BEGIN "
+        "INSERT OR REPLACE INTO changes (id, seq) VALUES (NEW.id, (SELECT coalesce(max(seq), 0) + 1 FROM changes)); "
+    "END;"
+    "CREATE TRIGGER secrets_deleted AFTER DELETE ON secrets BEGIN "
+        "INSERT OR REPLACE INTO changes (id, seq) VALUES (OLD.id, (SELECT coalesce(max(seq), 0) + 1 FROM changes)); "
+    "END;",
+    "CREATE INDEX secrets_username ON secrets (username COLLATE NOCASE);"
+    "CREATE INDEX secrets_description ON secrets (description COLLATE NOCASE);",
+    "CREATE INDEX secrets_date_added ON secrets (date_added);",
+    "ALTER TABLE secrets ADD COLUMN date_modified TEXT;"
+    "UPDATE secrets SET date_modified = date_added;"
+    "CREATE INDEX secrets_date_modified ON secrets (date_modified);",
+    "CREATE TABLE tags (id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE COLLATE NOCASE);"
+    "CREATE TABLE secret_tags (tag_id INTEGER NOT NULL, secret_id INTEGER NOT NULL, "
+        "PRIMARY KEY (tag_id, secret_id)) WITHOUT ROWID;"
+    "CREATE INDEX secret_tags_secret ON secret_tags (secret_id, tag_id);"
+    "CREATE TRIGGER secrets_untagged AFTER DELETE ON secrets BEGIN "
+        "DELETE FROM secret_tags WHERE secret_id = OLD.id; "
+    "END;"
+    "CREATE TRIGGER secret_tags_inserted AFTER INSERT ON secret_tags BEGIN "
+        "INSERT OR REPLACE INTO changes (id, seq) "
+            "VALUES (NEW.secret_id, (SELECT coalesce(max(seq), 0) + 1 FROM changes)); "
+    "END;"
+    "CREATE TRIGGER secret_tags_deleted AFTER DELETE ON secret_tags BEGIN "
+        "INSERT OR REPLACE INTO changes (id, seq) "
+            "VALUES (OLD.secret_id, (SELECT coalesce(max(seq), 0) + 1 FROM changes)); "
+        "DELETE FROM tags WHERE id = OLD.tag_id "
+            "AND NOT EXISTS (SELECT 1 FROM secret_tags WHERE tag_id = OLD.tag_id); "
+    "END;",
+};
+
+/* Bind order of the update statements, the record id comes last */
+static const struct {
+    uint8_t flag;
+    const char *column;
+} update_columns[] = {
+    {UPDATE_DESCRIPTION, "description"},
+    {UPDATE_SECRET, "secret"},
+    {UPDATE_USERNAME, "username"},
+};
+
+/* Bind order of lookup_where(): one value per exact field, a range per prefix */
+static const struct {
+    uint8_t flag;
+    uint8_t prefix;
+    const char *column;
+} lookup_columns[] = {
+    {LOOKUP_USERNAME, LOOKUP_USERNAME_PREFIX, "username"},
+    {LOOKUP_DESCRIPTION, LOOKUP_DESCRIPTION_PREFIX, "description"},
 };
 // clang-format on
 
@@ -37,75 +138,173 @@ static int sql_exec_n_err(sqlite3 *db, char *sql_fmt_str, char *sql_err_msg,
     return CRXP_OK;
 }
 
-static int sql_prep_n_exec(sqlite3 *db, char *sql_fmt_str, sqlite3_stmt *sql_stmt, const char *field, int id) {
-    if (sqlite3_prepare_v2(db, sql_fmt_str, -1, &sql_stmt, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        return CRXP_ERR;
+static void update_sql(uint8_t mask, char *buf, size_t size) {
+    const char *sep = "";
+    size_t len = (size_t) snprintf(buf, size, "UPDATE secrets SET ");
+
+    for (size_t i = 0; i < sizeof(update_columns) / sizeof(update_columns[0]); i++) {
+        if (!(mask & update_columns[i].flag)) continue;
+        len += (size_t) snprintf(buf + len, size - len, "%s%s = ?", sep, update_columns[i].column);
+        sep = ", ";
     }
 
-    if (sqlite3_bind_text(sql_stmt, 1, field, -1, SQLITE_STATIC) != SQLITE_OK
-        || sqlite3_bind_int(sql_stmt, 2, id) != SQLITE_OK) {
-        fprintf(stderr, "Error: Failed to bind sql statement: %s", sqlite3_errmsg(db));
-        sqlite3_finalize(sql_stmt);
-        return CRXP_ERR;
+    snprintf(buf + len, size - len, ", date_modified = CURRENT_DATE WHERE id = ?;");
+}
+
+/**
+ * The WHERE condition of a LOOKUP_* mask, returning its length. Both
+ * indexes are NOCASE, so are the comparisons, or they would not be used.
+ */
+size_t lookup_where(uint8_t mask, char *buf, size_t size) {
+    const char *sep = "";
+    size_t len = 0;
+
+    for (size_t i = 0; i < sizeof(lookup_columns) / sizeof(lookup_columns[0]); i++) {
+        const char *column = lookup_columns[i].column;
+        if (!(mask & lookup_columns[i].flag)) continue;
+        if (mask & lookup_columns[i].prefix)
+            len += (size_t) snprintf(buf + len, size - len, "%s%s >= ? COLLATE NOCASE AND %s < ? COLLATE NOCASE", sep,
+                                     column, column);
+        else len += (size_t) snprintf(buf + len, size - len, "%s%s = ? COLLATE NOCASE", sep, column);
+        sep = " AND ";
     }
 
-    if (sqlite3_step(sql_stmt) != SQLITE_DONE) {
-        fprintf(stderr, "Error: Failed to execute statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(sql_stmt);
-        return CRXP_ERR;
+    return len;
+}
+
+/**
+ * Returns the statement for id prepared on db, parsing it only the first
+ * time; a statement prepared on another connection is replaced. On
+ * failure the error is left on db for the caller to report.
+ */
+sqlite3_stmt *get_stmt(sqlite3 *db, SQL_STMT id) {
+    char sql_buf[128];
+    const char *sql = sql_str[id];
+
+    if (sql_stmts[id] != NULL && stmt_owner[id] == db) {
+        stats.hits++;
+        return sql_stmts[id];
+    }
+
+    sqlite3_finalize(sql_stmts[id]);
+    sql_stmts[id] = NULL;
+    stmt_owner[id] = NULL;
+    stats.misses++;
+
+    if (id > UPDATE_REC_STMT) {
+        update_sql((uint8_t) (id - UPDATE_REC_STMT), sql_buf, sizeof(sql_buf));
+        sql = sql_buf;
+    }
+
+    if (sql == NULL) return NULL;
+    if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &sql_stmts[id], NULL) != SQLITE_OK) {
+        sqlite3_finalize(sql_stmts[id]);
+        sql_stmts[id] = NULL;
+        return NULL;
+    }
+
+    stmt_owner[id] = db;
+    return sql_stmts[id];
+}
+
+/* Returns a registry statement to its unbound state for the next caller */
+void release_stmt(sqlite3_stmt *stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+/* For statements without parameters or rows: transaction control */
+bool exec_stmt(sqlite3 *db, SQL_STMT id) {
+    sqlite3_stmt *stmt = NULL;
+
+    if ((stmt = get_stmt(db, id)) == NULL || sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to execute \"%s\": %s\n", sql_str[id], sqlite3_errmsg(db));
+        if (stmt != NULL) sqlite3_reset(stmt);
+        return false;
+    }
+
+    sqlite3_reset(stmt);
+    return true;
+}
+
+stmt_stats_t stmt_stats(void) { return stats; }
+
+/* exists tells whether there is a meta table at all, a fresh meta.db has none */
+static bool meta_has_lanes(sqlite3 *db, bool *exists) {
+    bool found = false;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    *exists = false;
+    if (sqlite3_prepare_v2(db, "SELECT name FROM pragma_table_info('meta');", -1, &sql_stmt, NULL) != SQLITE_OK)
+        return false;
+    while (sqlite3_step(sql_stmt) == SQLITE_ROW) {
+        *exists = true;
+        if (strcmp((const char *) sqlite3_column_text(sql_stmt, 0), "lanes") == 0) found = true;
     }
 
     sqlite3_finalize(sql_stmt);
-    return CRXP_OK;
+    return found;
 }
 
-static int create_databases(vault_ctx_t *ctx) {
+/**
+ * Vaults from before multi-lane keys have no lanes column, their keys
+ * were all derived with the one lane it defaults to.
+ */
+static bool migrate_meta(sqlite3 *db) {
+    bool exists = false;
+
+    if (meta_has_lanes(db, &exists) || !exists) return true;
+    if (sqlite3_exec(db, "ALTER TABLE meta ADD COLUMN lanes INTEGER NOT NULL DEFAULT 1;", NULL, NULL, NULL)
+        == SQLITE_OK)
+        return true;
+
+    /* Another process may have added it first */
+    return meta_has_lanes(db, &exists);
+}
+
+/* meta.db is opened once per process and closed with the statements */
+static sqlite3 *meta_connection(void) {
+    if (meta_conn != NULL) return meta_conn;
+    if ((meta_conn = open_db(meta_db_path, SQLITE_OPEN_READWRITE)) != NULL && !migrate_meta(meta_conn))
+        fprintf(stderr, "Error: Failed to upgrade meta.db: %s\n", sqlite3_errmsg(meta_conn));
+    return meta_conn;
+}
+
+/**
+ * Keys a fresh vault with login_secret and creates its tables, without
+ * any prompt, so tools like the benchmark can build vaults too.
+ */
+int create_vault(vault_ctx_t *ctx, const char *login_secret) {
     char *sql_err_msg = NULL;
     char *sql_fmt_str = NULL;
     unsigned char *key = NULL;
     meta_t *meta = NULL;
 
-    tui_init();
-    tb_clear();
-    tb_print(0, 2, TB_DEFAULT, TB_DEFAULT, "Create a new login password/secret for cruxpass.");
-    tb_present();
-    char *login_secret = get_input("> Enter password: ", NULL, LOGIN_MAX_LEN, 0, 3);
-    tui_cleanup();
-
-    if (strlen(login_secret) < SECRET_MIN_LEN) {
-        fprintf(stderr, "Error: password invalid\n");
-        return CRXP_ERR;
-    }
-
     if ((meta = malloc(sizeof(meta_t) + SALT_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
     meta->version = 0x02;
+    meta->lanes = KDF_LANES_DEFAULT;
     randombytes_buf(meta->salt, SALT_LEN);
 
-    if ((key = (unsigned char *) sodium_malloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
-    if (!key_gen(key, login_secret, meta->salt)) {
-        sodium_memzero(login_secret, LOGIN_MAX_LEN);
+    if ((key = (unsigned char *) secmem_alloc(KEY_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
+    if (!key_gen(key, login_secret, meta->salt, meta->lanes)) {
         sodium_memzero(key, KEY_LEN);
-        sodium_free(key);
-        free(login_secret);
+        secmem_free(key);
         free(meta);
         return CRXP_ERR;
     }
 
-    sodium_memzero(login_secret, LOGIN_MAX_LEN);
-    free(login_secret);
     if (!decrypt(ctx->secret_db, key)) {
         sodium_memzero(key, KEY_LEN);
-        sodium_free(key);
+        secmem_free(key);
         free(meta);
         return CRXP_ERR;
     }
 
     sodium_memzero(key, KEY_LEN);
-    sodium_free(key);
+    secmem_free(key);
     sql_fmt_str
         = "CREATE TABLE IF NOT EXISTS meta ( id INTEGER PRIMARY "
-          "KEY, salt TEXT NOT NULL, version INTEGER NOT NULL);";
+          "KEY, salt TEXT NOT NULL, version INTEGER NOT NULL, lanes INTEGER NOT NULL DEFAULT 1);";
     if (!sql_exec_n_err(ctx->meta_db, sql_fmt_str, sql_err_msg, NULL, NULL)) {
         free(meta);
         return CRXP_ERR;
@@ -128,9 +327,83 @@ static int create_databases(vault_ctx_t *ctx) {
     return CRXP_OK;
 }
 
+static int create_databases(vault_ctx_t *ctx) {
+    tui_init();
+    tb_clear();
+    tb_print(0, 2, TB_DEFAULT, TB_DEFAULT, "Create a new login password/secret for cruxpass.");
+    tb_present();
+    char *login_secret = get_input("> Enter password: ", NULL, LOGIN_MAX_LEN, 0, 3);
+    tui_cleanup();
+
+    if (strlen(login_secret) < SECRET_MIN_LEN) {
+        fprintf(stderr, "Error: password invalid\n");
+        return CRXP_ERR;
+    }
+
+    /* New vaults start in WAL mode, readers such as an open TUI never block writers */
+    storage_profile_t profile = STORAGE_PROFILE_DEFAULT;
+    if (!storage_parse("wal", &profile) || !update_profile(ctx->meta_db, &profile, false)) {
+        sodium_memzero(login_secret, LOGIN_MAX_LEN);
+        free(login_secret);
+        return CRXP_ERR;
+    }
+
+    int ok = create_vault(ctx, login_secret);
+    sodium_memzero(login_secret, LOGIN_MAX_LEN);
+    free(login_secret);
+    return ok;
+}
+
+/* Reads PRAGMA user_version, -1 on error */
+static int schema_version(sqlite3 *db) {
+    int version = -1;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    if ((sql_stmt = get_stmt(db, USER_VERSION_STMT)) == NULL) return -1;
+    if (sqlite3_step(sql_stmt) == SQLITE_ROW) version = sqlite3_column_int(sql_stmt, 0);
+    release_stmt(sql_stmt);
+    return version;
+}
+
+/**
+ * Upgrades vaults written by older releases. The version is read again
+ * under the write lock, another process may have migrated in between.
+ */
+bool migrate_schema(sqlite3 *db) {
+    char sql[48];
+    int version = schema_version(db);
+
+    TRACE_SCOPE("migrate_schema");
+    if (version >= SCHEMA_VERSION) return true;
+    if (version < 0 || !exec_stmt(db, BEGIN_STMT)) {
+        fprintf(stderr, "Error: Failed to read the vault schema: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    for (version = schema_version(db); version >= 0 && version < SCHEMA_VERSION; version++) {
+        if (sqlite3_exec(db, schema_steps[version], NULL, NULL, NULL) != SQLITE_OK) {
+            fprintf(stderr, "Error: Failed to upgrade the vault schema: %s\n", sqlite3_errmsg(db));
+            exec_stmt(db, ROLLBACK_STMT);
+            return false;
+        }
+    }
+
+    snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", SCHEMA_VERSION);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK || !exec_stmt(db, COMMIT_STMT)) {
+        fprintf(stderr, "Error: Failed to upgrade the vault schema: %s\n", sqlite3_errmsg(db));
+        exec_stmt(db, ROLLBACK_STMT);
+        return false;
+    }
+
+    return true;
+}
+
+/* Warms the statements the TUI needs on every keypress */
 bool prepare_stmt(vault_ctx_t *ctx) {
-    for (int i = 0; i < STMT_COUNT; i++) {
-        if (sqlite3_prepare_v2(ctx->secret_db, sql_str[i], -1, &sql_stmts[i], NULL) != SQLITE_OK) {
+    TRACE_SCOPE("prepare_stmt");
+    if (!migrate_schema(ctx->secret_db)) return false;
+    for (int i = INSERT_REC_STMT; i <= LOAD_RECS_STMT; i++) {
+        if (get_stmt(ctx->secret_db, i) == NULL) {
             fprintf(stderr, "Error: failed to prepare statement: %s\n", sqlite3_errmsg(ctx->secret_db));
             return false;
         }
@@ -142,24 +415,64 @@ bool prepare_stmt(vault_ctx_t *ctx) {
 void cleanup_stmts(void) {
     for (int i = 0; i < STMT_COUNT; i++) {
         sqlite3_finalize(sql_stmts[i]);
+        sql_stmts[i] = NULL;
+        stmt_owner[i] = NULL;
+    }
+
+    if (meta_conn != NULL) {
+        sqlite3_close(meta_conn);
+        meta_conn = NULL;
     }
 }
 
+/* The jitter keeps writers that were blocked together from retrying in lockstep */
+static int busy_backoff(MAYBE_UNUSED void *arg, int count) {
+    int waited = 0;
+    int delay = DB_BUSY_MIN_MS;
+
+    for (int i = 0; i < count && waited < DB_BUSY_TIMEOUT_MS; i++) {
+        waited += delay;
+        if (delay < DB_BUSY_MAX_MS) delay = delay * 2 < DB_BUSY_MAX_MS ? delay * 2 : DB_BUSY_MAX_MS;
+    }
+
+    if (waited >= DB_BUSY_TIMEOUT_MS) return 0;
+    if (count == 0) metrics_add(METRIC_BUSY_WAITS, 1);
+    sqlite3_sleep(delay / 2 + (int) randombytes_uniform((uint32_t) (delay - delay / 2) + 1));
+    return 1;
+}
+
 sqlite3 *open_db(char *db_name, int flags) {
     sqlite3 *db = NULL;
+    TRACE_SCOPE("open_db");
     int rc = sqlite3_open_v2(db_name, &db, flags, NULL);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Error: failed to open %s: %s\n", db_name, sqlite3_errmsg(db));
         return NULL;
     }
 
+    sqlite3_busy_handler(db, busy_backoff, NULL);
+
     return db;
 }
 
+/* sqlite3_close() refuses connections that still have statements */
+void close_db(sqlite3 *db) {
+    if (db == NULL) return;
+    for (int i = 0; i < STMT_COUNT; i++) {
+        if (stmt_owner[i] != db) continue;
+        sqlite3_finalize(sql_stmts[i]);
+        sql_stmts[i] = NULL;
+        stmt_owner[i] = NULL;
+    }
+
+    sqlite3_close(db);
+}
+
 int init_sqlite(void) {
     vault_ctx_t ctx = {0};
     meta_t *meta = NULL;
 
+    TRACE_SCOPE("init_sqlite");
     if ((ctx.secret_db = open_db(cruxpass_db_path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX))
         == NULL) {
         return CRXP_ERR;
@@ -172,262 +485,607 @@ int init_sqlite(void) {
 
     if ((meta = fetch_meta()) != NULL) {
         free(meta);
-        sqlite3_close(ctx.meta_db);
-        sqlite3_close(ctx.secret_db);
+        close_db(ctx.meta_db);
+        close_db(ctx.secret_db);
         return CRXP_OK;
     }
 
     free(meta);
     if (!create_databases(&ctx)) {
-        sqlite3_close(ctx.meta_db);
-        sqlite3_close(ctx.secret_db);
+        close_db(ctx.meta_db);
+        close_db(ctx.secret_db);
         return CRXP_ERR;
     }
 
-    sqlite3_close(ctx.meta_db);
-    sqlite3_close(ctx.secret_db);
+    close_db(ctx.meta_db);
+    close_db(ctx.secret_db);
     return CRXP_OKK;
 }
 
 int insert_record(sqlite3 *db, secret_t *record) {
+    sqlite3_stmt *sql_stmt = NULL;
+
+    TRACE_SCOPE("insert_record");
     if (record == NULL) {
         fprintf(stderr, "Error: Empty record\n");
         return CRXP_ERR;
     }
 
-    if (sqlite3_bind_text(sql_stmts[INSERT_REC_STMT], 1, record->username, -1, SQLITE_STATIC) != SQLITE_OK
-        || sqlite3_bind_text(sql_stmts[INSERT_REC_STMT], 2, record->secret, -1, SQLITE_STATIC) != SQLITE_OK
-        || sqlite3_bind_text(sql_stmts[INSERT_REC_STMT], 3, record->description, -1, SQLITE_STATIC) != SQLITE_OK) {
+    if ((sql_stmt = get_stmt(db, INSERT_REC_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
+    }
+
+    if (sqlite3_bind_text(sql_stmt, 1, record->username, -1, SQLITE_STATIC) != SQLITE_OK
+        || sqlite3_bind_text(sql_stmt, 2, record->secret, -1, SQLITE_STATIC) != SQLITE_OK
+        || sqlite3_bind_text(sql_stmt, 3, record->description, -1, SQLITE_STATIC) != SQLITE_OK) {
         fprintf(stderr, "Error: Failed to bind sql statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_reset(sql_stmts[INSERT_REC_STMT]);
-        sqlite3_clear_bindings(sql_stmts[INSERT_REC_STMT]);
+        release_stmt(sql_stmt);
         return CRXP_ERR;
     }
 
-    if (sqlite3_step(sql_stmts[INSERT_REC_STMT]) != SQLITE_DONE) {
+    if (sqlite3_step(sql_stmt) != SQLITE_DONE) {
         fprintf(stderr, "Error: Failed to execute statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_reset(sql_stmts[INSERT_REC_STMT]);
-        sqlite3_clear_bindings(sql_stmts[INSERT_REC_STMT]);
+        release_stmt(sql_stmt);
         return CRXP_ERR;
     }
 
-    sqlite3_reset(sql_stmts[INSERT_REC_STMT]);
-    sqlite3_clear_bindings(sql_stmts[INSERT_REC_STMT]);
+    release_stmt(sql_stmt);
+    metrics_add(METRIC_RECORDS_INSERTED, 1);
     return CRXP_OK;
 }
 
 int delete_record(sqlite3 *db, int record_id) {
-    if (sqlite3_bind_int(sql_stmts[DELETE_REC_STMT], 1, record_id) != SQLITE_OK) {
+    sqlite3_stmt *sql_stmt = NULL;
+
+    TRACE_SCOPE("delete_record");
+    if ((sql_stmt = get_stmt(db, DELETE_REC_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
+    }
+
+    if (sqlite3_bind_int(sql_stmt, 1, record_id) != SQLITE_OK) {
         fprintf(stderr, "Error: Failed to bind sql statement: %s", sqlite3_errmsg(db));
-        sqlite3_reset(sql_stmts[DELETE_REC_STMT]);
-        sqlite3_clear_bindings(sql_stmts[DELETE_REC_STMT]);
+        release_stmt(sql_stmt);
         return CRXP_ERR;
     }
 
-    if (sqlite3_step(sql_stmts[DELETE_REC_STMT]) != SQLITE_DONE) {
+    if (sqlite3_step(sql_stmt) != SQLITE_DONE) {
         fprintf(stderr, "Error: Failed to execute statement\n");
-        sqlite3_reset(sql_stmts[DELETE_REC_STMT]);
-        sqlite3_clear_bindings(sql_stmts[DELETE_REC_STMT]);
+        release_stmt(sql_stmt);
         return CRXP_ERR;
     }
 
-    sqlite3_reset(sql_stmts[DELETE_REC_STMT]);
-    sqlite3_clear_bindings(sql_stmts[DELETE_REC_STMT]);
+    release_stmt(sql_stmt);
+    metrics_add(METRIC_RECORDS_DELETED, 1);
     return CRXP_OK;
 }
 
+/**
+ * All fields in flags are written by one statement, so "Update All
+ * Fields" is a single parse (the first time) and a single write.
+ */
 int update_record(sqlite3 *db, secret_t *secret_record, int record_id, uint8_t flags) {
-    char *sql_fmt_str = NULL;
+    int param = 1;
     sqlite3_stmt *sql_stmt = NULL;
+    const char *fields[] = {secret_record->description, secret_record->secret, secret_record->username};
+    const char *empty[] = {"Error: Empty description\n", "Error: Empty secret\n", "Error: Empty username\n"};
 
-    if (flags & UPDATE_DESCRIPTION) {
-        if (secret_record->description[0] == '\0') {
-            fprintf(stderr, "Error: Empty description\n");
-            return CRXP_ERR;
-        }
+    TRACE_SCOPE("update_record");
+    flags &= UPDATE_ALL;
+    if (flags == 0) return CRXP_OK;
 
-        sql_fmt_str = "UPDATE secrets SET description = ? WHERE id = ?;";
-        if (!sql_prep_n_exec(db, sql_fmt_str, sql_stmt, secret_record->description, record_id)) {
+    for (size_t i = 0; i < sizeof(update_columns) / sizeof(update_columns[0]); i++) {
+        if ((flags & update_columns[i].flag) && fields[i][0] == '\0') {
+            fprintf(stderr, "%s", empty[i]);
             return CRXP_ERR;
         }
+    }
 
-        sqlite3_reset(sql_stmt);
-        sqlite3_finalize(sql_stmt);
+    if ((sql_stmt = get_stmt(db, UPDATE_REC_STMT + flags)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
     }
 
-    if (flags & UPDATE_SECRET) {
-        if (secret_record->secret[0] == '\0') {
-            fprintf(stderr, "Error: Empty secret\n");
+    for (size_t i = 0; i < sizeof(update_columns) / sizeof(update_columns[0]); i++) {
+        if (!(flags & update_columns[i].flag)) continue;
+        if (sqlite3_bind_text(sql_stmt, param++, fields[i], -1, SQLITE_STATIC) != SQLITE_OK) {
+            fprintf(stderr, "Error: Failed to bind sql statement: %s", sqlite3_errmsg(db));
+            release_stmt(sql_stmt);
             return CRXP_ERR;
         }
+    }
 
-        sql_fmt_str = "UPDATE secrets SET secret = ? WHERE id = ?;";
-        if (!sql_prep_n_exec(db, sql_fmt_str, sql_stmt, secret_record->secret, record_id)) {
-            return CRXP_ERR;
-        }
+    if (sqlite3_bind_int(sql_stmt, param, record_id) != SQLITE_OK || sqlite3_step(sql_stmt) != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to execute statement: %s\n", sqlite3_errmsg(db));
+        release_stmt(sql_stmt);
+        return CRXP_ERR;
+    }
 
-        sqlite3_reset(sql_stmt);
-        sqlite3_finalize(sql_stmt);
+    release_stmt(sql_stmt);
+    metrics_add(METRIC_RECORDS_UPDATED, 1);
+    return CRXP_OK;
+}
+
+static bool tag_separator(unsigned char ch) { return ch <= ' ' || ch == ',' || ch == ';'; }
+
+/**
+ * Copies the next tag of *text into name, TAG_MAX_LEN + 1 bytes, and
+ * moves *text past it. Tags are separated by commas, semicolons or
+ * white space, a longer one is cut on a UTF-8 boundary. Returns false
+ * when no tag is left.
+ */
+bool tag_next(const char **text, char *name) {
+    const unsigned char *p = (const unsigned char *) *text;
+
+    while (*p != '\0' && tag_separator(*p)) p++;
+    const unsigned char *start = p;
+    while (*p != '\0' && !tag_separator(*p)) p++;
+    *text = (const char *) p;
+    if (p == start) return false;
+
+    size_t len = (size_t) (p - start);
+    if (len > TAG_MAX_LEN) {
+        len = TAG_MAX_LEN;
+        while (len > 0 && (start[len] & 0xC0) == 0x80) len--;
     }
 
-    if (flags & UPDATE_USERNAME) {
-        if (secret_record->username[0] == '\0') {
-            fprintf(stderr, "Error: Empty username\n");
-            return CRXP_ERR;
-        }
+    memcpy(name, start, len);
+    name[len] = '\0';
+    return true;
+}
 
-        sql_fmt_str = "UPDATE secrets SET username = ? WHERE id = ?;";
-        if (!sql_prep_n_exec(db, sql_fmt_str, sql_stmt, secret_record->username, record_id)) {
-            return CRXP_ERR;
+static bool step_tag(sqlite3 *db, SQL_STMT id, const char *name, int64_t record_id) {
+    sqlite3_stmt *sql_stmt = NULL;
+    int param = 1;
+
+    if ((sql_stmt = get_stmt(db, id)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    bool ok = name == NULL || sqlite3_bind_text(sql_stmt, param++, name, -1, SQLITE_STATIC) == SQLITE_OK;
+    if (ok && record_id != 0) ok = sqlite3_bind_int64(sql_stmt, param, record_id) == SQLITE_OK;
+    if (!ok || sqlite3_step(sql_stmt) != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to execute statement: %s\n", sqlite3_errmsg(db));
+        release_stmt(sql_stmt);
+        return false;
+    }
+
+    release_stmt(sql_stmt);
+    return true;
+}
+
+/**
+ * Links record id to every tag in tags, creating the tags that are new.
+ * It runs in the caller's transaction, import adds tags in its batches.
+ */
+int add_tags(sqlite3 *db, int64_t id, const char *tags) {
+    char name[TAG_MAX_LEN + 1];
+
+    while (tag_next(&tags, name)) {
+        if (!step_tag(db, TAG_INSERT_STMT, name, 0) || !step_tag(db, TAG_LINK_STMT, name, id)) return CRXP_ERR;
+    }
+
+    return CRXP_OK;
+}
+
+/* Replaces the tags of record id in one transaction, "-" or no tag leaves it untagged */
+int set_tags(sqlite3 *db, int64_t id, const char *tags) {
+    TRACE_SCOPE("set_tags");
+    if (strcmp(tags, "-") == 0) tags = "";
+    if (!exec_stmt(db, BEGIN_STMT)) return CRXP_ERR;
+
+    if (!step_tag(db, TAG_CLEAR_STMT, NULL, id) || add_tags(db, id, tags) != CRXP_OK
+        || !step_tag(db, TAG_TOUCH_STMT, NULL, id) || !exec_stmt(db, COMMIT_STMT)) {
+        exec_stmt(db, ROLLBACK_STMT);
+        return CRXP_ERR;
+    }
+
+    metrics_add(METRIC_RECORDS_UPDATED, 1);
+    return CRXP_OK;
+}
+
+/* The tags of record id separated by spaces, as many as fit in size */
+bool fetch_tags(sqlite3 *db, int64_t id, char *tags, size_t size) {
+    int rc = SQLITE_ROW;
+    size_t len = 0;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    tags[0] = '\0';
+    if ((sql_stmt = get_stmt(db, RECORD_TAGS_STMT)) == NULL || sqlite3_bind_int64(sql_stmt, 1, id) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to read the tags: %s\n", sqlite3_errmsg(db));
+        if (sql_stmt != NULL) release_stmt(sql_stmt);
+        return false;
+    }
+
+    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        const char *name = (const char *) sqlite3_column_text(sql_stmt, 0);
+        size_t name_len = (size_t) sqlite3_column_bytes(sql_stmt, 0);
+        if (len + name_len + 2 > size) break;
+
+        if (len > 0) tags[len++] = ' ';
+        memcpy(tags + len, name, name_len);
+        len += name_len;
+        tags[len] = '\0';
+    }
+
+    bool ok = rc == SQLITE_ROW || rc == SQLITE_DONE;
+    if (!ok) fprintf(stderr, "Error: Failed to read the tags: %s\n", sqlite3_errmsg(db));
+    release_stmt(sql_stmt);
+    return ok;
+}
+
+/**
+ * Reads every tag and the ids of its records into tags. Both scans walk
+ * a primary key in order, tags by id and secret_tags by (tag_id,
+ * secret_id), so the links are matched to their tag in one pass.
+ */
+int load_tags(sqlite3 *db, tag_index_t *tags) {
+    int rc = SQLITE_ROW;
+    int tag = 0;
+    bool ok = true;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    TRACE_SCOPE("load_tags");
+    free_tags(tags);
+    if ((sql_stmt = get_stmt(db, TAGS_LOAD_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
+    }
+
+    while (ok && (rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        const char *name = (const char *) sqlite3_column_text(sql_stmt, 1);
+        ok = add_tag(tags, sqlite3_column_int64(sql_stmt, 0), name != NULL ? name : "");
+    }
+
+    release_stmt(sql_stmt);
+    if (ok && rc == SQLITE_DONE) {
+        if ((sql_stmt = get_stmt(db, TAG_IDS_STMT)) == NULL) rc = SQLITE_ERROR;
+        while (ok && sql_stmt != NULL && (rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+            int64_t tag_id = sqlite3_column_int64(sql_stmt, 0);
+            while (tag < tags->size && tags->data[tag].id < tag_id) tag++;
+            if (tag < tags->size && tags->data[tag].id == tag_id)
+                ok = add_tag_id(tags, tag, sqlite3_column_int64(sql_stmt, 1));
         }
 
-        sqlite3_reset(sql_stmt);
-        sqlite3_finalize(sql_stmt);
+        if (sql_stmt != NULL) release_stmt(sql_stmt);
+    }
+
+    if (ok && rc != SQLITE_DONE) fprintf(stderr, "Error: Failed to load the tags: %s\n", sqlite3_errmsg(db));
+    if (!ok || rc != SQLITE_DONE) {
+        free_tags(tags);
+        return CRXP_ERR;
     }
 
+    tags->loaded = true;
     return CRXP_OK;
 }
 
-int load_records(sqlite3 *db, record_array_t *records) {
-    const char *sql = "SELECT id, username, description FROM secrets ORDER BY id;";
-    if (sqlite3_exec(db, sql, tui_pipeline, records, NULL) != SQLITE_OK) {
+/**
+ * Appends up to limit more rows of the record list to records, every
+ * row left when limit is negative. The statement stays on the next row
+ * between calls, *done is set once the last one is in.
+ */
+int stream_records(sqlite3 *db, record_array_t *records, int limit, bool *done) {
+    int rc = SQLITE_ROW;
+    bool ok = true;
+    char *argv[RECORD_COLUMNS];
+    sqlite3_stmt *sql_stmt = NULL;
+
+    TRACE_SCOPE("stream_records");
+    *done = false;
+    if ((sql_stmt = get_stmt(db, LOAD_RECS_STMT)) == NULL) {
         fprintf(stderr, "Error: SQL error: %s\n", sqlite3_errmsg(db));
         return CRXP_ERR;
     }
 
+    for (int i = 0; ok && (limit < 0 || i < limit); i++) {
+        if ((rc = sqlite3_step(sql_stmt)) != SQLITE_ROW) break;
+        for (int j = 0; j < RECORD_COLUMNS; j++) argv[j] = (char *) sqlite3_column_text(sql_stmt, j);
+        if ((ok = tui_pipeline(records, RECORD_COLUMNS, argv, NULL) == 0))
+            records->seq = sqlite3_column_int64(sql_stmt, RECORD_COLUMNS);
+    }
+
+    if (ok && rc == SQLITE_ROW) return CRXP_OK;
+
+    sqlite3_reset(sql_stmt);
+    if (!ok || rc != SQLITE_DONE) {
+        fprintf(stderr, "Error: SQL error: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
+    }
+
+    *done = true;
     return CRXP_OK;
 }
 
+/* Lets go of a stream_records() read that was not finished, and of its snapshot */
+void stream_records_end(sqlite3 *db) {
+    sqlite3_stmt *sql_stmt = NULL;
+    if ((sql_stmt = get_stmt(db, LOAD_RECS_STMT)) != NULL) sqlite3_reset(sql_stmt);
+}
+
+int load_records(sqlite3 *db, record_array_t *records) {
+    bool done = false;
+    TRACE_SCOPE("load_records");
+    return stream_records(db, records, -1, &done);
+}
+
+/**
+ * Collects the records changed after *seq, in id order. Deleted ones
+ * go to removed with only their id set.
+ */
+static int fetch_changes(sqlite3 *db, int64_t *seq, record_array_t *upserts, record_array_t *removed) {
+    int rc = SQLITE_OK;
+    bool ok = true;
+    char *argv[RECORD_COLUMNS];
+    sqlite3_stmt *sql_stmt = NULL;
+
+    if ((sql_stmt = get_stmt(db, CHANGES_STMT)) == NULL || sqlite3_bind_int64(sql_stmt, 1, *seq) != SQLITE_OK) {
+        fprintf(stderr, "Error: SQL error: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
+    }
+
+    while (ok && (rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        if (sqlite3_column_type(sql_stmt, 1) == SQLITE_NULL) {
+            ok = add_record(removed, (record_t) {.id = sqlite3_column_int64(sql_stmt, 0)});
+        } else {
+            for (int i = 0; i < RECORD_COLUMNS; i++) argv[i] = (char *) sqlite3_column_text(sql_stmt, i);
+            ok = tui_pipeline(upserts, RECORD_COLUMNS, argv, NULL) == 0;
+        }
+
+        int64_t row_seq = sqlite3_column_int64(sql_stmt, RECORD_COLUMNS);
+        if (row_seq > *seq) *seq = row_seq;
+    }
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) fprintf(stderr, "Error: SQL error: %s\n", sqlite3_errmsg(db));
+    release_stmt(sql_stmt);
+    return ok && rc == SQLITE_DONE ? CRXP_OK : CRXP_ERR;
+}
+
+/**
+ * Brings records up to date with the rows changed after records->seq,
+ * patching the list in place: one pass drops removed rows (and rows
+ * the TUI marked DELETED), updates are written over their row and new
+ * rows are merged in from the end. A vault emptied elsewhere keeps its
+ * rows, marked DELETED, so the list is never left empty.
+ */
+int refresh_records(sqlite3 *db, record_array_t *records) {
+    int kept = 0;
+    int inserts = 0;
+    int64_t seq = records->seq;
+    record_array_t upserts = {0, 0, NULL, 0, NULL};
+    record_array_t removed = {0, 0, NULL, 0, NULL};
+
+    TRACE_SCOPE("refresh_records");
+    if (!fetch_changes(db, &seq, &upserts, &removed)) {
+        free_records(&upserts);
+        free_records(&removed);
+        return CRXP_ERR;
+    }
+
+    for (int i = 0, r = 0; i < records->size; i++) {
+        int64_t id = records->data[i].id;
+        while (r < removed.size && removed.data[r].id < id) r++;
+        if (id == DELETED || (r < removed.size && removed.data[r].id == id)) continue;
+        if (kept != i) records->data[kept] = records->data[i];
+        kept++;
+    }
+
+    /* Nothing was moved when nothing was kept, the old rows are still there */
+    if (kept == 0 && upserts.size == 0) {
+        for (int i = 0; i < records->size; i++) records->data[i].id = DELETED;
+        kept = records->size;
+    }
+
+    records->size = kept;
+    for (int i = 0; i < upserts.size; i++) {
+        int64_t index = find_record(records, upserts.data[i].id);
+        if (index >= 0) records->data[index] = upserts.data[i];
+        else upserts.data[inserts++] = upserts.data[i];
+    }
+
+    bool ok = true;
+    for (int i = 0; i < inserts && ok; i++) ok = add_record(records, upserts.data[i]);
+    for (int i = records->size - inserts - 1, j = inserts - 1, w = records->size - 1; ok && j >= 0; w--) {
+        if (i >= 0 && records->data[i].id > upserts.data[j].id) records->data[w] = records->data[i--];
+        else records->data[w] = upserts.data[j--];
+    }
+
+    free_records(&upserts);
+    free_records(&removed);
+    if (ok) records->seq = seq;
+    return ok ? CRXP_OK : CRXP_ERR;
+}
+
 meta_t *fetch_meta(void) {
     sqlite3 *meta_db = NULL;
     sqlite3_stmt *sql_stmt = NULL;
     meta_t *meta = NULL;
-    char *sql_str = "SELECT salt, version FROM meta WHERE id = ?;";
     int id = 1;
-    if ((meta_db = open_db(meta_db_path, SQLITE_OPEN_READWRITE)) == NULL) {
+    TRACE_SCOPE("fetch_meta");
+    if ((meta_db = meta_connection()) == NULL) {
         return NULL;
     }
 
-    if ((meta = malloc(sizeof(meta_t) + SALT_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
-    if (sqlite3_prepare_v2(meta_db, sql_str, -1, &sql_stmt, NULL) != SQLITE_OK) {
+    if ((sql_stmt = get_stmt(meta_db, META_FETCH_STMT)) == NULL) {
         fprintf(stderr, "Warning: Failed to prepare statement: %s\n", sqlite3_errmsg(meta_db));
-        sqlite3_close(meta_db);
-        free(meta);
         return NULL;
     }
 
+    if ((meta = malloc(sizeof(meta_t) + SALT_LEN)) == NULL) CRXP__OUT_OF_MEMORY();
     if (sqlite3_bind_int64(sql_stmt, 1, id) != SQLITE_OK) {
         fprintf(stderr, "Error: Failed to bind sql statement: %s", sqlite3_errmsg(meta_db));
-        sqlite3_finalize(sql_stmt);
-        sqlite3_close(meta_db);
+        release_stmt(sql_stmt);
         free(meta);
         return NULL;
     }
 
     if (sqlite3_step(sql_stmt) != SQLITE_ROW) {
         fprintf(stderr, "Error: Failed to execute statement: %s\n", sqlite3_errmsg(meta_db));
-        sqlite3_finalize(sql_stmt);
-        sqlite3_close(meta_db);
+        release_stmt(sql_stmt);
         free(meta);
         return NULL;
     }
 
-    uint8_t *salt = (uint8_t *) sqlite3_column_text(sql_stmt, 0);
+    const uint8_t *salt = sqlite3_column_blob(sql_stmt, 0);
     int salt_len = sqlite3_column_bytes(sql_stmt, 0);
     if (salt == NULL || salt_len != SALT_LEN) {
         fprintf(stderr, "Error: Invalid salt data\n");
-        sqlite3_finalize(sql_stmt);
-        sqlite3_close(meta_db);
+        release_stmt(sql_stmt);
+        free(meta);
+        return NULL;
+    }
+
+    int lanes = sqlite3_column_int(sql_stmt, 2);
+    if (lanes < 1 || lanes > KDF_LANES_MAX) {
+        fprintf(stderr, "Error: Invalid key derivation lanes: %d\n", lanes);
+        release_stmt(sql_stmt);
         free(meta);
         return NULL;
     }
 
     memcpy(meta->salt, salt, SALT_LEN);
     meta->version = (uint8_t) sqlite3_column_int(sql_stmt, 1);
+    meta->lanes = (uint32_t) lanes;
 
-    sqlite3_finalize(sql_stmt);
-    sqlite3_close(meta_db);
+    release_stmt(sql_stmt);
     return meta;
 }
 
 bool update_meta(sqlite3 *db, meta_t *meta) {
     int id = 1;
-    bool db_self = false;
-    char *sql_fmt_str = NULL;
     sqlite3_stmt *sql_stmt = NULL;
-    if (db == NULL) {
-        if ((db = open_db(meta_db_path, SQLITE_OPEN_READWRITE)) == NULL) return false;
-        db_self = true;
+    if (db == NULL && (db = meta_connection()) == NULL) return false;
+
+    if ((sql_stmt = get_stmt(db, META_UPDATE_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return false;
     }
 
-    sql_fmt_str = "UPDATE meta SET salt = ? WHERE id = ?;";
-    if (!sql_prep_n_exec(db, sql_fmt_str, sql_stmt, (char *) meta->salt, id)) {
-        sqlite3_finalize(sql_stmt);
-        if (db_self) sqlite3_close(db);
+    if (sqlite3_bind_blob(sql_stmt, 1, meta->salt, SALT_LEN, SQLITE_STATIC) != SQLITE_OK
+        || sqlite3_bind_int(sql_stmt, 2, (int) meta->lanes) != SQLITE_OK
+        || sqlite3_bind_int(sql_stmt, 3, id) != SQLITE_OK || sqlite3_step(sql_stmt) != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to update meta: %s\n", sqlite3_errmsg(db));
+        release_stmt(sql_stmt);
         return false;
     }
 
-    if (db_self) sqlite3_close(db);
-    sqlite3_finalize(sql_stmt);
+    release_stmt(sql_stmt);
     return true;
 }
 
 bool insert_meta(sqlite3 *db, meta_t *meta) {
-    bool db_self = false;
-    char *sql_fmt_str = NULL;
     sqlite3_stmt *sql_stmt = NULL;
-    sql_fmt_str = "INSERT INTO meta (salt, version) VALUES (?, ?);";
-
-    if (db == NULL) {
-        if ((db = open_db(meta_db_path, SQLITE_OPEN_READWRITE)) == NULL) return NULL;
-        db_self = true;
-    }
+    if (db == NULL && (db = meta_connection()) == NULL) return false;
 
-    if (sqlite3_prepare_v2(db, sql_fmt_str, -1, &sql_stmt, NULL) != SQLITE_OK) {
+    if ((sql_stmt = get_stmt(db, META_INSERT_STMT)) == NULL) {
         fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(sql_stmt);
-        if (db_self) sqlite3_close(db);
         return false;
     }
 
-    if (sqlite3_bind_text(sql_stmt, 1, (char *) meta->salt, -1, SQLITE_STATIC) != SQLITE_OK
-        || sqlite3_bind_int(sql_stmt, 2, meta->version) != SQLITE_OK) {
+    if (sqlite3_bind_blob(sql_stmt, 1, meta->salt, SALT_LEN, SQLITE_STATIC) != SQLITE_OK
+        || sqlite3_bind_int(sql_stmt, 2, meta->version) != SQLITE_OK
+        || sqlite3_bind_int(sql_stmt, 3, (int) meta->lanes) != SQLITE_OK) {
         fprintf(stderr, "Error: Failed to bind sql statement: %s", sqlite3_errmsg(db));
-        sqlite3_finalize(sql_stmt);
-        if (db_self) sqlite3_close(db);
+        release_stmt(sql_stmt);
         return false;
     }
 
     if (sqlite3_step(sql_stmt) != SQLITE_DONE) {
         fprintf(stderr, "Error: Failed to step through statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(sql_stmt);
-        if (db_self) sqlite3_close(db);
+        release_stmt(sql_stmt);
         return false;
     }
 
-    sqlite3_finalize(sql_stmt);
-    if (db_self) sqlite3_close(db);
+    release_stmt(sql_stmt);
     return true;
 }
 
-bool fetch_secret(MAYBE_UNUSED sqlite3 *db, const int64_t id) {
-    if (sqlite3_bind_int64(sql_stmts[FETCH_SEC_STMT], 1, id) != SQLITE_OK) {
-        sqlite3_reset(sql_stmts[FETCH_SEC_STMT]);
-        sqlite3_clear_bindings(sql_stmts[FETCH_SEC_STMT]);
+/**
+ * Reads the storage profile of the vault, SQLCipher's defaults when
+ * there is none. pending is set while a page size migration is between
+ * saving the new profile and moving the rewritten vault in place.
+ */
+bool fetch_profile(storage_profile_t *profile, bool *pending) {
+    bool ok = true;
+    sqlite3 *meta_db = NULL;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    *profile = STORAGE_PROFILE_DEFAULT;
+    if (pending != NULL) *pending = false;
+    if ((meta_db = meta_connection()) == NULL) return false;
+
+    /* Vaults from before storage profiles have no storage table */
+    if ((sql_stmt = get_stmt(meta_db, PROFILE_FETCH_STMT)) == NULL) return sqlite3_errcode(meta_db) == SQLITE_ERROR;
+    if (sqlite3_step(sql_stmt) == SQLITE_ROW) {
+        const char *spec = (const char *) sqlite3_column_text(sql_stmt, 0);
+        ok = spec != NULL && storage_parse(spec, profile);
+        if (pending != NULL) *pending = sqlite3_column_int(sql_stmt, 1) != 0;
+    }
+
+    release_stmt(sql_stmt);
+    return ok;
+}
+
+bool update_profile(sqlite3 *db, const storage_profile_t *profile, bool pending) {
+    char spec[STORAGE_SPEC_MAX];
+    sqlite3_stmt *sql_stmt = NULL;
+    char *sql_fmt_str
+        = "CREATE TABLE IF NOT EXISTS storage (id INTEGER PRIMARY KEY, profile TEXT NOT NULL, "
+          "pending INTEGER NOT NULL DEFAULT 0);";
+
+    if (db == NULL && (db = meta_connection()) == NULL) return false;
+    if (sqlite3_exec(db, sql_fmt_str, NULL, NULL, NULL) != SQLITE_OK
+        || (sql_stmt = get_stmt(db, PROFILE_SAVE_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return false;
     }
 
-    if (sqlite3_step(sql_stmts[FETCH_SEC_STMT]) != SQLITE_ROW) {
-        sqlite3_reset(sql_stmts[FETCH_SEC_STMT]);
-        sqlite3_clear_bindings(sql_stmts[FETCH_SEC_STMT]);
+    storage_format(profile, spec, sizeof(spec));
+    if (sqlite3_bind_text(sql_stmt, 1, spec, -1, SQLITE_TRANSIENT) != SQLITE_OK
+        || sqlite3_bind_int(sql_stmt, 2, pending) != SQLITE_OK || sqlite3_step(sql_stmt) != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to save the storage profile: %s\n", sqlite3_errmsg(db));
+        release_stmt(sql_stmt);
         return false;
     }
 
-    const char *tmp = (char *) sqlite3_column_text(sql_stmts[FETCH_SEC_STMT], 0);
-    int len = sqlite3_column_bytes(sql_stmts[FETCH_SEC_STMT], 0);
+    release_stmt(sql_stmt);
+    return true;
+}
+
+bool fetch_secret(sqlite3 *db, const int64_t id) {
+    sqlite3_stmt *sql_stmt = NULL;
+
+    if ((sql_stmt = get_stmt(db, FETCH_SEC_STMT)) == NULL) return false;
+    if (sqlite3_bind_int64(sql_stmt, 1, id) != SQLITE_OK || sqlite3_step(sql_stmt) != SQLITE_ROW) {
+        release_stmt(sql_stmt);
+        return false;
+    }
+
+    const char *tmp = (char *) sqlite3_column_text(sql_stmt, 0);
+    int len = sqlite3_column_bytes(sql_stmt, 0);
 
     display_secret(tmp, len);
-    sqlite3_reset(sql_stmts[FETCH_SEC_STMT]);
-    sqlite3_clear_bindings(sql_stmts[FETCH_SEC_STMT]);
+    release_stmt(sql_stmt);
     return true;
 }
+
+/**
+ * data_version changes whenever another connection commits to the
+ * vault, our own writes leave it alone. Sets *version and returns true
+ * when it moved since the last call.
+ */
+bool vault_changed(sqlite3 *db, int64_t *version) {
+    int64_t current = 0;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    if ((sql_stmt = get_stmt(db, DATA_VERSION_STMT)) == NULL) return false;
+    if (sqlite3_step(sql_stmt) == SQLITE_ROW) current = sqlite3_column_int64(sql_stmt, 0);
+    sqlite3_reset(sql_stmt);
+
+    if (current == 0 || current == *version) return false;
+    bool changed = *version != 0;
+    *version = current;
+    return changed;
+}
@@ -0,0 +1,122 @@
+#include "dedup.h"
+
+#include <sodium/crypto_shorthash.h>
+#include <sodium/randombytes.h>
+#include <sodium/utils.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "secmem.h"
+
+static uint64_t hash_fields(dedup_set_t *set, const char **fields, const size_t *sizes, int count) {
+    uint64_t hash = 0;
+    unsigned char digest[crypto_shorthash_BYTES];
+    unsigned char buf[SECRET_MAX_LEN + USERNAME_MAX_LEN + DESC_MAX_LEN + 8];
+    size_t len = 0;
+
+    /* Fields are length prefixed so ("ab", "c") and ("a", "bc") never collide */
+    for (int i = 0; i < count; i++) {
+        size_t field_len = strnlen(fields[i], sizes[i]);
+        buf[len++] = (unsigned char) (field_len >> 8);
+        buf[len++] = (unsigned char) field_len;
+        memcpy(buf + len, fields[i], field_len);
+        len += field_len;
+    }
+
+    crypto_shorthash(digest, buf, len, set->hash_key);
+    memcpy(&hash, digest, sizeof(hash));
+    sodium_memzero(buf, len);
+
+    return hash == 0 ? 1 : hash;
+}
+
+void dedup_hash(dedup_set_t *set, const secret_t *rec, dedup_entry_t *entry) {
+    const char *fields[] = {rec->username, rec->description, rec->secret};
+    const size_t sizes[] = {sizeof(rec->username), sizeof(rec->description), sizeof(rec->secret)};
+    entry->key = hash_fields(set, fields, sizes, set->match_secret ? 3 : 2);
+    entry->secret = hash_fields(set, fields + 2, sizes + 2, 1);
+}
+
+static dedup_entry_t *find_slot(dedup_entry_t *data, size_t capacity, uint64_t key) {
+    size_t i = key & (capacity - 1);
+    while (data[i].key != 0 && data[i].key != key) i = (i + 1) & (capacity - 1);
+    return &data[i];
+}
+
+static bool grow(dedup_set_t *set) {
+    size_t capacity = set->capacity == 0 ? DEDUP_MIN_CAPACITY : set->capacity * 2;
+    dedup_entry_t *data = calloc(capacity, sizeof(dedup_entry_t));
+    if (data == NULL) return false;
+
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->data[i].key != 0) *find_slot(data, capacity, set->data[i].key) = set->data[i];
+    }
+
+    free(set->data);
+    set->data = data;
+    set->capacity = capacity;
+    return true;
+}
+
+dedup_entry_t *dedup_find(dedup_set_t *set, const dedup_entry_t *entry) {
+    if (set->capacity == 0) return NULL;
+    dedup_entry_t *slot = find_slot(set->data, set->capacity, entry->key);
+    return slot->key == 0 ? NULL : slot;
+}
+
+bool dedup_add(dedup_set_t *set, const dedup_entry_t *entry) {
+    /* Keep the load factor under 1/2 so probe chains stay short */
+    if ((set->size + 1) * 2 > set->capacity && !grow(set)) return false;
+
+    dedup_entry_t *slot = find_slot(set->data, set->capacity, entry->key);
+    if (slot->key == 0) set->size++;
+    *slot = *entry;
+    return true;
+}
+
+bool dedup_init(dedup_set_t *set, sqlite3 *db, bool match_secret) {
+    secret_t *rec = NULL;
+    dedup_entry_t entry = {0};
+    sqlite3_stmt *sql_stmt = NULL;
+    int rc = SQLITE_ERROR;
+
+    memset(set, 0, sizeof(dedup_set_t));
+    set->match_secret = match_secret;
+    randombytes_buf(set->hash_key, sizeof(set->hash_key));
+
+    if ((sql_stmt = get_stmt(db, DEDUP_SCAN_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    if ((rec = secmem_alloc(sizeof(secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    while ((rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        snprintf(rec->username, sizeof(rec->username), "%s", (const char *) sqlite3_column_text(sql_stmt, 1));
+        snprintf(rec->secret, sizeof(rec->secret), "%s", (const char *) sqlite3_column_text(sql_stmt, 2));
+        snprintf(rec->description, sizeof(rec->description), "%s", (const char *) sqlite3_column_text(sql_stmt, 3));
+
+        dedup_hash(set, rec, &entry);
+        entry.id = sqlite3_column_int64(sql_stmt, 0);
+        if (!dedup_add(set, &entry)) CRXP__OUT_OF_MEMORY();
+    }
+
+    secmem_free(rec);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to read existing entries: %s\n", sqlite3_errmsg(db));
+        release_stmt(sql_stmt);
+        dedup_free(set);
+        return false;
+    }
+
+    release_stmt(sql_stmt);
+    return true;
+}
+
+void dedup_free(dedup_set_t *set) {
+    free(set->data);
+    sodium_memzero(set, sizeof(dedup_set_t));
+}
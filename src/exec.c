@@ -0,0 +1,135 @@
+#include "exec.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <sodium/utils.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "trace.h"
+
+extern char **environ;
+
+/* A letter or '_', then letters, digits and '_', so every shell can read it */
+static bool valid_name(const char *name, size_t len) {
+    if (len == 0 || len > EXEC_NAME_MAX || isdigit((unsigned char) name[0])) return false;
+
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_') return false;
+    }
+
+    return true;
+}
+
+/* Parses NAME=key arguments, the key as lookup_parse() reads it: id:42 or user:svc,desc:prod* */
+exec_env_t *exec_parse(char **specs, int count) {
+    exec_env_t *env = NULL;
+
+    if ((env = calloc(1, sizeof(exec_env_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((env->names = calloc((size_t) count, sizeof(char *))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((env->keys = calloc((size_t) count, sizeof(lookup_key_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    env->count = count;
+
+    for (int i = 0; i < count; i++) {
+        size_t len = strcspn(specs[i], "=");
+        if (specs[i][len] != '=' || !valid_name(specs[i], len)) {
+            fprintf(stderr, "Error: exec variables are NAME=key, got: %s\n", specs[i]);
+            exec_free(env);
+            return NULL;
+        }
+
+        for (int j = 0; j < i; j++) {
+            if (strncmp(env->names[j], specs[i], len + 1) != 0) continue;
+            fprintf(stderr, "Error: %.*s is given twice\n", (int) len, specs[i]);
+            exec_free(env);
+            return NULL;
+        }
+
+        env->names[i] = specs[i];
+        if (!lookup_parse(&env->keys[i], specs[i] + len + 1, strlen(specs[i] + len + 1))) {
+            exec_free(env);
+            return NULL;
+        }
+    }
+
+    return env;
+}
+
+static bool overridden(const exec_env_t *env, const char *var) {
+    for (int i = 0; i < env->count; i++) {
+        if (strncmp(var, env->names[i], strcspn(env->names[i], "=") + 1) == 0) return true;
+    }
+
+    return false;
+}
+
+/**
+ * Resolves every key with one query and lays the NAME=secret strings out
+ * in one sodium_malloc block, read-only once written. The copies the
+ * lookup made are wiped as soon as they are in there.
+ */
+bool exec_resolve(exec_env_t *env, sqlite3 *db) {
+    size_t len = 0;
+    size_t inherited = 0;
+    char **secrets = NULL;
+
+    TRACE_SCOPE("exec_resolve");
+    if ((secrets = lookup_secrets(db, env->keys, env->count)) == NULL) return false;
+
+    for (int i = 0; i < env->count; i++) env->block_size += strcspn(env->names[i], "=") + strlen(secrets[i]) + 2;
+    while (environ[inherited] != NULL) inherited++;
+    if ((env->block = sodium_malloc(env->block_size)) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((env->envp = calloc(inherited + (size_t) env->count + 1, sizeof(char *))) == NULL) CRXP__OUT_OF_MEMORY();
+
+    size_t vars = 0;
+    for (size_t i = 0; i < inherited; i++) {
+        if (!overridden(env, environ[i])) env->envp[vars++] = environ[i];
+    }
+
+    for (int i = 0; i < env->count; i++) {
+        size_t name_len = strcspn(env->names[i], "=") + 1;
+        size_t secret_len = strlen(secrets[i]) + 1;
+
+        env->envp[vars++] = env->block + len;
+        memcpy(env->block + len, env->names[i], name_len);
+        memcpy(env->block + len + name_len, secrets[i], secret_len);
+        len += name_len + secret_len;
+    }
+
+    lookup_secrets_free(secrets);
+    sodium_mprotect_readonly(env->block);
+    metrics_add(METRIC_SECRETS_READ, (uint64_t) env->count);
+    return true;
+}
+
+/**
+ * Replaces cruxpass with argv[0], searched in PATH, under the built
+ * environment; the block goes away with the old process image. Returns
+ * only if the command could not be started.
+ */
+void exec_run(exec_env_t *env, char **argv) {
+    char **inherited = environ;
+
+    trace_dump();
+    fflush(NULL);
+    environ = env->envp;
+    execvp(argv[0], argv);
+
+    int err = errno;
+    environ = inherited;
+    fprintf(stderr, "Error: Failed to run %s: %s\n", argv[0], strerror(err));
+}
+
+void exec_free(exec_env_t *env) {
+    if (env == NULL) return;
+
+    if (env->block != NULL) sodium_free(env->block);
+    free(env->envp);
+    free(env->names);
+    free(env->keys);
+    free(env);
+}
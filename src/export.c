@@ -0,0 +1,385 @@
+#include "export.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sodium/utils.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "database.h"
+#include "metrics.h"
+#include "trace.h"
+
+bool outbuf_open(outbuf_t *out, int fd) {
+    memset(out, 0, sizeof(outbuf_t));
+    out->fd = fd;
+    if ((out->data = sodium_malloc(OUTBUF_SIZE)) == NULL) CRXP__OUT_OF_MEMORY();
+    return true;
+}
+
+bool outbuf_flush(outbuf_t *out) {
+    size_t done = 0;
+
+    while (!out->failed && done < out->used) {
+        ssize_t written = write(out->fd, out->data + done, out->used - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            fprintf(stderr, "Error: Failed to write output: %s\n", strerror(errno));
+            out->failed = true;
+            break;
+        }
+
+        done += (size_t) written;
+        out->written += (uint64_t) written;
+    }
+
+    out->used = 0;
+    return !out->failed;
+}
+
+/**
+ * Flushes what is left and wipes the buffer. The descriptor is left
+ * open, it belongs to the caller.
+ */
+bool outbuf_close(outbuf_t *out) {
+    bool ok = outbuf_flush(out);
+    sodium_free(out->data);
+    out->data = NULL;
+    return ok;
+}
+
+void outbuf_write(outbuf_t *out, const char *data, size_t len) {
+    while (len > 0) {
+        if (out->used == OUTBUF_SIZE) outbuf_flush(out);
+
+        size_t chunk = OUTBUF_SIZE - out->used;
+        if (chunk > len) chunk = len;
+
+        memcpy(out->data + out->used, data, chunk);
+        out->used += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void outbuf_puts(outbuf_t *out, const char *str) { outbuf_write(out, str, strlen(str)); }
+
+void outbuf_printf(outbuf_t *out, const char *fmt, ...) {
+    va_list args;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_start(args, fmt);
+        int len = vsnprintf(out->data + out->used, OUTBUF_SIZE - out->used, fmt, args);
+        va_end(args);
+
+        if (len < 0) return;
+        if ((size_t) len < OUTBUF_SIZE - out->used) {
+            out->used += (size_t) len;
+            return;
+        }
+
+        outbuf_flush(out);
+    }
+}
+
+/* RFC 4180: quote only fields that need it, double embedded quotes */
+void write_csv_field(outbuf_t *out, const char *str, int len) {
+    if (memchr(str, '"', len) == NULL && memchr(str, ',', len) == NULL && memchr(str, '\n', len) == NULL
+        && memchr(str, '\r', len) == NULL) {
+        outbuf_write(out, str, len);
+        return;
+    }
+
+    outbuf_putc(out, '"');
+    for (int i = 0; i < len; i++) {
+        if (str[i] == '"') outbuf_putc(out, '"');
+        outbuf_putc(out, str[i]);
+    }
+    outbuf_putc(out, '"');
+}
+
+void write_json_string(outbuf_t *out, const char *str, int len) {
+    int start = 0;
+
+    outbuf_putc(out, '"');
+    for (int i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        outbuf_write(out, str + start, i - start);
+        start = i + 1;
+
+        switch (c) {
+            case '"':
+                outbuf_puts(out, "\\\"");
+                break;
+            case '\\':
+                outbuf_puts(out, "\\\\");
+                break;
+            case '\n':
+                outbuf_puts(out, "\\n");
+                break;
+            case '\r':
+                outbuf_puts(out, "\\r");
+                break;
+            case '\t':
+                outbuf_puts(out, "\\t");
+                break;
+            default:
+                outbuf_printf(out, "\\u%04x", c);
+        }
+    }
+
+    outbuf_write(out, str + start, len - start);
+    outbuf_putc(out, '"');
+}
+
+/* Control characters other than tab and newlines are not allowed in XML 1.0, they are dropped */
+void write_xml_text(outbuf_t *out, const char *str, int len) {
+    int start = 0;
+
+    for (int i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) str[i];
+        const char *entity = NULL;
+
+        if (c == '&') entity = "&amp;";
+        else if (c == '<') entity = "&lt;";
+        else if (c == '>') entity = "&gt;";
+        else if (c == '"') entity = "&quot;";
+        else if (c == '\'') entity = "&apos;";
+        else if (c >= 0x20 || c == '\t' || c == '\n' || c == '\r') continue;
+        else entity = "";
+
+        outbuf_write(out, str + start, i - start);
+        outbuf_puts(out, entity);
+        start = i + 1;
+    }
+
+    outbuf_write(out, str + start, len - start);
+}
+
+/* Tabs, newlines and backslashes are escaped the way PostgreSQL's text format does, one record stays one line */
+void write_tsv_field(outbuf_t *out, const char *str, int len) {
+    int start = 0;
+
+    for (int i = 0; i < len; i++) {
+        const char *escape = NULL;
+
+        if (str[i] == '\t') escape = "\\t";
+        else if (str[i] == '\n') escape = "\\n";
+        else if (str[i] == '\r') escape = "\\r";
+        else if (str[i] == '\\') escape = "\\\\";
+        else continue;
+
+        outbuf_write(out, str + start, i - start);
+        outbuf_puts(out, escape);
+        start = i + 1;
+    }
+
+    outbuf_write(out, str + start, len - start);
+}
+
+#define FIELD(row, f) (row)->fields[f], (row)->lens[f]
+
+static void csv_begin(outbuf_t *out) { outbuf_puts(out, "Username,Secret,Description\r\n"); }
+
+static void csv_row(outbuf_t *out, const export_row_t *row, size_t index) {
+    (void) index;
+    write_csv_field(out, FIELD(row, EXPORT_USERNAME));
+    outbuf_putc(out, ',');
+    write_csv_field(out, FIELD(row, EXPORT_SECRET));
+    outbuf_putc(out, ',');
+    write_csv_field(out, FIELD(row, EXPORT_DESCRIPTION));
+    outbuf_puts(out, "\r\n");
+}
+
+static void jsonl_row(outbuf_t *out, const export_row_t *row, size_t index) {
+    (void) index;
+    outbuf_printf(out, "{\"id\":%lld,\"username\":", (long long) row->id);
+    write_json_string(out, FIELD(row, EXPORT_USERNAME));
+    if (row->fields[EXPORT_SECRET] != NULL) {
+        outbuf_puts(out, ",\"secret\":");
+        write_json_string(out, FIELD(row, EXPORT_SECRET));
+    }
+    outbuf_puts(out, ",\"description\":");
+    write_json_string(out, FIELD(row, EXPORT_DESCRIPTION));
+    outbuf_puts(out, ",\"date_added\":");
+    write_json_string(out, FIELD(row, EXPORT_DATE_ADDED));
+    outbuf_puts(out, ",\"date_modified\":");
+    write_json_string(out, FIELD(row, EXPORT_DATE_MODIFIED));
+    outbuf_puts(out, "}\n");
+}
+
+/* No header, and the secret comes last so the other columns keep their place without it */
+static void tsv_row(outbuf_t *out, const export_row_t *row, size_t index) {
+    (void) index;
+    outbuf_printf(out, "%lld\t", (long long) row->id);
+    write_tsv_field(out, FIELD(row, EXPORT_USERNAME));
+    outbuf_putc(out, '\t');
+    write_tsv_field(out, FIELD(row, EXPORT_DESCRIPTION));
+    outbuf_putc(out, '\t');
+    write_tsv_field(out, FIELD(row, EXPORT_DATE_ADDED));
+    outbuf_putc(out, '\t');
+    write_tsv_field(out, FIELD(row, EXPORT_DATE_MODIFIED));
+    if (row->fields[EXPORT_SECRET] != NULL) {
+        outbuf_putc(out, '\t');
+        write_tsv_field(out, FIELD(row, EXPORT_SECRET));
+    }
+    outbuf_putc(out, '\n');
+}
+
+static void keepass_begin(outbuf_t *out) {
+    outbuf_puts(out,
+                "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\n"
+                "<KeePassFile>\n"
+                "\t<Root>\n"
+                "\t\t<Group>\n"
+                "\t\t\t<Name>cruxpass</Name>\n");
+}
+
+static void keepass_string(outbuf_t *out, const char *key, const char *value, int len, bool protect) {
+    outbuf_puts(out, "\t\t\t\t<String><Key>");
+    outbuf_puts(out, key);
+    outbuf_puts(out, protect ? "</Key><Value ProtectInMemory=\"True\">" : "</Key><Value>");
+    write_xml_text(out, value, len);
+    outbuf_puts(out, "</Value></String>\n");
+}
+
+static void keepass_row(outbuf_t *out, const export_row_t *row, size_t index) {
+    (void) index;
+    outbuf_puts(out, "\t\t\t<Entry>\n");
+    keepass_string(out, "Title", FIELD(row, EXPORT_DESCRIPTION), false);
+    keepass_string(out, "UserName", FIELD(row, EXPORT_USERNAME), false);
+    keepass_string(out, "Password", FIELD(row, EXPORT_SECRET), true);
+    if (row->lens[EXPORT_DATE_ADDED] > 0) {
+        outbuf_puts(out, "\t\t\t\t<Times><CreationTime>");
+        write_xml_text(out, FIELD(row, EXPORT_DATE_ADDED));
+        outbuf_puts(out, "T00:00:00Z</CreationTime>");
+        if (row->lens[EXPORT_DATE_MODIFIED] > 0) {
+            outbuf_puts(out, "<LastModificationTime>");
+            write_xml_text(out, FIELD(row, EXPORT_DATE_MODIFIED));
+            outbuf_puts(out, "T00:00:00Z</LastModificationTime>");
+        }
+        outbuf_puts(out, "</Times>\n");
+    }
+    outbuf_puts(out, "\t\t\t</Entry>\n");
+}
+
+static void keepass_end(outbuf_t *out) {
+    outbuf_puts(out,
+                "\t\t</Group>\n"
+                "\t</Root>\n"
+                "</KeePassFile>\n");
+}
+
+/* Unencrypted Bitwarden export, every record becomes a login item */
+static void bitwarden_begin(outbuf_t *out) { outbuf_puts(out, "{\"encrypted\":false,\"folders\":[],\"items\":["); }
+
+static void bitwarden_row(outbuf_t *out, const export_row_t *row, size_t index) {
+    if (index > 0) outbuf_putc(out, ',');
+    outbuf_puts(out, "\n{\"type\":1,\"name\":");
+    write_json_string(out, FIELD(row, EXPORT_DESCRIPTION));
+    outbuf_puts(out, ",\"notes\":null,\"favorite\":false,\"login\":{\"username\":");
+    write_json_string(out, FIELD(row, EXPORT_USERNAME));
+    outbuf_puts(out, ",\"password\":");
+    write_json_string(out, FIELD(row, EXPORT_SECRET));
+    outbuf_puts(out, ",\"uris\":[],\"totp\":null}}");
+}
+
+static void bitwarden_end(outbuf_t *out) { outbuf_puts(out, "\n]}\n"); }
+
+static const export_writer_t writers[EXPORT_FORMAT_COUNT] = {
+    [EXPORT_CSV] = {"csv", csv_begin, csv_row, NULL},
+    [EXPORT_JSONL] = {"jsonl", NULL, jsonl_row, NULL},
+    [EXPORT_KEEPASS] = {"keepass", keepass_begin, keepass_row, keepass_end},
+    [EXPORT_BITWARDEN] = {"bitwarden", bitwarden_begin, bitwarden_row, bitwarden_end},
+    [EXPORT_TSV] = {"tsv", NULL, tsv_row, NULL},
+};
+
+const export_writer_t *export_writer(EXPORT_FORMAT format) {
+    if (format >= EXPORT_FORMAT_COUNT) return NULL;
+    return &writers[format];
+}
+
+/**
+ * Streams every matching row from one cursor straight into the writer,
+ * column pointers are used in place so nothing is allocated per row.
+ * The cursor's columns are id, then the EXPORT_* fields in order.
+ */
+bool export_rows(sqlite3_stmt *stmt, const export_writer_t *writer, outbuf_t *out, size_t *count) {
+    int rc = SQLITE_OK;
+    export_row_t row = {0};
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && !out->failed) {
+        row.id = sqlite3_column_int64(stmt, 0);
+        for (int i = 0; i < EXPORT_FIELD_COUNT; i++) {
+            row.fields[i] = (const char *) sqlite3_column_text(stmt, i + 1);
+            row.lens[i] = sqlite3_column_bytes(stmt, i + 1);
+            if (row.fields[i] == NULL && i != EXPORT_SECRET) row.fields[i] = "";
+        }
+
+        writer->row(out, &row, (*count)++);
+    }
+
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+        fprintf(stderr, "Error: Failed to read records: %s\n", sqlite3_errstr(rc));
+        return false;
+    }
+
+    return !out->failed;
+}
+
+int export_secrets(sqlite3 *db, const char *export_file, const export_opts_t *opts) {
+    int fd = -1;
+    size_t count = 0;
+    outbuf_t out = {0};
+    struct stat file_stat = {0};
+    sqlite3_stmt *stmt = NULL;
+    const export_writer_t *writer = NULL;
+
+    TRACE_SCOPE("export_secrets");
+
+    if ((writer = export_writer(opts->format)) == NULL) {
+        fprintf(stderr, "Error: Unknown export format\n");
+        return CRXP_ERR;
+    }
+
+    if ((stmt = get_stmt(db, opts->filter != NULL ? EXPORT_FILTER_STMT : EXPORT_ALL_STMT)) == NULL) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return CRXP_ERR;
+    }
+
+    if (opts->filter != NULL && sqlite3_bind_text(stmt, 1, opts->filter, -1, SQLITE_STATIC) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to bind filter: %s\n", sqlite3_errmsg(db));
+        release_stmt(stmt);
+        return CRXP_ERR;
+    }
+
+    /* Exports hold every secret in the clear, keep them private to the user */
+    if ((fd = open(export_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", export_file, strerror(errno));
+        release_stmt(stmt);
+        return CRXP_ERR;
+    }
+
+    outbuf_open(&out, fd);
+    if (writer->begin != NULL) writer->begin(&out);
+    bool ok = export_rows(stmt, writer, &out, &count);
+    if (ok && writer->end != NULL) writer->end(&out);
+
+    ok = outbuf_close(&out) && ok;
+    release_stmt(stmt);
+
+    /* A cut short export still holds secrets in the clear, drop it unless it is a device or pipe */
+    bool regular = fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+    if (close(fd) != 0) ok = false;
+    if (!ok && regular) unlink(export_file);
+    if (ok) fprintf(stderr, "Info: %zu records written as %s\n", count, writer->name);
+    metrics_add(METRIC_EXPORT_ROWS, count);
+    metrics_add(METRIC_EXPORT_BYTES, out.written);
+    return ok ? CRXP_OK : CRXP_ERR;
+}
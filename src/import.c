@@ -0,0 +1,626 @@
+#include "import.h"
+
+#include <sodium/utils.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "database.h"
+#include "metrics.h"
+#include "parser.h"
+#include "secmem.h"
+#include "trace.h"
+
+typedef enum {
+    ITEM_USERNAME,
+    ITEM_SECRET,
+    ITEM_TITLE,
+    ITEM_URL,
+    ITEM_TAGS,
+    ITEM_FIELD_COUNT
+} ITEM_FIELD;
+
+/* One entry of a foreign export, staged until its end tag/brace */
+typedef struct {
+    secret_t rec;
+    bool has_title;
+    bool truncated;
+    bool too_long;
+} import_item_t;
+
+_Static_assert(sizeof(import_item_t) <= SECMEM_LARGE_SLOT, "items must fit a slot");
+
+#define BITWARDEN_ID_LEN 36 /* a UUID */
+#define UTF8_BOM "\xEF\xBB\xBF"
+
+/* Bitwarden items name their folder by id, the folders come first */
+typedef struct {
+    char id[BITWARDEN_ID_LEN + 1];
+    char name[TAG_MAX_LEN + 1];
+} bitwarden_folder_t;
+
+typedef struct {
+    size_t size;
+    size_t capacity;
+    bitwarden_folder_t *data;
+} bitwarden_folders_t;
+
+/**
+ * Rows are written in IMPORT_BATCH_SIZE transactions, a single
+ * commit per batch instead of a journal sync per row.
+ */
+static bool sink_commit(import_sink_t *sink, bool reopen) {
+    if (!exec_stmt(sink->db, COMMIT_STMT)) return false;
+    sink->pending = 0;
+    return !reopen || exec_stmt(sink->db, BEGIN_STMT);
+}
+
+bool import_begin(import_sink_t *sink, sqlite3 *db, const import_opts_t *opts) {
+    memset(sink, 0, sizeof(import_sink_t));
+    sink->db = db;
+    sink->opts = opts;
+
+    if (opts->mode != DEDUP_KEEP && !dedup_init(&sink->set, db, opts->match_secret)) return false;
+    if (!exec_stmt(db, BEGIN_STMT)) {
+        dedup_free(&sink->set);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Writes rec and tags it with sink->tags, which are cleared for the
+ * next record. A duplicate that is skipped still gets the tags.
+ */
+int import_record(import_sink_t *sink, secret_t *rec) {
+    char tags[TAGS_MAX_LEN + 1];
+    dedup_entry_t entry = {0};
+    dedup_entry_t *match = NULL;
+
+    memcpy(tags, sink->tags, sizeof(tags));
+    sink->tags[0] = '\0';
+    if (sink->opts->mode != DEDUP_KEEP) {
+        dedup_hash(&sink->set, rec, &entry);
+        match = dedup_find(&sink->set, &entry);
+    }
+
+    if (match != NULL) {
+        if (sink->opts->mode == DEDUP_SKIP || match->secret == entry.secret) {
+            sink->skipped++;
+            return tags[0] == '\0' || add_tags(sink->db, match->id, tags) ? CRXP_OK : CRXP_ERR;
+        }
+
+        if (!update_record(sink->db, rec, match->id, UPDATE_SECRET)) return CRXP_ERR;
+        match->secret = entry.secret;
+        entry.id = match->id;
+        sink->updated++;
+    } else {
+        if (!insert_record(sink->db, rec)) return CRXP_ERR;
+        entry.id = sqlite3_last_insert_rowid(sink->db);
+        if (sink->opts->mode != DEDUP_KEEP && !dedup_add(&sink->set, &entry)) CRXP__OUT_OF_MEMORY();
+        sink->inserted++;
+    }
+
+    if (tags[0] != '\0' && !add_tags(sink->db, entry.id, tags)) return CRXP_ERR;
+    if (++sink->pending >= IMPORT_BATCH_SIZE && !sink->atomic && !sink_commit(sink, true)) return CRXP_ERR;
+    return CRXP_OK;
+}
+
+/**
+ * Commits the open batch, or rolls it back when the importer gave up
+ * (ok == false), and prints the summary.
+ */
+bool import_end(import_sink_t *sink, bool ok) {
+    if (ok) ok = sink_commit(sink, false);
+    if (!ok) exec_stmt(sink->db, ROLLBACK_STMT);
+    if (ok) metrics_add(METRIC_IMPORT_ROWS, sink->inserted + sink->updated);
+
+    fprintf(stderr, "Info: %zu inserted, %zu updated, %zu skipped as duplicates\n", sink->inserted, sink->updated,
+            sink->skipped);
+    if (sink->truncated > 0)
+        fprintf(stderr, "Warning: %zu records had a username or description cut to %d/%d characters\n",
+                sink->truncated, USERNAME_MAX_LEN, DESC_MAX_LEN - 1);
+    if (sink->rejected > 0)
+        fprintf(stderr, "Warning: %zu entries skipped: no secret, or a secret longer than %d characters\n",
+                sink->rejected, SECRET_MAX_LEN);
+    if (sink->ignored > 0) fprintf(stderr, "Info: %zu non-login items skipped\n", sink->ignored);
+
+    dedup_free(&sink->set);
+    return ok;
+}
+
+/**
+ * Copies a parsed value into a record field, cutting it on a UTF-8
+ * boundary when it does not fit. Returns false if anything was cut.
+ */
+static bool copy_field(char *dst, size_t size, const token_t *src) {
+    size_t len = src->len;
+    bool whole = !src->truncated;
+
+    if (len > size - 1) {
+        len = size - 1;
+        while (len > 0 && (src->data[len] & 0xC0) == 0x80) len--;
+        whole = false;
+    }
+
+    memcpy(dst, src->data, len);
+    dst[len] = '\0';
+    return whole;
+}
+
+static void item_set(import_item_t *item, ITEM_FIELD field, const token_t *value) {
+    secret_t *rec = &item->rec;
+
+    switch (field) {
+        case ITEM_USERNAME:
+            item->truncated |= !copy_field(rec->username, sizeof(rec->username), value);
+            break;
+        case ITEM_SECRET:
+            item->too_long = value->truncated || value->len > SECRET_MAX_LEN;
+            if (!item->too_long) copy_field(rec->secret, sizeof(rec->secret), value);
+            break;
+        case ITEM_TITLE:
+            if (value->len == 0) break;
+            item->truncated |= !copy_field(rec->description, sizeof(rec->description), value);
+            item->has_title = true;
+            break;
+        case ITEM_URL:
+            /* An entry without a title is described by its address */
+            if (!item->has_title) copy_field(rec->description, sizeof(rec->description), value);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Adds the tags in data to those of the next record, as many whole tags
+ * as fit. A folder is a single name (single == true), its separators
+ * become '-' so it stays one tag.
+ */
+static void sink_tags(import_sink_t *sink, const char *data, size_t data_len, bool single) {
+    char text[TAGS_MAX_LEN + 1];
+    char name[TAG_MAX_LEN + 1];
+    const char *next = text;
+    size_t len = strlen(sink->tags);
+
+    if (data_len > TAGS_MAX_LEN) {
+        data_len = TAGS_MAX_LEN;
+        while (data_len > 0 && (data[data_len] & 0xC0) == 0x80) data_len--;
+    }
+
+    memcpy(text, data, data_len);
+    text[data_len] = '\0';
+    for (char *c = text; single && *c != '\0'; c++) {
+        if ((unsigned char) *c <= ' ' || *c == ',' || *c == ';') *c = '-';
+    }
+
+    while (tag_next(&next, name)) {
+        size_t name_len = strlen(name);
+        if (len + name_len + 1 > TAGS_MAX_LEN) break;
+
+        if (len > 0) sink->tags[len++] = ' ';
+        memcpy(sink->tags + len, name, name_len + 1);
+        len += name_len;
+    }
+}
+
+static void item_commit(import_sink_t *sink, import_item_t *item, size_t line_number) {
+    if (item->too_long || item->rec.secret[0] == '\0') {
+        sink->tags[0] = '\0';
+        sink->rejected++;
+    } else {
+        if (item->truncated) sink->truncated++;
+        if (!import_record(sink, &item->rec)) fprintf(stderr, "Error: Failed to insert record near line: %zu\n", line_number);
+    }
+
+    sodium_memzero(item, sizeof(import_item_t));
+}
+
+/**
+ * @field: password_t field
+ * @max_length: field MAX, a const
+ * @field_name: for error handling
+ * @line_number also for error handling
+ */
+static int process_field(char *field, const int max_length, const token_t *token, const char *field_name,
+                         size_t line_number) {
+    if (token == NULL) {
+        fprintf(stderr, "Error: Missing %s at line %zu\n", field_name, line_number);
+        return CRXP_ERR;
+    }
+
+    if (token->truncated || (const int) token->len > max_length) {
+        fprintf(stderr, "Error: %s at line %zu is more than %d characters\n", field_name, line_number, max_length);
+        return CRXP_ERR;
+    }
+
+    if (token->len < FIELD_MIN && (max_length != SECRET_MAX_LEN)) {
+        fprintf(stderr, "Error: %s at line %zu is less than %d characters\n", field_name, line_number, FIELD_MIN);
+        return CRXP_ERR;
+    } else if (token->len < SECRET_MIN_LEN && (max_length == SECRET_MAX_LEN)) {
+        fprintf(stderr, "Error: %s at line %zu is less than %d characters\n", field_name, line_number, SECRET_MIN_LEN);
+        return CRXP_ERR;
+    }
+
+    memcpy(field, token->data, token->len + 1);
+    return CRXP_OK;
+}
+
+/**
+ * Maps header names onto fields, covering cruxpass, 1Password and
+ * browser exports. Returns false when the row is not a header.
+ */
+static bool csv_map_header(const csv_reader_t *reader, int columns[ITEM_FIELD_COUNT]) {
+    static const char *names[ITEM_FIELD_COUNT][5] = {
+        [ITEM_USERNAME] = {"username", "user name", "login username", "login_username", NULL},
+        [ITEM_SECRET] = {"password", "secret", "login password", "login_password", NULL},
+        [ITEM_TITLE] = {"title", "name", "description", NULL},
+        [ITEM_URL] = {"url", "website", "login uri", "login_uri", NULL},
+        [ITEM_TAGS] = {"tags", "tag", "folder", "grouping", NULL},
+    };
+
+    int found[ITEM_FIELD_COUNT] = {-1, -1, -1, -1, -1};
+    for (size_t col = 0; col < reader->count; col++) {
+        const char *cell = reader->fields[col].data;
+
+        /* Spreadsheet and password manager exports often start with a BOM */
+        if (col == 0 && strncmp(cell, UTF8_BOM, strlen(UTF8_BOM)) == 0) cell += strlen(UTF8_BOM);
+        for (int field = 0; field < ITEM_FIELD_COUNT; field++) {
+            for (const char **name = names[field]; *name != NULL; name++) {
+                if (found[field] == -1 && strcasecmp(cell, *name) == 0) found[field] = (int) col;
+            }
+        }
+    }
+
+    if (found[ITEM_SECRET] == -1) return false;
+    memcpy(columns, found, sizeof(found));
+    return true;
+}
+
+static const token_t *csv_column(const csv_reader_t *reader, int column) {
+    return column >= 0 && (size_t) column < reader->count ? &reader->fields[column] : NULL;
+}
+
+/**
+ * cruxpass CSV keeps its strict per-field checks, other managers' CSV
+ * (strict == false) is cut to fit and summarized instead.
+ */
+static bool import_csv(import_sink_t *sink, stream_t *in, bool strict) {
+    int rows = 0;
+    int columns[ITEM_FIELD_COUNT] = {0, 1, 2, -1, 3};
+    csv_reader_t *reader = NULL;
+    import_item_t *item = NULL;
+
+    if ((reader = sodium_malloc(sizeof(csv_reader_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((item = secmem_alloc(sizeof(import_item_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    csv_init(reader, in);
+    sodium_memzero(item, sizeof(import_item_t));
+
+    rows = csv_next_row(reader);
+    if (rows > 0 && csv_map_header(reader, columns)) {
+        rows = csv_next_row(reader);
+    } else if (!strict) {
+        fprintf(stderr, "Error: Missing header row with a \"Password\" column\n");
+        rows = -1;
+    }
+
+    for (; rows > 0; rows = csv_next_row(reader)) {
+        size_t line_number = reader->line;
+        secret_t *rec = &item->rec;
+
+        if (strict) {
+            if (!process_field(rec->username, USERNAME_MAX_LEN, csv_column(reader, columns[ITEM_USERNAME]), "Username",
+                               line_number)
+                || !process_field(rec->secret, SECRET_MAX_LEN, csv_column(reader, columns[ITEM_SECRET]), "Password",
+                                  line_number)
+                || !process_field(rec->description, DESC_MAX_LEN - 1, csv_column(reader, columns[ITEM_TITLE]),
+                                  "Description", line_number))
+                continue;
+
+            const token_t *tags = csv_column(reader, columns[ITEM_TAGS]);
+            if (tags != NULL) sink_tags(sink, tags->data, tags->len, false);
+            if (!import_record(sink, rec)) fprintf(stderr, "Error: Failed to insert record at line: %zu\n", line_number);
+            continue;
+        }
+
+        for (int field = 0; field < ITEM_TAGS; field++) {
+            const token_t *value = csv_column(reader, columns[field]);
+            if (value != NULL) item_set(item, (ITEM_FIELD) field, value);
+        }
+
+        const token_t *tags = csv_column(reader, columns[ITEM_TAGS]);
+        if (tags != NULL) sink_tags(sink, tags->data, tags->len, false);
+
+        item_commit(sink, item, line_number);
+    }
+
+    if (rows < 0) fprintf(stderr, "Error: Malformed CSV near line %zu\n", reader->line);
+    sodium_free(reader);
+    secmem_free(item);
+    return rows == 0;
+}
+
+static bool bitwarden_uris(json_parser_t *parser, import_item_t *item) {
+    JSON_TOKEN token = JSON_ERROR;
+
+    while ((token = json_next(parser)) == JSON_OBJECT_BEGIN) {
+        while ((token = json_next(parser)) == JSON_KEY) {
+            bool uri = strcmp(parser->token.data, "uri") == 0;
+            token = json_next(parser);
+            if (uri && token == JSON_STRING) item_set(item, ITEM_URL, &parser->token);
+            else if (!json_skip(parser, token)) return false;
+        }
+
+        if (token != JSON_OBJECT_END) return false;
+    }
+
+    return token == JSON_ARRAY_END;
+}
+
+static bool bitwarden_login(json_parser_t *parser, import_item_t *item) {
+    JSON_TOKEN token = JSON_ERROR;
+
+    while ((token = json_next(parser)) == JSON_KEY) {
+        int field = -1;
+        if (strcmp(parser->token.data, "username") == 0) field = ITEM_USERNAME;
+        else if (strcmp(parser->token.data, "password") == 0) field = ITEM_SECRET;
+        else if (strcmp(parser->token.data, "uris") == 0) field = ITEM_URL;
+
+        token = json_next(parser);
+        if (field == ITEM_URL && token == JSON_ARRAY_BEGIN) {
+            if (!bitwarden_uris(parser, item)) return false;
+        } else if (field != -1 && field != ITEM_URL && token == JSON_STRING) {
+            item_set(item, (ITEM_FIELD) field, &parser->token);
+        } else if (!json_skip(parser, token)) {
+            return false;
+        }
+    }
+
+    return token == JSON_OBJECT_END;
+}
+
+static bool bitwarden_folders(json_parser_t *parser, bitwarden_folders_t *folders) {
+    JSON_TOKEN token = JSON_ERROR;
+
+    if (json_next(parser) != JSON_ARRAY_BEGIN) return false;
+    while ((token = json_next(parser)) == JSON_OBJECT_BEGIN) {
+        bitwarden_folder_t folder = {0};
+
+        while ((token = json_next(parser)) == JSON_KEY) {
+            bool id = strcmp(parser->token.data, "id") == 0;
+            bool name = strcmp(parser->token.data, "name") == 0;
+
+            token = json_next(parser);
+            if (id && token == JSON_STRING) copy_field(folder.id, sizeof(folder.id), &parser->token);
+            else if (name && token == JSON_STRING) copy_field(folder.name, sizeof(folder.name), &parser->token);
+            else if (!json_skip(parser, token)) return false;
+        }
+
+        if (token != JSON_OBJECT_END) return false;
+        if (folders->size == folders->capacity) {
+            size_t capacity = folders->capacity == 0 ? 16 : folders->capacity * 2;
+            bitwarden_folder_t *data = realloc(folders->data, capacity * sizeof(bitwarden_folder_t));
+            if (data == NULL) CRXP__OUT_OF_MEMORY();
+            folders->data = data;
+            folders->capacity = capacity;
+        }
+        folders->data[folders->size++] = folder;
+    }
+
+    return token == JSON_ARRAY_END;
+}
+
+/* An item's folder becomes its tag */
+static void bitwarden_folder(import_sink_t *sink, const bitwarden_folders_t *folders, const char *id) {
+    for (size_t i = 0; i < folders->size; i++) {
+        const char *name = folders->data[i].name;
+        if (strcmp(folders->data[i].id, id) == 0) sink_tags(sink, name, strlen(name), true);
+    }
+}
+
+/* Bitwarden item types other than 1 (cards, notes, identities) carry no login and are skipped */
+static bool bitwarden_items(import_sink_t *sink, json_parser_t *parser, import_item_t *item,
+                            const bitwarden_folders_t *folders) {
+    JSON_TOKEN token = JSON_ERROR;
+
+    if (json_next(parser) != JSON_ARRAY_BEGIN) return false;
+    while ((token = json_next(parser)) == JSON_OBJECT_BEGIN) {
+        bool login = false;
+        size_t line_number = parser->in->line;
+
+        while ((token = json_next(parser)) == JSON_KEY) {
+            if (strcmp(parser->token.data, "type") == 0) {
+                token = json_next(parser);
+                login = token == JSON_NUMBER && strcmp(parser->token.data, "1") == 0;
+                if (!json_skip(parser, token)) return false;
+            } else if (strcmp(parser->token.data, "name") == 0) {
+                if ((token = json_next(parser)) == JSON_STRING) item_set(item, ITEM_TITLE, &parser->token);
+                else if (!json_skip(parser, token)) return false;
+            } else if (strcmp(parser->token.data, "folderId") == 0) {
+                if ((token = json_next(parser)) == JSON_STRING) bitwarden_folder(sink, folders, parser->token.data);
+                else if (!json_skip(parser, token)) return false;
+            } else if (strcmp(parser->token.data, "login") == 0) {
+                if ((token = json_next(parser)) == JSON_OBJECT_BEGIN) {
+                    if (!bitwarden_login(parser, item)) return false;
+                } else if (!json_skip(parser, token)) {
+                    return false;
+                }
+            } else if (!json_skip(parser, json_next(parser))) {
+                return false;
+            }
+        }
+
+        if (token != JSON_OBJECT_END) return false;
+        if (login) {
+            item_commit(sink, item, line_number);
+        } else {
+            sink->tags[0] = '\0';
+            sink->ignored++;
+            sodium_memzero(item, sizeof(import_item_t));
+        }
+    }
+
+    return token == JSON_ARRAY_END;
+}
+
+static bool import_bitwarden(import_sink_t *sink, stream_t *in) {
+    bool ok = false;
+    JSON_TOKEN token = JSON_ERROR;
+    json_parser_t *parser = NULL;
+    import_item_t *item = NULL;
+    bitwarden_folders_t folders = {0};
+
+    if ((parser = sodium_malloc(sizeof(json_parser_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((item = secmem_alloc(sizeof(import_item_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    json_init(parser, in);
+    sodium_memzero(item, sizeof(import_item_t));
+
+    if (json_next(parser) != JSON_OBJECT_BEGIN) goto malformed;
+    while ((token = json_next(parser)) == JSON_KEY) {
+        if (strcmp(parser->token.data, "encrypted") == 0) {
+            if ((token = json_next(parser)) == JSON_TRUE) {
+                fprintf(stderr, "Error: Encrypted Bitwarden exports are not supported, export as plain JSON\n");
+                goto done;
+            }
+
+            if (!json_skip(parser, token)) goto malformed;
+        } else if (strcmp(parser->token.data, "folders") == 0) {
+            if (!bitwarden_folders(parser, &folders)) goto malformed;
+        } else if (strcmp(parser->token.data, "items") == 0) {
+            if (!bitwarden_items(sink, parser, item, &folders)) goto malformed;
+        } else if (!json_skip(parser, json_next(parser))) {
+            goto malformed;
+        }
+    }
+
+    if (token == JSON_OBJECT_END && json_next(parser) == JSON_EOF) {
+        ok = true;
+        goto done;
+    }
+
+malformed:
+    fprintf(stderr, "Error: Malformed Bitwarden JSON near line %zu\n", in->line);
+done:
+    sodium_free(parser);
+    secmem_free(item);
+    free(folders.data);
+    return ok;
+}
+
+static void token_append(token_t *dst, const token_t *src) {
+    for (size_t i = 0; i < src->len; i++) token_putc(dst, src->data[i]);
+    dst->truncated |= src->truncated;
+}
+
+/**
+ * KeePass 2 XML: every <Entry> outside of a <History> holds <String>
+ * pairs of <Key> and <Value>, and its <Tags>. Groups are flattened.
+ */
+static bool import_keepass(import_sink_t *sink, stream_t *in) {
+    int history = 0;
+    bool in_entry = false;
+    size_t line_number = 0;
+    XML_TOKEN token = XML_ERROR;
+    token_t *capture = NULL;
+    xml_parser_t *parser = NULL;
+    import_item_t *item = NULL;
+    token_t *pair = NULL;
+    token_t *tags = NULL;
+
+    if ((parser = sodium_malloc(sizeof(xml_parser_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((item = secmem_alloc(sizeof(import_item_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((pair = sodium_allocarray(2, sizeof(token_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((tags = malloc(sizeof(token_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    xml_init(parser, in);
+    sodium_memzero(item, sizeof(import_item_t));
+
+    while ((token = xml_next(parser)) != XML_EOF && token != XML_ERROR) {
+        const char *name = parser->name.data;
+        bool live = in_entry && history == 0;
+
+        if (token == XML_TEXT) {
+            if (capture != NULL) token_append(capture, &parser->text);
+        } else if (token == XML_START) {
+            if (strcmp(name, "History") == 0) {
+                history++;
+            } else if (history == 0 && strcmp(name, "Entry") == 0) {
+                in_entry = true;
+                line_number = in->line;
+            } else if (live && strcmp(name, "String") == 0) {
+                token_reset(&pair[0]);
+                token_reset(&pair[1]);
+            } else if (live && strcmp(name, "Key") == 0) {
+                capture = &pair[0];
+            } else if (live && strcmp(name, "Value") == 0) {
+                capture = &pair[1];
+            } else if (live && strcmp(name, "Tags") == 0) {
+                token_reset(tags);
+                capture = tags;
+            }
+        } else if (strcmp(name, "History") == 0) {
+            history--;
+        } else if (strcmp(name, "Key") == 0 || strcmp(name, "Value") == 0) {
+            capture = NULL;
+        } else if (live && strcmp(name, "Tags") == 0) {
+            sink_tags(sink, tags->data, tags->len, false);
+            capture = NULL;
+        } else if (live && strcmp(name, "String") == 0) {
+            if (strcmp(pair[0].data, "Title") == 0) item_set(item, ITEM_TITLE, &pair[1]);
+            else if (strcmp(pair[0].data, "UserName") == 0) item_set(item, ITEM_USERNAME, &pair[1]);
+            else if (strcmp(pair[0].data, "Password") == 0) item_set(item, ITEM_SECRET, &pair[1]);
+            else if (strcmp(pair[0].data, "URL") == 0) item_set(item, ITEM_URL, &pair[1]);
+        } else if (live && strcmp(name, "Entry") == 0) {
+            item_commit(sink, item, line_number);
+            in_entry = false;
+        }
+    }
+
+    if (token == XML_ERROR || in_entry) fprintf(stderr, "Error: Malformed KeePass XML near line %zu\n", in->line);
+    sodium_free(parser);
+    secmem_free(item);
+    sodium_free(pair);
+    free(tags);
+    return token == XML_EOF && !in_entry;
+}
+
+/**
+ * Streams the file through the parser for its format, nothing beyond
+ * the read buffer and the record being built is held in memory.
+ * Records imported before a parse error are kept.
+ */
+int import_secrets(sqlite3 *db, const char *import_file, const import_opts_t *opts) {
+    bool ok = false;
+    stream_t in = {0};
+    import_sink_t sink = {0};
+
+    TRACE_SCOPE("import_secrets");
+    if (!stream_open(&in, import_file)) return CRXP_ERR;
+    if (!import_begin(&sink, db, opts)) {
+        stream_close(&in);
+        return CRXP_ERR;
+    }
+
+    switch (opts->format) {
+        case IMPORT_CSV:
+            ok = import_csv(&sink, &in, true);
+            break;
+        case IMPORT_1PASSWORD:
+            ok = import_csv(&sink, &in, false);
+            break;
+        case IMPORT_BITWARDEN:
+            ok = import_bitwarden(&sink, &in);
+            break;
+        case IMPORT_KEEPASS:
+            ok = import_keepass(&sink, &in);
+            break;
+    }
+
+    ok = import_end(&sink, true) && ok;
+    metrics_add(METRIC_IMPORT_BYTES, in.consumed);
+    stream_close(&in);
+    return ok ? CRXP_OK : CRXP_ERR;
+}
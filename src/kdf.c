@@ -0,0 +1,478 @@
+#include "kdf.h"
+
+#include <pthread.h>
+#include <sodium/crypto_generichash_blake2b.h>
+#include <sodium/utils.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define BLOCK_SIZE 1024
+#define BLOCK_WORDS (BLOCK_SIZE / 8)
+#define SYNC_POINTS 4
+#define ADDRESSES_IN_BLOCK BLOCK_WORDS
+#define ARGON2_VERSION 0x13
+#define ARGON2_TYPE_ID 2
+#define PREHASH_LEN crypto_generichash_blake2b_BYTES_MAX
+#define PREHASH_SEED_LEN (PREHASH_LEN + 8)
+
+typedef struct {
+    uint64_t v[BLOCK_WORDS];
+} block_t;
+
+typedef void (*fill_fn)(const block_t *prev, const block_t *ref, block_t *next, bool with_xor);
+
+typedef struct {
+    fill_fn fill; /* the widest compression function the CPU runs */
+    block_t *memory;
+    size_t memory_size;
+    uint32_t m_cost; /* KiB asked for, H0 hashes it rather than what was allocated */
+    uint32_t passes;
+    uint32_t lanes;
+    uint32_t lane_length;
+    uint32_t segment_length;
+    uint32_t threads; /* set once every worker that could be started is */
+    bool ready;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_barrier_t slice_done;
+    block_t final;
+} argon2_t;
+
+typedef struct {
+    argon2_t *ctx;
+    uint32_t index;
+} worker_t;
+
+static uint64_t load64(const unsigned char *src) {
+    uint64_t w = 0;
+    for (int i = 7; i >= 0; i--) w = w << 8 | src[i];
+    return w;
+}
+
+static void store32(unsigned char *dst, uint32_t w) {
+    for (int i = 0; i < 4; i++) dst[i] = (unsigned char) (w >> (8 * i));
+}
+
+static void store64(unsigned char *dst, uint64_t w) {
+    for (int i = 0; i < 8; i++) dst[i] = (unsigned char) (w >> (8 * i));
+}
+
+static void load_block(block_t *block, const unsigned char *src) {
+    for (int i = 0; i < BLOCK_WORDS; i++) block->v[i] = load64(src + 8 * i);
+}
+
+static void store_block(unsigned char *dst, const block_t *block) {
+    for (int i = 0; i < BLOCK_WORDS; i++) store64(dst + 8 * i, block->v[i]);
+}
+
+/* H' of RFC 9106: BLAKE2b stretched to any output length */
+static void hash_long(unsigned char *out, size_t out_len, const unsigned char *in, size_t in_len) {
+    crypto_generichash_blake2b_state state;
+    unsigned char len[4];
+    unsigned char v[crypto_generichash_blake2b_BYTES_MAX];
+    unsigned char next[crypto_generichash_blake2b_BYTES_MAX];
+    size_t hash_len = out_len <= sizeof(v) ? out_len : sizeof(v);
+
+    store32(len, (uint32_t) out_len);
+    crypto_generichash_blake2b_init(&state, NULL, 0, hash_len);
+    crypto_generichash_blake2b_update(&state, len, sizeof(len));
+    crypto_generichash_blake2b_update(&state, in, in_len);
+    if (out_len <= sizeof(v)) {
+        crypto_generichash_blake2b_final(&state, out, out_len);
+        return;
+    }
+
+    crypto_generichash_blake2b_final(&state, v, sizeof(v));
+    memcpy(out, v, sizeof(v) / 2);
+    out += sizeof(v) / 2;
+    out_len -= sizeof(v) / 2;
+    while (out_len > sizeof(v)) {
+        crypto_generichash_blake2b(next, sizeof(next), v, sizeof(v), NULL, 0);
+        memcpy(v, next, sizeof(v));
+        memcpy(out, v, sizeof(v) / 2);
+        out += sizeof(v) / 2;
+        out_len -= sizeof(v) / 2;
+    }
+
+    crypto_generichash_blake2b(out, out_len, v, sizeof(v), NULL, 0);
+    sodium_memzero(v, sizeof(v));
+    sodium_memzero(next, sizeof(next));
+}
+
+static inline uint64_t rotr64(uint64_t w, unsigned c) { return (w >> c) | (w << (64 - c)); }
+
+/* BLAKE2b's addition with the multiplication Argon2 adds to it */
+static inline uint64_t blamka(uint64_t x, uint64_t y) { return x + y + 2 * (x & 0xffffffff) * (y & 0xffffffff); }
+
+#define G(a, b, c, d)          \
+    do {                       \
+        a = blamka(a, b);      \
+        d = rotr64(d ^ a, 32); \
+        c = blamka(c, d);      \
+        b = rotr64(b ^ c, 24); \
+        a = blamka(a, b);      \
+        d = rotr64(d ^ a, 16); \
+        c = blamka(c, d);      \
+        b = rotr64(b ^ c, 63); \
+    } while (0)
+
+#define ROUND(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15) \
+    do {                                                                              \
+        G(v0, v4, v8, v12);                                                           \
+        G(v1, v5, v9, v13);                                                           \
+        G(v2, v6, v10, v14);                                                          \
+        G(v3, v7, v11, v15);                                                          \
+        G(v0, v5, v10, v15);                                                          \
+        G(v1, v6, v11, v12);                                                          \
+        G(v2, v7, v8, v13);                                                           \
+        G(v3, v4, v9, v14);                                                           \
+    } while (0)
+
+/**
+ * The compression function: next = P(prev ^ ref) ^ prev ^ ref, XORed
+ * into next after the first pass. Portable, x86-64 also has an AVX2 one.
+ */
+static void fill_block(const block_t *prev, const block_t *ref, block_t *next, bool with_xor) {
+    block_t r;
+    block_t tmp;
+
+    for (int i = 0; i < BLOCK_WORDS; i++) r.v[i] = tmp.v[i] = prev->v[i] ^ ref->v[i];
+    if (with_xor) {
+        for (int i = 0; i < BLOCK_WORDS; i++) tmp.v[i] ^= next->v[i];
+    }
+
+    uint64_t *v = r.v;
+    for (int i = 0; i < 8; i++) {
+        ROUND(v[16 * i], v[16 * i + 1], v[16 * i + 2], v[16 * i + 3], v[16 * i + 4], v[16 * i + 5], v[16 * i + 6],
+              v[16 * i + 7], v[16 * i + 8], v[16 * i + 9], v[16 * i + 10], v[16 * i + 11], v[16 * i + 12],
+              v[16 * i + 13], v[16 * i + 14], v[16 * i + 15]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        ROUND(v[2 * i], v[2 * i + 1], v[2 * i + 16], v[2 * i + 17], v[2 * i + 32], v[2 * i + 33], v[2 * i + 48],
+              v[2 * i + 49], v[2 * i + 64], v[2 * i + 65], v[2 * i + 80], v[2 * i + 81], v[2 * i + 96],
+              v[2 * i + 97], v[2 * i + 112], v[2 * i + 113]);
+    }
+
+    for (int i = 0; i < BLOCK_WORDS; i++) next->v[i] = tmp.v[i] ^ v[i];
+}
+
+#if defined(__x86_64__)
+/* AVX2 holds a row of the 4x4 matrix BLAKE2b works on in one register */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i blamka4(__m256i x, __m256i y) {
+    __m256i z = _mm256_mul_epu32(x, y);
+    return _mm256_add_epi64(_mm256_add_epi64(x, y), _mm256_add_epi64(z, z));
+}
+
+AVX2 static inline __m256i rotr4(__m256i w, int c) {
+    const __m256i rot24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10, 3, 4, 5, 6, 7, 0, 1, 2,
+                                           11, 12, 13, 14, 15, 8, 9, 10);
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9, 2, 3, 4, 5, 6, 7, 0, 1,
+                                           10, 11, 12, 13, 14, 15, 8, 9);
+    switch (c) {
+        case 32: return _mm256_shuffle_epi32(w, _MM_SHUFFLE(2, 3, 0, 1));
+        case 24: return _mm256_shuffle_epi8(w, rot24);
+        case 16: return _mm256_shuffle_epi8(w, rot16);
+        default: return _mm256_xor_si256(_mm256_srli_epi64(w, 63), _mm256_add_epi64(w, w));
+    }
+}
+
+AVX2 static inline void g4(__m256i *a, __m256i *b, __m256i *c, __m256i *d) {
+    *a = blamka4(*a, *b);
+    *d = rotr4(_mm256_xor_si256(*d, *a), 32);
+    *c = blamka4(*c, *d);
+    *b = rotr4(_mm256_xor_si256(*b, *c), 24);
+    *a = blamka4(*a, *b);
+    *d = rotr4(_mm256_xor_si256(*d, *a), 16);
+    *c = blamka4(*c, *d);
+    *b = rotr4(_mm256_xor_si256(*b, *c), 63);
+}
+
+/* Rotating rows b, c and d by one, two and three words turns the diagonals into columns */
+AVX2 static inline void round4(__m256i *a, __m256i *b, __m256i *c, __m256i *d) {
+    g4(a, b, c, d);
+    *b = _mm256_permute4x64_epi64(*b, _MM_SHUFFLE(0, 3, 2, 1));
+    *c = _mm256_permute4x64_epi64(*c, _MM_SHUFFLE(1, 0, 3, 2));
+    *d = _mm256_permute4x64_epi64(*d, _MM_SHUFFLE(2, 1, 0, 3));
+    g4(a, b, c, d);
+    *b = _mm256_permute4x64_epi64(*b, _MM_SHUFFLE(2, 1, 0, 3));
+    *c = _mm256_permute4x64_epi64(*c, _MM_SHUFFLE(1, 0, 3, 2));
+    *d = _mm256_permute4x64_epi64(*d, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+/* Rows of the block are its 16 word runs, columns take two words of every run */
+AVX2 static void fill_block_avx2(const block_t *prev, const block_t *ref, block_t *next, bool with_xor) {
+    block_t r;
+    __m256i row[4];
+
+    for (int i = 0; i < BLOCK_WORDS; i += 4) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &prev->v[i]),
+                                     _mm256_loadu_si256((const __m256i *) &ref->v[i]));
+        _mm256_storeu_si256((__m256i *) &r.v[i], x);
+        if (with_xor) x = _mm256_xor_si256(x, _mm256_loadu_si256((const __m256i *) &next->v[i]));
+        _mm256_storeu_si256((__m256i *) &next->v[i], x);
+    }
+
+    uint64_t *v = r.v;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) row[j] = _mm256_loadu_si256((const __m256i *) &v[16 * i + 4 * j]);
+        round4(&row[0], &row[1], &row[2], &row[3]);
+        for (int j = 0; j < 4; j++) _mm256_storeu_si256((__m256i *) &v[16 * i + 4 * j], row[j]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            uint64_t *low = &v[2 * i + 32 * j];
+            row[j] = _mm256_loadu2_m128i((const __m128i *) (low + 16), (const __m128i *) low);
+        }
+
+        round4(&row[0], &row[1], &row[2], &row[3]);
+        for (int j = 0; j < 4; j++) {
+            uint64_t *low = &v[2 * i + 32 * j];
+            _mm256_storeu2_m128i((__m128i *) (low + 16), (__m128i *) low, row[j]);
+        }
+    }
+
+    for (int i = 0; i < BLOCK_WORDS; i += 4) {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &next->v[i]),
+                                     _mm256_loadu_si256((const __m256i *) &v[i]));
+        _mm256_storeu_si256((__m256i *) &next->v[i], x);
+    }
+}
+#endif
+
+static void next_addresses(block_t *address, block_t *input, const block_t *zero) {
+    input->v[6]++;
+    fill_block(zero, input, address, false);
+    fill_block(zero, address, address, false);
+}
+
+/* Maps a pseudo-random value to a block of ref_lane the current block may depend on */
+static uint32_t index_alpha(const argon2_t *ctx, uint32_t pass, uint32_t slice, uint32_t index, uint32_t rand,
+                            bool same_lane) {
+    uint32_t area = 0;
+    uint32_t start = 0;
+
+    if (pass == 0) {
+        if (slice == 0)
+            area = index - 1;
+        else if (same_lane)
+            area = slice * ctx->segment_length + index - 1;
+        else
+            area = slice * ctx->segment_length - (index == 0 ? 1 : 0);
+    } else {
+        if (same_lane)
+            area = ctx->lane_length - ctx->segment_length + index - 1;
+        else
+            area = ctx->lane_length - ctx->segment_length - (index == 0 ? 1 : 0);
+        start = slice == SYNC_POINTS - 1 ? 0 : (slice + 1) * ctx->segment_length;
+    }
+
+    uint64_t relative = rand;
+    relative = relative * relative >> 32;
+    relative = area - 1 - ((uint64_t) area * relative >> 32);
+    return (uint32_t) ((start + relative) % ctx->lane_length);
+}
+
+/**
+ * Argon2id addresses the first half of the first pass like Argon2i, from
+ * a counter, and everything after like Argon2d, from the previous block.
+ */
+static void fill_segment(argon2_t *ctx, uint32_t pass, uint32_t lane, uint32_t slice) {
+    block_t address = {0};
+    block_t input = {0};
+    block_t zero = {0};
+    bool independent = pass == 0 && slice < SYNC_POINTS / 2;
+    uint32_t first = pass == 0 && slice == 0 ? 2 : 0;
+
+    if (independent) {
+        input.v[0] = pass;
+        input.v[1] = lane;
+        input.v[2] = slice;
+        input.v[3] = (uint64_t) ctx->lane_length * ctx->lanes;
+        input.v[4] = ctx->passes;
+        input.v[5] = ARGON2_TYPE_ID;
+        if (first != 0) next_addresses(&address, &input, &zero);
+    }
+
+    uint64_t lane_start = (uint64_t) lane * ctx->lane_length;
+    uint32_t offset = slice * ctx->segment_length + first;
+    uint32_t prev = offset == 0 ? ctx->lane_length - 1 : offset - 1;
+    for (uint32_t i = first; i < ctx->segment_length; i++, offset++, prev = offset - 1) {
+        uint64_t rand = 0;
+        if (independent) {
+            if (i % ADDRESSES_IN_BLOCK == 0) next_addresses(&address, &input, &zero);
+            rand = address.v[i % ADDRESSES_IN_BLOCK];
+        } else {
+            rand = ctx->memory[lane_start + prev].v[0];
+        }
+
+        uint32_t ref_lane = pass == 0 && slice == 0 ? lane : (uint32_t) ((rand >> 32) % ctx->lanes);
+        uint32_t ref_index = index_alpha(ctx, pass, slice, i, (uint32_t) rand, ref_lane == lane);
+        ctx->fill(&ctx->memory[lane_start + prev], &ctx->memory[(uint64_t) ref_lane * ctx->lane_length + ref_index],
+                   &ctx->memory[lane_start + offset], pass != 0);
+    }
+
+    sodium_memzero(&address, sizeof(block_t));
+    sodium_memzero(&input, sizeof(block_t));
+}
+
+/**
+ * Fills every lane numbered index modulo the worker count. Segments of
+ * one slice are independent, a worker that has more lanes than one
+ * fills them in turn, so the key is the same however many started.
+ */
+static void *fill_lanes(void *arg) {
+    worker_t *worker = arg;
+    argon2_t *ctx = worker->ctx;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (!ctx->ready) pthread_cond_wait(&ctx->start, &ctx->lock);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (uint32_t pass = 0; pass < ctx->passes; pass++) {
+        for (uint32_t slice = 0; slice < SYNC_POINTS; slice++) {
+            for (uint32_t lane = worker->index; lane < ctx->lanes; lane += ctx->threads)
+                fill_segment(ctx, pass, lane, slice);
+            pthread_barrier_wait(&ctx->slice_done);
+        }
+    }
+
+    /* Nothing reads another lane after the last slice, each worker folds and wipes its own */
+    for (uint32_t lane = worker->index; lane < ctx->lanes; lane += ctx->threads) {
+        block_t *lane_memory = &ctx->memory[(uint64_t) lane * ctx->lane_length];
+        pthread_mutex_lock(&ctx->lock);
+        for (int i = 0; i < BLOCK_WORDS; i++) ctx->final.v[i] ^= lane_memory[ctx->lane_length - 1].v[i];
+        pthread_mutex_unlock(&ctx->lock);
+        sodium_memzero(lane_memory, (size_t) ctx->lane_length * sizeof(block_t));
+    }
+
+    return NULL;
+}
+
+/* H0, followed by room for the block and lane numbers of the first blocks */
+static void prehash(unsigned char *h0, const argon2_t *ctx, size_t out_len, const char *passwd, size_t passwd_len,
+                    const unsigned char *salt, size_t salt_len) {
+    crypto_generichash_blake2b_state state;
+    unsigned char word[4];
+    uint32_t params[] = {ctx->lanes, (uint32_t) out_len, ctx->m_cost, ctx->passes,
+                         ARGON2_VERSION, ARGON2_TYPE_ID};
+
+    crypto_generichash_blake2b_init(&state, NULL, 0, PREHASH_LEN);
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+        store32(word, params[i]);
+        crypto_generichash_blake2b_update(&state, word, sizeof(word));
+    }
+
+    store32(word, (uint32_t) passwd_len);
+    crypto_generichash_blake2b_update(&state, word, sizeof(word));
+    crypto_generichash_blake2b_update(&state, (const unsigned char *) passwd, passwd_len);
+    store32(word, (uint32_t) salt_len);
+    crypto_generichash_blake2b_update(&state, word, sizeof(word));
+    crypto_generichash_blake2b_update(&state, salt, salt_len);
+
+    /* No secret key and no associated data, as crypto_pwhash() */
+    store32(word, 0);
+    crypto_generichash_blake2b_update(&state, word, sizeof(word));
+    crypto_generichash_blake2b_update(&state, word, sizeof(word));
+    crypto_generichash_blake2b_final(&state, h0, PREHASH_LEN);
+}
+
+/* The first two blocks of every lane come from H0, the rest from the blocks before them */
+static void first_blocks(argon2_t *ctx, unsigned char *h0) {
+    unsigned char bytes[BLOCK_SIZE];
+
+    for (uint32_t lane = 0; lane < ctx->lanes; lane++) {
+        for (uint32_t i = 0; i < 2; i++) {
+            store32(h0 + PREHASH_LEN, i);
+            store32(h0 + PREHASH_LEN + 4, lane);
+            hash_long(bytes, BLOCK_SIZE, h0, PREHASH_SEED_LEN);
+            load_block(&ctx->memory[(uint64_t) lane * ctx->lane_length + i], bytes);
+        }
+    }
+
+    sodium_memzero(bytes, sizeof(bytes));
+}
+
+/**
+ * Same costs as crypto_pwhash(): opslimit passes over memlimit bytes.
+ * Workers that cannot be started leave their lanes to the others, the
+ * key does not change, only the time it takes.
+ */
+bool kdf_argon2id(unsigned char *out, size_t out_len, const char *passwd, size_t passwd_len,
+                  const unsigned char *salt, size_t salt_len, uint64_t opslimit, size_t memlimit, uint32_t lanes) {
+    argon2_t ctx = {.lanes = lanes, .passes = (uint32_t) opslimit};
+    unsigned char h0[PREHASH_SEED_LEN];
+    unsigned char bytes[BLOCK_SIZE];
+    pthread_t threads[KDF_LANES_MAX];
+    worker_t workers[KDF_LANES_MAX];
+
+    if (lanes < 1 || lanes > KDF_LANES_MAX || opslimit < 1 || opslimit > UINT32_MAX
+        || memlimit / BLOCK_SIZE > UINT32_MAX || out_len < crypto_generichash_blake2b_BYTES_MIN) {
+        fprintf(stderr, "Error: Invalid Argon2id parameters\n");
+        return false;
+    }
+
+    /* At least two blocks per segment, and a whole number of segments */
+    size_t blocks = memlimit / BLOCK_SIZE;
+    ctx.m_cost = (uint32_t) blocks;
+    if (blocks < 2 * SYNC_POINTS * lanes) blocks = 2 * SYNC_POINTS * lanes;
+    ctx.segment_length = (uint32_t) (blocks / (SYNC_POINTS * lanes));
+    ctx.lane_length = ctx.segment_length * SYNC_POINTS;
+    ctx.memory_size = (size_t) ctx.lane_length * lanes * sizeof(block_t);
+
+    ctx.memory = mmap(NULL, ctx.memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ctx.memory == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to allocate %zu bytes for Argon2id\n", ctx.memory_size);
+        return false;
+    }
+
+#ifdef MADV_DONTDUMP
+    madvise(ctx.memory, ctx.memory_size, MADV_DONTDUMP);
+#endif
+    ctx.fill = fill_block;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) ctx.fill = fill_block_avx2;
+#endif
+    prehash(h0, &ctx, out_len, passwd, passwd_len, salt, salt_len);
+    first_blocks(&ctx, h0);
+    sodium_memzero(h0, sizeof(h0));
+
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.start, NULL);
+    uint32_t started = 1;
+    workers[0] = (worker_t) {&ctx, 0};
+    for (uint32_t i = 1; i < lanes; i++) {
+        workers[started] = (worker_t) {&ctx, started};
+        if (pthread_create(&threads[started], NULL, fill_lanes, &workers[started]) == 0) started++;
+    }
+
+    /* The barrier can only be sized once the workers are known, they wait for it */
+    pthread_barrier_init(&ctx.slice_done, NULL, started);
+    pthread_mutex_lock(&ctx.lock);
+    ctx.threads = started;
+    ctx.ready = true;
+    pthread_cond_broadcast(&ctx.start);
+    pthread_mutex_unlock(&ctx.lock);
+
+    fill_lanes(&workers[0]);
+    for (uint32_t i = 1; i < started; i++) pthread_join(threads[i], NULL);
+
+    store_block(bytes, &ctx.final);
+    hash_long(out, out_len, bytes, sizeof(bytes));
+    sodium_memzero(bytes, sizeof(bytes));
+    sodium_memzero(&ctx.final, sizeof(block_t));
+
+    pthread_barrier_destroy(&ctx.slice_done);
+    pthread_cond_destroy(&ctx.start);
+    pthread_mutex_destroy(&ctx.lock);
+    munmap(ctx.memory, ctx.memory_size);
+    return true;
+}
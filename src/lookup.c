@@ -0,0 +1,295 @@
+#include "lookup.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "export.h"
+#include "metrics.h"
+#include "secmem.h"
+#include "trace.h"
+
+/* A trailing '*' turns the field into a prefix, the '*' is not part of the value */
+static bool set_field(lookup_key_t *key, uint8_t flag, uint8_t prefix, const char *value, size_t len, size_t max) {
+    if (key->mask & flag) {
+        fprintf(stderr, "Error: A lookup key names a field twice\n");
+        return false;
+    }
+
+    key->mask |= flag;
+    if (len > 0 && value[len - 1] == LOOKUP_PREFIX_CHAR) {
+        key->mask |= prefix;
+        len--;
+    }
+
+    if (len > max) {
+        fprintf(stderr, "Error: Lookup value longer than the field: %.*s\n", (int) len, value);
+        return false;
+    }
+
+    if (flag == LOOKUP_USERNAME) {
+        key->username = value;
+        key->username_len = len;
+    } else {
+        key->description = value;
+        key->description_len = len;
+    }
+
+    return true;
+}
+
+static bool set_id(lookup_key_t *key, const char *value, size_t len) {
+    char *end = NULL;
+    char digits[24];
+
+    if (len == 0 || len >= sizeof(digits)) {
+        fprintf(stderr, "Error: Invalid record id: %.*s\n", (int) len, value);
+        return false;
+    }
+
+    memcpy(digits, value, len);
+    digits[len] = '\0';
+    errno = 0;
+    long long id = strtoll(digits, &end, 10);
+    if (errno != 0 || *end != '\0' || id <= 0) {
+        fprintf(stderr, "Error: Invalid record id: %s\n", digits);
+        return false;
+    }
+
+    key->id = id;
+    return true;
+}
+
+/* An id stands alone, it already names one record */
+static bool check_key(const lookup_key_t *key) {
+    if (key->id != 0 && key->mask != 0) {
+        fprintf(stderr, "Error: A record id cannot be combined with a username or description\n");
+        return false;
+    }
+
+    if (key->id == 0 && key->mask == 0) {
+        fprintf(stderr, "Error: Empty lookup key\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* Builds a key from --id, --user and --desc, an id below 1 is no id */
+bool lookup_key(lookup_key_t *key, long id, const char *username, const char *description) {
+    memset(key, 0, sizeof(lookup_key_t));
+    key->id = id > 0 ? id : 0;
+
+    if (username != NULL
+        && !set_field(key, LOOKUP_USERNAME, LOOKUP_USERNAME_PREFIX, username, strlen(username), USERNAME_MAX_LEN))
+        return false;
+    if (description != NULL
+        && !set_field(key, LOOKUP_DESCRIPTION, LOOKUP_DESCRIPTION_PREFIX, description, strlen(description),
+                      DESC_MAX_LEN))
+        return false;
+
+    return check_key(key);
+}
+
+/**
+ * Parses a key of spec_len bytes, not NUL terminated when it comes from
+ * a template: field=value terms joined by ',', the fields being id, user
+ * and desc. `user=deploy,desc=prod*` is a key, and so is
+ * `user:deploy,desc:prod*`, which reads better after `NAME=`.
+ */
+bool lookup_parse(lookup_key_t *key, const char *spec, size_t spec_len) {
+    const char *term = spec;
+    const char *spec_end = spec + spec_len;
+
+    memset(key, 0, sizeof(lookup_key_t));
+    while (term < spec_end) {
+        const char *end = memchr(term, LOOKUP_TERM_SEP, (size_t) (spec_end - term));
+        size_t len = end != NULL ? (size_t) (end - term) : (size_t) (spec_end - term);
+        const char *equals = term;
+        while (equals < term + len && memchr(LOOKUP_FIELD_SEPS, *equals, sizeof(LOOKUP_FIELD_SEPS) - 1) == NULL)
+            equals++;
+
+        if (equals == term + len) {
+            fprintf(stderr, "Error: Lookup terms are field=value, got: %.*s\n", (int) len, term);
+            return false;
+        }
+
+        const char *value = equals + 1;
+        size_t name_len = (size_t) (equals - term);
+        size_t value_len = len - name_len - 1;
+        bool ok = false;
+
+        if (name_len == 2 && strncmp(term, "id", 2) == 0) {
+            ok = key->id == 0 && set_id(key, value, value_len);
+        } else if (name_len == 4 && strncmp(term, "user", 4) == 0) {
+            ok = set_field(key, LOOKUP_USERNAME, LOOKUP_USERNAME_PREFIX, value, value_len, USERNAME_MAX_LEN);
+        } else if (name_len == 4 && strncmp(term, "desc", 4) == 0) {
+            ok = set_field(key, LOOKUP_DESCRIPTION, LOOKUP_DESCRIPTION_PREFIX, value, value_len, DESC_MAX_LEN);
+        } else {
+            fprintf(stderr, "Error: Unknown lookup field: %.*s (id, user or desc)\n", (int) name_len, term);
+        }
+
+        if (!ok) return false;
+        term = end != NULL ? end + 1 : term + len;
+    }
+
+    return check_key(key);
+}
+
+static void print_key(const lookup_key_t *key) {
+    if (key->id != 0) {
+        fprintf(stderr, "id=%lld", (long long) key->id);
+        return;
+    }
+
+    if (key->mask & LOOKUP_USERNAME)
+        fprintf(stderr, "user=%.*s%s", (int) key->username_len, key->username,
+                key->mask & LOOKUP_USERNAME_PREFIX ? "*" : "");
+    if ((key->mask & LOOKUP_USERNAME) && (key->mask & LOOKUP_DESCRIPTION)) fputc(LOOKUP_TERM_SEP, stderr);
+    if (key->mask & LOOKUP_DESCRIPTION)
+        fprintf(stderr, "desc=%.*s%s", (int) key->description_len, key->description,
+                key->mask & LOOKUP_DESCRIPTION_PREFIX ? "*" : "");
+}
+
+/**
+ * A prefix is the range [prefix, prefix 0xFF): under NOCASE every text
+ * starting with it sorts in there, and no UTF-8 byte is 0xFF.
+ */
+static bool bind_field(sqlite3_stmt *stmt, int *param, const char *value, size_t len, bool prefix) {
+    char upper[DESC_MAX_LEN + 2];
+
+    if (sqlite3_bind_text(stmt, (*param)++, value, (int) len, SQLITE_STATIC) != SQLITE_OK) return false;
+    if (!prefix) return true;
+
+    memcpy(upper, value, len);
+    upper[len] = (char) 0xFF;
+    return sqlite3_bind_text(stmt, (*param)++, upper, (int) len + 1, SQLITE_TRANSIENT) == SQLITE_OK;
+}
+
+static bool bind_key(sqlite3_stmt *stmt, int *param, const lookup_key_t *key) {
+    bool ok = true;
+
+    if (key->id != 0) return sqlite3_bind_int64(stmt, (*param)++, key->id) == SQLITE_OK;
+    if (key->mask & LOOKUP_USERNAME)
+        ok = bind_field(stmt, param, key->username, key->username_len, key->mask & LOOKUP_USERNAME_PREFIX);
+    if (ok && (key->mask & LOOKUP_DESCRIPTION))
+        ok = bind_field(stmt, param, key->description, key->description_len, key->mask & LOOKUP_DESCRIPTION_PREFIX);
+    return ok;
+}
+
+/**
+ * One query for up to LOOKUP_BATCH_MAX keys: a UNION ALL of one index
+ * search per key, each tagged with the key's index and stopped at two
+ * rows, which is enough to tell a key that is not unique.
+ */
+static bool lookup_batch(sqlite3 *db, const lookup_key_t *keys, int first, int count, int *matches, char **secrets) {
+    int param = 1;
+    size_t len = 0;
+    size_t size = (size_t) count * LOOKUP_ARM_MAX + 1;
+    char *sql = NULL;
+    sqlite3_stmt *sql_stmt = NULL;
+
+    if ((sql = malloc(size)) == NULL) CRXP__OUT_OF_MEMORY();
+    for (int i = first; i < first + count; i++) {
+        len += (size_t) snprintf(sql + len, size - len, "%sSELECT %d, secret FROM (SELECT secret FROM secrets WHERE ",
+                                 i > first ? " UNION ALL " : "", i);
+        if (keys[i].id != 0) len += (size_t) snprintf(sql + len, size - len, "id = ?");
+        else len += lookup_where(keys[i].mask, sql + len, size - len);
+        len += (size_t) snprintf(sql + len, size - len, " LIMIT 2)");
+    }
+
+    bool ok = sqlite3_prepare_v2(db, sql, (int) len, &sql_stmt, NULL) == SQLITE_OK;
+    for (int i = first; ok && i < first + count; i++) ok = bind_key(sql_stmt, &param, &keys[i]);
+
+    int rc = ok ? SQLITE_ROW : SQLITE_ERROR;
+    while (rc == SQLITE_ROW && (rc = sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+        int i = sqlite3_column_int(sql_stmt, 0);
+        if (matches[i]++ != 0) continue;
+
+        const unsigned char *secret = sqlite3_column_text(sql_stmt, 1);
+        size_t secret_len = (size_t) sqlite3_column_bytes(sql_stmt, 1);
+        if (secret_len > SECRET_MAX_LEN) {
+            rc = SQLITE_TOOBIG;
+            break;
+        }
+
+        memcpy(secrets[i], secret, secret_len);
+        secrets[i][secret_len] = '\0';
+    }
+
+    if (rc == SQLITE_TOOBIG) fprintf(stderr, "Error: A secret is longer than %d characters\n", SECRET_MAX_LEN);
+    else if (rc != SQLITE_DONE) fprintf(stderr, "Error: Lookup failed: %s\n", sqlite3_errmsg(db));
+    sqlite3_finalize(sql_stmt);
+    free(sql);
+    return rc == SQLITE_DONE;
+}
+
+/**
+ * Resolves every key, LOOKUP_BATCH_MAX per query, to a copy of its
+ * record's secret. Keys are all resolved first: the caller gets every
+ * secret it asked for or none, and every key that matched no record or
+ * more than one is reported. The copies share one block: a slab slot
+ * for a few keys, one sodium_malloc for many, instead of a slot each.
+ */
+char **lookup_secrets(sqlite3 *db, const lookup_key_t *keys, int count) {
+    bool ok = true;
+    int *matches = NULL;
+    char **secrets = NULL;
+
+    TRACE_SCOPE("lookup_secrets");
+    if ((matches = calloc((size_t) count, sizeof(int))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((secrets = calloc((size_t) count, sizeof(char *))) == NULL) CRXP__OUT_OF_MEMORY();
+    if ((secrets[0] = secmem_alloc((size_t) count * (SECRET_MAX_LEN + 1))) == NULL) CRXP__OUT_OF_MEMORY();
+    for (int i = 1; i < count; i++) secrets[i] = secrets[0] + (size_t) i * (SECRET_MAX_LEN + 1);
+
+    for (int first = 0; ok && first < count; first += LOOKUP_BATCH_MAX)
+        ok = lookup_batch(db, keys, first, count - first < LOOKUP_BATCH_MAX ? count - first : LOOKUP_BATCH_MAX,
+                          matches, secrets);
+
+    bool found = ok;
+    for (int i = 0; ok && i < count; i++) {
+        if (matches[i] == 1) continue;
+
+        fputs(matches[i] == 0 ? "Error: No record matches " : "Error: More than one record matches ", stderr);
+        print_key(&keys[i]);
+        fputc('\n', stderr);
+        found = false;
+    }
+
+    free(matches);
+    if (found) return secrets;
+
+    lookup_secrets_free(secrets);
+    return NULL;
+}
+
+void lookup_secrets_free(char **secrets) {
+    if (secrets == NULL) return;
+
+    secmem_free(secrets[0]);
+    free(secrets);
+}
+
+/* Writes the secret of every key to fd, one per line in the order of the keys */
+int get_secrets(sqlite3 *db, const lookup_key_t *keys, int count, int fd) {
+    char **secrets = NULL;
+    outbuf_t out = {0};
+
+    TRACE_SCOPE("get_secrets");
+    if ((secrets = lookup_secrets(db, keys, count)) == NULL) return CRXP_ERR;
+
+    outbuf_open(&out, fd);
+    for (int i = 0; i < count; i++) {
+        outbuf_write(&out, secrets[i], strlen(secrets[i]));
+        outbuf_putc(&out, '\n');
+    }
+
+    bool ok = outbuf_close(&out);
+    if (ok) metrics_add(METRIC_SECRETS_READ, (uint64_t) count);
+    lookup_secrets_free(secrets);
+    return ok ? CRXP_OK : CRXP_ERR;
+}
@@ -13,14 +13,30 @@
 #define ARGS_LINE_LENGTH 120
 #define ARGS_MIN_DESC_LENGTH 80
 
+#include "archive.h"
 #include "args.h"
+#include "backup.h"
+#include "breach.h"
 #include "cruxpass.h"
 #include "crypt.h"
 #include "database.h"
+#include "exec.h"
+#include "export.h"
+#include "import.h"
+#include "kdf.h"
+#include "lookup.h"
+#include "metrics.h"
+#include "query.h"
+#include "render.h"
+#include "secmem.h"
+#include "storage.h"
+#include "trace.h"
 #include "tui.h"
 
 unsigned char *key;
 vault_ctx_t *ctx;
+lookup_key_t *get_keys;
+exec_env_t *exec_env;
 
 extern char *meta_db_path;
 extern char *cruxpass_db_path;
@@ -35,12 +51,69 @@ int main(int argc, char **argv) {
     const bool *help = option_flag(&cmd_args, "help", "Show this help", .short_name = 'h', .early_exit = true);
     const bool *list = option_flag(&cmd_args, "list", "List all records", .short_name = 'l');
     const bool *save = option_flag(&cmd_args, "save", "Save a given record", .short_name = 'S');
-    const char **import_file = option_path(&cmd_args, "import", "Import records from a csv file", .short_name = 'i');
+    const char **import_file
+        = option_path(&cmd_args, "import", "Import records from a file (see --import-format)", .short_name = 'i');
+    const size_t *import_format
+        = option_enum(&cmd_args, "import-format", "Import format: csv, bitwarden, keepass or 1password (combined -i)",
+                      ((const char *[]) {IMPORT_FORMAT_NAMES, NULL}), .default_value = IMPORT_CSV);
+    const size_t *dedup_mode
+        = option_enum(&cmd_args, "dedup", "How to import records already in the vault: skip, update or keep both",
+                      ((const char *[]) {"skip", "update", "keep", NULL}), .default_value = DEDUP_SKIP);
+    const bool *dedup_secret
+        = option_flag(&cmd_args, "dedup-secret", "Also match the secret when looking for duplicates on import");
     const char **export_file
-        = option_path(&cmd_args, "export", "Export all records to a csv format", .short_name = 'e');
+        = option_path(&cmd_args, "export", "Export records to a file (see --format)", .short_name = 'e');
+    const size_t *export_format
+        = option_enum(&cmd_args, "format",
+                      "Format: csv, jsonl, keepass, bitwarden or tsv (combined -e), jsonl or tsv (combined query)",
+                      ((const char *[]) {EXPORT_FORMAT_NAMES, NULL}), .default_value = EXPORT_FORMAT_COUNT);
+    const char **export_filter = option_string(
+        &cmd_args, "filter", "Only records whose username or description contains a text (combined -e or query)");
+    const char **query_regex = option_string(
+        &cmd_args, "regex", "Only records whose username or description matches a regex (combined query)");
+    const char **query_since
+        = option_string(&cmd_args, "since", "Only records added on or after a YYYY-MM-DD date (combined query)");
+    const char **query_until
+        = option_string(&cmd_args, "until", "Only records added on or before a YYYY-MM-DD date (combined query)");
+    const char **query_ids_range
+        = option_string(&cmd_args, "ids", "Only records with ids in MIN:MAX, either may be left out (combined query)");
+    const size_t *query_sort
+        = option_enum(&cmd_args, "sort", "Sort by id, username, description, date or modified (combined query)",
+                      ((const char *[]) {QUERY_SORT_NAMES, NULL}), .default_value = QUERY_SORT_ID);
+    const bool *query_reverse = option_flag(&cmd_args, "reverse", "Sort in descending order (combined query)");
+    const long *query_limit
+        = option_long(&cmd_args, "limit", "Write at most N records, 0 for all (combined query)", .default_value = 0);
+    const bool *query_secrets
+        = option_flag(&cmd_args, "secrets", "Include the secrets, left out by default (combined query)");
+    const char **export_archive_file
+        = option_path(&cmd_args, "export-archive", "Export all records to an encrypted cruxpass archive");
+    const char **import_archive_file
+        = option_path(&cmd_args, "import-archive", "Import records from an encrypted cruxpass archive");
+    const char **backup_dir = option_path(&cmd_args, "backup", "Back up the encrypted vault into a directory");
+    const long *backup_keep
+        = option_long(&cmd_args, "backup-keep", "Number of backup generations to keep (combined --backup)",
+                      .default_value = 1);
+    const char **breach_file = option_path(&cmd_args, "breach-check",
+                                           "Check secrets against a sorted HIBP SHA-1 hash file (offline)");
+    const char **breach_index_file
+        = option_path(&cmd_args, "breach-index", "Build a lookup index for a sorted HIBP SHA-1 hash file");
     const bool *new_password = option_flag(&cmd_args, "new-password", "Change your login password", .short_name = 'n');
+    const long *kdf_lanes = option_long(&cmd_args, "kdf-lanes",
+                                        "Re-key the vault to derive its key with N Argon2id lanes, one thread each");
     const long *record_id
         = option_long(&cmd_args, "delete", "Deletes a record by id", .short_name = 'd', .default_value = -1);
+    const long *get_id
+        = option_long(&cmd_args, "id", "Record id to write the secret of (combined get)", .default_value = -1);
+    const char **get_user = option_string(
+        &cmd_args, "user", "Username to write the secret of, a trailing * matches a prefix (combined get)");
+    const char **get_desc = option_string(
+        &cmd_args, "desc", "Description to write the secret of, a trailing * matches a prefix (combined get)");
+    const long *output_fd
+        = option_long(&cmd_args, "output-fd", "File descriptor to write to (combined get, render or query)",
+                      .default_value = 1);
+    const long *password_fd = option_long(&cmd_args, "password-fd",
+                                          "Read the login password from a file descriptor instead of prompting",
+                                          .default_value = -1);
     const long *gen_secret_len
         = option_long(&cmd_args, "generate-rand", "Generates a random secret of a given length", .short_name = 'g');
     const bool *pin
@@ -58,9 +131,25 @@ int main(int argc, char **argv) {
         = option_flag(&cmd_args, "upper", "Generates an all upper case random pin of a given length (combined -g)",
                       .short_name = 'A');
 
+    const char **storage = option_string(
+        &cmd_args, "storage", "Show (show) or change the storage profile: presets and key=value settings");
+    const bool *metrics = option_flag(&cmd_args, "metrics", "Print operation counters in OpenMetrics text format");
+    const char **trace_file
+        = option_path(&cmd_args, "trace", "Write a Chrome trace of startup and database phases to a file");
+
     const char **cruxpass_run_dir = option_path(
         &cmd_args, "run-directory", "Specify the directory path where the database will be stored.", .short_name = 'r');
 
+    /* args.h knows no "--", what follows it is the command of exec */
+    char **exec_argv = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") != 0) continue;
+        exec_argv = &argv[i + 1];
+        argv[i] = NULL;
+        argc = i;
+        break;
+    }
+
     char **pos_args = NULL;
     int pos_args_len = parse_args(&cmd_args, argc, argv, &pos_args);
 
@@ -70,7 +159,79 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
-    if (*help || pos_args_len != 0 || argc == 1) {
+    if (*kdf_lanes < 0 || *kdf_lanes > KDF_LANES_MAX) {
+        fprintf(stderr, "Warning: --kdf-lanes must be between 1 and %d\n", KDF_LANES_MAX);
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    bool get = pos_args_len > 0 && strcmp(pos_args[0], "get") == 0;
+    bool exec = pos_args_len > 0 && strcmp(pos_args[0], "exec") == 0;
+    if (exec != (exec_argv != NULL) || (exec && (pos_args_len == 1 || *exec_argv == NULL))) {
+        fprintf(stderr, "Warning: exec takes NAME=key variables, then -- and the command to run\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    bool render = pos_args_len > 0 && strcmp(pos_args[0], "render") == 0;
+    if (render && pos_args_len != 2) {
+        fprintf(stderr, "Warning: render takes one template file\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    bool query = pos_args_len > 0 && strcmp(pos_args[0], "query") == 0;
+    if (query && pos_args_len != 1) {
+        fprintf(stderr, "Warning: query takes no arguments, only filter options\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    EXPORT_FORMAT query_format = *export_format == EXPORT_FORMAT_COUNT ? EXPORT_JSONL : (EXPORT_FORMAT) *export_format;
+    query_opts_t query_opts = {.format = query_format,
+                               .filter = *export_filter,
+                               .regex = *query_regex,
+                               .since = *query_since,
+                               .until = *query_until,
+                               .sort = (QUERY_SORT) *query_sort,
+                               .reverse = *query_reverse,
+                               .limit = *query_limit,
+                               .secrets = *query_secrets};
+    bool query_opts_set = *query_regex != NULL || *query_since != NULL || *query_until != NULL
+                          || *query_ids_range != NULL || *query_sort != QUERY_SORT_ID || *query_reverse
+                          || *query_limit != 0 || *query_secrets;
+    if ((!query && query_opts_set) || *query_limit < 0) {
+        fprintf(stderr, "Warning: --regex, --since, --until, --ids, --sort, --reverse, --limit and --secrets "
+                        "must be combined with query\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    if (query && *query_ids_range != NULL && !query_ids(&query_opts, *query_ids_range)) {
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    bool get_opts = *get_id != -1 || *get_user != NULL || *get_desc != NULL;
+    if (!get && get_opts) {
+        fprintf(stderr, "Warning: --id, --user and --desc must be combined with get\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    if (get && pos_args_len == 1 && !get_opts) {
+        fprintf(stderr, "Warning: get needs --id, --user or --desc, or keys after it\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    if (*output_fd < 0 || *password_fd < -1) {
+        fprintf(stderr, "Warning: --output-fd and --password-fd must be open file descriptors\n");
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    if (*help || (pos_args_len != 0 && !get && !exec && !render && !query) || argc == 1) {
         print_help(&cmd_args, argv[0]);
         free_args(&cmd_args);
         return EXIT_SUCCESS;
@@ -112,13 +273,22 @@ int main(int argc, char **argv) {
         }
 
         fprintf(stdout, "secret: %s\n", secret);
-        sodium_memzero(secret, sizeof(secret));
+        secmem_free(secret);
 
-        free(secret);
+        /* No vault is needed to generate, count it only if there is one */
+        char *meta_path = existing_meta_path(*cruxpass_run_dir);
+        if (meta_path != NULL) metrics_flush(meta_path);
+        free(meta_path);
         free_args(&cmd_args);
         return EXIT_SUCCESS;
     }
 
+    if (*breach_index_file != NULL) {
+        int ok = build_breach_index(*breach_index_file);
+        free_args(&cmd_args);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (*cruxpass_run_dir != NULL) {
         if (strlen(*cruxpass_run_dir) >= MAX_PATH_LEN - HOME_PATH_MAX_LEN) {
             fprintf(stderr, "Error: Path to run-directory too long.\n");
@@ -138,12 +308,61 @@ int main(int argc, char **argv) {
         return EXIT_FAILURE;
     }
 
+    /* The trace is written at exit, so failed runs are traced too */
+    if (*trace_file != NULL && !trace_init(*trace_file)) {
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
     if ((ctx = initcrux((char *) *cruxpass_run_dir)) == NULL) {
         free_args(&cmd_args);
         return EXIT_FAILURE;
     }
 
-    if ((key = authenticate(ctx)) == NULL) {
+    /* meta.db is not encrypted, automation can read the counters without the password */
+    if (*metrics) {
+        bool ok = metrics_print(meta_db_path, stdout);
+        cleanup_main();
+        free_args(&cmd_args);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (*storage != NULL && strcmp(*storage, "show") == 0) {
+        bool ok = storage_show(stdout);
+        cleanup_main();
+        free_args(&cmd_args);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* Keys are checked before the password is asked for, they point into argv */
+    int get_count = 0;
+    if (get) {
+        if ((get_keys = calloc((size_t) pos_args_len, sizeof(lookup_key_t))) == NULL) CRXP__OUT_OF_MEMORY();
+        bool ok = !get_opts || lookup_key(&get_keys[get_count++], *get_id, *get_user, *get_desc);
+        for (int i = 1; ok && i < pos_args_len; i++)
+            ok = lookup_parse(&get_keys[get_count++], pos_args[i], strlen(pos_args[i]));
+        if (!ok) {
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (exec && (exec_env = exec_parse(pos_args + 1, pos_args_len - 1)) == NULL) {
+        cleanup_main();
+        free_args(&cmd_args);
+        return EXIT_FAILURE;
+    }
+
+    /* A list on its own keeps the unlock prompt's termbox and streams the records in */
+    tui_state_t tui = {0};
+    tui_session(&tui, ctx->secret_db);
+    bool list_only = *list && !*new_password && !*save && *import_file == NULL && *export_file == NULL
+                     && *import_archive_file == NULL && *export_archive_file == NULL && *storage == NULL
+                     && *backup_dir == NULL && *breach_file == NULL && *record_id == -1 && !get && !exec && !render
+                     && !query;
+
+    if ((key = authenticate(ctx, (uint32_t) *kdf_lanes, list_only ? &tui : NULL, (int) *password_fd)) == NULL) {
         cleanup_main();
         free_args(&cmd_args);
         return EXIT_FAILURE;
@@ -163,11 +382,13 @@ int main(int argc, char **argv) {
     if (*save) {
         tui_init();
         tb_clear();
-        secret_t rec = {0};
-        if (get_input("> username: ", rec.username, USERNAME_MAX_LEN, 0, 2) == NULL
-            || get_input("> secret: ", rec.secret, SECRET_MAX_LEN, 0, 3) == NULL
-            || get_input("> description: ", rec.description, DESC_MAX_LEN, 0, 4) == NULL) {
+        secret_t *rec = NULL;
+        if ((rec = secmem_alloc(sizeof(secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
+        if (get_input("> username: ", rec->username, USERNAME_MAX_LEN, 0, 2) == NULL
+            || get_input("> secret: ", rec->secret, SECRET_MAX_LEN, 0, 3) == NULL
+            || get_input("> description: ", rec->description, DESC_MAX_LEN, 0, 4) == NULL) {
             tui_cleanup();
+            secmem_free(rec);
             cleanup_main();
             free_args(&cmd_args);
 
@@ -176,19 +397,23 @@ int main(int argc, char **argv) {
         }
 
         tui_cleanup();
-        if (strlen(rec.description) < FIELD_MIN || strlen(rec.secret) < FIELD_MIN || strlen(rec.username) < FIELD_MIN) {
+        if (strlen(rec->description) < FIELD_MIN || strlen(rec->secret) < FIELD_MIN
+            || strlen(rec->username) < FIELD_MIN) {
+            secmem_free(rec);
             cleanup_main();
             free_args(&cmd_args);
             fprintf(stderr, "Error: Failed to retrieve record\n");
             return EXIT_FAILURE;
         }
 
-        if (!insert_record(ctx->secret_db, &rec)) {
+        if (!insert_record(ctx->secret_db, rec)) {
+            secmem_free(rec);
             cleanup_main();
             free_args(&cmd_args);
             return EXIT_FAILURE;
         }
 
+        secmem_free(rec);
         fprintf(stderr, "Note: Password saved successfully\n");
     }
 
@@ -200,7 +425,10 @@ int main(int argc, char **argv) {
             return EXIT_FAILURE;
         }
 
-        if (!import_secrets(ctx->secret_db, (char *) *import_file)) {
+        import_opts_t import_opts = {.format = (IMPORT_FORMAT) *import_format,
+                                     .mode = (DEDUP_T) *dedup_mode,
+                                     .match_secret = *dedup_secret};
+        if (!import_secrets(ctx->secret_db, (char *) *import_file, &import_opts)) {
             cleanup_main();
             free_args(&cmd_args);
             fprintf(stderr, "Error: Failed to import secrets from: %s", *import_file);
@@ -218,7 +446,10 @@ int main(int argc, char **argv) {
             return EXIT_FAILURE;
         }
 
-        if (!export_secrets(ctx->secret_db, *export_file)) {
+        export_opts_t export_opts
+            = {.format = *export_format == EXPORT_FORMAT_COUNT ? EXPORT_CSV : (EXPORT_FORMAT) *export_format,
+               .filter = *export_filter};
+        if (!export_secrets(ctx->secret_db, *export_file, &export_opts)) {
             fprintf(stderr, "Error: Failed to export secrets to: %s\n", *export_file);
             cleanup_main();
             free_args(&cmd_args);
@@ -228,6 +459,81 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Info: secrets exported successfully to: %s\n", *export_file);
     }
 
+    if (*import_archive_file != NULL) {
+        import_opts_t import_opts = {.mode = (DEDUP_T) *dedup_mode, .match_secret = *dedup_secret};
+        if (!import_archive(ctx->secret_db, *import_archive_file, &import_opts)) {
+            fprintf(stderr, "Error: Failed to import archive: %s\n", *import_archive_file);
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+
+        fprintf(stderr, "Info: secrets imported successfully from: %s\n", *import_archive_file);
+    }
+
+    if (*export_archive_file != NULL) {
+        if (!export_archive(ctx->secret_db, *export_archive_file)) {
+            fprintf(stderr, "Error: Failed to export archive: %s\n", *export_archive_file);
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+
+        fprintf(stderr, "Info: secrets exported successfully to: %s\n", *export_archive_file);
+    }
+
+    if (*storage != NULL) {
+        if (!storage_set(ctx, key, *storage)) {
+            fprintf(stderr, "Error: Failed to change the storage profile\n");
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (*backup_dir != NULL) {
+        if (!backup_vault(ctx, key, *backup_dir, (int) *backup_keep)) {
+            fprintf(stderr, "Error: Failed to back up vault to: %s\n", *backup_dir);
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (*breach_file != NULL) {
+        if (!breach_check(ctx->secret_db, *breach_file)) {
+            fprintf(stderr, "Error: Failed to check secrets against: %s\n", *breach_file);
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (get) {
+        if (!get_secrets(ctx->secret_db, get_keys, get_count, (int) *output_fd)) {
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (render) {
+        if (!render_template(ctx->secret_db, pos_args[1], (int) *output_fd)) {
+            fprintf(stderr, "Error: Failed to render: %s\n", pos_args[1]);
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (query) {
+        if (!query_records(ctx->secret_db, &query_opts, (int) *output_fd)) {
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+    }
+
     if (*record_id != -1) {
         if (!delete_record(ctx->secret_db, *record_id)) {
             cleanup_main();
@@ -236,8 +542,25 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The vault is closed and the key wiped before the command takes over the process */
+    if (exec) {
+        if (!exec_resolve(exec_env, ctx->secret_db)) {
+            cleanup_main();
+            free_args(&cmd_args);
+            return EXIT_FAILURE;
+        }
+
+        exec_env_t *env = exec_env;
+        exec_env = NULL;
+        cleanup_main();
+        free_args(&cmd_args);
+        exec_run(env, exec_argv);
+        exec_free(env);
+        return EXIT_FAILURE;
+    }
+
     if (*list) {
-        if (tui_main(ctx->secret_db) == CRXP_ERR) {
+        if (tui_main(&tui) == CRXP_ERR) {
             cleanup_main();
             free_args(&cmd_args);
             return EXIT_FAILURE;
@@ -260,13 +583,21 @@ void cleanup_main(void) {
     tui_cleanup();
     cleanup_stmts();
     sqlite3_close(ctx->secret_db);
+    metrics_flush(meta_db_path);
     if (cruxpass_db_path != NULL) free(cruxpass_db_path);
     if (meta_db_path != NULL) free(meta_db_path);
 
     if (key != NULL) {
-        sodium_memzero(key, KEY_LEN);
-        sodium_free(key);
+        secmem_free(key);
+        key = NULL;
     }
+
+    free(get_keys);
+    get_keys = NULL;
+    exec_free(exec_env);
+    exec_env = NULL;
+
+    secmem_cleanup();
 }
 
 void print_help(Args *cmd_args, const char *program) {
@@ -275,7 +606,13 @@ void print_help(Args *cmd_args, const char *program) {
           "transparent. It uses an SQLCipher database to manage entries, and storage accessed via a login password.\n";
     char *footer = "Its philosophy is simplicity, security, and efficiency for devs and terminal wizards.";
 
-    fprintf(stdout, "usage: %s [options]\n\n", program);
+    fprintf(stdout,
+            "usage: %s [options]\n"
+            "       %s get [--id N | --user U --desc D] [id=N | user=U,desc=D ...]\n"
+            "       %s exec NAME=id:N | NAME=user:U,desc:D ... -- command [args]\n"
+            "       %s render TEMPLATE > FILE\n"
+            "       %s query [--filter T | --regex RE] [--since D] [--ids MIN:MAX] [--sort C] [--format jsonl|tsv]\n\n",
+            program, program, program, program, program);
     fprintf(stdout, "%s\n", description);
     print_options(cmd_args, stdout);
     fprintf(stdout, "\n%s\n", footer);
@@ -0,0 +1,187 @@
+#include "metrics.h"
+
+#ifndef SQLITE_HAS_CODEC
+#define SQLITE_HAS_CODEC
+#endif
+
+#include <sqlcipher/sqlite3.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    const char *help;
+} metric_info_t;
+
+static const metric_info_t counter_info[METRIC_COUNT] = {
+    [METRIC_RECORDS_INSERTED] = {"records_inserted", "Records inserted."},
+    [METRIC_RECORDS_UPDATED] = {"records_updated", "Records updated."},
+    [METRIC_RECORDS_DELETED] = {"records_deleted", "Records deleted."},
+    [METRIC_IMPORT_ROWS] = {"import_rows", "Records added or updated by imports."},
+    [METRIC_IMPORT_BYTES] = {"import_bytes", "Bytes read from import files."},
+    [METRIC_EXPORT_ROWS] = {"export_rows", "Records written by exports."},
+    [METRIC_EXPORT_BYTES] = {"export_bytes", "Bytes written to export files."},
+    [METRIC_SECRETS_GENERATED] = {"secrets_generated", "Random secrets generated."},
+    [METRIC_UNLOCK_FAILURES] = {"unlock_failures", "Unlocks that failed after the password was entered."},
+    [METRIC_BUSY_WAITS] = {"busy_waits", "Statements that waited for another process to release the vault."},
+    [METRIC_SECRETS_READ] = {"secrets_read", "Secrets written out by get, render and query or passed to exec."},
+    [METRIC_QUERY_ROWS] = {"query_rows", "Records listed by query."},
+};
+
+static const metric_info_t hist_info[HIST_COUNT] = {
+    [HIST_UNLOCK_SECONDS] = {"unlock_seconds", "Time from password entry to an open vault."},
+    [HIST_KDF_SECONDS] = {"kdf_seconds", "Time spent deriving keys with Argon2id."},
+};
+
+static const double hist_bounds[HIST_BUCKETS - 1] = {HIST_BOUNDS};
+
+static atomic_uint_fast64_t counters[METRIC_COUNT];
+static atomic_uint_fast64_t buckets[HIST_COUNT][HIST_BUCKETS];
+static atomic_uint_fast64_t hist_sum_us[HIST_COUNT];
+
+void metrics_add(METRIC_T metric, uint64_t n) { atomic_fetch_add_explicit(&counters[metric], n, memory_order_relaxed); }
+
+void metrics_observe(HIST_T hist, uint64_t ns) {
+    double seconds = ns / 1e9;
+    int bucket = 0;
+
+    while (bucket < HIST_BUCKETS - 1 && seconds > hist_bounds[bucket]) bucket++;
+    atomic_fetch_add_explicit(&buckets[hist][bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist_sum_us[hist], ns / 1000, memory_order_relaxed);
+}
+
+uint64_t metrics_now(void) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+static sqlite3 *open_stats(const char *meta_path) {
+    sqlite3 *db = NULL;
+    const char *sql = "CREATE TABLE IF NOT EXISTS stats (name TEXT PRIMARY KEY, value INTEGER NOT NULL DEFAULT 0);";
+
+    if (meta_path == NULL) return NULL;
+    if (sqlite3_open_v2(meta_path, &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    /* Several cruxpass processes may exit at the same time */
+    sqlite3_busy_timeout(db, METRICS_BUSY_TIMEOUT_MS);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    return db;
+}
+
+static bool merge(sqlite3_stmt *stmt, const char *name, atomic_uint_fast64_t *counter) {
+    uint64_t delta = atomic_exchange_explicit(counter, 0, memory_order_relaxed);
+    if (delta == 0) return true;
+
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64) delta);
+    int rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_DONE;
+}
+
+/**
+ * Adds what this process counted to the stats table and zeroes the
+ * local counters. Losing the counts never fails the operation itself.
+ */
+bool metrics_flush(const char *meta_path) {
+    bool ok = true;
+    char name[64];
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql
+        = "INSERT INTO stats (name, value) VALUES (?, ?) ON CONFLICT (name) DO UPDATE SET value = value + excluded.value;";
+
+    if ((db = open_stats(meta_path)) == NULL) return false;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK
+        || sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return false;
+    }
+
+    for (int i = 0; i < METRIC_COUNT && ok; i++) ok = merge(stmt, counter_info[i].name, &counters[i]);
+    for (int i = 0; i < HIST_COUNT && ok; i++) {
+        for (int j = 0; j < HIST_BUCKETS && ok; j++) {
+            snprintf(name, sizeof(name), "%s_bucket_%d", hist_info[i].name, j);
+            ok = merge(stmt, name, &buckets[i][j]);
+        }
+
+        snprintf(name, sizeof(name), "%s_sum_us", hist_info[i].name);
+        if (ok) ok = merge(stmt, name, &hist_sum_us[i]);
+    }
+
+    sqlite3_exec(db, ok ? "COMMIT;" : "ROLLBACK;", NULL, NULL, NULL);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return ok;
+}
+
+static int64_t stat_value(sqlite3_stmt *stmt, const char *name) {
+    int64_t value = 0;
+
+    sqlite3_bind_text(stmt, 1, name, -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) == SQLITE_ROW) value = sqlite3_column_int64(stmt, 0);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return value;
+}
+
+bool metrics_print(const char *meta_path, FILE *out) {
+    char name[64];
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+
+    if ((db = open_stats(meta_path)) == NULL) {
+        fprintf(stderr, "Error: Failed to open the stats table in %s\n", meta_path);
+        return false;
+    }
+
+    if (sqlite3_prepare_v2(db, "SELECT value FROM stats WHERE name = ?;", -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return false;
+    }
+
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        const metric_info_t *info = &counter_info[i];
+        fprintf(out, "# TYPE " METRICS_PREFIX "%s counter\n# HELP " METRICS_PREFIX "%s %s\n", info->name, info->name,
+                info->help);
+        fprintf(out, METRICS_PREFIX "%s_total %lld\n", info->name, (long long) stat_value(stmt, info->name));
+    }
+
+    for (int i = 0; i < HIST_COUNT; i++) {
+        const metric_info_t *info = &hist_info[i];
+        int64_t count = 0;
+
+        fprintf(out, "# TYPE " METRICS_PREFIX "%s histogram\n# HELP " METRICS_PREFIX "%s %s\n", info->name,
+                info->name, info->help);
+        for (int j = 0; j < HIST_BUCKETS; j++) {
+            snprintf(name, sizeof(name), "%s_bucket_%d", info->name, j);
+            count += stat_value(stmt, name);
+            if (j < HIST_BUCKETS - 1)
+                fprintf(out, METRICS_PREFIX "%s_bucket{le=\"%g\"} %lld\n", info->name, hist_bounds[j],
+                        (long long) count);
+            else
+                fprintf(out, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %lld\n", info->name, (long long) count);
+        }
+
+        snprintf(name, sizeof(name), "%s_sum_us", info->name);
+        fprintf(out, METRICS_PREFIX "%s_sum %.6f\n", info->name, stat_value(stmt, name) / 1e6);
+        fprintf(out, METRICS_PREFIX "%s_count %lld\n", info->name, (long long) count);
+    }
+
+    fprintf(out, "# EOF\n");
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return true;
+}
@@ -0,0 +1,421 @@
+#include "parser.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sodium/utils.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cruxpass.h"
+
+bool stream_open(stream_t *stream, const char *path) {
+    memset(stream, 0, sizeof(stream_t));
+    if ((stream->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    posix_fadvise(stream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if ((stream->buf = sodium_malloc(STREAM_BUF_SIZE)) == NULL) CRXP__OUT_OF_MEMORY();
+    stream->line = 1;
+    return true;
+}
+
+void stream_close(stream_t *stream) {
+    if (stream->buf != NULL) sodium_free(stream->buf);
+    if (stream->fd >= 0) close(stream->fd);
+    stream->buf = NULL;
+    stream->fd = -1;
+}
+
+bool stream_fill(stream_t *stream) {
+    ssize_t got = 0;
+
+    if (stream->failed) return false;
+    do {
+        got = read(stream->fd, stream->buf, STREAM_BUF_SIZE);
+    } while (got < 0 && errno == EINTR);
+
+    if (got < 0) {
+        fprintf(stderr, "Error: Failed to read input: %s\n", strerror(errno));
+        stream->failed = true;
+    }
+
+    stream->pos = 0;
+    stream->len = got > 0 ? (size_t) got : 0;
+    stream->consumed += stream->len;
+    return got > 0;
+}
+
+void token_utf8(token_t *token, unsigned long cp) {
+    if (cp < 0x80) {
+        token_putc(token, (char) cp);
+    } else if (cp < 0x800) {
+        token_putc(token, (char) (0xC0 | (cp >> 6)));
+        token_putc(token, (char) (0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        token_putc(token, (char) (0xE0 | (cp >> 12)));
+        token_putc(token, (char) (0x80 | ((cp >> 6) & 0x3F)));
+        token_putc(token, (char) (0x80 | (cp & 0x3F)));
+    } else {
+        token_putc(token, (char) (0xF0 | (cp >> 18)));
+        token_putc(token, (char) (0x80 | ((cp >> 12) & 0x3F)));
+        token_putc(token, (char) (0x80 | ((cp >> 6) & 0x3F)));
+        token_putc(token, (char) (0x80 | (cp & 0x3F)));
+    }
+}
+
+static int skip_space(stream_t *in) {
+    int c = 0;
+    while ((c = stream_peek(in)) == ' ' || c == '\t' || c == '\n' || c == '\r') stream_getc(in);
+    return c;
+}
+
+/* Reads until the terminator has been consumed, e.g. "-->" */
+static bool skip_until(stream_t *in, const char *end, token_t *keep) {
+    size_t len = strlen(end);
+    size_t matched = 0;
+    int c = 0;
+
+    while ((c = stream_getc(in)) != EOF) {
+        if (keep != NULL) token_putc(keep, (char) c);
+        if (c == end[matched]) {
+            if (++matched == len) {
+                if (keep != NULL && keep->len >= len) keep->data[keep->len -= len] = '\0';
+                return true;
+            }
+        } else {
+            matched = c == end[0] ? 1 : 0;
+        }
+    }
+
+    return false;
+}
+
+void json_init(json_parser_t *parser, stream_t *in) {
+    memset(parser, 0, sizeof(json_parser_t));
+    parser->in = in;
+}
+
+static long json_hex4(stream_t *in) {
+    long value = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = stream_getc(in);
+        if (!isxdigit(c)) return -1;
+        value = value * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+    }
+
+    return value;
+}
+
+static bool json_string(json_parser_t *parser) {
+    stream_t *in = parser->in;
+    token_t *token = &parser->token;
+    int c = 0;
+
+    token_reset(token);
+    while ((c = stream_getc(in)) != '"') {
+        if (c == EOF || c < 0x20) return false;
+        if (c != '\\') {
+            token_putc(token, (char) c);
+            continue;
+        }
+
+        switch (c = stream_getc(in)) {
+            case '"':
+            case '\\':
+            case '/':
+                token_putc(token, (char) c);
+                break;
+            case 'b':
+                token_putc(token, '\b');
+                break;
+            case 'f':
+                token_putc(token, '\f');
+                break;
+            case 'n':
+                token_putc(token, '\n');
+                break;
+            case 'r':
+                token_putc(token, '\r');
+                break;
+            case 't':
+                token_putc(token, '\t');
+                break;
+            case 'u': {
+                long cp = json_hex4(in);
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    if (stream_getc(in) != '\\' || stream_getc(in) != 'u') return false;
+                    long low = json_hex4(in);
+                    if (low < 0xDC00 || low > 0xDFFF) return false;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp < 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+                    return false;
+                }
+
+                token_utf8(token, (unsigned long) cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static JSON_TOKEN json_push(json_parser_t *parser, bool object) {
+    if (parser->depth == JSON_MAX_DEPTH) return JSON_ERROR;
+    parser->stack[parser->depth++] = object;
+    parser->want_key = object;
+    return object ? JSON_OBJECT_BEGIN : JSON_ARRAY_BEGIN;
+}
+
+static JSON_TOKEN json_pop(json_parser_t *parser, bool object) {
+    if (parser->depth == 0 || parser->stack[parser->depth - 1] != object) return JSON_ERROR;
+    parser->depth--;
+    parser->want_key = false;
+    return object ? JSON_OBJECT_END : JSON_ARRAY_END;
+}
+
+/**
+ * Returns the next token. Object keys come back as JSON_KEY with the
+ * colon consumed, string values are left decoded in parser->token.
+ */
+JSON_TOKEN json_next(json_parser_t *parser) {
+    stream_t *in = parser->in;
+    int c = skip_space(in);
+
+    if (c == ',') {
+        if (parser->depth == 0) return JSON_ERROR;
+        stream_getc(in);
+        parser->want_key = parser->stack[parser->depth - 1];
+        c = skip_space(in);
+    }
+
+    if (c == EOF) return parser->depth == 0 && !in->failed ? JSON_EOF : JSON_ERROR;
+    stream_getc(in);
+
+    switch (c) {
+        case '{':
+            return json_push(parser, true);
+        case '[':
+            return json_push(parser, false);
+        case '}':
+            return json_pop(parser, true);
+        case ']':
+            return json_pop(parser, false);
+        case '"':
+            if (!json_string(parser)) return JSON_ERROR;
+            if (!parser->want_key) return JSON_STRING;
+
+            parser->want_key = false;
+            if (skip_space(in) != ':') return JSON_ERROR;
+            stream_getc(in);
+            return JSON_KEY;
+    }
+
+    if (parser->want_key) return JSON_ERROR;
+
+    token_reset(&parser->token);
+    token_putc(&parser->token, (char) c);
+    while (isalnum(c = stream_peek(in)) || c == '+' || c == '-' || c == '.') token_putc(&parser->token, stream_getc(in));
+
+    if (strcmp(parser->token.data, "true") == 0) return JSON_TRUE;
+    if (strcmp(parser->token.data, "false") == 0) return JSON_FALSE;
+    if (strcmp(parser->token.data, "null") == 0) return JSON_NULL;
+    if (parser->token.data[0] == '-' || isdigit((unsigned char) parser->token.data[0])) return JSON_NUMBER;
+    return JSON_ERROR;
+}
+
+/* Skips the value that `current` starts, nested containers included */
+bool json_skip(json_parser_t *parser, JSON_TOKEN current) {
+    if (current == JSON_ERROR || current == JSON_EOF) return false;
+    if (current != JSON_OBJECT_BEGIN && current != JSON_ARRAY_BEGIN) return true;
+
+    int depth = parser->depth - 1;
+    while (parser->depth > depth) {
+        JSON_TOKEN token = json_next(parser);
+        if (token == JSON_ERROR || token == JSON_EOF) return false;
+    }
+
+    return true;
+}
+
+void xml_init(xml_parser_t *parser, stream_t *in) {
+    memset(parser, 0, sizeof(xml_parser_t));
+    parser->in = in;
+}
+
+static void xml_entity(stream_t *in, token_t *text) {
+    char name[12] = {0};
+    size_t len = 0;
+    int c = 0;
+
+    while (len < sizeof(name) - 1 && (c = stream_peek(in)) != EOF && c != ';' && c != '<') name[len++] = stream_getc(in);
+    if (c != ';') {
+        token_putc(text, '&');
+        for (size_t i = 0; i < len; i++) token_putc(text, name[i]);
+        return;
+    }
+
+    stream_getc(in);
+    if (strcmp(name, "amp") == 0) token_putc(text, '&');
+    else if (strcmp(name, "lt") == 0) token_putc(text, '<');
+    else if (strcmp(name, "gt") == 0) token_putc(text, '>');
+    else if (strcmp(name, "quot") == 0) token_putc(text, '"');
+    else if (strcmp(name, "apos") == 0) token_putc(text, '\'');
+    else if (name[0] == '#') {
+        char *end = NULL;
+        unsigned long cp = name[1] == 'x' ? strtoul(name + 2, &end, 16) : strtoul(name + 1, &end, 10);
+        if (*end == '\0' && cp > 0 && cp <= 0x10FFFF) token_utf8(text, cp);
+    }
+}
+
+static XML_TOKEN xml_text(xml_parser_t *parser) {
+    int c = 0;
+
+    token_reset(&parser->text);
+    while ((c = stream_peek(parser->in)) != EOF && c != '<') {
+        stream_getc(parser->in);
+        if (c == '&') xml_entity(parser->in, &parser->text);
+        else token_putc(&parser->text, (char) c);
+    }
+
+    return XML_TEXT;
+}
+
+static int xml_name(xml_parser_t *parser) {
+    int c = 0;
+
+    token_reset(&parser->name);
+    while ((c = stream_peek(parser->in)) != EOF && !isspace(c) && c != '/' && c != '>')
+        token_putc(&parser->name, (char) stream_getc(parser->in));
+
+    return c;
+}
+
+/* Attributes are not needed by any importer, only walked over */
+static bool xml_attributes(xml_parser_t *parser) {
+    int c = 0;
+    int quote = 0;
+    bool slash = false;
+
+    while ((c = stream_getc(parser->in)) != EOF) {
+        if (quote != 0) {
+            if (c == quote) quote = 0;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '>') {
+            parser->close_pending = slash;
+            return true;
+        }
+
+        slash = quote == 0 && c == '/';
+    }
+
+    return false;
+}
+
+/**
+ * Returns the next element boundary or run of text. Comments, processing
+ * instructions and DOCTYPE are skipped, CDATA sections come back as text.
+ */
+XML_TOKEN xml_next(xml_parser_t *parser) {
+    stream_t *in = parser->in;
+    int c = 0;
+
+    if (parser->close_pending) {
+        parser->close_pending = false;
+        return XML_END;
+    }
+
+    for (;;) {
+        if ((c = stream_peek(in)) == EOF) return in->failed ? XML_ERROR : XML_EOF;
+        if (c != '<') return xml_text(parser);
+
+        stream_getc(in);
+        c = stream_peek(in);
+        if (c == '?') {
+            if (!skip_until(in, "?>", NULL)) return XML_ERROR;
+            continue;
+        }
+
+        if (c == '!') {
+            stream_getc(in);
+            if (stream_peek(in) == '-') {
+                if (stream_getc(in) != '-' || stream_getc(in) != '-' || !skip_until(in, "-->", NULL)) return XML_ERROR;
+                continue;
+            }
+
+            if (stream_peek(in) == '[') {
+                const char *cdata = "[CDATA[";
+                for (size_t i = 0; cdata[i] != '\0'; i++)
+                    if (stream_getc(in) != cdata[i]) return XML_ERROR;
+
+                token_reset(&parser->text);
+                return skip_until(in, "]]>", &parser->text) ? XML_TEXT : XML_ERROR;
+            }
+
+            if (!skip_until(in, ">", NULL)) return XML_ERROR;
+            continue;
+        }
+
+        if (c == '/') {
+            stream_getc(in);
+            xml_name(parser);
+            return skip_until(in, ">", NULL) ? XML_END : XML_ERROR;
+        }
+
+        xml_name(parser);
+        if (parser->name.len == 0) return XML_ERROR;
+        return xml_attributes(parser) ? XML_START : XML_ERROR;
+    }
+}
+
+void csv_init(csv_reader_t *reader, stream_t *in) {
+    memset(reader, 0, sizeof(csv_reader_t));
+    reader->in = in;
+}
+
+/**
+ * Reads one RFC 4180 record, quoted fields may span lines. Returns the
+ * number of fields, 0 at the end of input and -1 on malformed input.
+ * Fields past CSV_MAX_FIELDS are dropped.
+ */
+int csv_next_row(csv_reader_t *reader) {
+    stream_t *in = reader->in;
+    int c = 0;
+
+    while ((c = stream_peek(in)) == '\r' || c == '\n') stream_getc(in);
+    if (c == EOF) return in->failed ? -1 : 0;
+
+    reader->line = in->line;
+    reader->count = 0;
+    do {
+        token_t *field = &reader->fields[reader->count < CSV_MAX_FIELDS ? reader->count : CSV_MAX_FIELDS];
+        token_reset(field);
+        reader->count++;
+
+        if (stream_peek(in) == '"') {
+            stream_getc(in);
+            for (;;) {
+                if ((c = stream_getc(in)) == EOF) return -1;
+                if (c == '"' && stream_peek(in) != '"') break;
+                if (c == '"') stream_getc(in);
+                token_putc(field, (char) c);
+            }
+
+            while ((c = stream_getc(in)) != ',' && c != '\n' && c != EOF)
+                if (c != '\r') token_putc(field, (char) c);
+        } else {
+            while ((c = stream_getc(in)) != ',' && c != '\n' && c != EOF) token_putc(field, (char) c);
+            if (field->len > 0 && field->data[field->len - 1] == '\r') field->data[--field->len] = '\0';
+        }
+    } while (c == ',');
+
+    if (reader->count > CSV_MAX_FIELDS) reader->count = CSV_MAX_FIELDS;
+    return (int) reader->count;
+}
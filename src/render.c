@@ -0,0 +1,176 @@
+#include "render.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define SCHEME_LEN (sizeof(RENDER_SCHEME) - 1)
+
+/* An empty template maps to nothing and renders to nothing */
+static bool map_template(const char *path, template_t *tpl) {
+    int fd = -1;
+    struct stat file_stat = {0};
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error: Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        fprintf(stderr, "Error: [ %s ] is not a readable file\n", path);
+        close(fd);
+        return false;
+    }
+
+    if (file_stat.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    madvise(data, (size_t) file_stat.st_size, MADV_SEQUENTIAL);
+    tpl->data = data;
+    tpl->size = (size_t) file_stat.st_size;
+    return true;
+}
+
+static void free_template(template_t *tpl) {
+    if (tpl->data != NULL) munmap((void *) tpl->data, tpl->size);
+    free(tpl->refs);
+    free(tpl->keys);
+    free(tpl->specs);
+    free(tpl->spec_lens);
+    memset(tpl, 0, sizeof(template_t));
+}
+
+/* Errors are rare, the line is counted only for them */
+static size_t line_of(const template_t *tpl, size_t offset) {
+    size_t line = 1;
+    for (const char *p = tpl->data; (p = memchr(p, '\n', (size_t) (tpl->data + offset - p))) != NULL; p++) line++;
+    return line;
+}
+
+/* Returns the index of the key spec names, parsing it only the first time it is seen */
+static int add_key(template_t *tpl, const char *spec, size_t spec_len) {
+    for (int i = 0; i < tpl->keys_len; i++) {
+        if (tpl->spec_lens[i] == spec_len && memcmp(tpl->specs[i], spec, spec_len) == 0) return i;
+    }
+
+    if (tpl->keys_len == tpl->keys_cap) {
+        tpl->keys_cap = tpl->keys_cap == 0 ? 16 : tpl->keys_cap * 2;
+        if ((tpl->keys = realloc(tpl->keys, (size_t) tpl->keys_cap * sizeof(lookup_key_t))) == NULL
+            || (tpl->specs = realloc(tpl->specs, (size_t) tpl->keys_cap * sizeof(char *))) == NULL
+            || (tpl->spec_lens = realloc(tpl->spec_lens, (size_t) tpl->keys_cap * sizeof(size_t))) == NULL)
+            CRXP__OUT_OF_MEMORY();
+    }
+
+    if (!lookup_parse(&tpl->keys[tpl->keys_len], spec, spec_len)) return -1;
+    tpl->specs[tpl->keys_len] = spec;
+    tpl->spec_lens[tpl->keys_len] = spec_len;
+    return tpl->keys_len++;
+}
+
+static void add_ref(template_t *tpl, size_t start, size_t end, int key) {
+    if (tpl->refs_len == tpl->refs_cap) {
+        tpl->refs_cap = tpl->refs_cap == 0 ? 64 : tpl->refs_cap * 2;
+        if ((tpl->refs = realloc(tpl->refs, tpl->refs_cap * sizeof(render_ref_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    }
+
+    tpl->refs[tpl->refs_len++] = (render_ref_t) {.start = start, .end = end, .key = key};
+}
+
+/**
+ * One pass over the template collecting its references. The text in
+ * between is not copied anywhere: it is written straight from the
+ * mapping once every key has been resolved.
+ */
+static bool scan_template(template_t *tpl) {
+    size_t pos = 0;
+    const char *data = tpl->data;
+    const char *open = NULL;
+
+    while (pos < tpl->size && (open = memchr(data + pos, RENDER_OPEN, tpl->size - pos)) != NULL) {
+        size_t start = (size_t) (open - data);
+        size_t p = start + 2;
+
+        pos = start + 1;
+        if (pos == tpl->size || data[pos] != RENDER_OPEN) continue;
+        while (p < tpl->size && data[p] == ' ') p++;
+        if (tpl->size - p < SCHEME_LEN || memcmp(data + p, RENDER_SCHEME, SCHEME_LEN) != 0) continue;
+
+        size_t spec = p + SCHEME_LEN;
+        for (p = spec; p + 1 < tpl->size && data[p] != '\n'; p++) {
+            if (data[p] == RENDER_CLOSE && data[p + 1] == RENDER_CLOSE) break;
+        }
+
+        if (p + 1 >= tpl->size || data[p] != RENDER_CLOSE) {
+            fprintf(stderr, "Error: Unterminated reference on line %zu of the template\n", line_of(tpl, start));
+            return false;
+        }
+
+        size_t spec_end = p;
+        while (spec_end > spec && data[spec_end - 1] == ' ') spec_end--;
+
+        int key = add_key(tpl, data + spec, spec_end - spec);
+        if (key < 0) {
+            fprintf(stderr, "Error: Invalid reference on line %zu of the template\n", line_of(tpl, start));
+            return false;
+        }
+
+        add_ref(tpl, start, p + 2, key);
+        pos = p + 2;
+    }
+
+    return true;
+}
+
+/**
+ * Renders the template at path to fd. All references are collected and
+ * resolved by one lookup before the first byte is written, so a failed
+ * render leaves no half written config behind.
+ */
+int render_template(sqlite3 *db, const char *path, int fd) {
+    char **secrets = NULL;
+    template_t tpl = {0};
+    outbuf_t out = {0};
+
+    TRACE_SCOPE("render_template");
+    if (!map_template(path, &tpl)) return CRXP_ERR;
+
+    bool ok = scan_template(&tpl);
+    if (ok && tpl.keys_len > 0) ok = (secrets = lookup_secrets(db, tpl.keys, tpl.keys_len)) != NULL;
+
+    if (ok) {
+        size_t pos = 0;
+        outbuf_open(&out, fd);
+        for (size_t i = 0; i < tpl.refs_len; i++) {
+            outbuf_write(&out, tpl.data + pos, tpl.refs[i].start - pos);
+            outbuf_puts(&out, secrets[tpl.refs[i].key]);
+            pos = tpl.refs[i].end;
+        }
+
+        outbuf_write(&out, tpl.data + pos, tpl.size - pos);
+        ok = outbuf_close(&out);
+    }
+
+    if (ok) metrics_add(METRIC_SECRETS_READ, (uint64_t) tpl.keys_len);
+    lookup_secrets_free(secrets);
+    free_template(&tpl);
+    return ok ? CRXP_OK : CRXP_ERR;
+}
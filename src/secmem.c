@@ -0,0 +1,152 @@
+#include "secmem.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "crypt.h"
+
+#define SLOT_CLASSES 2
+
+_Static_assert(SECMEM_SLOTS <= 64, "one bitmap word per slot size");
+_Static_assert(sizeof(secret_t) <= SECMEM_LARGE_SLOT, "records must fit a slot");
+_Static_assert(KEY_LEN <= SECMEM_SMALL_SLOT, "keys must fit a small slot");
+
+static const size_t slot_sizes[SLOT_CLASSES] = {SECMEM_SMALL_SLOT, SECMEM_LARGE_SLOT};
+
+static struct {
+    pthread_mutex_t lock;
+    bool mapped;
+    bool failed; /* no region, everything falls back */
+    unsigned char *region;
+    unsigned char *data;
+    size_t region_size;
+    size_t data_size;
+    unsigned char *base[SLOT_CLASSES];
+    uint64_t used[SLOT_CLASSES];
+    secmem_stats_t stats;
+} slab = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* Locks as much as RLIMIT_MEMLOCK and the budget allow, like sodium a failure is not fatal */
+static void slab_lock(void) {
+    struct rlimit limit = {0};
+
+    if (slab.data_size > SECMEM_MLOCK_BUDGET) return;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < slab.data_size)
+        return;
+    if (mlock(slab.data, slab.data_size) == 0) slab.stats.locked_bytes = slab.data_size;
+}
+
+/* Guard page, small slots, large slots, guard page */
+static bool slab_map(void) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t data = SECMEM_SLOTS * (SECMEM_SMALL_SLOT + SECMEM_LARGE_SLOT);
+
+    slab.data_size = (data + page - 1) / page * page;
+    slab.region_size = slab.data_size + 2 * page;
+    slab.region = mmap(NULL, slab.region_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab.region == MAP_FAILED) {
+        slab.region = NULL;
+        return false;
+    }
+
+    slab.data = slab.region + page;
+    if (mprotect(slab.region, page, PROT_NONE) != 0 || mprotect(slab.data + slab.data_size, page, PROT_NONE) != 0) {
+        munmap(slab.region, slab.region_size);
+        slab.region = slab.data = NULL;
+        return false;
+    }
+
+#ifdef MADV_DONTDUMP
+    madvise(slab.data, slab.data_size, MADV_DONTDUMP);
+#endif
+    slab_lock();
+    slab.base[0] = slab.data;
+    slab.base[1] = slab.data + SECMEM_SLOTS * SECMEM_SMALL_SLOT;
+    return true;
+}
+
+static bool in_slab(const unsigned char *ptr) {
+    return slab.data != NULL && ptr >= slab.data && ptr < slab.data + slab.data_size;
+}
+
+/* Memory comes out zeroed, whether it is a slot or a fallback */
+void *secmem_alloc(size_t size) {
+    void *ptr = NULL;
+
+    pthread_mutex_lock(&slab.lock);
+    if (!slab.mapped) {
+        slab.mapped = true;
+        slab.failed = !slab_map();
+    }
+
+    for (int class = 0; class < SLOT_CLASSES && ptr == NULL && !slab.failed; class++) {
+        if (size > slot_sizes[class] || ~slab.used[class] == 0) continue;
+
+        int slot = __builtin_ctzll(~slab.used[class]);
+        if (slot >= SECMEM_SLOTS) continue;
+        slab.used[class] |= UINT64_C(1) << slot;
+        ptr = slab.base[class] + (size_t) slot * slot_sizes[class];
+        if (++slab.stats.in_use > slab.stats.peak) slab.stats.peak = slab.stats.in_use;
+    }
+
+    slab.stats.allocs++;
+    if (ptr == NULL) slab.stats.fallbacks++;
+    pthread_mutex_unlock(&slab.lock);
+
+    if (ptr == NULL && (ptr = sodium_malloc(size)) != NULL) sodium_memzero(ptr, size);
+    return ptr;
+}
+
+void secmem_free(void *ptr) {
+    unsigned char *p = ptr;
+
+    if (ptr == NULL) return;
+    pthread_mutex_lock(&slab.lock);
+    slab.stats.frees++;
+    if (!in_slab(p)) {
+        pthread_mutex_unlock(&slab.lock);
+        sodium_free(ptr);
+        return;
+    }
+
+    int class = p >= slab.base[1];
+    size_t offset = (size_t) (p - slab.base[class]);
+    uint64_t bit = UINT64_C(1) << (offset / slot_sizes[class]);
+    if (offset % slot_sizes[class] != 0 || (slab.used[class] & bit) == 0)
+        CRXP__FATAL("Invalid free of secure memory at %p", ptr);
+
+    sodium_memzero(p, slot_sizes[class]);
+    slab.used[class] &= ~bit;
+    slab.stats.in_use--;
+    pthread_mutex_unlock(&slab.lock);
+}
+
+/* Wipes every slot, whether or not it was freed, and unmaps the region */
+void secmem_cleanup(void) {
+    pthread_mutex_lock(&slab.lock);
+    if (slab.region != NULL) {
+        sodium_memzero(slab.data, slab.data_size);
+        if (slab.stats.locked_bytes != 0) munlock(slab.data, slab.data_size);
+        munmap(slab.region, slab.region_size);
+    }
+
+    slab.region = slab.data = NULL;
+    slab.base[0] = slab.base[1] = NULL;
+    slab.used[0] = slab.used[1] = 0;
+    slab.mapped = slab.failed = false;
+    slab.stats.in_use = 0;
+    slab.stats.locked_bytes = 0;
+    pthread_mutex_unlock(&slab.lock);
+}
+
+secmem_stats_t secmem_stats(void) {
+    pthread_mutex_lock(&slab.lock);
+    secmem_stats_t stats = slab.stats;
+    pthread_mutex_unlock(&slab.lock);
+    return stats;
+}
@@ -0,0 +1,339 @@
+#include "storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "crypt.h"
+#include "database.h"
+#include "trace.h"
+
+extern char *cruxpass_db_path;
+
+/* <vault>.lock, held shared while the vault is open and exclusive while it is migrated */
+static int lock_fd = -1;
+
+typedef struct {
+    const char *name;
+    const char *spec;
+} preset_t;
+
+static const char *sync_names[] = {"off", "normal", "full", "extra"};
+
+static const preset_t presets[] = {
+    {"default", "journal=delete,sync=full,page=4096,cache=2000,temp=file,memsec=on"},
+    {"wal", "default,journal=wal,sync=normal"},
+    {"fast", "default,journal=wal,sync=normal,cache=16384,temp=memory,memsec=off"},
+};
+
+static bool parse_switch(const char *value, const char *on, const char *off, bool *out) {
+    if (strcmp(value, on) == 0) *out = true;
+    else if (strcmp(value, off) == 0) *out = false;
+    else return false;
+    return true;
+}
+
+static bool parse_int(const char *value, int min, int max, int *out) {
+    char *end = NULL;
+    errno = 0;
+    long n = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || n < min || n > max) return false;
+    *out = (int) n;
+    return true;
+}
+
+static bool parse_pair(const char *key, const char *value, storage_profile_t *profile) {
+    if (strcmp(key, "journal") == 0) return parse_switch(value, "wal", "delete", &profile->wal);
+    if (strcmp(key, "temp") == 0) return parse_switch(value, "memory", "file", &profile->temp_memory);
+    if (strcmp(key, "memsec") == 0) return parse_switch(value, "on", "off", &profile->memory_security);
+    if (strcmp(key, "cache") == 0) return parse_int(value, 1, STORAGE_CACHE_MAX, &profile->cache_kib);
+
+    if (strcmp(key, "sync") == 0) {
+        for (size_t i = 0; i < LEN(sync_names); i++) {
+            if (strcmp(value, sync_names[i]) != 0) continue;
+            profile->synchronous = (SYNC_T) i;
+            return true;
+        }
+
+        return false;
+    }
+
+    if (strcmp(key, "page") == 0) {
+        int size = 0;
+        if (!parse_int(value, STORAGE_PAGE_MIN, STORAGE_PAGE_MAX, &size) || (size & (size - 1)) != 0) return false;
+        profile->page_size = size;
+        return true;
+    }
+
+    return false;
+}
+
+/* Applies spec on top of profile, which is left as it was on errors */
+bool storage_parse(const char *spec, storage_profile_t *profile) {
+    char buf[STORAGE_SPEC_MAX + 1];
+    char *save = NULL;
+    storage_profile_t parsed = *profile;
+
+    if (strlen(spec) > STORAGE_SPEC_MAX) {
+        fprintf(stderr, "Error: Storage profile too long\n");
+        return false;
+    }
+
+    strcpy(buf, spec);
+    for (char *item = strtok_r(buf, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *value = strchr(item, '=');
+        bool ok = false;
+
+        if (value == NULL) {
+            for (size_t i = 0; i < LEN(presets) && !ok; i++) {
+                if (strcmp(item, presets[i].name) == 0) ok = storage_parse(presets[i].spec, &parsed);
+            }
+        } else {
+            *value++ = '\0';
+            ok = parse_pair(item, value, &parsed);
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Error: Invalid storage setting \"%s%s%s\"\n", item, value != NULL ? "=" : "",
+                    value != NULL ? value : "");
+            return false;
+        }
+    }
+
+    *profile = parsed;
+    return true;
+}
+
+void storage_format(const storage_profile_t *profile, char *buf, size_t size) {
+    snprintf(buf, size, "journal=%s,sync=%s,page=%d,cache=%d,temp=%s,memsec=%s", profile->wal ? "wal" : "delete",
+             sync_names[profile->synchronous], profile->page_size, profile->cache_kib,
+             profile->temp_memory ? "memory" : "file", profile->memory_security ? "on" : "off");
+}
+
+/* Cipher settings have to be in place before the first page is read */
+bool storage_key_pragmas(sqlite3 *db, const storage_profile_t *profile) {
+    char sql[64];
+
+    snprintf(sql, sizeof(sql), "PRAGMA cipher_page_size = %d;", profile->page_size);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to set the cipher page size: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    snprintf(sql, sizeof(sql), "PRAGMA cipher_memory_security = %s;", profile->memory_security ? "ON" : "OFF");
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error: Failed to set memory security: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool journal_is_wal(sqlite3 *db) {
+    bool wal = false;
+    sqlite3_stmt *stmt = NULL;
+
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1, &stmt, NULL) == SQLITE_OK
+        && sqlite3_step(stmt) == SQLITE_ROW) {
+        wal = strcmp((const char *) sqlite3_column_text(stmt, 0), "wal") == 0;
+    }
+
+    sqlite3_finalize(stmt);
+    return wal;
+}
+
+/**
+ * Connection settings, applied after the key is verified. The journal
+ * mode is stored in the vault file itself, so it is only switched when
+ * it differs: switching needs every other connection gone.
+ */
+bool storage_apply(sqlite3 *db, const storage_profile_t *profile) {
+    char sql[160];
+    int len = 0;
+
+    if (journal_is_wal(db) != profile->wal)
+        len = snprintf(sql, sizeof(sql), "PRAGMA journal_mode = %s; ", profile->wal ? "WAL" : "DELETE");
+
+    snprintf(sql + len, sizeof(sql) - (size_t) len, "PRAGMA synchronous = %d; PRAGMA cache_size = -%d; "
+             "PRAGMA temp_store = %d;", profile->synchronous, profile->cache_kib, profile->temp_memory ? 2 : 1);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Warning: Failed to apply the storage profile: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool migrate_path(char *path) {
+    if (snprintf(path, MAX_PATH_LEN, "%s" STORAGE_MIGRATE_SUFFIX, cruxpass_db_path) >= MAX_PATH_LEN) {
+        fprintf(stderr, "Error: Path to the vault too long\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool vault_lock(int operation) {
+    char path[MAX_PATH_LEN];
+
+    if (lock_fd < 0) {
+        if (snprintf(path, MAX_PATH_LEN, "%s" STORAGE_LOCK_SUFFIX, cruxpass_db_path) >= MAX_PATH_LEN) {
+            fprintf(stderr, "Error: Path to the vault too long\n");
+            return false;
+        }
+
+        if ((lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+            fprintf(stderr, "Error: Failed to open %s: %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+
+    while (flock(lock_fd, operation) != 0) {
+        if (errno == EINTR) continue;
+        if (errno == EWOULDBLOCK) fprintf(stderr, "Error: The vault is open in another cruxpass process\n");
+        else fprintf(stderr, "Error: Failed to lock the vault: %s\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * A migration writes the vault to <vault>.migrate, saves the new profile
+ * as pending, renames the copy over the vault and clears pending. After
+ * a crash the state says which of the two files the profile describes.
+ * Every process opening the vault comes through here and keeps a shared
+ * lock, so it waits out a running migration and never sees one half done.
+ */
+bool storage_recover(void) {
+    bool pending = false;
+    char path[MAX_PATH_LEN];
+    storage_profile_t profile = STORAGE_PROFILE_DEFAULT;
+
+    if (!vault_lock(LOCK_SH)) return false;
+    if (!migrate_path(path) || !fetch_profile(&profile, &pending)) return false;
+    if (!pending) {
+        if (unlink(path) == 0) fprintf(stderr, "Warning: Removed an unfinished storage migration\n");
+        return true;
+    }
+
+    if (access(path, F_OK) == 0 && rename(path, cruxpass_db_path) != 0) {
+        fprintf(stderr, "Error: Failed to finish the storage migration: %s\n", strerror(errno));
+        return false;
+    }
+
+    fprintf(stderr, "Info: Finished an interrupted storage migration\n");
+    return update_profile(NULL, &profile, false);
+}
+
+static bool export_vault(sqlite3 *db, const char *path, int page_size) {
+    char sql[160];
+    sqlite3 *copy = NULL;
+    sqlite3_stmt *stmt = NULL;
+
+    /* The vault connection cannot create files, ATTACH gets an empty one */
+    if ((copy = open_db((char *) path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) == NULL) return false;
+    sqlite3_close(copy);
+
+    /* Attached without a KEY clause, the copy is keyed like the vault */
+    if (sqlite3_prepare_v2(db, "ATTACH DATABASE ? AS migrated;", -1, &stmt, NULL) != SQLITE_OK
+        || sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC) != SQLITE_OK || sqlite3_step(stmt) != SQLITE_DONE) {
+        fprintf(stderr, "Error: Failed to create %s: %s\n", path, sqlite3_errmsg(db));
+        sqlite3_finalize(stmt);
+        return false;
+    }
+
+    sqlite3_finalize(stmt);
+    snprintf(sql, sizeof(sql), "PRAGMA migrated.cipher_page_size = %d; SELECT sqlcipher_export('migrated');",
+             page_size);
+    bool ok = sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK;
+    if (!ok) fprintf(stderr, "Error: Failed to rewrite the vault: %s\n", sqlite3_errmsg(db));
+
+    sqlite3_exec(db, "DETACH DATABASE migrated;", NULL, NULL, NULL);
+    return ok;
+}
+
+static bool reopen_vault(vault_ctx_t *ctx, unsigned char *key) {
+    if ((ctx->secret_db = open_db(cruxpass_db_path, SQLITE_OPEN_READWRITE)) == NULL) return false;
+    return decrypt(ctx->secret_db, key);
+}
+
+static bool storage_migrate(vault_ctx_t *ctx, unsigned char *key, const storage_profile_t *from,
+                            const storage_profile_t *to) {
+    char path[MAX_PATH_LEN];
+
+    TRACE_SCOPE("storage_migrate");
+    if (!migrate_path(path)) return false;
+
+    /* No other process may hold the vault open across export, rename and clear */
+    if (!vault_lock(LOCK_EX | LOCK_NB)) {
+        vault_lock(LOCK_SH);
+        return false;
+    }
+
+    unlink(path);
+
+    /* A -wal file left next to the vault would be replayed into the copy */
+    if (sqlite3_exec(ctx->secret_db, "PRAGMA journal_mode = DELETE;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Error: The vault is in use: %s\n", sqlite3_errmsg(ctx->secret_db));
+        vault_lock(LOCK_SH);
+        return false;
+    }
+
+    if (!export_vault(ctx->secret_db, path, to->page_size) || !update_profile(NULL, to, true)) {
+        unlink(path);
+        vault_lock(LOCK_SH);
+        return false;
+    }
+
+    close_db(ctx->secret_db);
+    ctx->secret_db = NULL;
+    if (rename(path, cruxpass_db_path) != 0) {
+        fprintf(stderr, "Error: Failed to replace the vault: %s\n", strerror(errno));
+        unlink(path);
+        update_profile(NULL, from, false);
+        vault_lock(LOCK_SH);
+        reopen_vault(ctx, key);
+        return false;
+    }
+
+    bool ok = update_profile(NULL, to, false);
+    vault_lock(LOCK_SH);
+    return ok && reopen_vault(ctx, key);
+}
+
+int storage_set(vault_ctx_t *ctx, unsigned char *key, const char *spec) {
+    char buf[STORAGE_SPEC_MAX];
+    storage_profile_t from = STORAGE_PROFILE_DEFAULT;
+
+    if (!fetch_profile(&from, NULL)) return CRXP_ERR;
+    storage_profile_t to = from;
+    if (!storage_parse(spec, &to)) return CRXP_ERR;
+
+    if (to.page_size != from.page_size) {
+        fprintf(stderr, "Info: Rewriting the vault with %d byte pages\n", to.page_size);
+        if (!storage_migrate(ctx, key, &from, &to)) return CRXP_ERR;
+    } else if (!update_profile(NULL, &to, false)) {
+        return CRXP_ERR;
+    }
+
+    if (!storage_apply(ctx->secret_db, &to)) return CRXP_ERR;
+    storage_format(&to, buf, sizeof(buf));
+    fprintf(stderr, "Info: Storage profile: %s\n", buf);
+    return CRXP_OK;
+}
+
+bool storage_show(FILE *out) {
+    bool pending = false;
+    char buf[STORAGE_SPEC_MAX];
+    storage_profile_t profile = STORAGE_PROFILE_DEFAULT;
+
+    if (!fetch_profile(&profile, &pending)) return false;
+    storage_format(&profile, buf, sizeof(buf));
+    fprintf(out, "%s%s\n", buf, pending ? " (migration pending)" : "");
+    return true;
+}
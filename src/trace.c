@@ -0,0 +1,121 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;  // string literal, never copied
+    uint64_t start;
+    uint64_t end;
+    int tid;
+} trace_event_t;
+
+bool trace_enabled = false;
+
+static trace_event_t *ring = NULL;
+static atomic_size_t ring_head;
+static atomic_int next_tid;
+static _Thread_local int trace_tid = 0;
+static uint64_t origin = 0;
+static char *trace_path = NULL;
+
+static void trace_atexit(void) { trace_dump(); }
+
+uint64_t trace_now(void) {
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Enables tracing and arranges for the ring to be written to path when
+ * the process exits, so every early return out of main() still dumps.
+ */
+bool trace_init(const char *path) {
+    if (ring != NULL) return true;
+#ifdef CRXP_NO_TRACE
+    fprintf(stderr, "Warning: cruxpass was built without tracing (TRACE=0), the trace will be empty\n");
+#endif
+    if ((ring = calloc(TRACE_RING_SIZE, sizeof(trace_event_t))) == NULL) {
+        fprintf(stderr, "Error: Failed to allocate the trace buffer\n");
+        return false;
+    }
+
+    /* Option values are freed before exit handlers run */
+    if ((trace_path = strdup(path)) == NULL || atexit(trace_atexit) != 0) {
+        fprintf(stderr, "Error: Failed to register the trace writer\n");
+        free(trace_path);
+        free(ring);
+        trace_path = NULL;
+        ring = NULL;
+        return false;
+    }
+
+    atomic_init(&ring_head, 0);
+    atomic_init(&next_tid, 0);
+    origin = trace_now();
+    trace_enabled = true;
+    return true;
+}
+
+/* Lock free: once the ring wraps the oldest spans are overwritten */
+void trace_record(const char *name, uint64_t start, uint64_t end) {
+    if (!trace_enabled) return;
+    if (trace_tid == 0) trace_tid = atomic_fetch_add(&next_tid, 1) + 1;
+
+    size_t slot = atomic_fetch_add(&ring_head, 1) % TRACE_RING_SIZE;
+    ring[slot] = (trace_event_t) {.name = name, .start = start, .end = end, .tid = trace_tid};
+}
+
+bool trace_dump(void) {
+    int fd = -1;
+    FILE *out = NULL;
+
+    if (!trace_enabled) return true;
+    trace_enabled = false;
+
+    if ((fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0
+        || (out = fdopen(fd, "w")) == NULL) {
+        fprintf(stderr, "Error: Failed to open trace file %s: %s\n", trace_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        free(trace_path);
+        free(ring);
+        trace_path = NULL;
+        ring = NULL;
+        return false;
+    }
+
+    size_t head = atomic_load(&ring_head);
+    size_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    size_t first = head - count;
+    pid_t pid = getpid();
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < count; i++) {
+        trace_event_t *ev = &ring[(first + i) % TRACE_RING_SIZE];
+        /* Spans that started before trace_init() are clamped to the origin */
+        uint64_t start = ev->start > origin ? ev->start - origin : 0;
+        uint64_t end = ev->end > origin ? ev->end - origin : 0;
+        fprintf(out,
+                "%s{\"name\":\"%s\",\"cat\":\"cruxpass\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                i == 0 ? "" : ",\n", ev->name, start / 1000.0, (end - start) / 1000.0, (int) pid, ev->tid);
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%zu}}\n", first);
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Failed to write trace file %s\n", trace_path);
+    if (first > 0) fprintf(stderr, "Warning: Trace buffer wrapped, %zu oldest spans dropped\n", first);
+
+    free(trace_path);
+    free(ring);
+    trace_path = NULL;
+    ring = NULL;
+    return ok;
+}
@@ -1,7 +1,9 @@
 #include "termbox2.h"
 #include "tui.h"
+#include "trace.h"
 
 #include <stdint.h>
+#include <string.h>
 #include <wchar.h>
 
 extern int current_page;
@@ -69,6 +71,11 @@ void draw_update_menu(int option, int start_x, int start_y) {
     fg = (option == 3) ? COLOR_PAGINATION : TB_DEFAULT;
     draw_border(start_x, start_y, option_w, 3, fg, TB_DEFAULT);
     tb_print(start_x + 2, start_y + 1, fg, TB_DEFAULT, "Update All Fields");
+    start_y += 4;
+
+    fg = (option == 4) ? COLOR_PAGINATION : TB_DEFAULT;
+    draw_border(start_x, start_y, option_w, 3, fg, TB_DEFAULT);
+    tb_print(start_x + 5, start_y + 1, fg, TB_DEFAULT, "Update Tags");
     tb_present();
 }
 
@@ -93,7 +100,8 @@ void draw_border(int start_x, int start_y, int width, int height, uintattr_t fg,
     tb_present();
 }
 
-static void draw_status(int start_y, int64_t cursor, int64_t total_records) {
+/* The tag filter, when there is one, is named on the top border */
+static void draw_status(int start_y, int64_t cursor, int64_t total_records, const char *tags) {
     int width = 40;
     int start_x = (tb_width() - width) / 2;
     int64_t rec_number = (total_records == 0) ? 0 : cursor + 1;
@@ -108,24 +116,44 @@ static void draw_status(int start_y, int64_t cursor, int64_t total_records) {
     tb_set_cell(start_x + width - 1, start_y, BORDER_TOP_RIGHT, COLOR_PAGINATION, TB_DEFAULT);
     tb_printf(start_x + 4, start_y + 1, COLOR_HEADER, TB_DEFAULT, "Page %d of %02d │ Record %ld of %ld",
               current_page + 1, total_pages + 1, rec_number, total_records);
+    if (tags != NULL) tb_printf(start_x + 2, start_y, COLOR_SEARCH, TB_DEFAULT, " tags: %.*s ", width - 12, tags);
+    if (hud.visible) draw_hud(start_x, width, start_y, total_records);
+}
+
+/* Column titles, the one the list is sorted by carries an arrow for the direction */
+static void draw_header(int start_x, int start_y, const record_view_t *view) {
+    static const char *titles[SORT_KEY_COUNT] = {"ID", "E-MAIL/USERNAME", "DESCRIPTION", "ADDED", "MODIFIED"};
+    static const int widths[SORT_KEY_COUNT] = {ID_WIDTH, USERNAME_WIDTH, DESC_WIDTH, DATE_WIDTH, DATE_WIDTH};
+    SORT_KEY key = view != NULL ? view->key : SORT_ID;
+    int x = start_x + 1;
+
+    for (int i = 0; i < SORT_KEY_COUNT; i++) {
+        tb_printf(x, start_y, COLOR_HEADER, TB_DEFAULT, " %-*s", widths[i], titles[i]);
+        if (i == (int) key) {
+            tb_set_cell(x + 2 + (int) strlen(titles[i]), start_y,
+                        view != NULL && view->reverse ? SORT_ARROW_DOWN : SORT_ARROW_UP, COLOR_HEADER, TB_DEFAULT);
+        }
+        x += widths[i] + 1;
+    }
 }
 
 void draw_table_border(int start_x, int start_y, int table_h) {
     tb_clear();
     draw_border(start_x, start_y, TABLE_WIDTH + 2, table_h + 2, COLOR_PAGINATION, TB_DEFAULT);
-    tb_printf(start_x + 1, start_y + 1, COLOR_HEADER, TB_DEFAULT, " %-*s  %-*s %-*s", ID_WIDTH - 1, "ID",
-              USERNAME_WIDTH, "E-MAIL/USERNAME", DESC_WIDTH, "DESCRIPTION");
     for (int i = 0; i < TABLE_WIDTH; i++) {
         tb_set_cell(start_x + i + 1, start_y + 2, BORDER_H, COLOR_PAGINATION, TB_DEFAULT);
     }
 }
 
 void _draw_table(record_array_t *records, queue_t *search_queue, char *search_parttern, table_t table) {
-    total_pages = records->size / records_per_page;
+    TRACE_SCOPE("draw_table");
+    uint64_t frame_start = hud_start();
+    int64_t size = view_size(table.view, records->size);
+    total_pages = size / records_per_page;
 
     int start_index = current_page * records_per_page;
     int end_index = start_index + records_per_page;
-    if (end_index > records->size) end_index = records->size;
+    if (end_index > size) end_index = size;
 
     record_t *rec = NULL;
     int row = table.start_y + 4;
@@ -141,25 +169,31 @@ void _draw_table(record_array_t *records, queue_t *search_queue, char *search_pa
         }
     }
 
-    if (search_parttern != NULL) {
-        for (int64_t i = 0; i < records->size; i++) {
-            if (records->data[i].id != DELETED
-                && (strstr(records->data[i].username, search_parttern) != NULL
-                    || strstr(records->data[i].description, search_parttern) != NULL)) {
+    /* Matches are rows, queued once per search in the order shown; 'n' walks the same queue on every frame */
+    if (search_parttern != NULL && queue_empty(search_queue)) {
+        uint64_t search_start = hud_start();
+        for (int64_t i = 0; i < size; i++) {
+            rec = &records->data[view_index(table.view, records->size, i)];
+            if (rec->id != DELETED
+                && (strstr(rec->username, search_parttern) != NULL
+                    || strstr(rec->description, search_parttern) != NULL)) {
                 if (!enqueue(search_queue, i)) send_notifctn("Error: Failed to enqueue record");
             }
         }
+        hud_search_done(search_start);
     }
 
+    draw_header(table.start_x, table.start_y + 1, table.view);
     for (int64_t i = start_index; i < end_index; i++) {
-        rec = &records->data[i];
+        rec = &records->data[view_index(table.view, records->size, i)];
         row = 4 + (i - start_index);
         fg = TB_DEFAULT;
         bg = TB_DEFAULT;
 
         if (rec->id == DELETED) {
-            tb_printf(start_x, row, COLOR_STATUS, TB_WHITE, " %-*s %-*s %-*.*s", ID_WIDTH, "DELETED", USERNAME_WIDTH,
-                      rec->username, DESC_WIDTH, DESC_WIDTH, rec->description);
+            tb_printf(start_x, row, COLOR_STATUS, TB_WHITE, " %-*s %-*s %-*.*s %-*s %-*s", ID_WIDTH, "DELETED",
+                      USERNAME_WIDTH, rec->username, DESC_WIDTH, DESC_WIDTH, rec->description, DATE_WIDTH,
+                      rec->date_added, DATE_WIDTH, rec->date_modified);
             continue;
         }
 
@@ -175,10 +209,12 @@ void _draw_table(record_array_t *records, queue_t *search_queue, char *search_pa
             bg = TB_WHITE;
         }
 
-        tb_printf(start_x, row, fg, bg, " %-*ld %-*s %-*.*s", ID_WIDTH, rec->id, USERNAME_WIDTH, rec->username,
-                  DESC_WIDTH, DESC_WIDTH, rec->description);
+        tb_printf(start_x, row, fg, bg, " %-*ld %-*s %-*.*s %-*s %-*s", ID_WIDTH, rec->id, USERNAME_WIDTH,
+                  rec->username, DESC_WIDTH, DESC_WIDTH, rec->description, DATE_WIDTH, rec->date_added, DATE_WIDTH,
+                  rec->date_modified);
     }
 
-    draw_status(table.height, table.cursor, records->size);
+    draw_status(table.height, table.cursor, size, table.tags);
     tb_present();
+    hud_frame_done(frame_start);
 }
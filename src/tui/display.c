@@ -1,5 +1,6 @@
 #include "cruxpass.h"
 #include "database.h"
+#include "secmem.h"
 #include "tui.h"
 
 #include <sodium/utils.h>
@@ -64,14 +65,39 @@ void display_secret(const char *secret, int len) {
     }
 }
 
+/**
+ * Spins under the art, where the password was typed, until done is set.
+ * Keys are dropped: the work it waits for cannot be cancelled.
+ */
+void display_spinner(const char *msg, atomic_bool *done) {
+    static const uint32_t frames[] = {0x280B, 0x2819, 0x2839, 0x2838, 0x283C, 0x2834, 0x2826, 0x2827, 0x2807, 0x280F};
+    int msg_len = strlen(msg);
+    struct tb_event ev = {0};
+
+    draw_art();
+    for (size_t frame = 0; !atomic_load(done); frame++) {
+        int term_h = tb_height();
+        int start_y = (term_h / 2) + 3;
+        int start_x = (tb_width() - msg_len - 2) / 2;
+
+        if (start_x < 0) start_x = 0;
+        if (start_y >= term_h - 1) start_y = term_h - 2;
+
+        tb_set_cell(start_x, start_y, frames[frame / 5 % LEN(frames)], COLOR_PAGINATION, TB_DEFAULT);
+        tb_print(start_x + 2, start_y, TB_DEFAULT | TB_BOLD, TB_DEFAULT, msg);
+        tb_present();
+        if (tb_peek_event(&ev, TUI_SPINNER_MS) == TB_OK && ev.type == TB_EVENT_RESIZE) draw_art();
+    }
+}
+
 void display_help(void) {
     int win_w = 50;
-    int win_h = 15;
+    int win_h = 17;
 
     int term_w = tb_width();
     int term_h = tb_height();
 
-    if (term_w < 60 + 4 || term_h < 18 + 2) {
+    if (term_w < 60 + 4 || term_h < 19 + 2) {
         send_notifctn("Warning: Term width or height too small");
         return;
     }
@@ -89,7 +115,7 @@ void display_help(void) {
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " d - Delete record        n - Next search result");
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " / - Search               L - Show description");
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " ? - Show this help       q/Q - Quit");
-    tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " Ctrl+r - Reload tui");
+    tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " Ctrl+r - Reload tui       P - Performance overlay");
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " r - a/A/p/r/x Regenerate secret");
 
     line++;
@@ -97,6 +123,8 @@ void display_help(void) {
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " j/k - Down/Up");
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " g/G - First/Last");
     tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " h/l - Page left/right");
+    tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " s/S - Sort by the next column/Reverse order");
+    tb_print(start_x + 2, line++, TB_DEFAULT, TB_DEFAULT, " t - Filter by tags, none shows every record");
 
     line++;
     tb_print(start_x + 2, line, TB_DEFAULT, TB_DEFAULT, "Press any key to close...");
@@ -187,21 +215,22 @@ void display_ran_secret(sqlite3 *db, const char *secret_str) {
         if (ev.ch == 's' || ev.ch == 'S') {
             start_y = 1;
             start_x = 2;
-            secret_t rec = {0};
+            secret_t *rec = NULL;
+            if ((rec = secmem_alloc(sizeof(secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
 
             tb_clear();
-            get_input("> username: ", rec.username, USERNAME_MAX_LEN, start_x + 4, start_y++);
-            get_input("> description: ", rec.description, DESC_MAX_LEN, start_x + 4, start_y++);
-
-            if (strlen(rec.username) == 0 || strlen(rec.description) == 0) return;
-            memcpy(rec.secret, secret_str, SECRET_MAX_LEN);
-            if (!insert_record(db, &rec)) {
-                send_notifctn("Error: Failed to saved secret");
-                return;
-            };
-
-            sodium_memzero((char *) secret_str, sec_len);
-            sodium_memzero((char *) rec.secret, sec_len);
+            get_input("> username: ", rec->username, USERNAME_MAX_LEN, start_x + 4, start_y++);
+            get_input("> description: ", rec->description, DESC_MAX_LEN, start_x + 4, start_y++);
+
+            bool ok = strlen(rec->username) != 0 && strlen(rec->description) != 0;
+            if (ok) {
+                memcpy(rec->secret, secret_str, sec_len);
+                ok = insert_record(db, rec);
+                if (!ok) send_notifctn("Error: Failed to saved secret");
+            }
+
+            secmem_free(rec);
+            if (!ok) return;
             send_notifctn("Info: secret saved");
             break;
         }
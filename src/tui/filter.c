@@ -0,0 +1,193 @@
+#include "cruxpass.h"
+#include "database.h"
+#include "trace.h"
+#include "tui.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+bool add_tag(tag_index_t *tags, int64_t id, const char *name) {
+    if (tags->size >= tags->capacity) {
+        int new_capacity = tags->capacity == 0 ? 8 : tags->capacity * 2;
+        tag_t *new_data = realloc(tags->data, (size_t) new_capacity * sizeof(tag_t));
+        if (new_data == NULL) {
+            fprintf(stderr, "Error: Failed to allocate Memory\n");
+            return false;
+        }
+        tags->data = new_data;
+        tags->capacity = new_capacity;
+    }
+
+    tag_t *tag = &tags->data[tags->size++];
+    tag->id = id;
+    tag->first = tags->id_count;
+    tag->count = 0;
+    snprintf(tag->name, sizeof(tag->name), "%s", name);
+    return true;
+}
+
+/* Ids arrive grouped by tag, so a tag's run always ends at id_count */
+bool add_tag_id(tag_index_t *tags, int tag, int64_t id) {
+    if (tags->id_count >= tags->id_capacity) {
+        int new_capacity = tags->id_capacity == 0 ? 64 : tags->id_capacity * 2;
+        int64_t *new_ids = realloc(tags->ids, (size_t) new_capacity * sizeof(int64_t));
+        if (new_ids == NULL) {
+            fprintf(stderr, "Error: Failed to allocate Memory\n");
+            return false;
+        }
+        tags->ids = new_ids;
+        tags->id_capacity = new_capacity;
+    }
+
+    if (tags->data[tag].count++ == 0) tags->data[tag].first = tags->id_count;
+    tags->ids[tags->id_count++] = id;
+    return true;
+}
+
+void free_tags(tag_index_t *tags) {
+    free(tags->data);
+    free(tags->ids);
+    memset(tags, 0, sizeof(tag_index_t));
+}
+
+static const tag_t *find_tag(const tag_index_t *tags, const char *name) {
+    for (int i = 0; i < tags->size; i++) {
+        if (strcasecmp(tags->data[i].name, name) == 0) return &tags->data[i];
+    }
+
+    return NULL;
+}
+
+/* First index from lo on whose id is not below id: doubling steps, then a binary search */
+static int gallop(const int64_t *ids, int lo, int size, int64_t id) {
+    int step = 1;
+    int hi = lo;
+
+    while (hi < size && ids[hi] < id) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+
+    if (hi > size) hi = size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/* Keeps the ids also in other, in place; each lookup gallops on from the last */
+static int intersect(int64_t *ids, int count, const int64_t *other, int other_count) {
+    int kept = 0;
+
+    for (int i = 0, j = 0; i < count && j < other_count; i++) {
+        j = gallop(other, j, other_count, ids[i]);
+        if (j < other_count && other[j] == ids[i]) ids[kept++] = ids[i];
+    }
+
+    return kept;
+}
+
+/**
+ * The ids of the records carrying every tag in text, ascending, in
+ * *ids for the caller to free. The shortest list is copied and then
+ * narrowed by the others, smallest first: the work follows the rarest
+ * tag, not the size of the vault. Returns false when a name is no tag.
+ */
+bool tag_filter(const tag_index_t *tags, const char *text, int64_t **ids, int *count) {
+    char name[TAG_MAX_LEN + 1];
+    const tag_t *chosen[TAG_FILTER_MAX];
+    int chosen_count = 0;
+
+    TRACE_SCOPE("tag_filter");
+    *ids = NULL;
+    *count = 0;
+    while (tag_next(&text, name)) {
+        const tag_t *tag = find_tag(tags, name);
+        if (tag == NULL || chosen_count == TAG_FILTER_MAX) return false;
+        chosen[chosen_count++] = tag;
+    }
+
+    if (chosen_count == 0) return false;
+    for (int i = 1; i < chosen_count; i++) {
+        const tag_t *tag = chosen[i];
+        int j = i;
+        for (; j > 0 && chosen[j - 1]->count > tag->count; j--) chosen[j] = chosen[j - 1];
+        chosen[j] = tag;
+    }
+
+    if ((*ids = malloc((size_t) (chosen[0]->count + 1) * sizeof(int64_t))) == NULL) CRXP__OUT_OF_MEMORY();
+    memcpy(*ids, tags->ids + chosen[0]->first, (size_t) chosen[0]->count * sizeof(int64_t));
+    *count = chosen[0]->count;
+    for (int i = 1; i < chosen_count && *count > 0; i++)
+        *count = intersect(*ids, *count, tags->ids + chosen[i]->first, chosen[i]->count);
+    return true;
+}
+
+/* Takes ids, from tag_filter(), as the filter of view; NULL drops the filter */
+void filter_set(record_view_t *view, int64_t *ids, int count) {
+    free(view->filter);
+    free(view->rows);
+    view->filter = ids;
+    view->filter_size = ids != NULL ? count : 0;
+    view->rows = NULL;
+    view->row_count = 0;
+}
+
+/**
+ * Lists in rows the records the filter keeps, in the order of key. The
+ * records and the filter are both in id order, one merge finds them;
+ * a sorted key then keeps its order through a mark per record. Rows
+ * stay NULL when no record is kept. Returns false when out of memory.
+ */
+bool filter_rows(record_view_t *view, const record_array_t *records, SORT_KEY key) {
+    const int *order = view->orders[key];
+    uint8_t *kept = NULL;
+    int *rows = NULL;
+    int count = 0;
+
+    free(view->rows);
+    view->rows = NULL;
+    view->row_count = 0;
+    if (view->filter_size == 0 || records->size == 0) return true;
+
+    if ((rows = malloc((size_t) view->filter_size * sizeof(int))) == NULL) return false;
+    if (order != NULL && (kept = calloc((size_t) records->size, 1)) == NULL) {
+        free(rows);
+        return false;
+    }
+
+    for (int i = 0, j = 0; i < records->size && j < view->filter_size; i++) {
+        int64_t id = records->data[i].id;
+        if (id == DELETED) continue;
+        while (j < view->filter_size && view->filter[j] < id) j++;
+        if (j == view->filter_size || view->filter[j] != id) continue;
+
+        if (kept != NULL) kept[i] = 1;
+        else rows[count++] = i;
+    }
+
+    if (kept != NULL) {
+        count = 0;
+        for (int i = 0; i < records->size; i++) {
+            if (kept[order[i]]) rows[count++] = order[i];
+        }
+        free(kept);
+    }
+
+    if (count == 0) {
+        free(rows);
+        return true;
+    }
+
+    view->rows = rows;
+    view->row_count = count;
+    return true;
+}
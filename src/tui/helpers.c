@@ -1,11 +1,13 @@
 #include "cruxpass.h"
 #include "database.h"
+#include "secmem.h"
 #include "tui.h"
 
 #include <sodium/utils.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 static int updates_menu(void) {
     int option = 0;
@@ -15,7 +17,7 @@ static int updates_menu(void) {
 
     int start_x = (term_w / 2) - 8;
     if (start_x < 0) start_x = 0;
-    int start_y = (term_h / 2) - 5;
+    int start_y = (term_h / 2) - 10;
     if (start_y < 0) start_y = 0;
 
     struct tb_event ev = {0};
@@ -29,7 +31,7 @@ static int updates_menu(void) {
 
         start_x = (term_w / 2) - 8;
         if (start_x < 0) start_x = 0;
-        start_y = (term_h / 2) - 5;
+        start_y = (term_h / 2) - 10;
         if (start_y < 0) start_y = 0;
 
         if (ev.type == TB_EVENT_KEY) {
@@ -38,7 +40,7 @@ static int updates_menu(void) {
             } else if (ev.ch == 'k' || ev.key == TB_KEY_ARROW_UP) {
                 if (option > 0) option--;
             } else if (ev.ch == 'j' || ev.key == TB_KEY_ARROW_DOWN) {
-                if (option < 3) option++;
+                if (option < 4) option++;
             }
             draw_update_menu(option, start_x, start_y);
         }
@@ -47,54 +49,88 @@ static int updates_menu(void) {
     return option;
 }
 
-bool do_updates(sqlite3 *db, record_array_t *records, int64_t current_position) {
-    int64_t id = records->data[current_position].id;
+/* The date the vault writes for CURRENT_DATE, which is in UTC */
+static void current_date(char *date) {
+    time_t now = time(NULL);
+    struct tm tm = {0};
+
+    if (gmtime_r(&now, &tm) == NULL || strftime(date, DATE_LEN + 1, "%Y-%m-%d", &tm) == 0) date[0] = '\0';
+}
+
+/* Shows the record's tags and replaces them with the ones typed, "-" removes them all */
+static bool update_tags(sqlite3 *db, record_t *record, int start_x, int start_y) {
+    char tags[TAGS_MAX_LEN + 1] = {0};
+
+    if (!fetch_tags(db, record->id, tags, sizeof(tags))) {
+        send_notifctn("Error: Failed to read tags");
+        return false;
+    }
+
+    tb_printf(start_x, start_y, TB_DEFAULT, TB_DEFAULT, "tags: %s", tags[0] != '\0' ? tags : "-");
+    memset(tags, 0, sizeof(tags));
+    if (get_input("> tags: ", tags, TAGS_MAX_LEN, start_x, start_y + 1) == NULL || tags[0] == '\0') return false;
+
+    if (!set_tags(db, record->id, tags)) {
+        send_notifctn("Error: Tags not updated");
+        return false;
+    }
+
+    current_date(record->date_modified);
+    return true;
+}
+
+bool do_updates(sqlite3 *db, record_array_t *records, int64_t index) {
+    int64_t id = records->data[index].id;
 
     int start_x = 0;
     int start_y = 1;
 
     int option = updates_menu();
     if (option < 0) return false;
+    if (option == 4) {
+        tb_clear();
+        return update_tags(db, &records->data[index], start_x + 4, start_y);
+    }
 
+    bool ok = false;
     int8_t flag = 0;
-    secret_t rec = {0};
+    secret_t *rec = NULL;
+    if ((rec = secmem_alloc(sizeof(secret_t))) == NULL) CRXP__OUT_OF_MEMORY();
 
     tb_clear();
     switch (option) {
         case 0:
-            get_input("> username: ", rec.username, USERNAME_MAX_LEN, start_x + 4, start_y);
-            if (strlen(rec.username) < FIELD_MIN) return false;
+            get_input("> username: ", rec->username, USERNAME_MAX_LEN, start_x + 4, start_y);
+            if (strlen(rec->username) < FIELD_MIN) goto defer;
             flag = UPDATE_USERNAME;
             break;
         case 1:
-            get_input("> description: ", rec.description, DESC_MAX_LEN, start_x + 4, start_y);
-            if (strlen(rec.description) < FIELD_MIN) return false;
+            get_input("> description: ", rec->description, DESC_MAX_LEN, start_x + 4, start_y);
+            if (strlen(rec->description) < FIELD_MIN) goto defer;
             flag = UPDATE_DESCRIPTION;
             break;
         case 2:
-            get_input("> secret: ", rec.secret, SECRET_MAX_LEN, start_x + 4, start_y);
-            if (strlen(rec.secret) < SECRET_MIN_LEN) return false;
+            get_input("> secret: ", rec->secret, SECRET_MAX_LEN, start_x + 4, start_y);
+            if (strlen(rec->secret) < SECRET_MIN_LEN) goto defer;
             flag = UPDATE_SECRET;
             break;
         case 3:
-            get_input("> username: ", rec.username, USERNAME_MAX_LEN, start_x + 4, start_y++);
-            get_input("> secret: ", rec.secret, SECRET_MAX_LEN, start_x + 4, start_y++);
-            get_input("> description: ", rec.description, DESC_MAX_LEN, start_x + 4, start_y++);
-            if (strlen(rec.username) == 0 || strlen(rec.description) == 0 || strlen(rec.secret) < 8) return false;
-            flag = UPDATE_USERNAME | UPDATE_DESCRIPTION | UPDATE_SECRET;
+            get_input("> username: ", rec->username, USERNAME_MAX_LEN, start_x + 4, start_y++);
+            get_input("> secret: ", rec->secret, SECRET_MAX_LEN, start_x + 4, start_y++);
+            get_input("> description: ", rec->description, DESC_MAX_LEN, start_x + 4, start_y++);
+            if (strlen(rec->username) == 0 || strlen(rec->description) == 0 || strlen(rec->secret) < 8) goto defer;
+            flag = UPDATE_ALL;
             break;
-        default: return false;
+        default: goto defer;
     }
 
-    if (flag & UPDATE_DESCRIPTION) memcpy(records->data[current_position].description, rec.description, DESC_MAX_LEN);
-    if (flag & UPDATE_USERNAME) memcpy(records->data[current_position].username, rec.username, USERNAME_MAX_LEN);
+    if (flag & UPDATE_DESCRIPTION) memcpy(records->data[index].description, rec->description, DESC_MAX_LEN);
+    if (flag & UPDATE_USERNAME) memcpy(records->data[index].username, rec->username, USERNAME_MAX_LEN);
 
-    if (!update_record(db, &rec, id, flag)) {
-        if (flag & UPDATE_SECRET) sodium_memzero(rec.secret, SECRET_MAX_LEN);
-        send_notifctn("Error: Rec not updated");
-        return false;
-    }
+    if (!(ok = update_record(db, rec, id, flag))) send_notifctn("Error: Rec not updated");
+    else current_date(records->data[index].date_modified);
 
-    if (flag & UPDATE_SECRET) sodium_memzero(rec.secret, SECRET_MAX_LEN);
-    return true;
+defer:
+    secmem_free(rec);
+    return ok;
 }
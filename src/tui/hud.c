@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "tui.h"
+
+hud_t hud = {0};
+
+/* 0 while the overlay is hidden, so callers skip their bookkeeping */
+uint64_t hud_start(void) { return hud.visible ? trace_now() : 0; }
+
+void hud_frame_done(uint64_t start) {
+    if (start == 0) return;
+    hud.last_frame_ns = trace_now() - start;
+    hud.frame_ns[hud.frames++ % HUD_FRAMES] = hud.last_frame_ns;
+}
+
+void hud_search_done(uint64_t start) {
+    if (start != 0) hud.search_ns = trace_now() - start;
+}
+
+void hud_sort_done(uint64_t start) {
+    if (start != 0) hud.sort_ns = trace_now() - start;
+}
+
+void hud_filter_done(uint64_t start) {
+    if (start != 0) hud.filter_ns = trace_now() - start;
+}
+
+void hud_db_done(const char *op, uint64_t start) {
+    if (start == 0) return;
+    hud.db_op = op;
+    hud.db_ns = trace_now() - start;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank p99 over the frames kept in the ring */
+static double frame_p99_ms(void) {
+    uint64_t sorted[HUD_FRAMES];
+    size_t count = hud.frames < HUD_FRAMES ? hud.frames : HUD_FRAMES;
+
+    if (count == 0) return 0;
+    memcpy(sorted, hud.frame_ns, count * sizeof(uint64_t));
+    qsort(sorted, count, sizeof(uint64_t), compare_u64);
+    size_t rank = (count * 99 + 99) / 100;
+    return sorted[rank - 1] / 1e6;
+}
+
+static double resident_mib(void) {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL) return 0;
+    if (fscanf(statm, "%*d %ld", &pages) != 1) pages = 0;
+    fclose(statm);
+    return (double) pages * (double) sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+/**
+ * Draws the overlay on both sides of the status box, whose left edge is
+ * status_x and which is status_w cells wide.
+ */
+void draw_hud(int status_x, int status_w, int start_y, int64_t total_records) {
+    char line[64];
+    int len = 0;
+
+    len = snprintf(line, sizeof(line), "frame %.2fms p99 %.2fms", hud.last_frame_ns / 1e6, frame_p99_ms());
+    tb_print(status_x - len - 1, start_y, COLOR_HUD, TB_DEFAULT, line);
+    len = snprintf(line, sizeof(line), "search %.2fms sort %.2fms tags %.2fms", hud.search_ns / 1e6,
+                   hud.sort_ns / 1e6, hud.filter_ns / 1e6);
+    tb_print(status_x - len - 1, start_y + 1, COLOR_HUD, TB_DEFAULT, line);
+    if (hud.arena != NULL) {
+        const arena_stats_t *stats = &hud.arena->stats;
+        len = snprintf(line, sizeof(line), "arena %zuK peak %zuK frag %d%%", stats->used / 1024, stats->peak / 1024,
+                       arena_fragmentation(stats));
+        tb_print(status_x - len - 1, start_y + 2, COLOR_HUD, TB_DEFAULT, line);
+    }
+
+    tb_printf(status_x + status_w + 1, start_y, COLOR_HUD, TB_DEFAULT, "rss %.1fM %ld recs", resident_mib(),
+              (long) total_records);
+    tb_printf(status_x + status_w + 1, start_y + 1, COLOR_HUD, TB_DEFAULT, "db %s %.2fms +%zu ev",
+              hud.db_op != NULL ? hud.db_op : "-", hud.db_ns / 1e6, hud.coalesced);
+}
@@ -1,4 +1,5 @@
 #include "cruxpass.h"
+#include "secmem.h"
 #include "tui.h"
 
 #include <errno.h>
@@ -81,7 +82,7 @@ char *get_secret(const char *prompt) {
     draw_art();
     int term_w = tb_width();
     int term_h = tb_height();
-    if ((secret = (char *) sodium_malloc(LOGIN_MAX_LEN + 1)) == NULL) {
+    if ((secret = (char *) secmem_alloc(LOGIN_MAX_LEN + 1)) == NULL) {
         tui_cleanup();
         CRXP__OUT_OF_MEMORY();
     }
@@ -108,7 +109,7 @@ char *get_secret(const char *prompt) {
 
             if (ev.key == TB_KEY_ESC || ev.key == TB_KEY_CTRL_C) {
                 sodium_memzero((void *const) secret, LOGIN_MAX_LEN + 1);
-                sodium_free(secret);
+                secmem_free(secret);
                 tb_hide_cursor();
                 return NULL;
             }
@@ -154,13 +155,14 @@ char *get_secret(const char *prompt) {
     if (position < SECRET_MIN_LEN) {
         tui_cleanup();
         fprintf(stderr, "Error: Invalid secret length\n");
-        sodium_free(secret);
+        secmem_free(secret);
         return NULL;
     }
     return secret;
 }
 
-char *get_search_parttern(void) {
+/* The pattern is allocated in arena, NULL when the search was cancelled or left empty */
+char *get_search_parttern(arena_t *arena) {
     int term_w = tb_width();
     int term_h = tb_height();
     char *search_parttern = NULL;
@@ -172,16 +174,46 @@ char *get_search_parttern(void) {
         return NULL;
     }
 
+    if ((search_parttern = arena_alloc(arena, SEARCH_TXT_MAX + 1)) == NULL) {
+        send_notifctn("Error: Failed to allocate Memory");
+        return NULL;
+    }
+
+    memset(search_parttern, 0, SEARCH_TXT_MAX + 1);
     tb_clear();
 
     draw_border(start_x, start_y, SEARCH_TXT_MAX + 4, 3, TB_DEFAULT, TB_DEFAULT);
     tb_print(start_x + 2, start_y, COLOR_HEADER, TB_DEFAULT, "| Search |");
     tb_present();
-    search_parttern = get_input(NULL, NULL, SEARCH_TXT_MAX, start_x + 2, start_y + 1);
+    if (get_input(NULL, search_parttern, SEARCH_TXT_MAX, start_x + 2, start_y + 1) == NULL) search_parttern = NULL;
+    else if (search_parttern[0] == '\0') search_parttern = NULL;
     tb_clear();
     return search_parttern;
 }
 
+/* Reads the tags to filter by into tags, TAG_FILTER_LEN + 1 bytes; false when cancelled */
+bool get_tag_filter(char *tags) {
+    int term_w = tb_width();
+    int term_h = tb_height();
+
+    int start_x = (term_w - (TAG_FILTER_LEN + 2)) / 2;
+    int start_y = (term_h - 4) / 2;
+    if (start_x <= 0 || start_y <= 0) {
+        send_notifctn("Warning: Term width or height too small");
+        return false;
+    }
+
+    memset(tags, 0, TAG_FILTER_LEN + 1);
+    tb_clear();
+
+    draw_border(start_x, start_y, TAG_FILTER_LEN + 4, 3, TB_DEFAULT, TB_DEFAULT);
+    tb_print(start_x + 2, start_y, COLOR_HEADER, TB_DEFAULT, "| Tags |");
+    tb_present();
+    bool ok = get_input(NULL, tags, TAG_FILTER_LEN, start_x + 2, start_y + 1) != NULL;
+    tb_clear();
+    return ok;
+}
+
 bool get_long(char *prompt, long *out) {
     int sec_win_h = 3;
     int sec_win_w = MIN_WIN_WIDTH;
@@ -256,6 +288,5 @@ void get_random_secret(sqlite3 *db, bank_options_t opt) {
     char *secret = random_secret(ran_len, &opt);
     if (secret == NULL) return;
     display_ran_secret(db, secret);
-    sodium_memzero(secret, sizeof(secret));
-    free(secret);
+    secmem_free(secret);
 }
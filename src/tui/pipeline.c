@@ -8,7 +8,9 @@
 bool add_record(record_array_t *vec, record_t rec) {
     if (vec->size >= vec->capacity) {
         int new_capacity = vec->capacity == 0 ? 8 : vec->capacity * 2;
-        record_t *new_data = realloc(vec->data, new_capacity * sizeof(record_t));
+        record_t *new_data = vec->arena != NULL ? arena_grow(vec->arena, vec->data, vec->capacity * sizeof(record_t),
+                                                             new_capacity * sizeof(record_t))
+                                                : realloc(vec->data, new_capacity * sizeof(record_t));
         if (new_data == NULL) {
             fprintf(stderr, "Error: Failed to allocate Memory\n");
             return false;
@@ -22,7 +24,7 @@ bool add_record(record_array_t *vec, record_t rec) {
 }
 
 /*NOTE: This is used by the load_records to feed the tui */
-int tui_pipeline(void *data, MAYBE_UNUSED int argc, char **argv, MAYBE_UNUSED char **azColName) {
+int tui_pipeline(void *data, int argc, char **argv, MAYBE_UNUSED char **azColName) {
     record_array_t *vec = (record_array_t *) data;
     record_t rec = {0};
 
@@ -34,16 +36,38 @@ int tui_pipeline(void *data, MAYBE_UNUSED int argc, char **argv, MAYBE_UNUSED ch
     if (argv[2] != NULL) strncpy(rec.description, argv[2], DESC_MAX_LEN);
     else strcpy(rec.description, "...");
 
+    /* Dates are left empty on rows read without them */
+    if (argc > 3 && argv[3] != NULL) strncpy(rec.date_added, argv[3], DATE_LEN);
+    if (argc > 4 && argv[4] != NULL) strncpy(rec.date_modified, argv[4], DATE_LEN);
+
     if (!add_record(vec, rec)) return 1;
     return 0;
 }
 
+/* Records in an arena are given back to it, the arena stays for the next load */
 void free_records(record_array_t *arr) {
     if (arr->data != NULL) {
-        free(arr->data);
+        if (arr->arena != NULL) arena_release(arr->arena, arr->data, arr->capacity * sizeof(record_t));
+        else free(arr->data);
         arr->data = NULL;
     }
 
     arr->size = 0;
     arr->capacity = 0;
+    arr->seq = 0;
+}
+
+/* Records come ordered by id, returns the index of id or -1 */
+int64_t find_record(const record_array_t *arr, int64_t id) {
+    int64_t low = 0;
+    int64_t high = arr->size - 1;
+
+    while (low <= high) {
+        int64_t mid = low + (high - low) / 2;
+        if (arr->data[mid].id == id) return mid;
+        if (arr->data[mid].id < id) low = mid + 1;
+        else high = mid - 1;
+    }
+
+    return -1;
 }
@@ -7,7 +7,9 @@
 
 bool enqueue(queue_t *queue, int64_t index) {
     if (queue_empty(queue)) {
-        if ((queue->data = calloc(QUEUE_MAX, sizeof(int64_t))) == NULL) {
+        queue->data = queue->arena != NULL ? arena_alloc(queue->arena, QUEUE_MAX * sizeof(int64_t))
+                                           : calloc(QUEUE_MAX, sizeof(int64_t));
+        if (queue->data == NULL) {
             return false;
         }
 
@@ -15,7 +17,9 @@ bool enqueue(queue_t *queue, int64_t index) {
     }
 
     if (queue_full(queue)) {
-        int64_t *new_data = realloc(queue->data, sizeof(int64_t) * queue->capacity * 2);
+        size_t size = sizeof(int64_t) * queue->capacity;
+        int64_t *new_data = queue->arena != NULL ? arena_grow(queue->arena, queue->data, size, size * 2)
+                                                 : realloc(queue->data, size * 2);
         if (new_data == NULL) {
             return false;
         }
@@ -48,7 +52,8 @@ bool queue_empty(queue_t *queue) { return queue == NULL || queue->data == NULL;
 
 void free_queue(queue_t *queue) {
     if (queue->data != NULL) {
-        free(queue->data);
+        if (queue->arena != NULL) arena_release(queue->arena, queue->data, sizeof(int64_t) * queue->capacity);
+        else free(queue->data);
         queue->data = NULL;
         queue->capacity = 0;
         queue->head = 0;
@@ -0,0 +1,231 @@
+#include "trace.h"
+#include "tui.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define SORT_RUN 16 /* runs this short are insertion sorted before the merges */
+
+typedef int (*record_cmp_t)(const record_t *a, const record_t *b);
+
+typedef struct {
+    const record_t *data;
+    record_cmp_t cmp;
+    int *order;
+    int *tmp; /* as long as order, the merges write into it */
+    int lo;
+    int mid;
+    int hi;
+} sort_job_t;
+
+static int cmp_username(const record_t *a, const record_t *b) { return strcasecmp(a->username, b->username); }
+static int cmp_description(const record_t *a, const record_t *b) { return strcasecmp(a->description, b->description); }
+static int cmp_added(const record_t *a, const record_t *b) { return strcmp(a->date_added, b->date_added); }
+static int cmp_modified(const record_t *a, const record_t *b) { return strcmp(a->date_modified, b->date_modified); }
+
+/* Text under NOCASE as the vault indexes it, dates as YYYY-MM-DD text */
+static const record_cmp_t comparators[SORT_KEY_COUNT] = {
+    [SORT_USERNAME] = cmp_username,
+    [SORT_DESCRIPTION] = cmp_description,
+    [SORT_ADDED] = cmp_added,
+    [SORT_MODIFIED] = cmp_modified,
+};
+
+/* Takes from the left on ties: records start in id order, equal keys stay in it */
+static void merge(const sort_job_t *job, const int *src, int *dst, int lo, int mid, int hi) {
+    int i = lo;
+    int j = mid;
+    int k = lo;
+
+    while (i < mid && j < hi) dst[k++] = job->cmp(&job->data[src[j]], &job->data[src[i]]) < 0 ? src[j++] : src[i++];
+    while (i < mid) dst[k++] = src[i++];
+    while (j < hi) dst[k++] = src[j++];
+}
+
+static void insertion_sort(const sort_job_t *job, int lo, int hi) {
+    int *order = job->order;
+
+    for (int i = lo + 1; i < hi; i++) {
+        int index = order[i];
+        int j = i;
+        for (; j > lo && job->cmp(&job->data[index], &job->data[order[j - 1]]) < 0; j--) order[j] = order[j - 1];
+        order[j] = index;
+    }
+}
+
+/* Bottom-up merge sort of order[lo, hi), passes go back and forth between order and tmp */
+static void *sort_run(void *arg) {
+    const sort_job_t *job = arg;
+    int *src = job->order;
+    int *dst = job->tmp;
+
+    for (int lo = job->lo; lo < job->hi; lo += SORT_RUN)
+        insertion_sort(job, lo, lo + SORT_RUN < job->hi ? lo + SORT_RUN : job->hi);
+
+    for (int width = SORT_RUN; width < job->hi - job->lo; width *= 2) {
+        for (int lo = job->lo; lo < job->hi; lo += 2 * width) {
+            int mid = lo + width < job->hi ? lo + width : job->hi;
+            int hi = mid + width < job->hi ? mid + width : job->hi;
+            merge(job, src, dst, lo, mid, hi);
+        }
+
+        int *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != job->order) memcpy(job->order + job->lo, src + job->lo, (size_t) (job->hi - job->lo) * sizeof(int));
+    return NULL;
+}
+
+static void *merge_runs(void *arg) {
+    const sort_job_t *job = arg;
+
+    merge(job, job->order, job->tmp, job->lo, job->mid, job->hi);
+    memcpy(job->order + job->lo, job->tmp + job->lo, (size_t) (job->hi - job->lo) * sizeof(int));
+    return NULL;
+}
+
+/* A job whose thread cannot be started runs on the caller, the result is the same */
+static void run_jobs(void *(*fn)(void *), sort_job_t *jobs, int count) {
+    pthread_t threads[SORT_THREADS_MAX];
+    bool started[SORT_THREADS_MAX] = {false};
+
+    for (int i = 1; i < count; i++) started[i] = pthread_create(&threads[i], NULL, fn, &jobs[i]) == 0;
+    for (int i = 0; i < count; i++) {
+        if (!started[i]) fn(&jobs[i]);
+    }
+
+    for (int i = 1; i < count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+}
+
+/* A power of two, so the runs merge pairwise down to one */
+static int sort_threads(int size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = 1;
+
+    if (size < SORT_PARALLEL_MIN) return 1;
+    while (threads * 2 <= SORT_THREADS_MAX && threads * 2 <= cpus) threads *= 2;
+    return threads;
+}
+
+/**
+ * Parallel merge sort of the record indexes: each thread sorts a run of
+ * its own, then the runs are merged in pairs, half as many threads each
+ * round, the last merge on one.
+ */
+static void sort_order(const record_array_t *records, record_cmp_t cmp, int *order, int *tmp) {
+    sort_job_t jobs[SORT_THREADS_MAX];
+    int size = records->size;
+    int runs = sort_threads(size);
+
+    for (int i = 0; i < runs; i++) {
+        jobs[i] = (sort_job_t) {records->data, cmp, order, tmp, (int) ((int64_t) size * i / runs), 0,
+                                (int) ((int64_t) size * (i + 1) / runs)};
+    }
+    run_jobs(sort_run, jobs, runs);
+
+    for (; runs > 1; runs /= 2) {
+        for (int i = 0; i < runs / 2; i++) {
+            jobs[i] = (sort_job_t) {records->data,
+                                    cmp,
+                                    order,
+                                    tmp,
+                                    (int) ((int64_t) size * (2 * i) / runs),
+                                    (int) ((int64_t) size * (2 * i + 1) / runs),
+                                    (int) ((int64_t) size * (2 * i + 2) / runs)};
+        }
+        run_jobs(merge_runs, jobs, runs / 2);
+    }
+}
+
+/* Drops the cached orders and rows, the records they were computed for have changed */
+void sort_invalidate(record_view_t *view) {
+    for (int i = 0; i < SORT_KEY_COUNT; i++) {
+        free(view->orders[i]);
+        view->orders[i] = NULL;
+    }
+
+    free(view->rows);
+    view->rows = NULL;
+    view->row_count = 0;
+    view->size = 0;
+}
+
+/**
+ * Shows the records by key, sorting them when the key's order is not
+ * cached yet and listing the rows a tag filter keeps. Returns false
+ * when there is no memory for it, the view is then left as it was.
+ */
+bool sort_records(record_view_t *view, const record_array_t *records, SORT_KEY key) {
+    bool stale = false;
+
+    TRACE_SCOPE("sort_records");
+    if (view->size != records->size) sort_invalidate(view);
+    stale = view->size != records->size || key != view->key;
+    if (key != SORT_ID && view->orders[key] == NULL && records->size > 0) {
+        int *order = malloc((size_t) records->size * sizeof(int));
+        int *tmp = malloc((size_t) records->size * sizeof(int));
+        if (order == NULL || tmp == NULL) {
+            free(order);
+            free(tmp);
+            return false;
+        }
+
+        for (int i = 0; i < records->size; i++) order[i] = i;
+        sort_order(records, comparators[key], order, tmp);
+        free(tmp);
+        view->orders[key] = order;
+    }
+
+    if (view->filter != NULL && (stale || view->rows == NULL) && !filter_rows(view, records, key)) return false;
+    view->size = records->size;
+    view->key = key;
+    return true;
+}
+
+/* Rows shown: the records a tag filter keeps, or all of them */
+int64_t view_size(const record_view_t *view, int64_t size) {
+    return view != NULL && view->filter != NULL && view->size == size ? view->row_count : size;
+}
+
+/* Index in the records of the one shown on row */
+int64_t view_index(const record_view_t *view, int64_t size, int64_t row) {
+    if (view == NULL) return row;
+    if (view->filter != NULL && view->size == size) {
+        if (view->reverse) row = view->row_count - 1 - row;
+        return view->rows[row];
+    }
+    if (view->reverse) row = size - 1 - row;
+
+    const int *order = view->orders[view->key];
+    return order != NULL && view->size == size ? order[row] : row;
+}
+
+/* Row the record at index is shown on, -1 when there is none */
+int64_t view_row(const record_view_t *view, int64_t size, int64_t index) {
+    if (index < 0 || index >= size) return -1;
+
+    if (view != NULL && view->filter != NULL && view->size == size) {
+        for (int row = 0; row < view->row_count; row++) {
+            if (view->rows[row] == index) return view->reverse ? view->row_count - 1 - row : row;
+        }
+        return -1;
+    }
+
+    const int *order = view != NULL ? view->orders[view->key] : NULL;
+    if (order == NULL || view->size != size) return view != NULL && view->reverse ? size - 1 - index : index;
+
+    for (int64_t row = 0; row < size; row++) {
+        if (order[row] == index) return view->reverse ? size - 1 - row : row;
+    }
+
+    return -1;
+}
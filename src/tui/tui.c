@@ -4,6 +4,8 @@
 #include <locale.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "database.h"
 
@@ -11,6 +13,9 @@ int total_pages;
 int current_page;
 int records_per_page = 30;
 
+static FILE *held_stderr;
+static int stderr_fd = -1;
+
 bool tui_init(void) {
     if (tb_init() != TB_OK) {
         fprintf(stderr, "Error: Failed to initialize TUI\n");
@@ -22,9 +27,44 @@ bool tui_init(void) {
     return true;
 }
 
+/* Messages held by tui_hold_stderr() are printed once termbox is gone */
+static void release_stderr(void) {
+    char buf[512];
+    size_t len = 0;
+
+    if (held_stderr == NULL) return;
+    fflush(stderr);
+    dup2(stderr_fd, STDERR_FILENO);
+    close(stderr_fd);
+    stderr_fd = -1;
+
+    rewind(held_stderr);
+    while ((len = fread(buf, 1, sizeof(buf), held_stderr)) > 0) fwrite(buf, 1, len, stderr);
+    fclose(held_stderr);
+    held_stderr = NULL;
+}
+
+/**
+ * termbox draws on /dev/tty, anything printed to stderr while it is up
+ * lands on the screen and is gone at tui_cleanup(). Until then stderr
+ * goes to a temporary file instead, when one can be made.
+ */
+void tui_hold_stderr(void) {
+    if (held_stderr != NULL) return;
+    fflush(stderr);
+    if ((held_stderr = tmpfile()) == NULL) return;
+    if ((stderr_fd = dup(STDERR_FILENO)) < 0 || dup2(fileno(held_stderr), STDERR_FILENO) < 0) {
+        if (stderr_fd >= 0) close(stderr_fd);
+        fclose(held_stderr);
+        held_stderr = NULL;
+        stderr_fd = -1;
+    }
+}
+
 void tui_cleanup(void) {
     tb_clear();
     tb_shutdown();
+    release_stderr();
 }
 
 static bool notify_deleted(int64_t id) {
@@ -35,177 +75,370 @@ static bool notify_deleted(int64_t id) {
     return false;
 }
 
-int tui_main(sqlite3 *db) {
-    struct tb_event ev = {0};
-    queue_t search_queue = {0};
-    char *search_pattern = NULL;
-    int64_t current_position = 0;
-    record_array_t records = {0, 0, NULL};
+void tui_layout(tui_state_t *tui, int width, int height) {
+    tui->term_width = width;
+    tui->term_height = height;
+    tui->start_x = (width - TABLE_WIDTH) / 2;
+    if (tui->start_x < 0) tui->start_x = 0;
+    tui->start_y = 1;
+    tui->table_h = height - 4;
+}
 
-    if (!load_records(db, &records)) {
-        fprintf(stderr, "Error: Failed to load data from database\n");
-        return CRXP_ERR;
+void tui_render(tui_state_t *tui) {
+    records_per_page = tui->term_height - 8;
+    if (records_per_page < 1) records_per_page = 1;
+
+    current_page = tui->position / records_per_page;
+
+    draw_table(&tui->records, &tui->search_queue, tui->search_pattern, .start_x = tui->start_x,
+               .height = tui->table_h, .cursor = tui->position, .view = &tui->view,
+               .tags = tui->view.filter != NULL ? tui->tag_text : NULL);
+}
+
+/* Keys that search, sort, filter, write or go to the last record need every record in */
+static bool needs_all_records(const struct tb_event *ev) {
+    if (ev->type != TB_EVENT_KEY) return false;
+    if (ev->key == TB_KEY_END || ev->key == TB_KEY_CTRL_R) return true;
+    return ev->ch != 0 && strchr("/nGdursSt", (int) ev->ch) != NULL;
+}
+
+static void drop_filter(tui_state_t *tui) {
+    filter_set(&tui->view, NULL, 0);
+    tui->tag_text[0] = '\0';
+}
+
+/**
+ * Shows the list by key and direction with the cursor on the record at
+ * index. Search matches are rows, they are queued again in the new order.
+ * A tag filter that keeps no record any more is dropped.
+ */
+static bool tui_sort(tui_state_t *tui, int64_t index, SORT_KEY key, bool reverse) {
+    bool ok = true;
+
+    uint64_t sort_start = hud_start();
+    if (!(ok = sort_records(&tui->view, &tui->records, key))) {
+        /* The order shown so far may have gone with the records it was for */
+        if (tui->view.orders[tui->view.key] == NULL) tui->view.key = SORT_ID;
     }
+    hud_sort_done(sort_start);
 
-    if (records.size == 0) {
-        fprintf(stderr, "Warning: No records found\n");
-        return CRXP_ERR;
+    if (tui->view.filter != NULL && (!ok || tui->view.row_count == 0)) {
+        drop_filter(tui);
+        if (ok) send_notifctn("Note: No record has all these tags");
     }
 
-    tui_init();
-    int term_width = tb_width();
-    int term_height = tb_height();
+    tui->view.reverse = reverse;
+    free_queue(&tui->search_queue);
+    int64_t size = view_size(&tui->view, tui->records.size);
+    int64_t row = view_row(&tui->view, tui->records.size, index);
+    if (row >= 0) tui->position = row;
+    if (tui->position >= size) tui->position = size - 1;
+    if (tui->position < 0) tui->position = 0;
+    return ok;
+}
 
-    int start_x = (term_width - TABLE_WIDTH) / 2;
-    if (start_x < 0) start_x = 0;
-    int start_y = 1;
-    int table_h = term_height - 4;
+/**
+ * Sets the filter to the records carrying every tag in text, dropping
+ * it for an empty text. Tags are read on first use and again after the
+ * vault changed. The caller sorts to list the rows.
+ */
+static bool tui_tags(tui_state_t *tui, const char *text) {
+    int64_t *ids = NULL;
+    int count = 0;
 
-    draw_table_border(start_x, start_y, table_h);
+    if (text[0] == '\0') {
+        drop_filter(tui);
+        return true;
+    }
 
-    while (1) {
-        records_per_page = term_height - 8;
-        if (records_per_page < 1) records_per_page = 1;
-
-        current_page = current_position / records_per_page;
-
-        draw_table(&records, &search_queue, search_pattern, .start_x = start_x, .height = table_h,
-                   .cursor = current_position);
-
-        if (tb_poll_event(&ev) != TB_OK) continue;
-
-        if (ev.type == TB_EVENT_KEY) {
-            if (ev.key == TB_KEY_ESC || ev.key == TB_KEY_CTRL_C || ev.ch == 'q' || ev.ch == 'Q') {
-                break;
-            } else if (ev.ch == 'k' || ev.key == TB_KEY_ARROW_UP) {
-                if (current_position > 0) current_position--;
-            } else if (ev.ch == 'j' || ev.key == TB_KEY_ARROW_DOWN) {
-                if (current_position < records.size - 1) current_position++;
-            } else if (ev.ch == 'h' || ev.key == TB_KEY_ARROW_LEFT) {
-                current_position = (int64_t) (current_page - 1) * records_per_page;
-                if (current_position < 0) current_position = 0;
-            } else if (ev.ch == 'l' || ev.key == TB_KEY_ARROW_RIGHT) {
-                current_position = (int64_t) (current_page + 1) * records_per_page;
-                if (current_position >= records.size) current_position = records.size - 1;
-            } else if (ev.ch == 'g' || ev.key == TB_KEY_HOME) {
-                current_position = 0;
-            } else if (ev.ch == 'G' || ev.key == TB_KEY_END) {
-                current_position = records.size - 1;
-            } else if (ev.ch == '/') {
-                if (search_pattern != NULL) {
-                    free(search_pattern);
-                    search_pattern = NULL;
-                }
+    if (!tui->tags.loaded) {
+        uint64_t db_start = hud_start();
+        if (!load_tags(tui->db, &tui->tags)) {
+            drop_filter(tui);
+            send_notifctn("Error: Failed to load tags");
+            return false;
+        }
+        hud_db_done("tags", db_start);
+    }
 
-                free_queue(&search_queue);
-                search_pattern = get_search_parttern();
-                draw_table_border(start_x, start_y, table_h);
-                continue;
-            } else if (ev.ch == 'n') {
-                if (!queue_empty(&search_queue)) {
-                    int64_t index = dequeue(&search_queue);
-
-                    if (index == QUEUE_ERR) {
-                        send_notifctn("Error: Dequeue failed");
-                        continue;
-                    }
-
-                    current_position = index;
-                    continue;
-                } else {
-                    send_notifctn("Note: Match not found");
-                }
-            } else if (ev.ch == '?') {
-                display_help();
-                draw_table_border(start_x, start_y, table_h);
-                continue;
-
-            } else if (ev.ch == 'd') {
-                if (notify_deleted(records.data[current_position].id)) continue;
-                if (!delete_record(db, records.data[current_position].id)) {
-                    send_notifctn("Error: Deletion failed");
-                    continue;
-                }
+    if (!tag_filter(&tui->tags, text, &ids, &count)) {
+        drop_filter(tui);
+        send_notifctn("Note: No such tag");
+        return false;
+    }
 
-                send_notifctn("Note: Record deleted");
-                records.data[current_position].id = DELETED;
+    filter_set(&tui->view, ids, count);
+    if (text != tui->tag_text) snprintf(tui->tag_text, sizeof(tui->tag_text), "%s", text);
+    return true;
+}
 
-            } else if (ev.ch == 'u') {
-                if (notify_deleted(records.data[current_position].id)) continue;
-                if (!do_updates(db, &records, current_position)) {
-                    send_notifctn("Warning: Rec update failed");
-                    draw_table_border(start_x, start_y, table_h);
-                    continue;
-                }
+/**
+ * Applies one event to the list view. Returns false once the user quits.
+ * The next frame is drawn by tui_render(), dialogs draw their own.
+ */
+bool tui_handle_event(tui_state_t *tui, struct tb_event *ev) {
+    record_array_t *records = &tui->records;
 
-                send_notifctn("Note: Record updated");
-                draw_table_border(start_x, start_y, table_h);
-            } else if (ev.key == TB_KEY_ENTER) {
-                if (notify_deleted(records.data[current_position].id)) continue;
-                if (!fetch_secret(db, records.data[current_position].id)) {
-                    send_notifctn("Error: Failed to fetch secret");
-                };
-                draw_table_border(start_x, start_y, table_h);
-            } else if (ev.ch == 'L') {
-                if (notify_deleted(records.data[current_position].id)) continue;
-                display_desc(records.data[current_position].description);
-                draw_table_border(start_x, start_y, table_h);
-                continue;
-            } else if (ev.ch == 'r') {
-                if (notify_deleted(records.data[current_position].id)) continue;
-
-                ev.ch = 0;
-                bank_options_t opt = {0};
-                if (tb_poll_event(&ev) != TB_OK) continue;
-                if (ev.type != TB_EVENT_KEY) continue;
-                char cc = ev.ch;
-                switch (cc) {
-                    case 'a': opt = (bank_options_t){.lower = true}; break;
-                    case 'A': opt = (bank_options_t){.upper = true}; break;
-                    case 'p': opt = (bank_options_t){.digit = true}; break;
-                    case 'r':
-                        opt = (bank_options_t){.lower = true, .upper = true, .digit = true, .symbols = true};
-                        break;
-                    case 'x':
-                        opt = (bank_options_t){
-                            .lower = true, .upper = true, .digit = true, .symbols = true, .ex_ambiguous = true};
-                        break;
-                    default: continue;
-                }
+    if (tui->streaming && needs_all_records(ev) && !tui_stream(tui, -1)) {
+        send_notifctn("Error: Failed to load records");
+        return true;
+    }
+
+    /* The record under the cursor, for the keys that act on it */
+    record_t *rec = &records->data[view_index(&tui->view, records->size, tui->position)];
 
-                tb_clear();
-                get_random_secret(db, opt);
-                draw_table_border(start_x, start_y, table_h);
-                continue;
-            } else if (ev.key == TB_KEY_CTRL_R) {
-                free_records(&records);
-                if (load_records(db, &records) == 0) {
-                    send_notifctn("Error: TUI Reload failed");
-                    continue;
+    if (ev->type == TB_EVENT_KEY) {
+        if (ev->key == TB_KEY_ESC || ev->key == TB_KEY_CTRL_C || ev->ch == 'q' || ev->ch == 'Q') {
+            return false;
+        } else if (ev->ch == 'k' || ev->key == TB_KEY_ARROW_UP) {
+            if (tui->position > 0) tui->position--;
+        } else if (ev->ch == 'j' || ev->key == TB_KEY_ARROW_DOWN) {
+            if (tui->position < view_size(&tui->view, records->size) - 1) tui->position++;
+        } else if (ev->ch == 'h' || ev->key == TB_KEY_ARROW_LEFT) {
+            tui->position = (int64_t) (current_page - 1) * records_per_page;
+            if (tui->position < 0) tui->position = 0;
+        } else if (ev->ch == 'l' || ev->key == TB_KEY_ARROW_RIGHT) {
+            tui->position = (int64_t) (current_page + 1) * records_per_page;
+            int64_t size = view_size(&tui->view, records->size);
+            if (tui->position >= size) tui->position = size - 1;
+        } else if (ev->ch == 'g' || ev->key == TB_KEY_HOME) {
+            tui->position = 0;
+        } else if (ev->ch == 'G' || ev->key == TB_KEY_END) {
+            tui->position = view_size(&tui->view, records->size) - 1;
+        } else if (ev->ch == '/') {
+            /* The last pattern and its matches go in one step */
+            free_queue(&tui->search_queue);
+            arena_end(&tui->search_scope);
+            tui->search_scope = arena_begin(&tui->scratch);
+            tui->search_pattern = get_search_parttern(&tui->scratch);
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+        } else if (ev->ch == 'n') {
+            if (!queue_empty(&tui->search_queue)) {
+                int64_t index = dequeue(&tui->search_queue);
+
+                if (index == QUEUE_ERR) {
+                    send_notifctn("Error: Dequeue failed");
+                    return true;
                 }
-                send_notifctn("Info: TUI reloaded");
-                current_position = 0;
-                continue;
+
+                tui->position = index;
+            } else {
+                send_notifctn("Note: Match not found");
+            }
+        } else if (ev->ch == '?') {
+            display_help();
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+        } else if (ev->ch == 'P') {
+            hud.visible = !hud.visible;
+        } else if (ev->ch == 's' || ev->ch == 'S') {
+            SORT_KEY key = ev->ch == 's' ? (tui->view.key + 1) % SORT_KEY_COUNT : tui->view.key;
+            bool reverse = ev->ch == 'S' ? !tui->view.reverse : tui->view.reverse;
+            if (!tui_sort(tui, rec - records->data, key, reverse)) send_notifctn("Error: Failed to sort records");
+        } else if (ev->ch == 't') {
+            char text[TAG_FILTER_LEN + 1];
+            bool ok = get_tag_filter(text);
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+            if (!ok) return true;
+
+            uint64_t filter_start = hud_start();
+            if (tui_tags(tui, text)) tui_sort(tui, rec - records->data, tui->view.key, tui->view.reverse);
+            hud_filter_done(filter_start);
+        } else if (ev->ch == 'd') {
+            if (notify_deleted(rec->id)) return true;
+            uint64_t db_start = hud_start();
+            if (!delete_record(tui->db, rec->id)) {
+                send_notifctn("Error: Deletion failed");
+                return true;
+            }
+
+            hud_db_done("delete", db_start);
+
+            send_notifctn("Note: Record deleted");
+            rec->id = DELETED;
+
+        } else if (ev->ch == 'u') {
+            if (notify_deleted(rec->id)) return true;
+            if (!do_updates(tui->db, records, rec - records->data)) {
+                send_notifctn("Warning: Rec update failed");
+                draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+                return true;
             }
 
-        } else if (ev.type == TB_EVENT_RESIZE) {
-            term_width = ev.w;
-            term_height = ev.h;
+            /* The record may have moved in the order shown, or left the tag filter */
+            tui->tags.loaded = false;
+            if (tui->view.filter != NULL) tui_tags(tui, tui->tag_text);
+            sort_invalidate(&tui->view);
+            tui_sort(tui, rec - records->data, tui->view.key, tui->view.reverse);
+            send_notifctn("Note: Record updated");
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+        } else if (ev->key == TB_KEY_ENTER) {
+            if (notify_deleted(rec->id)) return true;
+            if (!fetch_secret(tui->db, rec->id)) {
+                send_notifctn("Error: Failed to fetch secret");
+            };
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+        } else if (ev->ch == 'L') {
+            if (notify_deleted(rec->id)) return true;
+            display_desc(rec->description);
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+        } else if (ev->ch == 'r') {
+            if (notify_deleted(rec->id)) return true;
 
-            records_per_page = term_height - 6;
-            if (records_per_page < 1) records_per_page = 1;
+            ev->ch = 0;
+            bank_options_t opt = {0};
+            if (tb_poll_event(ev) != TB_OK) return true;
+            if (ev->type != TB_EVENT_KEY) return true;
+            char cc = ev->ch;
+            switch (cc) {
+                case 'a': opt = (bank_options_t){.lower = true}; break;
+                case 'A': opt = (bank_options_t){.upper = true}; break;
+                case 'p': opt = (bank_options_t){.digit = true}; break;
+                case 'r':
+                    opt = (bank_options_t){.lower = true, .upper = true, .digit = true, .symbols = true};
+                    break;
+                case 'x':
+                    opt = (bank_options_t){
+                        .lower = true, .upper = true, .digit = true, .symbols = true, .ex_ambiguous = true};
+                    break;
+                default: return true;
+            }
 
-            start_x = (term_width - TABLE_WIDTH) / 2;
-            start_y = 1;
-            table_h = term_height - 4;
             tb_clear();
-            draw_table_border(start_x, start_y, table_h);
+            get_random_secret(tui->db, opt);
+            draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+        } else if (ev->key == TB_KEY_CTRL_R) {
+            if (!tui_refresh(tui)) {
+                send_notifctn("Error: TUI Reload failed");
+                return true;
+            }
+            send_notifctn("Info: TUI reloaded");
+        }
+
+    } else if (ev->type == TB_EVENT_RESIZE) {
+        tui_layout(tui, ev->w, ev->h);
+        tb_clear();
+        draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+    }
+
+    return true;
+}
+
+/**
+ * Merges the rows changed since the last load into the list, see
+ * refresh_records(). The cursor stays on the record it was on, or on
+ * the same row when that record is gone, and the search is kept.
+ */
+bool tui_refresh(tui_state_t *tui) {
+    int64_t size = tui->records.size;
+    int64_t id = size > 0 ? tui->records.data[view_index(&tui->view, size, tui->position)].id : DELETED;
+
+    uint64_t db_start = hud_start();
+    if (!refresh_records(tui->db, &tui->records)) return false;
+    hud_db_done("refresh", db_start);
+
+    /* Orders, tags and search matches were for the old list, they are redone for this one */
+    int64_t index = id != DELETED ? find_record(&tui->records, id) : -1;
+    tui->tags.loaded = false;
+    if (tui->view.filter != NULL) tui_tags(tui, tui->tag_text);
+    sort_invalidate(&tui->view);
+    tui_sort(tui, index, tui->view.key, tui->view.reverse);
+    return true;
+}
+
+/* Reads up to limit more records of a list that came up before all of them were in */
+bool tui_stream(tui_state_t *tui, int limit) {
+    bool done = false;
+
+    uint64_t db_start = hud_start();
+    if (!stream_records(tui->db, &tui->records, limit, &done)) {
+        tui->streaming = false;
+        return false;
+    }
+
+    hud_db_done("stream", db_start);
+    tui->streaming = !done;
+    return true;
+}
+
+/* Everything the session allocated goes with its two arenas */
+void tui_free(tui_state_t *tui) {
+    if (tui->streaming) stream_records_end(tui->db);
+    tui->streaming = false;
+    sort_invalidate(&tui->view);
+    filter_set(&tui->view, NULL, 0);
+    tui->view = (record_view_t) {0};
+    free_tags(&tui->tags);
+    tui->tag_text[0] = '\0';
+    arena_free(&tui->arena);
+    arena_free(&tui->scratch);
+    tui->records = (record_array_t) {0, 0, NULL, 0, NULL};
+    tui->search_queue = (queue_t) {0};
+    tui->search_scope = (arena_scope_t) {0};
+    tui->search_pattern = NULL;
+}
+
+void tui_session(tui_state_t *tui, sqlite3 *db) {
+    *tui = (tui_state_t) {.db = db};
+    tui->records.arena = &tui->arena;
+    tui->search_queue.arena = &tui->scratch;
+}
+
+/**
+ * Runs the record list. A session that is not up yet reads every
+ * record first, one authenticate() brought up goes on from the first
+ * page and reads the rest between frames until it is all in.
+ */
+int tui_main(tui_state_t *tui) {
+    struct tb_event ev = {0};
+
+    if (!tui->term_ready && !load_records(tui->db, &tui->records)) {
+        fprintf(stderr, "Error: Failed to load data from database\n");
+        tui_free(tui);
+        return CRXP_ERR;
+    }
+
+    if (tui->records.size == 0 && !tui->streaming) {
+        if (tui->term_ready) tui_cleanup();
+        fprintf(stderr, "Warning: No records found\n");
+        tui_free(tui);
+        return CRXP_ERR;
+    }
+
+    vault_changed(tui->db, &tui->data_version);
+    hud.arena = &tui->arena;
+    if (!tui->term_ready) tui_init();
+    tui_layout(tui, tb_width(), tb_height());
+    draw_table_border(tui->start_x, tui->start_y, tui->table_h);
+
+    while (1) {
+        tui_render(tui);
+
+        /* An idle TUI wakes up to pick up records other processes wrote */
+        int rc = tb_peek_event(&ev, tui->streaming ? 0 : TUI_REFRESH_MS);
+        if (rc == TB_ERR_NO_EVENT) {
+            if (tui->streaming) {
+                if (!tui_stream(tui, TUI_STREAM_ROWS)) send_notifctn("Error: Failed to load records");
+            } else if (vault_changed(tui->db, &tui->data_version) && tui_refresh(tui)) {
+                send_notifctn("Info: Vault changed, records reloaded");
+            }
+            continue;
         }
+
+        if (rc != TB_OK) continue;
+        bool running = tui_handle_event(tui, &ev);
+
+        /* Keys that piled up while drawing (a held j/k) are applied before the next frame */
+        for (int i = 0; running && i < TUI_COALESCE_MAX && tb_peek_event(&ev, 0) == TB_OK; i++) {
+            running = tui_handle_event(tui, &ev);
+            hud.coalesced++;
+        }
+
+        if (!running) break;
     }
 
     tui_cleanup();
-    free_records(&records);
-    free_queue(&search_queue);
-    if (search_pattern != NULL) free(search_pattern);
+    tui->term_ready = false;
+    hud.arena = NULL;
+    tui_free(tui);
     return CRXP_OK;
 }